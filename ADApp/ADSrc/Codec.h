@@ -1,12 +1,17 @@
 #ifndef Codec_H
 #define Codec_H
 
+#include <string>
+#include <vector>
+
 static std::string codecName[] = {
     "",
     "jpeg",
     "blosc",
     "lz4",
-    "bslz4"
+    "bslz4",
+    "zstd",
+    "bszstd"
 };
 
 typedef enum {
@@ -14,7 +19,9 @@ typedef enum {
   NDCODEC_JPEG,
   NDCODEC_BLOSC,
   NDCODEC_LZ4,
-  NDCODEC_BSLZ4
+  NDCODEC_BSLZ4,
+  NDCODEC_ZSTD,
+  NDCODEC_BSZSTD
 } NDCodecCompressor_t;
 
 typedef struct Codec_t {
@@ -22,6 +29,11 @@ typedef struct Codec_t {
   int         level;      /**< Compression level. */
   int         shuffle;    /**< Shuffle type. */
   int         compressor; /**< Compressor type. For codecs that support more than one compressor. */
+  size_t      chunkRows;  /**< Number of elements of the slowest varying dimension in each chunk if the data was
+                            *  compressed in chunks, 0 if it was compressed as a single block. */
+  std::vector<size_t> chunkSizes; /**< Compressed size of each chunk. The chunks follow each other in pData. */
+  size_t      headerRoom; /**< Number of bytes reserved in front of the compressed data, and in front of each
+                            *  chunk, for the header that the HDF5 filters expect. */
 
   Codec_t() {
     clear();
@@ -32,6 +44,9 @@ typedef struct Codec_t {
     level = -1;
     shuffle = -1;
     compressor = -1;
+    chunkRows = 0;
+    chunkSizes.clear();
+    headerRoom = 0;
   }
 
   bool empty() {
@@ -86,6 +86,17 @@ typedef struct NDArrayInfo {
     size_t colorStride;     /**< The number of array elements between color values */
 } NDArrayInfo_t;
 
+/** Owner of an NDArray data buffer that was not allocated by the NDArrayPool, for example
+  * the buffer of a pvData array that an NDArray shares without copying.
+  * NDArrayPool::release() calls release() when the last reference to the NDArray is released,
+  * instead of keeping the buffer for reuse. */
+class epicsShareClass NDArrayBufferOwner {
+public:
+    virtual ~NDArrayBufferOwner() {}
+    /** Releases the buffer. Called once; implementations normally delete themselves. */
+    virtual void release() = 0;
+};
+
 /** N-dimensional array class; each array has a set of dimensions, a data type, pointer to data, and optional attributes. 
   * An NDArray also has a uniqueId and timeStamp that to identify it. NDArray objects can be allocated
   * by an NDArrayPool object, which maintains a free list of NDArrays for efficient memory management. */
@@ -126,7 +137,8 @@ public:
                                   * dims[ndims-1] changing slowest. */
     NDAttributeList *pAttributeList;  /**< Linked list of attributes */
     Codec_t codec;              /**< Definition of codec used to compress the data. */
-    size_t compressedSize;      /**< Size of the compressed data. Should be equal to dataSize if pData is uncompressed. */
+    size_t compressedSize;      /**< Size of the compressed data, including codec.headerRoom. Should be equal to dataSize if pData is uncompressed. */
+    NDArrayBufferOwner *pBufferOwner; /**< Owner of pData if the NDArrayPool did not allocate it, otherwise NULL. */
 };
 
 // This class defines the object that is contained in the std::multilist for sorting NDArrays in the freeList_.
@@ -162,7 +174,8 @@ class epicsShareClass NDArrayPool {
 public:
     NDArrayPool  (class asynNDArrayDriver *pDriver, size_t maxMemory);
     virtual ~NDArrayPool() {}
-    NDArray*     alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData);
+    NDArray*     alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                       NDArrayBufferOwner *pBufferOwner=NULL);
     NDArray*     copy(NDArray *pIn, NDArray *pOut, bool copyData, bool copyDimensions=true, bool copyDataType=true);
 
     int          reserve(NDArray *pArray);
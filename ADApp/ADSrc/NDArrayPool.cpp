@@ -37,6 +37,31 @@ static const char *driverName = "NDArrayPool";
 volatile int eraseNDAttributes=0;
 extern "C" {epicsExportAddress(int, eraseNDAttributes);}
 
+/** alignNDArrayData is a global variable that sets the alignment in bytes of the data buffers
+  * that NDArrayPool->alloc() allocates. The default value is 0, meaning that malloc() is used
+  * with its default alignment. Setting it to the block size of the disk (e.g. 4096) lets file
+  * plugins that bypass the page cache (O_DIRECT) write straight from the NDArray buffers.
+  * It must be a power of 2 and a multiple of sizeof(void *). It is ignored on Windows.
+  */
+volatile int alignNDArrayData=0;
+extern "C" {epicsExportAddress(int, alignNDArrayData);}
+
+/** Allocate an array data buffer aligned as set by alignNDArrayData.
+  * The buffer can be freed with free().
+  */
+static void *allocData(size_t dataSize)
+{
+#if !defined(_WIN32)
+  void *pData = NULL;
+  int align = alignNDArrayData;
+  if ((align > 0) && ((align & (align-1)) == 0) && ((align % sizeof(void *)) == 0)) {
+    if (posix_memalign(&pData, align, dataSize) != 0) pData = NULL;
+    return pData;
+  }
+#endif
+  return malloc(dataSize);
+}
+
 /** NDArrayPool constructor
   * \param[in] pDriver Pointer to the asynNDArrayDriver that created this object.
   * \param[in] maxMemory Maxiumum number of bytes of memory the the pool is allowed to use, summed over
@@ -90,6 +115,9 @@ void NDArrayPool::onReleaseArray(NDArray *pArray)
   * alloc() will compute the size required from ndims, dims, and dataType.
   * \param[in] pData Pointer to a data buffer; if NULL then alloc will allocate a new
   * array buffer; if not NULL then it is assumed to point to a valid buffer.
+  * \param[in] pBufferOwner Owner of pData if the pool must not free it; pData must then not be NULL.
+  * The buffer is not counted against maxMemory and pBufferOwner->release() is called when the
+  * last reference to the NDArray is released. If alloc() fails the caller still owns pBufferOwner.
   * 
   * If pData is not NULL then dataSize must contain the actual number of bytes in the existing
   * array, and this array must be large enough to hold the array data. 
@@ -100,7 +128,8 @@ void NDArrayPool::onReleaseArray(NDArray *pArray)
   * maxMemory then an error will be returned. alloc() sets the reference count for the
   * returned NDArray to 1.
   */
-NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData)
+NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                            NDArrayBufferOwner *pBufferOwner)
 {
   NDArray *pArray=NULL;
   NDArrayInfo_t arrayInfo;
@@ -165,7 +194,8 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
   if (pData) {
     pArray->pData = pData;
     pArray->dataSize = dataSize;
-    memorySize_ += dataSize;
+    pArray->pBufferOwner = pBufferOwner;
+    if (!pBufferOwner) memorySize_ += dataSize;
   } else if (pArray->pData == NULL) {
     if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
       // We don't have enough memory to allocate the array
@@ -188,7 +218,7 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
              "%s: error: reached limit of %ld memory (%d buffers)\n",
              functionName, (long)maxMemory_, numBuffers_);
     } else {
-      pArray->pData = malloc(dataSize);
+      pArray->pData = allocData(dataSize);
       if (pArray->pData) {
         pArray->dataSize = dataSize;
         pArray->compressedSize = dataSize;
@@ -246,7 +276,7 @@ NDArray* NDArrayPool::copy(NDArray *pIn, NDArray *pOut, bool copyData, bool copy
   if (copyDataType) {
     pOut->dataType = pIn->dataType;
   }
-  pOut->codec.name = pIn->codec.name;
+  pOut->codec = pIn->codec;
   pOut->compressedSize = pIn->compressedSize;
   if (copyData) {
     pIn->getInfo(&arrayInfo);
@@ -313,9 +343,18 @@ int NDArrayPool::release(NDArray *pArray)
   }
   //asynPrint(pDriver_->pasynUserSelf, ASYN_TRACE_FLOW,
   //  "NDArrayPool::release pArray=%p, count=%d\n", pArray, pArray->referenceCount);
+  NDArrayBufferOwner *pBufferOwner = NULL;
+
   epicsMutexLock(listLock_);
   pArray->referenceCount--;
   if (pArray->referenceCount == 0) {
+    /* A buffer the pool does not own goes back to its owner; the NDArray object is kept without a buffer */
+    if (pArray->pBufferOwner) {
+      pBufferOwner = pArray->pBufferOwner;
+      pArray->pBufferOwner = NULL;
+      pArray->pData = NULL;
+      pArray->dataSize = 0;
+    }
     /* The last user has released this image, add it back to the free list */
     freeListElement listElement(pArray, pArray->dataSize);
     freeList_.insert(listElement);
@@ -328,6 +367,7 @@ int NDArrayPool::release(NDArray *pArray)
   // Call release hook (for pools that manage objects derived from NDArray class)
   onReleaseArray(pArray);
   epicsMutexUnlock(listLock_);
+  if (pBufferOwner) pBufferOwner->release();
   return ND_SUCCESS;
 }
 
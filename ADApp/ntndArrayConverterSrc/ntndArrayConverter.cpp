@@ -227,6 +227,31 @@ NTNDArrayInfo_t NTNDArrayConverter::getInfo (void)
 void NTNDArrayConverter::toArray (NDArray *dest)
 {
     toValue(dest);
+    toFields(dest);
+}
+
+/** Returns a new NDArray from the pool whose pData points into the value array of the
+  * NTNDArray instead of a copy of it. The value array is kept alive until the NDArray is
+  * released. pvData arrays are immutable, so the NDArray data must be treated as read-only.
+  * \param[in] pool The pool that allocates the NDArray; the data is not counted against its maxMemory.
+  * Throws std::runtime_error if the NDArray cannot be allocated. */
+NDArray *NTNDArrayConverter::toArray (NDArrayPool *pool)
+{
+    NDArray *dest = importValue(pool);
+
+    try {
+        dest->pAttributeList->clear();
+        toFields(dest);
+    } catch(...) {
+        dest->release();
+        throw;
+    }
+    return dest;
+}
+
+/** Copies everything except the value into dest */
+void NTNDArrayConverter::toFields (NDArray *dest)
+{
     toDimensions(dest);
     toTimeStamp(dest);
     toDataTimeStamp(dest);
@@ -293,6 +318,66 @@ void NTNDArrayConverter::toValue (NDArray *dest)
 
 }
 
+// Holds a reference to the value array of an NTNDArray for as long as an NDArray uses its data
+template <typename arrayValType>
+class NTNDArrayBuffer : public NDArrayBufferOwner {
+public:
+    NTNDArrayBuffer(const shared_vector<const arrayValType>& data) : m_data(data) {}
+    void release() { delete this; }
+private:
+    shared_vector<const arrayValType> m_data;
+};
+
+template <typename arrayType>
+NDArray *NTNDArrayConverter::importValue (NDArrayPool *pool, NTNDArrayInfo_t& info)
+{
+    typedef typename arrayType::value_type arrayValType;
+    typedef typename arrayType::const_svector arrayVecType;
+
+    PVUnionPtr src(m_array->getValue());
+    arrayVecType srcVec(src->get<arrayType>()->view());
+    size_t bytes = srcVec.size()*sizeof(arrayValType);
+
+    // An empty value cannot be shared: alloc() would allocate a buffer for a NULL pData
+    if (srcVec.empty())
+        throw std::runtime_error("empty value array");
+
+    NTNDArrayBuffer<arrayValType> *pBuffer = new NTNDArrayBuffer<arrayValType>(srcVec);
+    NDArray *dest = pool->alloc(info.ndims, info.dims, info.dataType, bytes,
+            (void*)srcVec.data(), pBuffer);
+    if (!dest) {
+        delete pBuffer;
+        throw std::runtime_error("error allocating NDArray");
+    }
+
+    dest->codec.name = info.codec;
+    dest->compressedSize = bytes;
+    return dest;
+}
+
+NDArray *NTNDArrayConverter::importValue (NDArrayPool *pool)
+{
+    NTNDArrayInfo_t info = getInfo();
+
+    switch(getValueType())
+    {
+    case pvByte:    return importValue<PVByteArray>  (pool, info);
+    case pvUByte:   return importValue<PVUByteArray> (pool, info);
+    case pvShort:   return importValue<PVShortArray> (pool, info);
+    case pvUShort:  return importValue<PVUShortArray>(pool, info);
+    case pvInt:     return importValue<PVIntArray>   (pool, info);
+    case pvUInt:    return importValue<PVUIntArray>  (pool, info);
+    case pvLong:    return importValue<PVLongArray>  (pool, info);
+    case pvULong:   return importValue<PVULongArray> (pool, info);
+    case pvFloat:   return importValue<PVFloatArray> (pool, info);
+    case pvDouble:  return importValue<PVDoubleArray>(pool, info);
+    case pvBoolean:
+    case pvString:
+    default:
+        throw std::runtime_error("invalid value data type");
+    }
+}
+
 void NTNDArrayConverter::toDimensions (NDArray *dest)
 {
     PVStructureArrayPtr src(m_array->getDimension());
@@ -422,7 +507,13 @@ void NTNDArrayConverter::fromValue (NDArray *src)
     NDArrayInfo_t arrayInfo;
     src->getInfo(&arrayInfo);
 
-    int64 compressedSize = src->compressedSize;
+    // Chunked data has a header room in front of every chunk and needs the chunk sizes
+    // to be decompressed, neither of which NTNDArray can carry
+    if (src->codec.chunkRows > 0)
+        throw std::runtime_error("chunked compressed arrays are not supported");
+
+    // Bytes reserved in front of the compressed data by NDPluginCodec are not sent
+    int64 compressedSize = src->compressedSize - src->codec.headerRoom;
     int64 uncompressedSize = arrayInfo.totalBytes;
 
     m_array->getCompressedDataSize()->put(compressedSize);
@@ -430,18 +521,29 @@ void NTNDArrayConverter::fromValue (NDArray *src)
 
     // The uncompressed data type would be lost when converting to NTNDArray,
     // so we must store it somewhere. codec.parameters seems like a good place.
-    PVScalarPtr uncompressedType(PVDC->createPVScalar(pvInt));
-    uncompressedType->putFrom<int32>(NDDataTypeToScalar[src->dataType]);
-
+    // The field is created once and only written when the type changes.
     PVStructurePtr codec(m_array->getCodec());
-    codec->getSubField<PVUnion>("parameters")->set(uncompressedType);
-    codec->getSubField<PVString>("name")->put(src->codec.name);
+    PVUnionPtr parameters(codec->getSubField<PVUnion>("parameters"));
+    PVIntPtr uncompressedType(parameters->get<PVInt>());
+    int32 scalarType = NDDataTypeToScalar[src->dataType];
+    if (!uncompressedType) {
+        uncompressedType = PVDC->createPVScalar<PVInt>();
+        uncompressedType->put(scalarType);
+        parameters->set(uncompressedType);
+    } else if (uncompressedType->get() != scalarType) {
+        uncompressedType->put(scalarType);
+        parameters->postPut();
+    }
+    PVStringPtr codecName(codec->getSubField<PVString>("name"));
+    if (codecName->get() != src->codec.name)
+        codecName->put(src->codec.name);
 
     size_t count = src->codec.empty() ? arrayInfo.nElements : compressedSize;
 
     src->reserve();
+    size_t offset = src->codec.empty() ? 0 : src->codec.headerRoom;
     shared_vector<arrayValType> temp((srcDataType*)src->pData,
-            freeNDArray<srcDataType>(src), 0, count);
+            freeNDArray<srcDataType>(src), offset, count);
 
     PVUnionPtr dest = m_array->getValue();
     dest->select<arrayType>(unionField)->replace(freeze(temp));
@@ -521,42 +623,110 @@ void NTNDArrayConverter::fromTimeStamp (NDArray *src)
 }
 
 template <typename pvAttrType, typename valueType>
-void NTNDArrayConverter::fromAttribute (PVStructurePtr dest, NDAttribute *src)
+void NTNDArrayConverter::fromAttribute (NTNDAttributeField_t& dest, NDAttribute *src)
 {
     valueType value;
     src->getValue(src->getDataType(), (void*)&value);
 
-    PVUnionPtr destUnion(dest->getSubFieldT<PVUnion>("value"));
-    typename pvAttrType::shared_pointer valueFld(destUnion->get<pvAttrType>());
-    if(!valueFld) {
-        valueFld = PVDC->createPVScalar<pvAttrType>();
-        destUnion->set(valueFld);
+    typename pvAttrType::shared_pointer valueFld(static_pointer_cast<pvAttrType>(dest.value));
+    if(valueFld->get() != value)
+        valueFld->put(value);
+}
+
+void NTNDArrayConverter::fromStringAttribute (NTNDAttributeField_t& dest, NDAttribute *src)
+{
+    string value;
+    src->getValue(value);
+
+    PVStringPtr valueFld(static_pointer_cast<PVString>(dest.value));
+    if(valueFld->get() != value)
+        valueFld->put(value);
+}
+
+static bool attributeSetFree (const NTNDAttributeSet_t& attrSet)
+{
+    for(size_t i = 0; i < attrSet.size(); ++i)
+    {
+        if(!attrSet[i].structure.unique())
+            return false;
     }
-    valueFld->put(value);
+    return true;
 }
 
-void NTNDArrayConverter::fromStringAttribute (PVStructurePtr dest, NDAttribute *src)
+/** Returns true if the names or types of the attributes differ from those of the cached sets */
+bool NTNDArrayConverter::attributeLayoutChanged (NDAttributeList *src)
 {
-    NDAttrDataType_t attrDataType;
-    size_t attrDataSize;
-
-    src->getValueInfo(&attrDataType, &attrDataSize);
-    std::vector<char> value(attrDataSize);
-    src->getValue(attrDataType, &value[0], attrDataSize);
-
-    PVUnionPtr destUnion(dest->getSubFieldT<PVUnion>("value"));
-    PVStringPtr valueFld(destUnion->get<PVString>());
-    if(!valueFld) {
-        valueFld = PVDC->createPVScalar<PVString>();
-        destUnion->set(valueFld);
+    NDAttribute *attr = NULL;
+    size_t i = 0;
+
+    if((size_t)src->count() != m_attrLayout.size())
+        return true;
+
+    while((attr = src->next(attr)))
+    {
+        if(attr->getDataType() != m_attrLayout[i].second ||
+           m_attrLayout[i].first != attr->getName())
+            return true;
+        ++i;
     }
-    valueFld->put(&value[0]);
+    return false;
 }
 
-void NTNDArrayConverter::fromUndefinedAttribute (PVStructurePtr dest)
+/** Returns a set of attribute structures for the attribute list that pvAccess no longer references.
+  * The structure array shares its elements with the monitor queues, so a set can only be
+  * changed in place when nobody else holds it. The sets are rebuilt when the names or types change. */
+NTNDAttributeSet_t& NTNDArrayConverter::getAttributeSet (NDAttributeList *src)
 {
-    PVFieldPtr nullPtr;
-    dest->getSubField<PVUnion>("value")->set(nullPtr);
+    typedef std::deque<NTNDAttributeSet_t>::iterator SetIt;
+
+    if(attributeLayoutChanged(src))
+    {
+        NDAttribute *attr = NULL;
+
+        m_attrSets.clear();
+        m_attrLayout.clear();
+        while((attr = src->next(attr)))
+            m_attrLayout.push_back(std::make_pair(string(attr->getName()), attr->getDataType()));
+    }
+
+    for(SetIt it = m_attrSets.begin(); it != m_attrSets.end(); ++it)
+    {
+        if(attributeSetFree(*it))
+            return *it;
+    }
+
+    // All sets are in use: make a new one, and forget the oldest if there are too many
+    if(m_attrSets.size() >= NTNDARRAY_ATTRIBUTE_SETS)
+        m_attrSets.pop_front();
+
+    StructureConstPtr structure(m_array->getAttribute()->getStructureArray()->getStructure());
+    NTNDAttributeSet_t newSet(m_attrLayout.size());
+
+    for(size_t i = 0; i < m_attrLayout.size(); ++i)
+    {
+        NTNDAttributeField_t& f = newSet[i];
+        NDAttrDataType_t dataType = m_attrLayout[i].second;
+
+        f.structure  = PVDC->createPVStructure(structure);
+        f.structure->getSubField<PVString>("name")->put(m_attrLayout[i].first);
+        f.descriptor = f.structure->getSubField<PVString>("descriptor");
+        f.source     = f.structure->getSubField<PVString>("source");
+        f.sourceType = f.structure->getSubField<PVInt>("sourceType");
+
+        if(dataType == NDAttrString)
+            f.value = PVDC->createPVScalar(pvString);
+        else if(dataType <= NDAttrFloat64)
+            f.value = PVDC->createPVScalar(NDDataTypeToScalar[dataType]);
+        else if(dataType != NDAttrUndefined)
+            throw std::runtime_error("invalid attribute data type");
+
+        // The value union of an NDAttrUndefined attribute is left empty
+        if(f.value)
+            f.structure->getSubField<PVUnion>("value")->set(f.value);
+    }
+
+    m_attrSets.push_back(newSet);
+    return m_attrSets.back();
 }
 
 void NTNDArrayConverter::fromAttributes (NDArray *src)
@@ -564,50 +734,45 @@ void NTNDArrayConverter::fromAttributes (NDArray *src)
     PVStructureArrayPtr dest(m_array->getAttribute());
     NDAttributeList *srcList = src->pAttributeList;
     NDAttribute *attr = NULL;
-    StructureConstPtr structure(dest->getStructureArray()->getStructure());
-    PVStructureArray::svector destVec(dest->reuse());
-
-    destVec.resize(srcList->count());
+    NTNDAttributeSet_t& attrSet = getAttributeSet(srcList);
+    PVStructureArray::svector destVec(attrSet.size());
 
     size_t i = 0;
     while((attr = srcList->next(attr)))
     {
-        if(!destVec[i].get() || !destVec[i].unique())
-            destVec[i] = PVDC->createPVStructure(structure);
-
-        PVStructurePtr pvAttr(destVec[i]);
+        NTNDAttributeField_t& f = attrSet[i];
 
-        pvAttr->getSubField<PVString>("name")->put(attr->getName());
-        pvAttr->getSubField<PVString>("descriptor")->put(attr->getDescription());
-        pvAttr->getSubField<PVString>("source")->put(attr->getSource());
+        // Only the fields whose values changed are written
+        if(f.descriptor->get() != attr->getDescription())
+            f.descriptor->put(attr->getDescription());
+        if(f.source->get() != attr->getSource())
+            f.source->put(attr->getSource());
 
         NDAttrSource_t sourceType;
         attr->getSourceInfo(&sourceType);
-        pvAttr->getSubField<PVInt>("sourceType")->put(sourceType);
+        if(f.sourceType->get() != sourceType)
+            f.sourceType->put(sourceType);
 
         switch(attr->getDataType())
         {
-        case NDAttrInt8:      fromAttribute <PVByte,   int8_t>  (pvAttr, attr); break;
-        case NDAttrUInt8:     fromAttribute <PVUByte,  uint8_t> (pvAttr, attr); break;
-        case NDAttrInt16:     fromAttribute <PVShort,  int16_t> (pvAttr, attr); break;
-        case NDAttrUInt16:    fromAttribute <PVUShort, uint16_t>(pvAttr, attr); break;
-        case NDAttrInt32:     fromAttribute <PVInt,    int32_t> (pvAttr, attr); break;
-        case NDAttrUInt32:    fromAttribute <PVUInt,   uint32_t>(pvAttr, attr); break;
-        case NDAttrInt64:     fromAttribute <PVLong,   int64_t> (pvAttr, attr); break;
-        case NDAttrUInt64:    fromAttribute <PVULong,  uint64_t>(pvAttr, attr); break;
-        case NDAttrFloat32:   fromAttribute <PVFloat,  float>   (pvAttr, attr); break;
-        case NDAttrFloat64:   fromAttribute <PVDouble, double>  (pvAttr, attr); break;
-        case NDAttrString:    fromStringAttribute(pvAttr, attr); break;
-        case NDAttrUndefined: fromUndefinedAttribute(pvAttr); break;
+        case NDAttrInt8:      fromAttribute <PVByte,   int8_t>  (f, attr); break;
+        case NDAttrUInt8:     fromAttribute <PVUByte,  uint8_t> (f, attr); break;
+        case NDAttrInt16:     fromAttribute <PVShort,  int16_t> (f, attr); break;
+        case NDAttrUInt16:    fromAttribute <PVUShort, uint16_t>(f, attr); break;
+        case NDAttrInt32:     fromAttribute <PVInt,    int32_t> (f, attr); break;
+        case NDAttrUInt32:    fromAttribute <PVUInt,   uint32_t>(f, attr); break;
+        case NDAttrInt64:     fromAttribute <PVLong,   int64_t> (f, attr); break;
+        case NDAttrUInt64:    fromAttribute <PVULong,  uint64_t>(f, attr); break;
+        case NDAttrFloat32:   fromAttribute <PVFloat,  float>   (f, attr); break;
+        case NDAttrFloat64:   fromAttribute <PVDouble, double>  (f, attr); break;
+        case NDAttrString:    fromStringAttribute(f, attr); break;
+        case NDAttrUndefined: break;
         default:              throw std::runtime_error("invalid attribute data type");
         }
 
+        destVec[i] = f.structure;
         ++i;
     }
 
     dest->replace(freeze(destVec));
 }
-
-
-
-
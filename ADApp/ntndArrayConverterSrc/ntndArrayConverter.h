@@ -1,6 +1,15 @@
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <NDArray.h>
 #include <pv/ntndarray.h>
 
+/* Maximum number of attribute structure sets that fromArray keeps for reuse.
+ * A set that was published is reused once pvAccess no longer references it. */
+#define NTNDARRAY_ATTRIBUTE_SETS 4
+
 typedef struct NTNDArrayInfo
 {
     int ndims;
@@ -18,6 +27,18 @@ typedef struct NTNDArrayInfo
     }x, y, color;
 }NTNDArrayInfo_t;
 
+/** Cached fields of one element of the attribute structure array */
+typedef struct NTNDAttributeField
+{
+    epics::pvData::PVStructurePtr structure;
+    epics::pvData::PVStringPtr descriptor;
+    epics::pvData::PVStringPtr source;
+    epics::pvData::PVIntPtr sourceType;
+    epics::pvData::PVScalarPtr value;    /* Selected field of the value union, NULL for NDAttrUndefined */
+}NTNDAttributeField_t;
+
+typedef std::vector<NTNDAttributeField_t> NTNDAttributeSet_t;
+
 class epicsShareClass NTNDArrayConverter
 {
 public:
@@ -25,6 +46,7 @@ public:
 
     NTNDArrayInfo_t getInfo (void);
     void toArray (NDArray *dest);
+    NDArray *toArray (NDArrayPool *pool);
     void fromArray (NDArray *src);
 
 private:
@@ -37,6 +59,11 @@ private:
     void toValue (NDArray *dest);
     void toValue (NDArray *dest);
 
+    template <typename arrayType>
+    NDArray *importValue (NDArrayPool *pool, NTNDArrayInfo_t& info);
+    NDArray *importValue (NDArrayPool *pool);
+
+    void toFields (NDArray *dest);
     void toDimensions (NDArray *dest);
     void toTimeStamp (NDArray *dest);
     void toDataTimeStamp (NDArray *dest);
@@ -56,10 +83,15 @@ private:
     void fromDataTimeStamp (NDArray *src);
 
     template <typename pvAttrType, typename valueType>
-    void fromAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
-    void fromStringAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
-    void fromUndefinedAttribute (epics::pvData::PVStructurePtr dest);
+    void fromAttribute (NTNDAttributeField_t& dest, NDAttribute *src);
+    void fromStringAttribute (NTNDAttributeField_t& dest, NDAttribute *src);
+    bool attributeLayoutChanged (NDAttributeList *src);
+    NTNDAttributeSet_t& getAttributeSet (NDAttributeList *src);
     void fromAttributes (NDArray *src);
+
+    /* Names and types of the attributes in the cached sets */
+    std::vector<std::pair<std::string, NDAttrDataType_t> > m_attrLayout;
+    std::deque<NTNDAttributeSet_t> m_attrSets;
 };
 
 typedef std::tr1::shared_ptr<NTNDArrayConverter> NTNDArrayConverterPtr;
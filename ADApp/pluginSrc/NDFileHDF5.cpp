@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <list>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <sstream>
@@ -48,7 +49,9 @@ enum HDF5Compression_t {HDF5CompressNone=0,
                         HDF5CompressBlosc, 
                         HDF5CompressBshuf, 
                         HDF5CompressLZ4,
-                        HDF5CompressJPEG};
+                        HDF5CompressJPEG,
+                        HDF5CompressZstd,
+                        HDF5CompressBshufZstd};
 /* Filter ID officially assigned to blosc */
 #define FILTER_BLOSC 32001
 /* Filter ID officially assigned to bitshuffle */
@@ -57,10 +60,17 @@ enum HDF5Compression_t {HDF5CompressNone=0,
 #define FILTER_LZ4 32004
 /* Filter ID officially assigned to jpeg */
 #define FILTER_JPEG 32019
+/* Filter ID officially assigned to zstd */
+#define FILTER_ZSTD 32015
+/* Compression selector for the bitshuffle filter */
+#define BSHUF_H5_COMPRESS_LZ4  2
+#define BSHUF_H5_COMPRESS_ZSTD 3
 
 #define DIMSREPORTSIZE 512
 #define DIMNAMESIZE 40
 #define ALIGNMENT_BOUNDARY 1048576
+#define DIRECT_IO_BLOCK_SIZE 4096          /* Default block size for the direct (O_DIRECT) file driver */
+#define DIRECT_IO_COPY_BUFFER_SIZE 16777216 /* Copy buffer used by the direct file driver for unaligned I/O */
 #define INFINITE_FRAMES_CAPTURE 10000 /* Used to calculate istorek (the size of the chunk index binar search tree) when capturing infinite number of frames */
 
 #ifdef HDF5_BTREE_IK_MAX_ENTRIES
@@ -85,6 +95,31 @@ static herr_t cFlushCallback(hid_t objectID, void *data)
 }
 #endif
 
+// Copy one HDF5 attribute to the object whose handle is passed in data, for use with H5Aiterate2.
+// Attributes of variable length types are not copied.
+static herr_t cCopyAttribute(hid_t location, const char *name, const H5A_info_t *info, void *data)
+{
+  hid_t dest = *(hid_t *)data;
+  hid_t attr = H5Aopen(location, name, H5P_DEFAULT);
+  if (attr < 0) return 0;
+  hid_t type = H5Aget_type(attr);
+  hid_t space = H5Aget_space(attr);
+  if (H5Tdetect_class(type, H5T_VLEN) <= 0 && H5Tis_variable_str(type) <= 0){
+    std::vector<char> buffer(H5Sget_simple_extent_npoints(space) * H5Tget_size(type));
+    if (!buffer.empty() && H5Aread(attr, type, &buffer[0]) >= 0){
+      hid_t copy = H5Acreate2(dest, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+      if (copy >= 0){
+        H5Awrite(copy, type, &buffer[0]);
+        H5Aclose(copy);
+      }
+    }
+  }
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Aclose(attr);
+  return 0;
+}
+
 const char *NDFileHDF5::str_NDFileHDF5_chunkSize[MAX_CHUNK_DIMS] = {
     "HDF5_nColChunks",
     "HDF5_nRowChunks",
@@ -167,6 +202,15 @@ static void flushTaskC(void *drvPvt)
     pPlugin->flushTask();
 }
 
+/** The task to run the thread for asynchronous writes
+ * \param[in] drvPvt Pointer to the NDFileHDF5 object
+ */
+static void writeTaskC(void *drvPvt)
+{
+    NDFileHDF5 *pPlugin = (NDFileHDF5 *)drvPvt;
+    pPlugin->writeTask();
+}
+
 /** Opens a HDF5 file.  
  * In write mode if NDFileModeMultiple is set then the first dataspace dimension is set to H5S_UNLIMITED to allow 
  * multiple arrays to be written to the same file.
@@ -181,6 +225,8 @@ static void flushTaskC(void *drvPvt)
 asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
 {
   int storeAttributes, storePerformance;
+  int asyncWrite, asyncQueueSize;
+  int numWriters;
   static const char *functionName = "openFile";
   int numCapture;
   asynStatus status = asynSuccess;
@@ -191,9 +237,14 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   this->lock();
   // Reset flush counter
   setIntegerParam(NDFileHDF5_SWMRCbCounter, 0);
+  setIntegerParam(NDFileHDF5_chunkRewrites, 0);
+  this->chunkRewrites = 0;
   getIntegerParam(NDFileNumCapture, &numCapture);
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
+  getIntegerParam(NDFileHDF5_asyncWrite, &asyncWrite);
+  getIntegerParam(NDFileHDF5_asyncQueueSize, &asyncQueueSize);
+  getIntegerParam(NDFileHDF5_numWriters, &numWriters);
 
   // We don't support reading yet
   if (openMode & NDFileModeRead) {
@@ -228,6 +279,19 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   // Check to see if a file is already open and close it
   this->checkForOpenFile();
 
+  // Spread the frames of a multi-frame file over several writers if requested
+  if (numWriters > 1 && (openMode & NDFileModeMultiple)){
+    return this->openRoundRobin(fileName, pArray, numWriters);
+  }
+
+  // The write mode is fixed for the lifetime of the file
+  this->asyncWriteActive = (asyncWrite == 1);
+  this->asyncQueueSize = (asyncQueueSize < 1) ? 1 : asyncQueueSize;
+  writeQueueLock.lock();
+  this->asyncWriteStatus = asynSuccess;
+  writeQueueLock.unlock();
+  this->numPerformanceColumns = this->asyncWriteActive ? HDF5_PERF_COLUMNS_ASYNC : HDF5_PERF_COLUMNS;
+
   if (openMode & NDFileModeMultiple){
     this->multiFrameFile = true;
   } else {
@@ -251,7 +315,7 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   this->pFileAttributes->clear();
 
   // Insert default NDAttribute from the NDArray object (timestamps etc)
-  this->addDefaultAttributes(pArray);
+  this->addDefaultAttributes(pArray, this->pFileAttributes);
 
   // Now get the current values of the attributes for this plugin
   this->getAttributes(this->pFileAttributes);
@@ -1342,6 +1406,9 @@ hid_t NDFileHDF5::createDatasetDetector(hid_t group, hdf5::Dataset *dset)
             driverName, functionName,
             (int)nbytes, (int)nslots);
   H5Pset_chunk_cache( dset_access_plist, (size_t)nslots, (size_t)nbytes, 1.0);
+  this->lock();
+  setIntegerParam(NDFileHDF5_chunkCacheBytes, (int)nbytes);
+  this->unlock();
 
   /*
    * Create a new dataset within the file using cparms
@@ -1364,34 +1431,60 @@ hid_t NDFileHDF5::createDatasetDetector(hid_t group, hdf5::Dataset *dset)
 }
 
 /** Writes NDArray data to a HDF5 file.
+  * If asynchronous writing was enabled when the file was opened the frame is queued for the
+  * writer thread, which makes the HDF5 calls, and this returns as soon as the frame is queued.
   * \param[in] pArray Pointer to an NDArray to write to the file. This function can be called multiple
   *            times between the call to openFile and closeFile if NDFileModeMultiple was set in 
   *            openMode in the call to NDFileHDF5::openFile.
   */
 asynStatus NDFileHDF5::writeFile(NDArray *pArray)
 {
-  herr_t hdfstatus = 0;
   asynStatus status = asynSuccess;
   int storeAttributes, storePerformance, flush;
   int dimAttDataset = 0;
   int posRunning = 0;
   char posName[MAXEXTRADIMS][MAX_STRING_SIZE];
-  epicsTimeStamp startts, endts;
+  epicsTimeStamp startts;
   epicsInt32 numCaptured;
-  double dt=0.0, period=0.0, runtime = 0.0;
   int extradims = 0;
   hsize_t offsets[MAXEXTRADIMS] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  bool async = this->asyncWriteActive;
+  asynStatus asyncStatus = asynSuccess;
+  NDAttributeList *pAttributes = this->pFileAttributes;
   static const char *functionName = "writeFile";
 
+  if (this->rrNumWriters > 0) return this->writeRoundRobin(pArray);
+
   // Take the flushing lock here, we do not let a manual flush occur
   // from a different thread during execution of this method.
-  flushLock.lock();
+  // In asynchronous mode only the writer thread makes HDF5 calls, and it takes
+  // the lock for each frame it writes.
+  if (!async) flushLock.lock();
 
   if (this->file == 0) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
               "%s::%s file is not open!\n", 
               driverName, functionName);
-    flushLock.unlock();          
+    if (!async) flushLock.unlock();
+    return asynError;
+  }
+
+  if (async) {
+    writeQueueLock.lock();
+    asyncStatus = this->asyncWriteStatus;
+    writeQueueLock.unlock();
+  }
+  if (asyncStatus != asynSuccess) {
+    // The writer thread failed to write an earlier frame. All following writes
+    // will fail as well so close the file and abort.
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: could not write a queued frame. Aborting\n",
+              driverName, functionName);
+    this->closeFile();
+    this->lock();
+    setIntegerParam(NDFileCapture, 0);
+    setIntegerParam(NDWriteFile, 0);
+    this->unlock();
     return asynError;
   }
 
@@ -1420,33 +1513,38 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   if (storeAttributes == 1){
     // Update attribute list. We use a separate attribute list
     // from the one in pArray to avoid the need to copy the array.
+    // In asynchronous mode the writer thread still uses pFileAttributes
+    // for the frames ahead of this one, so each frame gets its own list.
+    if (async) pAttributes = new NDAttributeList;
     // Get the current values of the attributes for this plugin
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
               "%s::%s getting attribute list\n", 
               driverName, functionName);
-    status = (asynStatus)this->getAttributes(this->pFileAttributes);
+    status = (asynStatus)this->getAttributes(pAttributes);
     if (status != asynSuccess){
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s::%s ERROR: could not update the attribute list\n",
                 driverName, functionName);
-      flushLock.unlock();
+      if (async) delete pAttributes;
+      if (!async) flushLock.unlock();
       return asynError;
     }
 
     // Insert default NDAttribute from the NDArray object (timestamps etc)
-    this->addDefaultAttributes(pArray);
+    this->addDefaultAttributes(pArray, pAttributes);
 
     // Now append the attributes from the array which are already up to date from
     // the driver and prior plugins
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
               "%s::%s copying attribute list\n", 
               driverName, functionName);
-    status = (asynStatus)pArray->pAttributeList->copy(this->pFileAttributes);
+    status = (asynStatus)pArray->pAttributeList->copy(pAttributes);
     if (status != asynSuccess){
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s::%s ERROR: could not append attributes to NDArray from driver\n",
                 driverName, functionName);
-      flushLock.unlock();
+      if (async) delete pAttributes;
+      if (!async) flushLock.unlock();
       return asynError;
     }
   }
@@ -1474,7 +1572,8 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                   "%s::%s ERROR: could not retrieve destination from specified attribute\n",
                   driverName, functionName);
-        flushLock.unlock();
+        if (async && storeAttributes == 1) delete pAttributes;
+        if (!async) flushLock.unlock();
         return asynError;
       }
     }
@@ -1522,43 +1621,57 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     }
   }
 
+  if (async){
+    if (status != asynSuccess){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: could not extend the dataset. Aborting\n",
+                driverName, functionName);
+      if (storeAttributes == 1) delete pAttributes;
+      this->closeFile();
+      this->lock();
+      setIntegerParam(NDFileCapture, 0);
+      setIntegerParam(NDWriteFile, 0);
+      this->unlock();
+      return asynError;
+    }
+    // Capture the position of this frame in the dataset now, as the dataset will
+    // be extended again for the following frames before this one is written
+    NDFileHDF5WriteRequest_t *pRequest = new NDFileHDF5WriteRequest_t;
+    pRequest->pArray = pArray;
+    pRequest->pDataset = this->detDataMap[destination];
+    pRequest->pDataset->getPosition(pRequest->dims, pRequest->offset);
+    pRequest->pAttributes = NULL;
+    pRequest->positionMode = -1;
+    if (storeAttributes == 1){
+      pRequest->pAttributes = pAttributes;
+      if (dimAttDataset == 0){
+        pRequest->positionMode = 0;
+      } else if (destination == this->defDsetName){
+        pRequest->positionMode = posRunning;
+      }
+    }
+    memcpy(pRequest->offsets, offsets, sizeof(offsets));
+    pRequest->numCaptured = numCaptured;
+    pRequest->storePerformance = storePerformance;
+    pRequest->flush = flush;
+    pRequest->queuedts = startts;
+    pArray->reserve();
+    this->nextRecord++;
+    return this->queueWrite(pRequest);
+  }
+
   if (status == asynSuccess){
     status = this->detDataMap[destination]->writeFile(pArray, this->datatype, this->dataspace, this->framesize);
   }
+  if (status == asynSuccess){
+    this->checkChunkRewrites(this->detDataMap[destination]);
+  }
   if (status != asynSuccess){
     // If dataset creation fails then close file and abort as all following writes will fail as well
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s::%s ERROR: could not write to dataset. Aborting\n",
               driverName, functionName);
-    hdfstatus = H5Sclose(this->dataspace);
-    if (hdfstatus){
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s::%s ERROR: Dataspace did not close cleanly.\n",
-                driverName, functionName);
-    }
-    hdfstatus = H5Pclose(this->cparms);
-    if (hdfstatus){
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s::%s ERROR: Cparms did not close cleanly.\n",
-                driverName, functionName);
-    }
-    hdfstatus = H5Tclose(this->datatype);
-    if (hdfstatus){
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s::%s ERROR: Datatype did not close cleanly.\n",
-                driverName, functionName);
-    }
-    hdfstatus = H5Fclose(this->file);
-    if (hdfstatus){
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s::%s ERROR: File did not close cleanly.\n",
-                driverName, functionName);
-    }
-    this->file = 0;
-    this->lock();
-    setIntegerParam(NDFileCapture, 0);
-    setIntegerParam(NDWriteFile, 0);
-    this->unlock();
+    this->closeFileOnError();
     flushLock.unlock();
     return asynError;
   }
@@ -1568,12 +1681,12 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
       // If attribute datasets are following dimensions of the main dataset
       // check to ensure this NDArray is destined for the default dataset
       if (destination == this->defDsetName){
-        status = this->writeAttributeDataset(hdf5::OnFrame, posRunning, offsets);
+        status = this->writeAttributeDataset(hdf5::OnFrame, posRunning, offsets, numCaptured);
       }
     } else {
       // Normal attribute datasets required (linear 1D)
       // so save on every occasion
-      status = this->writeAttributeDataset(hdf5::OnFrame, 0, offsets);
+      status = this->writeAttributeDataset(hdf5::OnFrame, 0, offsets, numCaptured);
     }
     if (status != asynSuccess){
       flushLock.unlock();
@@ -1583,21 +1696,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     }
   }
   if (storePerformance == 1 && numCaptured <= this->numPerformancePoints){
-    epicsTimeGetCurrent(&endts);
-    dt = epicsTimeDiffInSeconds(&endts, &startts);
-    *this->performancePtr = dt;
-    this->performancePtr++;
-    period = epicsTimeDiffInSeconds(&endts, &this->prevts);
-    *this->performancePtr = period;
-    this->prevts = endts;
-    this->performancePtr++;
-    runtime = epicsTimeDiffInSeconds(&endts, &this->firstFrame);
-    *this->performancePtr = runtime;
-    this->performancePtr++;
-    *this->performancePtr = this->frameSize/period;
-    this->performancePtr++;
-    *this->performancePtr = (numCaptured * this->frameSize)/runtime;
-    this->performancePtr++;
+    this->storePerformancePoint(&startts, numCaptured, 0, 0.0);
   }
 
   if (checkForSWMRMode()){
@@ -1610,7 +1709,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   if (status != asynSuccess){
     // HK is this a memory leak?
     // compared to a couple of lines above where more is closed???
-    hdfstatus = H5Fclose(this->file);
+    herr_t hdfstatus = H5Fclose(this->file);
     if (hdfstatus){
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s::%s ERROR: File did not close cleanly.\n",
@@ -1623,8 +1722,8 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     this->unlock();
   } else {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-              "%s::%s wrote frame. dt=%.5fs (T=%.5fs)\n",
-              driverName, functionName, dt, period);
+              "%s::%s wrote frame.\n",
+              driverName, functionName);
 
     this->nextRecord++;
   }
@@ -1635,6 +1734,221 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   return status;
 }
 
+/** Close the HDF5 handles and the file after a write has failed, and stop capturing.
+ * Called with the flushing lock held.
+ */
+void NDFileHDF5::closeFileOnError()
+{
+  herr_t hdfstatus = 0;
+  static const char *functionName = "closeFileOnError";
+
+  hdfstatus = H5Sclose(this->dataspace);
+  if (hdfstatus){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: Dataspace did not close cleanly.\n",
+              driverName, functionName);
+  }
+  hdfstatus = H5Pclose(this->cparms);
+  if (hdfstatus){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: Cparms did not close cleanly.\n",
+              driverName, functionName);
+  }
+  hdfstatus = H5Tclose(this->datatype);
+  if (hdfstatus){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: Datatype did not close cleanly.\n",
+              driverName, functionName);
+  }
+  hdfstatus = H5Fclose(this->file);
+  if (hdfstatus){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR: File did not close cleanly.\n",
+              driverName, functionName);
+  }
+  this->file = 0;
+  this->lock();
+  setIntegerParam(NDFileCapture, 0);
+  setIntegerParam(NDWriteFile, 0);
+  this->unlock();
+}
+
+/** Record one row of the performance dataset for a frame that has just been written.
+ * \param[in] startts Time the write of the frame started
+ * \param[in] numCaptured Number of the frame in the file, starting at 1
+ * \param[in] queueDepth Number of frames queued ahead of this one (asynchronous mode only)
+ * \param[in] latency Time from queueing the frame to the end of its write (asynchronous mode only)
+ */
+void NDFileHDF5::storePerformancePoint(epicsTimeStamp *startts, epicsInt32 numCaptured, int queueDepth, double latency)
+{
+  epicsTimeStamp endts;
+  double dt, period, runtime;
+
+  epicsTimeGetCurrent(&endts);
+  dt = epicsTimeDiffInSeconds(&endts, startts);
+  *this->performancePtr = dt;
+  this->performancePtr++;
+  period = epicsTimeDiffInSeconds(&endts, &this->prevts);
+  *this->performancePtr = period;
+  this->prevts = endts;
+  this->performancePtr++;
+  runtime = epicsTimeDiffInSeconds(&endts, &this->firstFrame);
+  *this->performancePtr = runtime;
+  this->performancePtr++;
+  *this->performancePtr = this->frameSize/period;
+  this->performancePtr++;
+  *this->performancePtr = (numCaptured * this->frameSize)/runtime;
+  this->performancePtr++;
+  if (this->numPerformanceColumns == HDF5_PERF_COLUMNS_ASYNC){
+    *this->performancePtr = queueDepth;
+    this->performancePtr++;
+    *this->performancePtr = latency;
+    this->performancePtr++;
+  }
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::storePerformancePoint wrote frame. dt=%.5fs (T=%.5fs)\n",
+            driverName, dt, period);
+}
+
+/** Queue a frame for the writer thread.
+ * Blocks while the maximum number of frames are already queued or being written.
+ * \param[in] pRequest The frame to write; ownership passes to the writer thread
+ */
+asynStatus NDFileHDF5::queueWrite(NDFileHDF5WriteRequest_t *pRequest)
+{
+  int depth;
+
+  writeQueueLock.lock();
+  while (this->writesPending >= this->asyncQueueSize){
+    writeQueueLock.unlock();
+    epicsEventWaitWithTimeout(this->writeDoneEventId, 0.1);
+    writeQueueLock.lock();
+  }
+  pRequest->queueDepth = this->writesPending;
+  this->writeQueue.push_back(pRequest);
+  this->writesPending++;
+  depth = this->writesPending;
+  writeQueueLock.unlock();
+  epicsEventSignal(this->writeEventId);
+  this->setQueueDepth(depth);
+  return asynSuccess;
+}
+
+/** Wait until the writer thread has written all of the queued frames.
+ */
+void NDFileHDF5::drainWriteQueue()
+{
+  writeQueueLock.lock();
+  while (this->writesPending > 0){
+    writeQueueLock.unlock();
+    epicsEventWaitWithTimeout(this->writeDoneEventId, 0.1);
+    writeQueueLock.lock();
+  }
+  writeQueueLock.unlock();
+}
+
+/** Update the queue depth parameter.
+ */
+void NDFileHDF5::setQueueDepth(int depth)
+{
+  this->lock();
+  setIntegerParam(NDFileHDF5_asyncQueueDepth, depth);
+  callParamCallbacks();
+  this->unlock();
+}
+
+/** Thread function for the asynchronous writer.
+ * Waits for frames to be queued by writeFile and writes them in the order they were queued.
+ */
+void NDFileHDF5::writeTask()
+{
+  const char* functionName = "writeTask";
+  NDFileHDF5WriteRequest_t *pRequest;
+  int depth;
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Started writeTask thread\n", driverName, functionName);
+  while (1){
+    epicsEventWait(this->writeEventId);
+    writeQueueLock.lock();
+    while (!this->writeQueue.empty()){
+      pRequest = this->writeQueue.front();
+      this->writeQueue.pop_front();
+      writeQueueLock.unlock();
+      this->writeQueued(pRequest);
+      writeQueueLock.lock();
+      this->writesPending--;
+      depth = this->writesPending;
+      writeQueueLock.unlock();
+      this->setQueueDepth(depth);
+      epicsEventSignal(this->writeDoneEventId);
+      writeQueueLock.lock();
+    }
+    writeQueueLock.unlock();
+  }
+}
+
+/** Write a frame queued by writeFile. Called from the writer thread.
+ * Once a write has failed the following frames are discarded, and the plugin
+ * thread closes the file on its next call to writeFile or closeFile.
+ * \param[in] pRequest The frame to write; it is deleted and its array released
+ */
+void NDFileHDF5::writeQueued(NDFileHDF5WriteRequest_t *pRequest)
+{
+  asynStatus status = asynSuccess;
+  epicsTimeStamp startts, endts;
+  NDAttributeList *pPrevAttributes;
+  static const char *functionName = "writeQueued";
+
+  // The plugin thread reads the status in writeFile and closeFile
+  writeQueueLock.lock();
+  status = this->asyncWriteStatus;
+  writeQueueLock.unlock();
+
+  if (status == asynSuccess){
+    flushLock.lock();
+    epicsTimeGetCurrent(&startts);
+    status = pRequest->pDataset->writeFile(pRequest->pArray, this->datatype, this->dataspace, this->framesize,
+                                           pRequest->dims, pRequest->offset);
+    if (status != asynSuccess){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: could not write to dataset\n",
+                driverName, functionName);
+    } else {
+      this->checkChunkRewrites(pRequest->pDataset);
+    }
+    if (status == asynSuccess && pRequest->pAttributes){
+      // Make this frame's attributes the current ones, which flushTask and closeFile also use
+      pPrevAttributes = this->pFileAttributes;
+      this->pFileAttributes = pRequest->pAttributes;
+      pRequest->pAttributes = pPrevAttributes;
+      if (pRequest->positionMode >= 0){
+        status = this->writeAttributeDataset(hdf5::OnFrame, pRequest->positionMode, pRequest->offsets,
+                                             pRequest->numCaptured);
+      }
+    }
+    if (status == asynSuccess && pRequest->storePerformance == 1 &&
+        pRequest->numCaptured <= this->numPerformancePoints){
+      epicsTimeGetCurrent(&endts);
+      this->storePerformancePoint(&startts, pRequest->numCaptured, pRequest->queueDepth,
+                                  epicsTimeDiffInSeconds(&endts, &pRequest->queuedts));
+    }
+    if (status == asynSuccess && checkForSWMRMode()){
+      if ((pRequest->numCaptured+1) % pRequest->flush == 0) {
+        // We are in SWMR mode so flush the dataset on every <flush> frames
+        status = pRequest->pDataset->flushDataset();
+      }
+    }
+    flushLock.unlock();
+    writeQueueLock.lock();
+    this->asyncWriteStatus = status;
+    writeQueueLock.unlock();
+  }
+
+  pRequest->pArray->release();
+  if (pRequest->pAttributes) delete pRequest->pAttributes;
+  delete pRequest;
+}
+
 /** Read NDArray data from a HDF5 file; NOTE: not implemented yet.
   * \param[in] pArray Pointer to the address of an NDArray to read the data into.  */ 
 asynStatus NDFileHDF5::readFile(NDArray **pArray)
@@ -1651,8 +1965,11 @@ asynStatus NDFileHDF5::closeFile()
   epicsTimeStamp now;
   double runtime = 0.0, writespeed = 0.0;
   epicsInt32 numCaptured;
+  asynStatus status = asynSuccess;
   static const char *functionName = "closeFile";
 
+  if (this->rrNumWriters > 0) return this->closeRoundRobin();
+
   if (this->file == 0){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
               "%s::%s file was not open! Ignoring close command.\n", 
@@ -1660,6 +1977,19 @@ asynStatus NDFileHDF5::closeFile()
     return asynSuccess;
   }
 
+  if (this->asyncWriteActive){
+    // Let the writer thread finish the queued frames before closing
+    this->drainWriteQueue();
+    writeQueueLock.lock();
+    status = this->asyncWriteStatus;
+    writeQueueLock.unlock();
+    if (status != asynSuccess){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: not all queued frames were written\n",
+                driverName, functionName);
+    }
+  }
+
   this->lock();
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
@@ -1756,13 +2086,441 @@ asynStatus NDFileHDF5::closeFile()
   writespeed = (numCaptured * this->frameSize)/runtime;
   setDoubleParam(NDFileHDF5_totalIoSpeed, writespeed);
   setDoubleParam(NDFileHDF5_totalRuntime, runtime);
+  setIntegerParam(NDFileHDF5_asyncQueueDepth, 0);
   this->unlock();
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s::%s file closed! runtime=%.3f s overall acquisition performance=%.2f Mbit/s\n",
             driverName, functionName, runtime, writespeed);
 
+  return status;
+}
+
+/** Open a multi-frame file whose frames are spread round-robin over several writers.
+ * Each writer is an internal NDFileHDF5 with its own asynchronous writer thread, which writes
+ * every numWriters'th frame to its own file, named after fileName with _w<n> appended.
+ * The master file fileName is created when the file is closed, see createRoundRobinMaster.
+ * \param[in] fileName Name of the master file.
+ * \param[in] pArray The first NDArray; used to configure the writers.
+ * \param[in] numWriters Number of writers to use.
+ */
+asynStatus NDFileHDF5::openRoundRobin(const char *fileName, NDArray *pArray, int numWriters)
+{
+  static const char *functionName = "openRoundRobin";
+#if H5_VERSION_GE(1,10,0)
+  char writerName[MAX_FILENAME_LEN];
+  char dsetName[MAX_FILENAME_LEN];
+  std::string tempSuffix, arrayPort, baseName, extension;
+  int arrayAddr, numCapture, extraDims, posRunning;
+  size_t dot, slash;
+  asynStatus status = asynSuccess;
+  hbool_t threadSafe = 0;
+
+  // The writer threads call HDF5 concurrently, which corrupts a library that is not thread-safe
+  if (H5is_library_threadsafe(&threadSafe) < 0 || !threadSafe){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR %d writers need a thread-safe HDF5 library\n",
+              driverName, functionName, numWriters);
+    return asynError;
+  }
+
+  this->lock();
+  getIntegerParam(NDFileNumCapture, &numCapture);
+  getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
+  getIntegerParam(NDFileHDF5_posRunning, &posRunning);
+  getStringParam(NDFileTempSuffix, tempSuffix);
+  getStringParam(NDPluginDriverArrayPort, arrayPort);
+  getIntegerParam(NDPluginDriverArrayAddr, &arrayAddr);
+  this->unlock();
+
+  // The master file interleaves the frames of the writers along a single frame
+  // dimension, so extra dimensions and positional placement cannot be used
+  if (extraDims > 0 || posRunning == 1){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR extra dimensions and position mode cannot be used with %d writers\n",
+              driverName, functionName, numWriters);
+    return asynError;
+  }
+
+  // Record the structure of the layout, which the master file repeats
+  this->layout.unload_xml();
+  if (this->loadXMLLayout()){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR failed to load the file layout\n",
+              driverName, functionName);
+    return asynError;
+  }
+  this->rrGroups.clear();
+  this->rrDatasets.clear();
+  this->rrHardLinks.clear();
+  this->collectRoundRobinLayout(this->layout.get_hdftree());
+  this->layout.unload_xml();
+
+  // The writers are asyn ports, whose names cannot be registered again, so they are created
+  // once, kept for later files and deleted in the destructor
+  while ((int)this->rrWriters.size() < numWriters){
+    epicsSnprintf(writerName, sizeof(writerName), "%s_W%d", this->portName, (int)this->rrWriters.size());
+    this->rrWriters.push_back(new NDFileHDF5(writerName, 1, 1, arrayPort.c_str(), arrayAddr, 0, 0));
+  }
+
+  // Name the files of the writers after the master file, without the temporary suffix
+  baseName = fileName;
+  if (!tempSuffix.empty() && baseName.size() > tempSuffix.size() &&
+      baseName.compare(baseName.size() - tempSuffix.size(), tempSuffix.size(), tempSuffix) == 0){
+    baseName.erase(baseName.size() - tempSuffix.size());
+  }
+  dot = baseName.rfind('.');
+  slash = baseName.find_last_of("/\\");
+  if (dot != std::string::npos && (slash == std::string::npos || dot > slash)){
+    extension = baseName.substr(dot);
+    baseName.erase(dot);
+  }
+
+  this->rrMasterName = fileName;
+  this->rrFileNames.clear();
+  this->rrFrames.assign(numWriters, 0);
+  this->rrNumFrames = 0;
+  for (int i = 0; i < numWriters && status == asynSuccess; i++){
+    epicsSnprintf(writerName, sizeof(writerName), "%s_w%d%s", baseName.c_str(), i, extension.c_str());
+    // Each writer captures its share of the frames
+    this->lock();
+    this->copyRoundRobinParams(this->rrWriters[i],
+                               numCapture == 0 ? 0 : (numCapture + numWriters - 1 - i) / numWriters);
+    this->unlock();
+    status = this->rrWriters[i]->openFile(writerName, NDFileModeWrite | NDFileModeMultiple, pArray);
+    if (status == asynSuccess){
+      this->rrFileNames.push_back(writerName);
+    } else {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR failed to open %s\n",
+                driverName, functionName, writerName);
+    }
+  }
+  if (status != asynSuccess){
+    for (size_t i = 0; i < this->rrFileNames.size(); i++){
+      this->rrWriters[i]->closeFile();
+    }
+    return asynError;
+  }
+
+  // The NDAttribute datasets depend on the attributes of the first array, so they are
+  // taken from the first writer rather than from the layout
+  std::list<NDFileHDF5AttributeDataset*>::iterator it_attr;
+  for (it_attr = this->rrWriters[0]->attrList.begin(); it_attr != this->rrWriters[0]->attrList.end(); ++it_attr){
+    if (H5Iget_name((*it_attr)->getHandle(), dsetName, sizeof(dsetName)) > 0){
+      this->rrDatasets.push_back(std::make_pair(std::string(dsetName),
+                                                (*it_attr)->getWhenToSave() == hdf5::OnFrame));
+    }
+  }
+
+  epicsTimeGetCurrent(&this->opents);
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+  this->frameSize = (8.0 * info.totalBytes)/(1024.0 * 1024.0);
+  this->rrNumWriters = numWriters;
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s writing %s with %d writers\n",
+            driverName, functionName, fileName, numWriters);
   return asynSuccess;
+#else
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s ERROR more than one writer needs virtual datasets, which need HDF5 1.10 or later\n",
+            driverName, functionName);
+  return asynError;
+#endif
+}
+
+/** Pass a frame to the next round-robin writer.
+ * \param[in] pArray The NDArray to write.
+ */
+asynStatus NDFileHDF5::writeRoundRobin(NDArray *pArray)
+{
+  int index = (int)(this->rrNumFrames % this->rrNumWriters);
+  NDFileHDF5 *pWriter = this->rrWriters[index];
+  asynStatus status;
+
+  pWriter->lock();
+  pWriter->setIntegerParam(NDFileNumCaptured, (int)this->rrFrames[index] + 1);
+  pWriter->unlock();
+  status = pWriter->writeFile(pArray);
+  if (status == asynSuccess){
+    this->rrFrames[index]++;
+    this->rrNumFrames++;
+  }
+  return status;
+}
+
+/** Close the files of the round-robin writers and create the master file.
+ */
+asynStatus NDFileHDF5::closeRoundRobin()
+{
+  epicsTimeStamp now;
+  double runtime = 0.0, writespeed = 0.0;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "closeRoundRobin";
+
+  for (int i = 0; i < this->rrNumWriters; i++){
+    if (this->rrWriters[i]->closeFile() != asynSuccess) status = asynError;
+  }
+  if (this->createRoundRobinMaster() != asynSuccess) status = asynError;
+  this->rrNumWriters = 0;
+
+  epicsTimeGetCurrent(&now);
+  runtime = epicsTimeDiffInSeconds(&now, &this->opents);
+  writespeed = (this->rrNumFrames * this->frameSize)/runtime;
+  this->lock();
+  setDoubleParam(NDFileHDF5_totalIoSpeed, writespeed);
+  setDoubleParam(NDFileHDF5_totalRuntime, runtime);
+  this->unlock();
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s files closed! runtime=%.3f s overall acquisition performance=%.2f Mbit/s\n",
+            driverName, functionName, runtime, writespeed);
+  return status;
+}
+
+/** Copy the HDF5 parameters of this plugin to a round-robin writer.
+ * The parameters of the base classes are not copied; the writers are driven directly
+ * through openFile, writeFile and closeFile. Must be called with the lock held.
+ * \param[in] pWriter The writer.
+ * \param[in] numCapture Number of frames the writer is to capture.
+ */
+void NDFileHDF5::copyRoundRobinParams(NDFileHDF5 *pWriter, int numCapture)
+{
+  asynParamType type;
+  epicsInt32 ival;
+  double dval;
+  std::string sval;
+
+  pWriter->lock();
+  // NDFileHDF5_numWriters is the last parameter created, the writers use a single file each
+  for (int index = FIRST_NDFILE_HDF5_PARAM; index < NDFileHDF5_numWriters; index++){
+    if (getParamType(index, &type) != asynSuccess) continue;
+    if (type == asynParamInt32){
+      if (getIntegerParam(index, &ival) == asynSuccess) pWriter->setIntegerParam(index, ival);
+    } else if (type == asynParamFloat64){
+      if (getDoubleParam(index, &dval) == asynSuccess) pWriter->setDoubleParam(index, dval);
+    } else if (type == asynParamOctet){
+      if (getStringParam(index, sval) == asynSuccess) pWriter->setStringParam(index, sval);
+    }
+  }
+  pWriter->setIntegerParam(NDFileHDF5_numWriters, 1);
+  // The writers run in parallel, each in its own writer thread
+  pWriter->setIntegerParam(NDFileHDF5_asyncWrite, 1);
+  pWriter->setIntegerParam(NDFileNumCapture, numCapture);
+  pWriter->setIntegerParam(NDFileNumCaptured, 0);
+  pWriter->unlock();
+}
+
+/** Record the groups, detector and constant datasets and hard links of a layout tree,
+ * parents before children, for the master file of a round-robin capture.
+ * \param[in] group The group to start from.
+ */
+void NDFileHDF5::collectRoundRobinLayout(hdf5::Group *group)
+{
+  hdf5::Group::MapDatasets_t::iterator it_dset;
+  hdf5::Group::MapDatasets_t& datasets = group->get_datasets();
+  for (it_dset = datasets.begin(); it_dset != datasets.end(); ++it_dset){
+    hdf5::DataSource& source = it_dset->second->data_source();
+    if (source.is_src_detector()){
+      this->rrDatasets.push_back(std::make_pair(it_dset->second->get_full_name(), true));
+    } else if (source.is_src_constant()){
+      this->rrDatasets.push_back(std::make_pair(it_dset->second->get_full_name(), false));
+    }
+  }
+
+  hdf5::Group::MapHardLinks_t::iterator it_link;
+  hdf5::Group::MapHardLinks_t& hardlinks = group->get_hardlinks();
+  for (it_link = hardlinks.begin(); it_link != hardlinks.end(); ++it_link){
+    this->rrHardLinks.push_back(std::make_pair(it_link->second->get_full_name(), it_link->second->get_target()));
+  }
+
+  hdf5::Group::MapGroups_t::iterator it_group;
+  hdf5::Group::MapGroups_t& groups = group->get_groups();
+  for (it_group = groups.begin(); it_group != groups.end(); ++it_group){
+    this->rrGroups.push_back(it_group->second->get_full_name());
+    this->collectRoundRobinLayout(it_group->second);
+  }
+}
+
+/** Create the master file of a round-robin capture.
+ * The master file has the groups, datasets and hard links of the layout. Datasets with a
+ * value per frame are virtual datasets which interleave the datasets of the writer files, so
+ * that frame n of the master file is frame n/numWriters of writer n%numWriters. The other
+ * datasets, and the HDF5 attributes, are copied from the file of the first writer.
+ * The files of the writers are referenced by their name only, so they must be kept in the
+ * same directory as the master file.
+ */
+asynStatus NDFileHDF5::createRoundRobinMaster()
+{
+  asynStatus status = asynSuccess;
+  static const char *functionName = "createRoundRobinMaster";
+#if H5_VERSION_GE(1,10,0)
+  std::vector<hid_t> sources;
+  hid_t master, lcpl, group, source;
+  size_t i;
+
+  for (i = 0; i < this->rrFileNames.size(); i++){
+    sources.push_back(H5Fopen(this->rrFileNames[i].c_str(), H5F_ACC_RDONLY, H5P_DEFAULT));
+    if (sources[i] < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR could not open %s\n",
+                driverName, functionName, this->rrFileNames[i].c_str());
+      status = asynError;
+    }
+  }
+  master = H5Fcreate(this->rrMasterName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (master < 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR could not create %s\n",
+              driverName, functionName, this->rrMasterName.c_str());
+    status = asynError;
+  }
+  if (status != asynSuccess){
+    for (i = 0; i < sources.size(); i++){
+      if (sources[i] >= 0) H5Fclose(sources[i]);
+    }
+    if (master >= 0) H5Fclose(master);
+    return status;
+  }
+
+  lcpl = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(lcpl, 1);
+
+  H5Aiterate2(sources[0], H5_INDEX_NAME, H5_ITER_NATIVE, NULL, cCopyAttribute, &master);
+  for (i = 0; i < this->rrGroups.size(); i++){
+    const char *name = this->rrGroups[i].c_str();
+    if (H5Lexists(sources[0], name, H5P_DEFAULT) <= 0) continue;
+    group = H5Gcreate2(master, name, lcpl, H5P_DEFAULT, H5P_DEFAULT);
+    if (group < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR could not create group %s\n",
+                driverName, functionName, name);
+      status = asynError;
+      continue;
+    }
+    source = H5Gopen2(sources[0], name, H5P_DEFAULT);
+    H5Aiterate2(source, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, cCopyAttribute, &group);
+    H5Gclose(source);
+    H5Gclose(group);
+  }
+
+  for (i = 0; i < this->rrDatasets.size(); i++){
+    const char *name = this->rrDatasets[i].first.c_str();
+    // Datasets of NDAttributes which were missing from the first array are not created
+    if (H5Lexists(sources[0], name, H5P_DEFAULT) <= 0) continue;
+    if (this->rrDatasets[i].second){
+      if (this->rrNumFrames == 0) continue;
+      if (this->createVirtualDataset(master, sources, this->rrDatasets[i].first) != asynSuccess){
+        status = asynError;
+      }
+    } else if (H5Ocopy(sources[0], name, master, name, H5P_DEFAULT, lcpl) < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR could not copy dataset %s\n",
+                driverName, functionName, name);
+      status = asynError;
+    }
+  }
+
+  for (i = 0; i < this->rrHardLinks.size(); i++){
+    const char *target = this->rrHardLinks[i].second.c_str();
+    if (H5Lexists(master, target, H5P_DEFAULT) <= 0) continue;
+    if (H5Lcreate_hard(master, target, master, this->rrHardLinks[i].first.c_str(), lcpl, H5P_DEFAULT) < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s error creating hard link from: %s to %s\n",
+                driverName, functionName, target, this->rrHardLinks[i].first.c_str());
+    }
+  }
+
+  H5Pclose(lcpl);
+  for (i = 0; i < sources.size(); i++){
+    H5Fclose(sources[i]);
+  }
+  H5Fclose(master);
+#endif
+  return status;
+}
+
+/** Create a virtual dataset in the master file of a round-robin capture which interleaves
+ * the datasets of the same name in the writer files along their first dimension.
+ * \param[in] master Handle of the master file.
+ * \param[in] sources Handles of the writer files, in writer order.
+ * \param[in] name Full name of the dataset.
+ */
+asynStatus NDFileHDF5::createVirtualDataset(hid_t master, std::vector<hid_t>& sources, const std::string& name)
+{
+  asynStatus status = asynSuccess;
+  static const char *functionName = "createVirtualDataset";
+#if H5_VERSION_GE(1,10,0)
+  hsize_t dims[H5S_MAX_RANK], srcdims[H5S_MAX_RANK];
+  hsize_t start[H5S_MAX_RANK], stride[H5S_MAX_RANK], count[H5S_MAX_RANK];
+  hsize_t numWriters = sources.size();
+  hid_t first, type, space, vspace, srcspace, dcpl, lcpl, dset, vdset;
+  std::string srcFileName;
+  int rank;
+
+  first = H5Dopen2(sources[0], name.c_str(), H5P_DEFAULT);
+  if (first < 0) return asynError;
+  type = H5Dget_type(first);
+  space = H5Dget_space(first);
+  rank = H5Sget_simple_extent_ndims(space);
+  H5Sget_simple_extent_dims(space, dims, NULL);
+  H5Sclose(space);
+
+  dims[0] = this->rrNumFrames;
+  vspace = H5Screate_simple(rank, dims, NULL);
+  dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  for (hsize_t w = 0; w < numWriters; w++){
+    dset = H5Dopen2(sources[w], name.c_str(), H5P_DEFAULT);
+    if (dset < 0) continue;
+    space = H5Dget_space(dset);
+    H5Sget_simple_extent_dims(space, srcdims, NULL);
+    H5Sclose(space);
+    H5Dclose(dset);
+    if (srcdims[0] == 0 || w >= this->rrNumFrames) continue;
+    // Frame j of this writer is frame w + j*numWriters of the master file
+    for (int d = 0; d < rank; d++){
+      start[d] = 0;
+      stride[d] = 1;
+      count[d] = srcdims[d];
+    }
+    start[0] = w;
+    stride[0] = numWriters;
+    count[0] = (this->rrNumFrames - w + numWriters - 1) / numWriters;
+    if (srcdims[0] < count[0]) count[0] = srcdims[0];
+    H5Sselect_hyperslab(vspace, H5S_SELECT_SET, start, stride, count, NULL);
+    srcdims[0] = count[0];
+    srcspace = H5Screate_simple(rank, srcdims, NULL);
+    // Reference the writer files relative to the master file
+    srcFileName = this->rrFileNames[w];
+    size_t slash = srcFileName.find_last_of("/\\");
+    if (slash != std::string::npos) srcFileName.erase(0, slash + 1);
+    if (H5Pset_virtual(dcpl, vspace, srcFileName.c_str(), name.c_str(), srcspace) < 0) status = asynError;
+    H5Sclose(srcspace);
+  }
+  H5Sselect_all(vspace);
+
+  lcpl = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(lcpl, 1);
+  vdset = H5Dcreate2(master, name.c_str(), type, vspace, lcpl, dcpl, H5P_DEFAULT);
+  if (vdset < 0){
+    status = asynError;
+  } else {
+    H5Aiterate2(first, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, cCopyAttribute, &vdset);
+    H5Dclose(vdset);
+  }
+  if (status != asynSuccess){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR could not create virtual dataset %s\n",
+              driverName, functionName, name.c_str());
+  }
+  H5Pclose(lcpl);
+  H5Pclose(dcpl);
+  H5Sclose(vspace);
+  H5Tclose(type);
+  H5Dclose(first);
+#endif
+  return status;
 }
 
 /** Perform any actions required when an int32 parameter is updated.
@@ -1952,6 +2710,12 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       case HDF5CompressJPEG:
         filterId = FILTER_JPEG;
         break;
+      case HDF5CompressZstd:
+        filterId = FILTER_ZSTD;
+        break;
+      case HDF5CompressBshufZstd:
+        filterId = FILTER_BSHUF;
+        break;
       default:
         filterId = H5Z_FILTER_NONE;
         status = asynError;
@@ -2023,6 +2787,18 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       status = asynError;
       setIntegerParam(function, oldvalue);
     }
+  } else if (function == NDFileHDF5_zstdCompressLevel) {
+    if (this->file != 0 || value < 1 || value > 22)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_numWriters){
+    // The number of writers cannot change while a file is open
+    if (this->file != 0 || this->rrNumWriters > 0 || value < 1){
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
   } else if (function == NDFileHDF5_SWMRMode){
 
     // Reject SWMR mode if the HDF version doesn't support it
@@ -2307,6 +3083,7 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_bloscCompressor,    asynParamInt32,   &NDFileHDF5_bloscCompressor);
   this->createParam(str_NDFileHDF5_bloscCompressLevel, asynParamInt32,   &NDFileHDF5_bloscCompressLevel);
   this->createParam(str_NDFileHDF5_jpegQuality,     asynParamInt32,   &NDFileHDF5_jpegQuality);
+  this->createParam(str_NDFileHDF5_zstdCompressLevel, asynParamInt32, &NDFileHDF5_zstdCompressLevel);
   this->createParam(str_NDFileHDF5_dimAttDatasets,  asynParamInt32,   &NDFileHDF5_dimAttDatasets);
   this->createParam(str_NDFileHDF5_layoutErrorMsg,  asynParamOctet,   &NDFileHDF5_layoutErrorMsg);
   this->createParam(str_NDFileHDF5_layoutValid,     asynParamInt32,   &NDFileHDF5_layoutValid);
@@ -2322,6 +3099,16 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_SWMRSupported,   asynParamInt32,   &NDFileHDF5_SWMRSupported);
   this->createParam(str_NDFileHDF5_SWMRMode,        asynParamInt32,   &NDFileHDF5_SWMRMode);
   this->createParam(str_NDFileHDF5_SWMRRunning,     asynParamInt32,   &NDFileHDF5_SWMRRunning);
+  this->createParam(str_NDFileHDF5_asyncWrite,      asynParamInt32,   &NDFileHDF5_asyncWrite);
+  this->createParam(str_NDFileHDF5_asyncQueueSize,  asynParamInt32,   &NDFileHDF5_asyncQueueSize);
+  this->createParam(str_NDFileHDF5_asyncQueueDepth, asynParamInt32,   &NDFileHDF5_asyncQueueDepth);
+  this->createParam(str_NDFileHDF5_directIO,        asynParamInt32,   &NDFileHDF5_directIO);
+  this->createParam(str_NDFileHDF5_chunkAutoTune,   asynParamInt32,   &NDFileHDF5_chunkAutoTune);
+  this->createParam(str_NDFileHDF5_chunkTargetBytes, asynParamInt32,  &NDFileHDF5_chunkTargetBytes);
+  this->createParam(str_NDFileHDF5_chunkCacheBytes, asynParamInt32,   &NDFileHDF5_chunkCacheBytes);
+  this->createParam(str_NDFileHDF5_chunkRewrites,   asynParamInt32,   &NDFileHDF5_chunkRewrites);
+  // NDFileHDF5_numWriters must be the last parameter, see copyRoundRobinParams
+  this->createParam(str_NDFileHDF5_numWriters,      asynParamInt32,   &NDFileHDF5_numWriters);
 
   setIntegerParam(NDFileHDF5_chunkSizeAuto, 1);
   for (int chunkIndex = 0; chunkIndex < MAX_CHUNK_DIMS; chunkIndex++){
@@ -2353,6 +3140,7 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_bloscCompressLevel, 5);
   setIntegerParam(NDFileHDF5_dimAttDatasets,  0);
   setIntegerParam(NDFileHDF5_jpegQuality,     90);
+  setIntegerParam(NDFileHDF5_zstdCompressLevel, 3);
   setStringParam (NDFileHDF5_layoutErrorMsg,  "");
   setIntegerParam(NDFileHDF5_layoutValid,     1);
   setStringParam (NDFileHDF5_layoutFilename,  "");
@@ -2366,6 +3154,15 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_SWMRCbCounter,   0);
   setIntegerParam(NDFileHDF5_SWMRMode,        0);
   setIntegerParam(NDFileHDF5_SWMRRunning,     0);
+  setIntegerParam(NDFileHDF5_asyncWrite,      0);
+  setIntegerParam(NDFileHDF5_asyncQueueSize,  4);
+  setIntegerParam(NDFileHDF5_asyncQueueDepth, 0);
+  setIntegerParam(NDFileHDF5_directIO,        0);
+  setIntegerParam(NDFileHDF5_chunkAutoTune,   0);
+  setIntegerParam(NDFileHDF5_chunkTargetBytes, 1048576);
+  setIntegerParam(NDFileHDF5_chunkCacheBytes, 0);
+  setIntegerParam(NDFileHDF5_chunkRewrites,   0);
+  setIntegerParam(NDFileHDF5_numWriters,      1);
   if (checkForSWMRSupported()){
     setIntegerParam(NDFileHDF5_SWMRSupported, 1);
   } else {
@@ -2408,12 +3205,21 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->offset       = NULL;
   this->virtualdims  = NULL;
   this->rank         = 0;
+  this->extraRank    = 0;
+  this->chunkRewrites = 0;
   this->file         = 0;
   this->ptrFillValue = (void*)calloc(8, sizeof(char));
   this->dimsreport   = (char*)calloc(DIMSREPORTSIZE, sizeof(char));
   this->performanceBuf       = NULL;
   this->performancePtr       = NULL;
   this->numPerformancePoints = 0;
+  this->numPerformanceColumns = HDF5_PERF_COLUMNS;
+  this->asyncWriteActive     = false;
+  this->asyncQueueSize       = 1;
+  this->asyncWriteStatus     = asynSuccess;
+  this->writesPending        = 0;
+  this->rrNumWriters         = 0;
+  this->rrNumFrames          = 0;
 
   this->hostname = (char*)calloc(MAXHOSTNAMELEN, sizeof(char));
   gethostname(this->hostname, MAXHOSTNAMELEN);
@@ -2434,6 +3240,37 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
       printf("%s:%s epicsThreadCreate failure for flushing task\n", driverName, functionName);
       return;
   }
+
+  this->writeEventId = epicsEventCreate(epicsEventEmpty);
+  this->writeDoneEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->writeEventId || !this->writeDoneEventId){
+      printf("%s:%s epicsEventCreate failure for write events\n", driverName, functionName);
+      return;
+  }
+
+  // Create the thread that writes frames when asynchronous writing is enabled
+  status = (epicsThreadCreate("HDF5WriteTask",
+                              epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)writeTaskC,
+                              this) == NULL);
+  if (status){
+      printf("%s:%s epicsThreadCreate failure for write task\n", driverName, functionName);
+      return;
+  }
+}
+
+/** Destructor.
+ * Closes the files of the round-robin writers if a file is still open and deletes the writers.
+ */
+NDFileHDF5::~NDFileHDF5()
+{
+  for (int i = 0; i < this->rrNumWriters; i++){
+    this->rrWriters[i]->closeFile();
+  }
+  for (size_t i = 0; i < this->rrWriters.size(); i++){
+    delete this->rrWriters[i];
+  }
 }
 
 /** Calculate the total number of frames that the current configured dimensions can contain.
@@ -2505,13 +3342,172 @@ unsigned int NDFileHDF5::calcIstorek()
   return retval;
 }
 
+/** Return the number of chunks of the detector dataset that are partially written at the same
+  * time when frames are written in order: every chunk across one frame, multiplied by the chunks of
+  * the extra dimensions that vary faster than the slowest extra dimension with a chunk size above 1.
+  */
+hsize_t NDFileHDF5::calcOpenChunks()
+{
+  hsize_t openChunks = 1;
+  int slowest = -1;
+  int i;
+
+  for (i = this->extraRank; i < this->rank; i++) {
+    openChunks *= (this->maxdims[i] + this->chunkdims[i] - 1) / this->chunkdims[i];
+  }
+  for (i = 0; i < this->extraRank; i++) {
+    if (this->chunkdims[i] > 1) {
+      slowest = i;
+      break;
+    }
+  }
+  if (slowest >= 0) {
+    for (i = slowest + 1; i < this->extraRank; i++) {
+      if (this->maxdims[i] == H5S_UNLIMITED) continue;
+      openChunks *= (this->maxdims[i] + this->chunkdims[i] - 1) / this->chunkdims[i];
+    }
+  }
+  return openChunks;
+}
+
+/** Choose the chunk shape of the detector dataset from the frame geometry.
+  * Frames smaller than HDF5_chunkTargetBytes are grouped along the frame number dimension
+  * until a chunk holds about HDF5_chunkTargetBytes. Larger frames are split along their
+  * slowest varying dimension when a compression filter is enabled; uncompressed frames
+  * keep whole-frame chunks so that they are still written with direct chunk writes.
+  * The chosen shape is written back to the chunk size parameters.
+  * Must be called with the lock held.
+  * \param[in] pArray The first NDArray of the file.
+  * \param[in] extradims Number of dimensions in addition to the frame dimensions.
+  */
+void NDFileHDF5::autoTuneChunks(NDArray *pArray, int extradims)
+{
+  NDArrayInfo_t info;
+  int targetBytes = 0;
+  int compressionType = 0;
+  int fileWriteMode = 0;
+  int nFramesChunks = 1;
+  int i;
+  static const char *functionName = "autoTuneChunks";
+
+  pArray->getInfo(&info);
+  getIntegerParam(NDFileHDF5_chunkTargetBytes, &targetBytes);
+  getIntegerParam(NDFileHDF5_compressionType, &compressionType);
+  getIntegerParam(NDFileWriteMode, &fileWriteMode);
+  if (targetBytes < 1) targetBytes = 1;
+  hsize_t frameBytes = info.totalBytes;
+  if (frameBytes < 1) frameBytes = 1;
+
+  // Start from whole-frame chunks
+  for (i = 0; i < pArray->ndims; i++) {
+    this->chunkdims[this->rank - i - 1] = pArray->dims[i].size;
+  }
+
+  if (frameBytes > (hsize_t)targetBytes) {
+    if (compressionType != HDF5CompressNone) {
+      hsize_t nChunks = (frameBytes + targetBytes - 1) / targetBytes;
+      hsize_t rows = (this->framesize[extradims] + nChunks - 1) / nChunks;
+      if (rows < 1) rows = 1;
+      this->chunkdims[extradims] = rows;
+    }
+  } else if (fileWriteMode != NDFileModeSingle && extradims > 0) {
+    hsize_t frames = (hsize_t)targetBytes / frameBytes;
+    hsize_t maxFrames = this->maxdims[extradims - 1];
+    if (maxFrames != H5S_UNLIMITED && frames > maxFrames) frames = maxFrames;
+    if (frames < 1) frames = 1;
+    nFramesChunks = (int)frames;
+    this->chunkdims[extradims - 1] = nFramesChunks;
+  }
+
+  for (i = 0; i < pArray->ndims && i < MAX_CHUNK_DIMS; i++) {
+    setIntegerParam(NDFileHDF5_chunkSize[i], (int)this->chunkdims[this->rank - i - 1]);
+  }
+  if (fileWriteMode != NDFileModeSingle) {
+    setIntegerParam(NDFileHDF5_nFramesChunks, nFramesChunks);
+  }
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s frame=%lu bytes target=%d bytes: %d frames per chunk, %lu rows per chunk\n",
+            driverName, functionName, (unsigned long)frameBytes, targetBytes,
+            nFramesChunks, (unsigned long)this->chunkdims[extradims]);
+}
+
+/** Check the detector datasets for chunks that were flushed out of the chunk cache before they
+  * were complete and had to be read back and written again.
+  * The total is reported in HDF5_chunkRewrites. With HDF5_chunkAutoTune enabled the chunk cache
+  * of the dataset is enlarged so that all partially written chunks fit; otherwise a warning is
+  * printed the first time it happens.
+  * \param[in] pDataset The dataset that has just been written to.
+  */
+void NDFileHDF5::checkChunkRewrites(NDFileHDF5Dataset *pDataset)
+{
+  unsigned long rewrites = 0;
+  int chunkAutoTune = 0;
+  static const char *functionName = "checkChunkRewrites";
+
+  for (std::map<std::string, NDFileHDF5Dataset *>::iterator it = this->detDataMap.begin();
+       it != this->detDataMap.end(); ++it) {
+    rewrites += it->second->getChunkRewrites();
+  }
+  if (rewrites == this->chunkRewrites) return;
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_chunkAutoTune, &chunkAutoTune);
+  if (this->chunkRewrites == 0 && !chunkAutoTune) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+              "%s::%s WARNING: chunks are evicted from the chunk cache before they are complete "
+              "(cache=%lu bytes, partially written chunks=%lu bytes)\n",
+              driverName, functionName, (unsigned long)pDataset->getChunkCacheBytes(),
+              (unsigned long)pDataset->getOpenChunkBytes());
+  }
+  this->chunkRewrites = rewrites;
+  setIntegerParam(NDFileHDF5_chunkRewrites, (int)rewrites);
+  callParamCallbacks();
+  this->unlock();
+
+  // The dataset is reopened to change its cache, which is not allowed while SWMR readers may be attached
+  if (chunkAutoTune && !this->checkForSWMRMode()) {
+    hsize_t nbytes = pDataset->getOpenChunkBytes() + pDataset->getChunkBytes();
+    if (nbytes > HDF5_MAX_CHUNK_CACHE) nbytes = HDF5_MAX_CHUNK_CACHE;
+    if (nbytes > pDataset->getChunkCacheBytes()) {
+      hsize_t nslots = 100 * (nbytes / pDataset->getChunkBytes());
+      if (nslots > HDF5_MAX_CHUNK_SLOTS) nslots = HDF5_MAX_CHUNK_SLOTS;
+      while (!IsPrime(nslots)) nslots++;
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s::%s enlarging chunk cache to %lu bytes\n",
+                driverName, functionName, (unsigned long)nbytes);
+      if (pDataset->setChunkCache((size_t)nslots, (size_t)nbytes) == asynSuccess) {
+        this->lock();
+        setIntegerParam(NDFileHDF5_chunkCacheBytes, (int)nbytes);
+        callParamCallbacks();
+        this->unlock();
+      }
+    }
+  }
+}
+
 hsize_t NDFileHDF5::calcChunkCacheBytes()
 {
   hsize_t nbytes = 0;
   epicsInt32 n_frames_chunk=0;
+  int chunkAutoTune = 0;
+  static const char *functionName = "calcChunkCacheBytes";
   this->lock();
   getIntegerParam(NDFileHDF5_nFramesChunks, &n_frames_chunk);
+  getIntegerParam(NDFileHDF5_chunkAutoTune, &chunkAutoTune);
   this->unlock();
+  if (chunkAutoTune) {
+    // Room for every partially written chunk plus the one being started
+    hsize_t chunkBytes = this->bytesPerElement;
+    for (int i = 0; i < this->rank; i++) chunkBytes *= this->chunkdims[i];
+    nbytes = (this->calcOpenChunks() + 1) * chunkBytes;
+    if (nbytes > HDF5_MAX_CHUNK_CACHE) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s WARNING: %lu bytes are needed to cache all partially written chunks, limiting to %d\n",
+                driverName, functionName, (unsigned long)nbytes, HDF5_MAX_CHUNK_CACHE);
+      nbytes = HDF5_MAX_CHUNK_CACHE;
+    }
+    return nbytes;
+  }
   nbytes = this->maxdims[this->rank - 1] * this->maxdims[this->rank - 2] * this->bytesPerElement * n_frames_chunk;
   return nbytes;
 }
@@ -2538,13 +3534,26 @@ hsize_t NDFileHDF5::calcChunkCacheSlots()
   unsigned int long num_chunks = 1;
   double div_result = 0.0;
   epicsInt32 n_frames_chunk=0, n_extra_dims=0, n_frames_capture=0;
+  int chunkAutoTune = 0;
   
   this->lock();
   getIntegerParam(NDFileHDF5_nFramesChunks, &n_frames_chunk);
   getIntegerParam(NDFileHDF5_nExtraDims, &n_extra_dims);
   getIntegerParam(NDFileNumCapture, &n_frames_capture);
+  getIntegerParam(NDFileHDF5_chunkAutoTune, &chunkAutoTune);
   this->unlock();
 
+  if (chunkAutoTune) {
+    // About 100 slots for every chunk that fits in the cache keeps hash collisions rare
+    hsize_t chunkBytes = this->bytesPerElement;
+    for (int i = 0; i < this->rank; i++) chunkBytes *= this->chunkdims[i];
+    nslots = 100 * (unsigned long)(this->calcChunkCacheBytes() / chunkBytes);
+    if (nslots > HDF5_MAX_CHUNK_SLOTS) nslots = HDF5_MAX_CHUNK_SLOTS;
+    while(!IsPrime(nslots))
+      nslots++;
+    return nslots;
+  }
+
   div_result = (double)this->maxdims[this->rank - 1] / (double)this->chunkdims[this->rank -1];
   num_chunks *= (unsigned int long)ceil(div_result);
   div_result = (double)this->maxdims[this->rank - 2] / (double)this->chunkdims[this->rank -2];
@@ -2579,7 +3588,7 @@ asynStatus NDFileHDF5::configurePerformanceDataset()
     this->numPerformancePoints = numCaptureFrames;
     if (this->performanceBuf != NULL) {free(this->performanceBuf); this->performanceBuf = NULL;}
     if (this->performanceBuf == NULL)
-      this->performanceBuf = (epicsFloat64*)  calloc(5 * this->numPerformancePoints, sizeof(double));
+      this->performanceBuf = (epicsFloat64*)  calloc(HDF5_PERF_COLUMNS_ASYNC * this->numPerformancePoints, sizeof(double));
   }
   this->performancePtr  = this->performanceBuf;
 
@@ -2615,7 +3624,7 @@ asynStatus NDFileHDF5::createPerformanceDataset()
       }
     }
     dims[0] = 1;
-    dims[1] = 5;
+    dims[1] = this->numPerformanceColumns;
 
     if(perf_group == NULL)
     {
@@ -2640,7 +3649,7 @@ asynStatus NDFileHDF5::createPerformanceDataset()
     // Check the chunking value
     calculateAttributeChunking(&chunking, mdchunking);
     hid_t hdfcparm   = H5Pcreate(H5P_DATASET_CREATE);
-    hsize_t chunk[2] = {(hsize_t)chunking, 5};
+    hsize_t chunk[2] = {(hsize_t)chunking, (hsize_t)this->numPerformanceColumns};
     int hdfrank  = 2;
     H5Pset_chunk(hdfcparm, hdfrank, chunk);
 
@@ -2678,7 +3687,7 @@ asynStatus NDFileHDF5::writePerformanceDataset()
   this->lock();
   getIntegerParam(NDFileNumCaptured, &numCaptured);
   this->unlock();
-  dims[1] = 5;
+  dims[1] = this->numPerformanceColumns;
   if (numCaptured < this->numPerformancePoints) dims[0] = numCaptured;
   else dims[0] = this->numPerformancePoints;
 
@@ -2691,6 +3700,23 @@ asynStatus NDFileHDF5::writePerformanceDataset()
              H5S_ALL, H5S_ALL,
              H5P_DEFAULT, this->performanceBuf);
 
+    // The asynchronous writer also records the write latency of each frame;
+    // summarise it as percentiles in attributes of the dataset
+    if (this->numPerformanceColumns == HDF5_PERF_COLUMNS_ASYNC && dims[0] > 0){
+      std::vector<double> latency(dims[0]);
+      for (hsize_t i = 0; i < dims[0]; i++){
+        latency[i] = this->performanceBuf[i*HDF5_PERF_COLUMNS_ASYNC + HDF5_PERF_COLUMNS_ASYNC-1];
+      }
+      std::sort(latency.begin(), latency.end());
+      const char *names[] = {"write_latency_p50", "write_latency_p90", "write_latency_p99", "write_latency_max"};
+      const double fractions[] = {0.50, 0.90, 0.99, 1.0};
+      for (int i = 0; i < 4; i++){
+        std::ostringstream value;
+        value << latency[(size_t)(fractions[i] * (latency.size()-1) + 0.5)];
+        this->writeH5attrFloat64(this->perf_dataset_id, names[i], value.str());
+      }
+    }
+
     /* Close the second dataset */
     H5Dclose(this->perf_dataset_id);
   }
@@ -2919,8 +3945,11 @@ asynStatus NDFileHDF5::calculateAttributeChunking(int *chunking, int *mdim_chunk
 
 /** Write the NDArray attributes to the file
  *
+ * \param[in] numCaptured Value of NDFileNumCaptured for the frame being written, used to decide
+ *            whether to flush in SWMR mode. The writer thread passes the value captured when the
+ *            frame was queued; if it is negative the current value of the parameter is used.
  */
-asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets)
+asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets, int numCaptured)
 {
   asynStatus status = asynSuccess;
   NDAttribute *ndAttr = NULL;
@@ -2930,10 +3959,11 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positi
 
   // Check if we need to force a flush of the datasets
   if (checkForSWMRMode()){
-    int numCaptured = 0;
-    this->lock();
-    getIntegerParam(NDFileNumCaptured, &numCaptured);
-    this->unlock();
+    if (numCaptured < 0){
+      this->lock();
+      getIntegerParam(NDFileNumCaptured, &numCaptured);
+      this->unlock();
+    }
     int chunking = 0;
     int mdchunking[MAXEXTRADIMS];
     for (int index = 0; index < MAXEXTRADIMS; index++){
@@ -3214,6 +4244,7 @@ asynStatus NDFileHDF5::configureDims(NDArray *pArray)
   }
 
   this->rank = ndims;
+  this->extraRank = extradims;
   //asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
   //  "%s::%s initialising the basic frame dimension sizes. rank=%d\n",
   //  driverName, functionName, this->rank);
@@ -3240,6 +4271,7 @@ asynStatus NDFileHDF5::configureDims(NDArray *pArray)
   }
   int max_items = 0;
   int hdfdim = 0;
+  bool chunkingOverridden = false;
 
   // Loop over the number of user_chunking array elements
   for (i = 0; i<pArray->ndims; i++)
@@ -3253,10 +4285,26 @@ asynStatus NDFileHDF5::configureDims(NDArray *pArray)
       if (user_chunking[i] > max_items) user_chunking[i] = max_items;
     }
     if (chunkSizeAuto || (user_chunking[i] < 1)) user_chunking[i] = max_items;
+    // Arrays compressed in chunks by NDPluginCodec can only be written with direct chunk
+    // writes if the dataset chunks are the same as the codec chunks
+    if (pArray->codec.chunkRows > 0) {
+      int codecChunk = (i == pArray->ndims-1) ? (int)pArray->codec.chunkRows : max_items;
+      if (user_chunking[i] != codecChunk) chunkingOverridden = true;
+      user_chunking[i] = codecChunk;
+    }
     assert(hdfdim >= 0);
     this->chunkdims[hdfdim] = user_chunking[i];
     setIntegerParam(NDFileHDF5_chunkSize[i], user_chunking[i]);
   }
+  if (chunkingOverridden) {
+    char message[MAX_STRING_SIZE];
+    epicsSnprintf(message, sizeof(message), "Chunking set to codec ChunkRows=%d",
+                  (int)pArray->codec.chunkRows);
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+      "%s::%s %s, the requested chunk sizes were replaced\n",
+      driverName, functionName, message);
+    setStringParam(NDFileWriteMessage, message);
+  }
   int fileWriteMode = 0;
   getIntegerParam(NDFileWriteMode, &fileWriteMode);    
   // Add extra dimension if not in single mode
@@ -3270,6 +4318,13 @@ asynStatus NDFileHDF5::configureDims(NDArray *pArray)
     setIntegerParam(NDFileHDF5_nFramesChunks, nFramesChunks);
   }
 
+  // Arrays compressed by NDPluginCodec keep the chunks of the codec
+  int chunkAutoTune;
+  getIntegerParam(NDFileHDF5_chunkAutoTune, &chunkAutoTune);
+  if (chunkAutoTune && pArray->codec.empty()) {
+    this->autoTuneChunks(pArray, extradims);
+  }
+
   // Check flushing parameter, if it is less than nFramesChunks then make them match
   int nFramesChunk;
   getIntegerParam(NDFileHDF5_nFramesChunks, &nFramesChunk);
@@ -3306,6 +4361,7 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
   int bloscCompressor = 0;
   int bloscLevel = 0;
   int jpegQuality = 0;
+  int zstdLevel = 0;
   static const char * functionName = "configureCompression";
 
   this->lock();
@@ -3325,6 +4381,12 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
       setIntegerParam(NDFileHDF5_compressionType, HDF5CompressLZ4);
     } else if (pArray->codec.name == codecName[NDCODEC_JPEG]) {
       setIntegerParam(NDFileHDF5_compressionType, HDF5CompressJPEG);
+    } else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+      setIntegerParam(NDFileHDF5_compressionType, HDF5CompressZstd);
+      setIntegerParam(NDFileHDF5_zstdCompressLevel, pArray->codec.level);
+    } else if (pArray->codec.name == codecName[NDCODEC_BSZSTD]) {
+      setIntegerParam(NDFileHDF5_compressionType, HDF5CompressBshufZstd);
+      setIntegerParam(NDFileHDF5_zstdCompressLevel, pArray->codec.level);
     }
   }
   getIntegerParam(NDFileHDF5_compressionType, &compressionScheme);
@@ -3336,8 +4398,13 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
   getIntegerParam(NDFileHDF5_bloscCompressor, &bloscCompressor);
   getIntegerParam(NDFileHDF5_bloscCompressLevel, &bloscLevel);
   getIntegerParam(NDFileHDF5_jpegQuality, &jpegQuality);
+  getIntegerParam(NDFileHDF5_zstdCompressLevel, &zstdLevel);
   this->unlock();
 
+  // The level of a pre-compressed NDArray bypasses the check in writeInt32
+  if (zstdLevel < 1) zstdLevel = 1;
+  else if (zstdLevel > 22) zstdLevel = 22;
+
   // Clear the codec to (possibly) configure a new one
   this->codec.clear();
   switch (compressionScheme)
@@ -3400,7 +4467,7 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
     case HDF5CompressBshuf: {
         unsigned int cds[2];
         cds[0] = 0; /* bitshuffle selects the block size automatically */
-        cds[1] = 2; /* lz4 compression */
+        cds[1] = BSHUF_H5_COMPRESS_LZ4;
         int h5status = H5Pset_filter(this->cparms, FILTER_BSHUF, H5Z_FLAG_MANDATORY, 2, cds);
         if (h5status) {
           asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Failed to set h5 bitshuffle filter\n");
@@ -3421,6 +4488,39 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
         this->codec.name = codecName[NDCODEC_LZ4];
       }
       break;
+    case HDF5CompressZstd: {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s Setting zstd compression filter level=%d\n",
+                  driverName, functionName, zstdLevel);
+        unsigned int cds[1];
+        cds[0] = zstdLevel;
+        int h5status = H5Pset_filter(this->cparms, FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, cds);
+        if (h5status) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Failed to set h5 zstd filter\n");
+          break;
+        }
+        this->codec.name = codecName[NDCODEC_ZSTD];
+        this->codec.level = zstdLevel;
+      }
+      break;
+    case HDF5CompressBshufZstd: {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s Setting bitshuffle/zstd compression filter level=%d\n",
+                  driverName, functionName, zstdLevel);
+        /* 0 to 2 (inclusive) param slots are reserved. */
+        unsigned int cds[6] = {0};
+        cds[3] = 0; /* bitshuffle selects the block size automatically */
+        cds[4] = BSHUF_H5_COMPRESS_ZSTD;
+        cds[5] = zstdLevel;
+        int h5status = H5Pset_filter(this->cparms, FILTER_BSHUF, H5Z_FLAG_MANDATORY, 6, cds);
+        if (h5status) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Failed to set h5 bitshuffle/zstd filter\n");
+          break;
+        }
+        this->codec.name = codecName[NDCODEC_BSZSTD];
+        this->codec.level = zstdLevel;
+      }
+      break;
     case HDF5CompressJPEG: {
         unsigned int cds[4];
         int colorMode = NDColorModeMono;
@@ -3602,7 +4702,7 @@ void NDFileHDF5::checkForOpenFile()
    * It would be nice if NDPluginFile class would accept an asynError returned from
    * this method and not increment the filecounter and name... However, for now we just
    * close the file that is open and open a new one. */
-  if (this->file != 0){
+  if (this->file != 0 || this->rrNumWriters > 0){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
               "%s::%s file is already open. Closing it and opening new one.\n", 
               driverName, functionName);
@@ -3640,25 +4740,25 @@ bool NDFileHDF5::checkForSWMRSupported()
   return SWMRSupported;
 }
 
-/** Add the default attributes from NDArrays into the local NDAttribute list.
+/** Add the default attributes from NDArrays into a local NDAttribute list.
  *
  * The relevant attributes are: uniqueId, timeStamp, epicsTS.secPastEpoch and
  * epicsTS.nsec.
  */
-void NDFileHDF5::addDefaultAttributes(NDArray *pArray)
-{
-  this->pFileAttributes->add("NDArrayUniqueId",
-                             "The unique ID of the NDArray",
-                             NDAttrInt32, (void*)&(pArray->uniqueId));
-  this->pFileAttributes->add("NDArrayTimeStamp",
-                             "The timestamp of the NDArray as float64",
-                             NDAttrFloat64, (void*)&(pArray->timeStamp));
-  this->pFileAttributes->add("NDArrayEpicsTSSec",
-                             "The NDArray EPICS timestamp seconds past epoch",
-                             NDAttrUInt32, (void*)&(pArray->epicsTS.secPastEpoch));
-  this->pFileAttributes->add("NDArrayEpicsTSnSec",
-                             "The NDArray EPICS timestamp nanoseconds",
-                             NDAttrUInt32, (void*)&(pArray->epicsTS.nsec));
+void NDFileHDF5::addDefaultAttributes(NDArray *pArray, NDAttributeList *pList)
+{
+  pList->add("NDArrayUniqueId",
+             "The unique ID of the NDArray",
+             NDAttrInt32, (void*)&(pArray->uniqueId));
+  pList->add("NDArrayTimeStamp",
+             "The timestamp of the NDArray as float64",
+             NDAttrFloat64, (void*)&(pArray->timeStamp));
+  pList->add("NDArrayEpicsTSSec",
+             "The NDArray EPICS timestamp seconds past epoch",
+             NDAttrUInt32, (void*)&(pArray->epicsTS.secPastEpoch));
+  pList->add("NDArrayEpicsTSnSec",
+             "The NDArray EPICS timestamp nanoseconds",
+             NDAttrUInt32, (void*)&(pArray->epicsTS.nsec));
 }
 
 /** Helper function to create a comma separated list of integers in a string
@@ -3744,6 +4844,7 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   int tempAlign = 0;
   int tempThreshold = 0;
   int SWMRMode = 0;
+  int directIO = 0;
   static const char *functionName = "createNewFile";
 
   this->lock();
@@ -3751,6 +4852,7 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   getIntegerParam(NDFileHDF5_chunkBoundaryThreshold, (int*)&tempThreshold);
   // Check if we are in SWMR mode
   getIntegerParam(NDFileHDF5_SWMRMode, &SWMRMode);
+  getIntegerParam(NDFileHDF5_directIO, &directIO);
   this->unlock();
 
   /* File access property list: set the alignment boundary to a user defined block size
@@ -3765,6 +4867,43 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   if (tempThreshold > 0){
     threshold = tempThreshold;
   }
+
+  /* Direct I/O: write with O_DIRECT through the direct file driver so that the data
+   * bypasses the page cache. Objects must then start on disk block boundaries, so
+   * alignment is switched on if the user has not set it, and a user alignment is
+   * rounded up to a multiple of the block size. */
+  if (directIO == 1){
+#ifdef H5_HAVE_DIRECT
+    if (align % DIRECT_IO_BLOCK_SIZE != 0){
+      align = (align / DIRECT_IO_BLOCK_SIZE + 1) * DIRECT_IO_BLOCK_SIZE;
+      if (tempAlign > 0){
+        this->lock();
+        setIntegerParam(NDFileHDF5_chunkBoundaryAlign, (int)align);
+        this->unlock();
+      }
+    }
+    if (align == 0){
+      align = DIRECT_IO_BLOCK_SIZE;
+    }
+    hdfstatus = H5Pset_fapl_direct(access_plist, (size_t)align, (size_t)align, DIRECT_IO_COPY_BUFFER_SIZE);
+    if (hdfstatus < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+          "%s::%s Warning: failed to select the direct file driver with alignment=%llu bytes\n",
+          driverName, functionName, align);
+      this->lock();
+      setIntegerParam(NDFileHDF5_directIO, 0);
+      this->unlock();
+    }
+#else
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s Warning: direct I/O requested but the HDF5 library was built without the direct file driver\n",
+        driverName, functionName);
+    this->lock();
+    setIntegerParam(NDFileHDF5_directIO, 0);
+    this->unlock();
+#endif
+  }
+
   if (align > 0){
     hdfstatus = H5Pset_alignment( access_plist, threshold, align );
     if (hdfstatus < 0){
@@ -3880,6 +5019,29 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
   H5Pset_fill_value(this->cparms, this->datatype, this->ptrFillValue );
   
 
+  if (this->loadXMLLayout()){
+    return asynError;
+  }
+
+  // Append the default NDArray attributes to the detector datasets
+  if (this->writeDefaultDatasetAttributes(pArray)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s WARNING Failed write default NDArray attributes to detector datasets\n",
+                driverName, functionName);
+      return asynError;
+  }
+
+  asynStatus ret = this->createXMLFileLayout();
+  return ret;
+}
+
+/** Load the XML layout named by the layout filename parameter, or the default layout if
+ * it is empty.
+ */
+asynStatus NDFileHDF5::loadXMLLayout()
+{
+  static const char *functionName = "loadXMLLayout";
+
   //We use MAX_LAYOUT_LEN instead of MAX_FILENAME_LEN because we want to be able to load
   // in an xml string or a file containing the xml
   char *layoutFile = new char[MAX_LAYOUT_LEN];
@@ -3925,17 +5087,7 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
     }
   }
   delete [] layoutFile;
-
-  // Append the default NDArray attributes to the detector datasets
-  if (this->writeDefaultDatasetAttributes(pArray)) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
-                "%s::%s WARNING Failed write default NDArray attributes to detector datasets\n",
-                driverName, functionName);
-      return asynError;
-  }
-
-  asynStatus ret = this->createXMLFileLayout();
-  return ret;
+  return asynSuccess;
 }
 
 int NDFileHDF5::isAttributeIndex(const std::string& attName)
@@ -8,6 +8,10 @@
 #define NDFileHDF5_H
 
 #include <list>
+#include <deque>
+#include <vector>
+#include <string>
+#include <utility>
 #include <hdf5.h>
 #include <asynDriver.h>
 #include <NDPluginFile.h>
@@ -44,6 +48,7 @@
 #define str_NDFileHDF5_bloscCompressor   "HDF5_bloscCompressor"
 #define str_NDFileHDF5_bloscCompressLevel "HDF5_bloscCompressLevel"
 #define str_NDFileHDF5_jpegQuality       "HDF5_jpegQuality"
+#define str_NDFileHDF5_zstdCompressLevel "HDF5_zstdCompressLevel"
 #define str_NDFileHDF5_dimAttDatasets    "HDF5_dimAttDatasets"
 #define str_NDFileHDF5_layoutErrorMsg    "HDF5_layoutErrorMsg"
 #define str_NDFileHDF5_layoutValid       "HDF5_layoutValid"
@@ -61,6 +66,43 @@
 #define str_NDFileHDF5_SWMRSupported     "HDF5_SWMRSupported"
 #define str_NDFileHDF5_SWMRMode          "HDF5_SWMRMode"
 #define str_NDFileHDF5_SWMRRunning       "HDF5_SWMRRunning"
+#define str_NDFileHDF5_asyncWrite        "HDF5_asyncWrite"
+#define str_NDFileHDF5_asyncQueueSize    "HDF5_asyncQueueSize"
+#define str_NDFileHDF5_asyncQueueDepth   "HDF5_asyncQueueDepth"
+#define str_NDFileHDF5_directIO          "HDF5_directIO"
+#define str_NDFileHDF5_chunkAutoTune     "HDF5_chunkAutoTune"
+#define str_NDFileHDF5_chunkTargetBytes  "HDF5_chunkTargetBytes"
+#define str_NDFileHDF5_chunkCacheBytes   "HDF5_chunkCacheBytes"
+#define str_NDFileHDF5_chunkRewrites     "HDF5_chunkRewrites"
+#define str_NDFileHDF5_numWriters        "HDF5_numWriters"
+
+/** Number of columns in the performance dataset, and the number when the asynchronous writer is
+  * used, which adds the write queue depth and the write latency of each frame */
+#define HDF5_PERF_COLUMNS        5
+#define HDF5_PERF_COLUMNS_ASYNC  7
+
+/** Largest chunk cache that chunk auto-tuning gives a detector dataset, in bytes */
+#define HDF5_MAX_CHUNK_CACHE     (1024*1024*1024)
+/** Largest number of chunk cache hash table slots that chunk auto-tuning uses */
+#define HDF5_MAX_CHUNK_SLOTS     1000000
+
+/** A frame queued for the asynchronous writer thread. Everything the writer needs is captured
+  * when the frame is queued, so that the plugin thread can go on to prepare the next frame.
+  */
+typedef struct {
+  NDArray *pArray;              /**< The array to write; reserved until it has been written */
+  NDFileHDF5Dataset *pDataset;  /**< The destination dataset */
+  hsize_t dims[ND_ARRAY_MAX_DIMS + MAXEXTRADIMS];   /**< Dataset dimensions including this frame */
+  hsize_t offset[ND_ARRAY_MAX_DIMS + MAXEXTRADIMS]; /**< Position of this frame in the dataset */
+  NDAttributeList *pAttributes; /**< Attribute values for this frame, NULL if attributes are not written */
+  int positionMode;             /**< Position mode passed to writeAttributeDataset */
+  hsize_t offsets[MAXEXTRADIMS];/**< Positional offsets passed to writeAttributeDataset */
+  int numCaptured;              /**< Value of NDFileNumCaptured for this frame */
+  int storePerformance;         /**< Whether to record performance data for this frame */
+  int flush;                    /**< SWMR flush period in frames */
+  int queueDepth;               /**< Number of frames ahead of this one when it was queued */
+  epicsTimeStamp queuedts;      /**< Time the frame was queued */
+} NDFileHDF5WriteRequest_t;
 
 /** Writes NDArrays in the HDF5 file format; an XML file can control the structure of the HDF5 file.
   */
@@ -77,6 +119,7 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     NDFileHDF5(const char *portName, int queueSize, int blockingCallbacks, 
                const char *NDArrayPort, int NDArrayAddr,
                int priority, int stackSize);
+    virtual ~NDFileHDF5();
        
     /* The methods that this class implements */
     virtual asynStatus openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray);
@@ -88,6 +131,7 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
 
     void flushTask();
+    void writeTask();
     asynStatus startSWMR();
     asynStatus flushCallback();
     asynStatus createXMLFileLayout();
@@ -158,6 +202,7 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_bloscCompressLevel;
     int NDFileHDF5_bloscShuffleType;
     int NDFileHDF5_jpegQuality;
+    int NDFileHDF5_zstdCompressLevel;
     int NDFileHDF5_dimAttDatasets;
     int NDFileHDF5_layoutErrorMsg;
     int NDFileHDF5_layoutValid;
@@ -171,6 +216,15 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_SWMRSupported;
     int NDFileHDF5_SWMRMode;
     int NDFileHDF5_SWMRRunning;
+    int NDFileHDF5_asyncWrite;
+    int NDFileHDF5_asyncQueueSize;
+    int NDFileHDF5_asyncQueueDepth;
+    int NDFileHDF5_directIO;
+    int NDFileHDF5_chunkAutoTune;
+    int NDFileHDF5_chunkTargetBytes;
+    int NDFileHDF5_chunkCacheBytes;
+    int NDFileHDF5_chunkRewrites;
+    int NDFileHDF5_numWriters;
 
     asynStatus configureDims(NDArray *pArray);
     void calcNumFrames();
@@ -199,7 +253,13 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     char* getDimsReport();
     asynStatus writeStringAttribute(hid_t element, const char* attrName, const char* attrStrValue);
     asynStatus calculateAttributeChunking(int *chunking, int *mdim_chunking);
-    asynStatus writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets);
+    asynStatus writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets, int numCaptured=-1);
+    void storePerformancePoint(epicsTimeStamp *startts, epicsInt32 numCaptured, int queueDepth, double latency);
+    void closeFileOnError();
+    asynStatus queueWrite(NDFileHDF5WriteRequest_t *pRequest);
+    void writeQueued(NDFileHDF5WriteRequest_t *pRequest);
+    void drainWriteQueue();
+    void setQueueDepth(int depth);
     asynStatus closeAttributeDataset();
     asynStatus configurePerformanceDataset();
     asynStatus createPerformanceDataset();
@@ -207,17 +267,28 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     unsigned int calcIstorek();
     hsize_t calcChunkCacheBytes();
     hsize_t calcChunkCacheSlots();
+    hsize_t calcOpenChunks();
+    void autoTuneChunks(NDArray *pArray, int extradims);
+    void checkChunkRewrites(NDFileHDF5Dataset *pDataset);
 
     void checkForOpenFile();
     bool checkForSWMRMode();
     bool checkForSWMRSupported();
-    void addDefaultAttributes(NDArray *pArray);
+    void addDefaultAttributes(NDArray *pArray, NDAttributeList *pList);
     asynStatus writeDefaultDatasetAttributes(NDArray *pArray);
     asynStatus createNewFile(const char *fileName);
     asynStatus createFileLayout(NDArray *pArray);
+    asynStatus loadXMLLayout();
     asynStatus createAttributeDataset(NDArray *pArray);
     int isAttributeIndex(const std::string& attName);
     epicsInt32 findPositionIndex(NDArray *pArray, char *posName);
+    asynStatus openRoundRobin(const char *fileName, NDArray *pArray, int numWriters);
+    asynStatus writeRoundRobin(NDArray *pArray);
+    asynStatus closeRoundRobin();
+    void copyRoundRobinParams(NDFileHDF5 *pWriter, int numCapture);
+    void collectRoundRobinLayout(hdf5::Group *group);
+    asynStatus createRoundRobinMaster();
+    asynStatus createVirtualDataset(hid_t master, std::vector<hid_t>& sources, const std::string& name);
 
 
     hdf5::LayoutXML layout;
@@ -238,6 +309,7 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     double *performanceBuf;
     double *performancePtr;
     epicsInt32 numPerformancePoints;
+    int numPerformanceColumns;
     epicsTimeStamp prevts;
     epicsTimeStamp opents;
     epicsTimeStamp firstFrame;
@@ -248,8 +320,31 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     epicsEventId flushEventId;
     epicsMutex flushLock;
 
+    /* Asynchronous writer. The queue, the pending count and the write status are protected by writeQueueLock. */
+    bool asyncWriteActive;      /** < Asynchronous writing is used for the file that is open */
+    int asyncQueueSize;         /** < Maximum number of frames queued or being written */
+    asynStatus asyncWriteStatus;/** < Status of the last write done by the writer thread */
+    int writesPending;          /** < Number of frames queued or being written */
+    std::deque<NDFileHDF5WriteRequest_t *> writeQueue;
+    epicsMutex writeQueueLock;
+    epicsEventId writeEventId;     /** < Signalled when a frame is queued */
+    epicsEventId writeDoneEventId; /** < Signalled when a frame has been written */
+
     std::list<NDFileHDF5AttributeDataset*> attrList;
 
+    /* Round-robin writers. When more than one writer is configured the frames of a multi-frame
+     * file are spread over internal NDFileHDF5 instances which each write their own file, and a
+     * master file with virtual datasets is created when the file is closed. */
+    std::vector<NDFileHDF5 *> rrWriters;   /** < The writers, created when they are first needed and deleted with this plugin */
+    int rrNumWriters;                      /** < Number of writers used for the open file, 0 if round-robin is not used */
+    std::string rrMasterName;              /** < Name of the master file */
+    std::vector<std::string> rrFileNames;  /** < Name of the file written by each writer */
+    std::vector<hsize_t> rrFrames;         /** < Number of frames written by each writer */
+    hsize_t rrNumFrames;                   /** < Total number of frames written */
+    std::vector<std::string> rrGroups;     /** < Groups of the file layout, parents before children */
+    std::vector<std::pair<std::string, bool> > rrDatasets;         /** < Datasets and whether they hold a value per frame */
+    std::vector<std::pair<std::string, std::string> > rrHardLinks; /** < Hard links and their targets */
+
     /* HDF5 handles and references */
     hid_t file;
     hid_t dataspace;
@@ -261,6 +356,8 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     /* dimension descriptors */
     int rank;               /** < number of dimensions */
     int nvirtual;           /** < number of extra virtual dimensions */
+    int extraRank;          /** < number of dimensions in addition to the frame dimensions */
+    unsigned long chunkRewrites; /** < Number of detector dataset chunks rewritten in the open file */
     hsize_t *dims;          /** < Array of current dimension sizes. This updates as various dimensions grow. */
     hsize_t *maxdims;       /** < Array of maximum dimension sizes. The value -1 is HDF5 term for infinite. */
     hsize_t *chunkdims;     /** < Array of chunk size in each dimension. Only the dimensions that indicate the frame size (width, height) can really be tweaked. All other dimensions should be set to 1. */
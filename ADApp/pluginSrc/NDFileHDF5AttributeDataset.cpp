@@ -12,6 +12,8 @@
 #include <epicsMath.h>
 
 #define MAX_ATTRIBUTE_STRING_SIZE 256
+// Largest buffer of values kept in memory for a 1D attribute dataset
+#define MAX_ATTRIBUTE_BUFFER_SIZE (1024*1024)
 
 NDFileHDF5AttributeDataset::NDFileHDF5AttributeDataset(hid_t file, const std::string& name, NDAttrDataType_t type) :
   name_(name),
@@ -35,7 +37,12 @@ NDFileHDF5AttributeDataset::NDFileHDF5AttributeDataset(hid_t file, const std::st
   rank_(0),
   nextRecord_(0),
   extraDimensions_(0),
-  whenToSave_(hdf5::OnFrame)
+  whenToSave_(hdf5::OnFrame),
+  buffer_(NULL),
+  bufferSize_(0),
+  bufferCount_(0),
+  bufferOffset_(0),
+  elementBytes_(0)
 {
   //printf("Constructor called for %s\n", name.c_str());
   // Allocate enough memory for the fill value to accept any data type
@@ -52,6 +59,7 @@ NDFileHDF5AttributeDataset::~NDFileHDF5AttributeDataset()
   if (this->dims_        != NULL) free(this->dims_);
   if (this->offset_      != NULL) free(this->offset_);
   if (this->elementSize_ != NULL) free(this->elementSize_);
+  if (this->buffer_      != NULL) free(this->buffer_);
 }
 
 void NDFileHDF5AttributeDataset::setDsetName(const std::string& dsetName)
@@ -79,6 +87,16 @@ asynStatus NDFileHDF5AttributeDataset::createDataset(int user_chunking)
 
   status = createHDF5Dataset();
 
+  // Values of 1D datasets are collected in memory and written a chunk at a time
+  // rather than one element per frame
+  elementBytes_ = H5Tget_size(datatype_);
+  bufferSize_ = chunk_[0];
+  if (bufferSize_ * elementBytes_ > MAX_ATTRIBUTE_BUFFER_SIZE) bufferSize_ = MAX_ATTRIBUTE_BUFFER_SIZE / elementBytes_;
+  if (bufferSize_ < 1) bufferSize_ = 1;
+  if (buffer_ != NULL) free(buffer_);
+  buffer_ = (char *)calloc(bufferSize_, elementBytes_);
+  bufferCount_ = 0;
+
   return status;
 }
 
@@ -146,6 +164,23 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
     if (ret == ND_ERROR) {
       memset(pDatavalue, 0, MAX_ATTRIBUTE_STRING_SIZE);
     }
+
+    if (buffer_ != NULL) {
+      // Add the value to the buffer, and write the buffer out when it is full, on a chunk
+      // boundary, when a flush is requested or for values that are not written per frame
+      if (bufferCount_ == 0) bufferOffset_ = offset_[0];
+      memcpy(buffer_ + bufferCount_ * elementBytes_, pDatavalue, elementBytes_);
+      bufferCount_++;
+      if (flush == 1) {
+        status = this->flushDataset();
+      } else if (bufferCount_ == bufferSize_ || (chunk_[0] > 0 && (offset_[0] + 1) % chunk_[0] == 0) ||
+                 whenToSave != hdf5::OnFrame) {
+        status = this->writeBuffer();
+      }
+      nextRecord_++;
+      return status;
+    }
+
     // Work with HDF5 library to select a suitable hyperslab (one element) and write the new data to it
     H5Dset_extent(dataset_, dims_);
     filespace_ = H5Dget_space(dataset_);
@@ -212,9 +247,41 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
   return status;
 }
 
+/** Write the buffered values of a 1D dataset to the file with a single hyperslab write.
+ */
+asynStatus NDFileHDF5AttributeDataset::writeBuffer()
+{
+  asynStatus status = asynSuccess;
+  hsize_t start[2] = {0, 0};
+  hsize_t count[2] = {1, 1};
+  hid_t blockspace;
+
+  if (bufferCount_ == 0) return status;
+
+  H5Dset_extent(dataset_, dims_);
+
+  // Write the data to the hyperslab if data is defined
+  if (!isUndefined_) {
+    start[0] = bufferOffset_;
+    count[0] = bufferCount_;
+    filespace_ = H5Dget_space(dataset_);
+    H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, start, NULL, count, NULL);
+    blockspace = H5Screate_simple(rank_, count, NULL);
+    if (H5Dwrite(dataset_, datatype_, blockspace, filespace_, H5P_DEFAULT, buffer_) < 0) {
+      status = asynError;
+    }
+    H5Sclose(blockspace);
+    H5Sclose(filespace_);
+  }
+  bufferCount_ = 0;
+
+  return status;
+}
+
 asynStatus NDFileHDF5AttributeDataset::closeAttributeDataset()
 {
   //printf("close called for %s\n", name_.c_str());
+  this->writeBuffer();
   H5Dclose(dataset_);
   H5Sclose(memspace_);
   H5Sclose(dataspace_);
@@ -464,10 +531,18 @@ hid_t NDFileHDF5AttributeDataset::getHandle()
   return dataset_;
 }
 
+hdf5::When_t NDFileHDF5AttributeDataset::getWhenToSave()
+{
+  return whenToSave_;
+}
+
 asynStatus NDFileHDF5AttributeDataset::flushDataset()
 {
   asynStatus status = asynSuccess;
 
+  // Write out any buffered values first
+  status = this->writeBuffer();
+
   // We cannot flush for SWMR if the HDF version doesn't support it
   #if H5_VERSION_GE(1,9,178)
 
@@ -33,6 +33,7 @@ public:
   asynStatus flushDataset();
   std::string getName();
   hid_t getHandle();
+  hdf5::When_t getWhenToSave();
 
 private:
   asynStatus createHDF5Dataset();
@@ -42,6 +43,7 @@ private:
   void extendDataSet();
   void extendDataSet(hsize_t *offsets);
   void extendIndexDataSet(hsize_t offset);
+  asynStatus writeBuffer();
 
   std::string      name_;            // Name of the attribute
   std::string      dsetName_;        // Name of the dataset to store
@@ -66,6 +68,11 @@ private:
   int              nextRecord_;
   int              extraDimensions_;
   hdf5::When_t     whenToSave_;
+  char             *buffer_;         // Values not yet written to a 1D dataset
+  size_t           bufferSize_;      // Capacity of buffer_ in elements
+  size_t           bufferCount_;     // Number of values in buffer_
+  hsize_t          bufferOffset_;    // Offset in the dataset of the first value in buffer_
+  size_t           elementBytes_;    // Size of one value in the file datatype
 
 };
 
@@ -1,11 +1,10 @@
 #include "NDFileHDF5Dataset.h"
 #include <iostream>
 #include <stdlib.h>
-#include <osiSock.h>
+#include "NDPluginCodec.h"
 
 #include <hdf5_hl.h>
 
-#define htonll(x) ( ( (uint64_t)(htonl( (uint32_t)((x << 32) >> 32)))<< 32) | htonl( ((uint32_t)(x >> 32)) ))
 
 static const char *fileName = "NDFileHDF5Dataset";
 
@@ -15,7 +14,9 @@ static const char *fileName = "NDFileHDF5Dataset";
  * \param[in] dataset - HDF5 handle to the dataset.
  */
 NDFileHDF5Dataset::NDFileHDF5Dataset(asynUser *pAsynUser, const std::string& name, hid_t dataset) : 
-                                     pAsynUser_(pAsynUser), name_(name), dataset_(dataset), nextRecord_(0)
+                                     pAsynUser_(pAsynUser), name_(name), dataset_(dataset), nextRecord_(0),
+                                     chunkModel_(false), chunkBytes_(0), chunksPerFrame_(1), framesPerChunk_(1),
+                                     cacheBytes_(0), maxOpenChunks_(0), chunkRewrites_(0)
 {
   this->maxdims_     = NULL;
   this->dims_        = NULL;
@@ -202,9 +203,14 @@ asynStatus NDFileHDF5Dataset::verifyChunking(NDArray *pArray)
       mismatch = true;
     }
   }
-  // Remaining dimensions must match chunk definition
+  // Remaining dimensions must match chunk definition.  Arrays compressed in chunks
+  // must have one dataset chunk per compressed chunk.
   for (int index = 0; index < pArray->ndims; index++) {
-    if (pArray->dims[index].size != this->chunkdims_[index]) {
+    size_t chunkSize = pArray->dims[index].size;
+    if (index == pArray->ndims-1 && pArray->codec.chunkRows > 0) {
+      chunkSize = pArray->codec.chunkRows;
+    }
+    if (chunkSize != this->chunkdims_[index]) {
       mismatch = true;
     }
   }
@@ -235,6 +241,48 @@ void NDFileHDF5Dataset::configureCompression(Codec_t codec)
   this->codec = codec;
 }
 
+/** writeChunk.
+ * Write one chunk of data with a direct chunk write, adding the header that the
+ * HDF5 filter expects in front of data compressed by NDPluginCodec.
+ * If NDPluginCodec reserved codec.headerRoom bytes in front of the data it has
+ * already written the header there, otherwise the data is copied behind a new
+ * header. The array is not changed, other plugins may be using it.
+ * \param[in] pArray - The NDArray the data belongs to.
+ * \param[in] offset - The offset of the chunk in the dataset.
+ * \param[in] pData - The data of the chunk.
+ * \param[in] size - The size of the data in bytes.
+ * \param[in] uncompressedSize - The size of the chunk in bytes when uncompressed.
+ */
+herr_t NDFileHDF5Dataset::writeChunk(NDArray *pArray, hsize_t *offset, void *pData, size_t size, size_t uncompressedSize)
+{
+    herr_t hdfstatus;
+    size_t headerSize = filterHeaderSize(pArray->codec.name);
+    char *temp=0;
+
+    if (headerSize > 0) {
+        if (pArray->codec.headerRoom >= headerSize) {
+            pData = (char *)pData - headerSize;
+        } else {
+            temp = (char *)malloc(headerSize + size);
+            writeFilterHeader(pArray->codec.name, temp, uncompressedSize, size);
+            memcpy(temp+headerSize, pData, size);
+            pData = temp;
+        }
+        size += headerSize;
+    }
+    #if H5_VERSION_GE(1, 10, 3)
+    hdfstatus = H5Dwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
+                               offset, size, pData);
+    #else  // Use deprecated method
+    hdfstatus = H5DOwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
+                                offset, size, pData);
+    #endif
+    if (temp) {
+        free(temp);
+    }
+    return hdfstatus;
+}
+
 /** writeFile.
  * Write the data using the HDF5 library calls.
  * \param[in] pArray - The NDArray containing the data to write.
@@ -243,6 +291,23 @@ void NDFileHDF5Dataset::configureCompression(Codec_t codec)
  * \param[in] framesize - The size of the data to write.
  */
 asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize)
+{
+  return this->writeFile(pArray, datatype, dataspace, framesize, this->dims_, this->offset_);
+}
+
+/**
+ * Write the data at a position that was captured earlier with getPosition.
+ * This is used by the asynchronous writer, where the dataset may already have been
+ * extended for the frames that are queued behind this one.
+ * \param[in] pArray - The NDArray containing the data to write.
+ * \param[in] datatype - The HDF5 datatype of the data.
+ * \param[in] dataspace - A handle to the HDF5 dataspace for this dataset.
+ * \param[in] framesize - The size of the data to write.
+ * \param[in] dims - The dimensions of the dataset once this frame has been written.
+ * \param[in] offset - The offset of this frame in the dataset.
+ */
+asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize,
+                                        hsize_t *dims, hsize_t *offset)
 {
   herr_t hdfstatus;
   static const char *functionName = "writeFile";
@@ -250,9 +315,9 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
   // Increase the size of the dataset
   asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
             "%s::%s: set_extent dims={%d,%d,%d}\n",
-            fileName, functionName, (int)this->dims_[0], (int)this->dims_[1], (int)this->dims_[2]);
+            fileName, functionName, (int)dims[0], (int)dims[1], (int)dims[2]);
 
-  hdfstatus = H5Dset_extent(this->dataset_, this->dims_);
+  hdfstatus = H5Dset_extent(this->dataset_, dims);
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
               "%s::%s ERROR Increasing the size of the dataset [%s] failed\n", 
@@ -267,7 +332,7 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
               fileName, functionName, this->name_.c_str());
     return asynError;
   }
-  hdfstatus = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, this->offset_, NULL, framesize, NULL);
+  hdfstatus = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, offset, NULL, framesize, NULL);
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
               "%s::%s ERROR Unable to select hyperslab\n", 
@@ -282,54 +347,27 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
     asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
               "%s::%s NDArray correctly chunked. Using direct chunk write\n",
               fileName, functionName);
-    size_t size = pArray->compressedSize;
-    void *pData = pArray->pData;
-    char *temp=0;
     NDArrayInfo_t info;
     pArray->getInfo(&info);
-    if (pArray->codec.empty()) {
-        size = info.totalBytes;
-    }
-    else if (pArray->codec.name == codecName[NDCODEC_LZ4]) {
-        // We need to add a 16-byte header to the lz4 compressed data
-        temp = (char *)malloc(16 + size);
-        // First 8 bytes is the uncompressed array size
-        unsigned long long ui64 = htonll(info.totalBytes);
-        memcpy(temp, &ui64, 8);
-        // Next 4 bytes is the block size = uncompressed size as long as < 1GB which we assume here
-        epicsUInt32 ui32 = htonl((int)info.totalBytes);
-        memcpy(temp+8, &ui32, 4);
-        // Next 4 bytes is the compressed size
-        ui32 = htonl((int)size);
-        memcpy(temp+12, &ui32, 4);
-        // Now copy the data
-        memcpy(temp+16, pArray->pData, size);
-        pData = temp;
-        size += 16;
-    }
-    else if (pArray->codec.name == codecName[NDCODEC_BSLZ4]) {
-        // We need to add a 12-byte header to the bs/lz4 compressed data
-        temp = (char *)malloc(12 + size);
-        // First 8 bytes is the uncompressed array size
-        unsigned long long ui64 = htonll(info.totalBytes);
-        memcpy(temp, &ui64, 8);
-        // Next 4 bytes is the block size * elem_size;  8192 is the default in bitshuffle
-        epicsUInt32 ui32 = htonl(8192);
-        memcpy(temp+8, &ui32, 4);
-        // Now copy the data
-        memcpy(temp+12, pArray->pData, size);
-        pData = temp;
-        size += 12;
-    }
-    #if H5_VERSION_GE(1, 10, 3)
-    hdfstatus = H5Dwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
-                               this->offset_, size, pData);
-    #else  // Use deprecated method
-    hdfstatus = H5DOwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
-                                this->offset_, size, pData);
-    #endif
-    if (temp) {
-        free(temp);
+    if (pArray->codec.chunkRows > 0) {
+      // One direct chunk write for each chunk compressed by NDPluginCodec
+      size_t chunkBytes = info.totalBytes / pArray->dims[pArray->ndims-1].size * pArray->codec.chunkRows;
+      hsize_t *chunkOffset = (hsize_t *)calloc(this->rank_, sizeof(hsize_t));
+      char *pData = (char *)pArray->pData;
+      memcpy(chunkOffset, offset, this->rank_ * sizeof(hsize_t));
+      hdfstatus = 0;
+      for (size_t i = 0; i < pArray->codec.chunkSizes.size() && !hdfstatus; i++) {
+        chunkOffset[this->extra_rank_] = offset[this->extra_rank_] + i * pArray->codec.chunkRows;
+        pData += pArray->codec.headerRoom;
+        hdfstatus = writeChunk(pArray, chunkOffset, pData, pArray->codec.chunkSizes[i], chunkBytes);
+        pData += pArray->codec.chunkSizes[i];
+      }
+      free(chunkOffset);
+    } else if (pArray->codec.empty()) {
+      hdfstatus = writeChunk(pArray, offset, pArray->pData, info.totalBytes, info.totalBytes);
+    } else {
+      hdfstatus = writeChunk(pArray, offset, (char *)pArray->pData + pArray->codec.headerRoom,
+                             pArray->compressedSize - pArray->codec.headerRoom, info.totalBytes);
     }
   } else {
     // Either direct chunk write is not available, or we need to use the HDF5 pipeline for
@@ -346,6 +384,7 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
               "%s::%s NDArray not correctly chunked. Using standard write\n",
               fileName, functionName);
     hdfstatus = H5Dwrite(this->dataset_, datatype, dataspace, fspace, H5P_DEFAULT, pArray->pData);
+    if (!hdfstatus) this->countChunkRewrites(offset);
   }
 
   if (hdfstatus){
@@ -369,6 +408,23 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
   return asynSuccess;
 }
 
+/** Copy the current dimensions and offset of the dataset, as set by the last call to extendDataSet.
+ * \param[out] dims - Array of at least getRank() elements to receive the dimensions.
+ * \param[out] offset - Array of at least getRank() elements to receive the offset.
+ */
+void NDFileHDF5Dataset::getPosition(hsize_t *dims, hsize_t *offset)
+{
+  memcpy(dims, this->dims_, this->rank_ * sizeof(hsize_t));
+  memcpy(offset, this->offset_, this->rank_ * sizeof(hsize_t));
+}
+
+/** Return the number of dimensions of the dataset.
+ */
+int NDFileHDF5Dataset::getRank()
+{
+  return this->rank_;
+}
+
 /** getHandle.
  * Returns the HDF5 handle to this dataset.
  */
@@ -458,3 +514,157 @@ hsize_t NDFileHDF5Dataset::getVirtualDim(int index)
 }
 
 
+
+/** Initialise the chunk cache model from the chunking and chunk cache of the dataset.
+  */
+void NDFileHDF5Dataset::initChunkModel()
+{
+  int i;
+  this->chunkModel_ = true;
+  hid_t cparms = H5Dget_create_plist(this->dataset_);
+  if (cparms < 0) return;
+  if (H5Pget_layout(cparms) == H5D_CHUNKED) {
+    this->chunkDims_.resize(this->rank_);
+    H5Pget_chunk(cparms, this->rank_, &this->chunkDims_[0]);
+  }
+  H5Pclose(cparms);
+  if (this->chunkDims_.empty()) return;
+
+  hid_t datatype = H5Dget_type(this->dataset_);
+  this->chunkBytes_ = H5Tget_size(datatype);
+  H5Tclose(datatype);
+  this->chunksPerFrame_ = 1;
+  this->framesPerChunk_ = 1;
+  for (i = 0; i < this->rank_; i++) {
+    this->chunkBytes_ *= this->chunkDims_[i];
+    if (i < this->extra_rank_) {
+      this->framesPerChunk_ *= this->chunkDims_[i];
+    } else {
+      this->chunksPerFrame_ *= (this->maxdims_[i] + this->chunkDims_[i] - 1) / this->chunkDims_[i];
+    }
+  }
+
+  size_t nslots = 0;
+  size_t nbytes = 0;
+  double w0 = 0.0;
+  hid_t dapl = H5Dget_access_plist(this->dataset_);
+  if (dapl >= 0) {
+    H5Pget_chunk_cache(dapl, &nslots, &nbytes, &w0);
+    H5Pclose(dapl);
+  }
+  this->cacheBytes_ = nbytes;
+}
+
+/** Update the chunk cache model after a frame has been written through the HDF5 pipeline.
+  * HDF5 does not report chunk evictions, so the cache is modelled as a least recently used
+  * list of the chunks that have not been completely written yet. A chunk that is written again
+  * after it has dropped out of that list has to be read back from the file, uncompressed,
+  * and compressed and written again.
+  * \param[in] offset - The offset of the frame in the dataset.
+  */
+void NDFileHDF5Dataset::countChunkRewrites(hsize_t *offset)
+{
+  int i;
+  if (!this->chunkModel_) this->initChunkModel();
+  // Chunks that are complete after a single frame never need to be read back
+  if (this->chunkDims_.empty() || this->framesPerChunk_ <= 1) return;
+
+  std::vector<hsize_t> key(this->extra_rank_);
+  for (i = 0; i < this->extra_rank_; i++) key[i] = offset[i] / this->chunkDims_[i];
+
+  hsize_t cacheChunks = this->cacheBytes_ / this->chunkBytes_;
+  hsize_t cacheFrames = cacheChunks / this->chunksPerFrame_;
+
+  std::list<std::vector<hsize_t> >::iterator it;
+  for (it = this->cachedChunks_.begin(); it != this->cachedChunks_.end(); ++it) {
+    if (*it == key) break;
+  }
+  if (it != this->cachedChunks_.end()) {
+    this->cachedChunks_.erase(it);
+  } else if (this->openChunks_.count(key)) {
+    // Partially written chunks that have been evicted; a cache too small for one frame keeps some of them
+    if (cacheFrames > 0) {
+      this->chunkRewrites_ += this->chunksPerFrame_;
+    } else {
+      this->chunkRewrites_ += this->chunksPerFrame_ - cacheChunks;
+    }
+  }
+
+  hsize_t frames = ++this->openChunks_[key];
+  if (frames >= this->framesPerChunk_) {
+    // Fully written chunks are evicted first and never read back
+    this->openChunks_.erase(key);
+    return;
+  }
+  if (this->openChunks_.size() * this->chunksPerFrame_ > this->maxOpenChunks_) {
+    this->maxOpenChunks_ = this->openChunks_.size() * this->chunksPerFrame_;
+  }
+  this->cachedChunks_.push_front(key);
+  while (this->cachedChunks_.size() > cacheFrames) this->cachedChunks_.pop_back();
+}
+
+/** Return the number of chunks that were evicted from the chunk cache before they were complete.
+  */
+unsigned long NDFileHDF5Dataset::getChunkRewrites()
+{
+  return this->chunkRewrites_;
+}
+
+/** Return the size in bytes of one uncompressed chunk of the dataset.
+  */
+hsize_t NDFileHDF5Dataset::getChunkBytes()
+{
+  if (!this->chunkModel_) this->initChunkModel();
+  return this->chunkBytes_;
+}
+
+/** Return the size in bytes of the chunk cache of the dataset.
+  */
+hsize_t NDFileHDF5Dataset::getChunkCacheBytes()
+{
+  if (!this->chunkModel_) this->initChunkModel();
+  return this->cacheBytes_;
+}
+
+/** Return the size in bytes of the largest number of partially written chunks seen so far.
+  */
+hsize_t NDFileHDF5Dataset::getOpenChunkBytes()
+{
+  return this->maxOpenChunks_ * this->chunkBytes_;
+}
+
+/** Change the chunk cache of the dataset.
+  * The chunk cache of a dataset can only be set when it is opened, so the dataset is closed,
+  * which writes out the chunks in the cache, and opened again with the new settings.
+  * \param[in] nslots - Number of slots in the chunk cache hash table.
+  * \param[in] nbytes - Size of the chunk cache in bytes.
+  */
+asynStatus NDFileHDF5Dataset::setChunkCache(size_t nslots, size_t nbytes)
+{
+  char dsetName[256];
+  static const char *functionName = "setChunkCache";
+
+  if (H5Iget_name(this->dataset_, dsetName, sizeof(dsetName)) <= 0) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to get the path of dataset [%s]\n",
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+  hid_t file = H5Iget_file_id(this->dataset_);
+  hid_t dapl = H5Dget_access_plist(this->dataset_);
+  H5Pset_chunk_cache(dapl, nslots, nbytes, 1.0);
+  H5Dclose(this->dataset_);
+  this->dataset_ = H5Dopen2(file, dsetName, dapl);
+  H5Pclose(dapl);
+  H5Fclose(file);
+  if (this->dataset_ < 0) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to reopen dataset [%s]\n",
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+  // All chunks were written out when the dataset was closed
+  this->cacheBytes_ = nbytes;
+  this->cachedChunks_.clear();
+  return asynSuccess;
+}
@@ -2,6 +2,9 @@
 #define NDFILEHDF5DATASET_H_
 
 #include <string>
+#include <list>
+#include <map>
+#include <vector>
 #include <hdf5.h>
 #include "NDPluginFile.h"
 #include "NDFileHDF5VersionCheck.h"
@@ -20,14 +23,26 @@ class NDFileHDF5Dataset
     asynStatus verifyChunking(NDArray *pArray);
     void configureCompression(Codec_t codec);
     asynStatus writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize);
+    asynStatus writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize,
+                         hsize_t *dims, hsize_t *offset);
+    void getPosition(hsize_t *dims, hsize_t *offset);
+    int getRank();
     hid_t getHandle();
     asynStatus flushDataset();
     hsize_t getDim(int index);
     hsize_t getMaxDim(int index);
     hsize_t getOffset(int index);
     hsize_t getVirtualDim(int index);
+    unsigned long getChunkRewrites();
+    hsize_t getChunkBytes();
+    hsize_t getChunkCacheBytes();
+    hsize_t getOpenChunkBytes();
+    asynStatus setChunkCache(size_t nslots, size_t nbytes);
 
   private:
+    herr_t writeChunk(NDArray *pArray, hsize_t *offset, void *pData, size_t size, size_t uncompressedSize);
+    void initChunkModel();
+    void countChunkRewrites(hsize_t *offset);
 
     asynUser    *pAsynUser_;   // Pointer to the asynUser structure
     std::string name_;         // Name of this dataset
@@ -47,6 +62,18 @@ class NDFileHDF5Dataset
     Codec_t codec;             // Definition of codec used to compress the data.
     char        *ptrDimensionNames[ND_ARRAY_MAX_DIMS]; // Array of strings with human readable names for each dimension
     char        *dimsreport_;  // A string which contain a verbose report of all dimension sizes. The method getDimsReport fill in this
+
+    // Model of the HDF5 chunk cache, used to count chunks that are evicted before they are complete
+    bool        chunkModel_;      // Whether the model has been initialised from the dataset properties
+    std::vector<hsize_t> chunkDims_; // Chunk dimensions of the dataset in the file
+    hsize_t     chunkBytes_;      // Size of one uncompressed chunk
+    hsize_t     chunksPerFrame_;  // Number of chunks across one frame
+    hsize_t     framesPerChunk_;  // Number of frames needed to complete a chunk
+    size_t      cacheBytes_;      // Size of the chunk cache of the dataset
+    std::list<std::vector<hsize_t> > cachedChunks_; // Partially written chunks in the cache, most recent first
+    std::map<std::vector<hsize_t>, hsize_t> openChunks_; // Frames written to each partially written chunk
+    hsize_t     maxOpenChunks_;   // Largest number of partially written chunks seen
+    unsigned long chunkRewrites_; // Number of chunks that had to be read back and written again
 };
 
 
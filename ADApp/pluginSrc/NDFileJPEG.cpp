@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <vector>
+
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
@@ -21,22 +23,197 @@
 #include <epicsExport.h>
 #include "NDPluginFile.h"
 #include "NDFileJPEG.h"
+#include "NDWorkerPool.h"
 
 
 static const char *driverName = "NDFileJPEG";
 
+/** Expanded data destination object for JPEG output */
+typedef struct {
+  struct jpeg_destination_mgr pub;    /* public fields */
+  struct NDFileJPEGEncoder *pEncoder; /* Encoder that owns the output buffer */
+} jpegDestMgr;
+
+/** libjpeg compressor and buffers of one thread. They are reused from image to image,
+  * so after the first image no memory is allocated unless the image gets larger. */
+struct NDFileJPEGEncoder {
+    struct jpeg_compress_struct jpegInfo;
+    struct jpeg_error_mgr jpegErr;
+    jpegDestMgr destMgr;
+    std::vector<JOCTET> output;             /* Compressed image */
+    size_t outputSize;                      /* Number of bytes of the compressed image in output */
+    std::vector<unsigned char> interleaved; /* RGB2 and RGB3 images converted to RGB1 */
+    std::vector<JSAMPROW> rows;             /* Pointer to each row of the image */
+
+    NDFileJPEGEncoder();
+    ~NDFileJPEGEncoder();
+    bool encode(NDArray *pArray, NDColorMode_t colorMode, int quality);
+};
+
+/** An image queued for the workers */
+struct NDFileJPEGJob {
+    NDArray *pArray;         /* Image to write; reserved until the file is written */
+    std::string fileName;
+    NDColorMode_t colorMode;
+    int quality;
+};
+
+/* Note: we don't use the built-in stdio routines, because this does not work when using
+ * the prebuilt library and either VC++ or g++ on Windows.  The FILE pointers are wrong
+ * when doing that.  Rather we implement our own jpeg_destination_mgr structure, which
+ * compresses into a memory buffer that is written to the file with a single fwrite. */
+static void init_destination(j_compress_ptr cinfo)
+{
+    NDFileJPEGEncoder *pEncoder = ((jpegDestMgr*) cinfo->dest)->pEncoder;
+
+    if (pEncoder->output.empty()) pEncoder->output.resize(JPEG_BUF_SIZE);
+    pEncoder->destMgr.pub.next_output_byte = &pEncoder->output[0];
+    pEncoder->destMgr.pub.free_in_buffer = pEncoder->output.size();
+    pEncoder->outputSize = 0;
+}
+
+/* Called when the buffer is full; double its size */
+static boolean empty_output_buffer(j_compress_ptr cinfo)
+{
+    NDFileJPEGEncoder *pEncoder = ((jpegDestMgr*) cinfo->dest)->pEncoder;
+    size_t used = pEncoder->output.size();
+
+    pEncoder->output.resize(2 * used);
+    pEncoder->destMgr.pub.next_output_byte = &pEncoder->output[used];
+    pEncoder->destMgr.pub.free_in_buffer = used;
+    return TRUE;
+}
+
+static void term_destination(j_compress_ptr cinfo)
+{
+    NDFileJPEGEncoder *pEncoder = ((jpegDestMgr*) cinfo->dest)->pEncoder;
+
+    pEncoder->outputSize = pEncoder->output.size() - pEncoder->destMgr.pub.free_in_buffer;
+}
+
+NDFileJPEGEncoder::NDFileJPEGEncoder()
+    : outputSize(0)
+{
+    jpeg_create_compress(&this->jpegInfo);
+    this->jpegInfo.err = jpeg_std_error(&this->jpegErr);
+    this->destMgr.pub.init_destination = init_destination;
+    this->destMgr.pub.empty_output_buffer = empty_output_buffer;
+    this->destMgr.pub.term_destination = term_destination;
+    this->destMgr.pEncoder = this;
+    this->jpegInfo.dest = (jpeg_destination_mgr *) &this->destMgr;
+}
+
+NDFileJPEGEncoder::~NDFileJPEGEncoder()
+{
+    jpeg_destroy_compress(&this->jpegInfo);
+}
+
+/** Compresses an image into the output buffer.
+  * RGB2 and RGB3 images are first converted to RGB1 in one pass, then all the rows
+  * are passed to libjpeg in a single call.
+  * \param[in] pArray The image; its structure was checked by NDFileJPEG::openFile
+  * \param[in] colorMode The color mode of the image
+  * \param[in] quality The JPEG quality, 0-100
+  * \return true if the image was compressed
+  */
+bool NDFileJPEGEncoder::encode(NDArray *pArray, NDColorMode_t colorMode, int quality)
+{
+    unsigned char *pData = (unsigned char *)pArray->pData;
+    unsigned char *pRed, *pGreen, *pBlue, *pOut;
+    size_t sizeX, sizeY, x, y;
+    int components = 3;
+
+    switch (colorMode) {
+        case NDColorModeMono:
+            sizeX = pArray->dims[0].size;
+            sizeY = pArray->dims[1].size;
+            components = 1;
+            break;
+        case NDColorModeRGB1:
+            sizeX = pArray->dims[1].size;
+            sizeY = pArray->dims[2].size;
+            break;
+        case NDColorModeRGB2:
+            sizeX = pArray->dims[0].size;
+            sizeY = pArray->dims[2].size;
+            this->interleaved.resize(sizeX * sizeY * 3);
+            pOut = &this->interleaved[0];
+            for (y=0; y<sizeY; y++) {
+                pRed = pData + y * sizeX * 3;
+                pGreen = pRed + sizeX;
+                pBlue = pGreen + sizeX;
+                for (x=0; x<sizeX; x++) {
+                    *pOut++ = pRed[x];
+                    *pOut++ = pGreen[x];
+                    *pOut++ = pBlue[x];
+                }
+            }
+            pData = &this->interleaved[0];
+            break;
+        case NDColorModeRGB3:
+            sizeX = pArray->dims[0].size;
+            sizeY = pArray->dims[1].size;
+            this->interleaved.resize(sizeX * sizeY * 3);
+            pOut = &this->interleaved[0];
+            pRed = pData;
+            pGreen = pRed + sizeX * sizeY;
+            pBlue = pGreen + sizeX * sizeY;
+            for (x=0; x<sizeX*sizeY; x++) {
+                *pOut++ = pRed[x];
+                *pOut++ = pGreen[x];
+                *pOut++ = pBlue[x];
+            }
+            pData = &this->interleaved[0];
+            break;
+        default:
+            return false;
+    }
+
+    this->rows.resize(sizeY);
+    for (y=0; y<sizeY; y++) {
+        this->rows[y] = pData + y * sizeX * components;
+    }
+
+    this->jpegInfo.image_width  = (JDIMENSION)sizeX;
+    this->jpegInfo.image_height = (JDIMENSION)sizeY;
+    this->jpegInfo.input_components = components;
+    this->jpegInfo.in_color_space = (components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&this->jpegInfo);
+    jpeg_set_quality(&this->jpegInfo, quality, TRUE);
+
+    jpeg_start_compress(&this->jpegInfo, TRUE);
+    while (this->jpegInfo.next_scanline < this->jpegInfo.image_height) {
+        JDIMENSION next = this->jpegInfo.next_scanline;
+        if (jpeg_write_scanlines(&this->jpegInfo, &this->rows[next], this->jpegInfo.image_height - next) == 0) {
+            jpeg_abort_compress(&this->jpegInfo);
+            return false;
+        }
+    }
+    jpeg_finish_compress(&this->jpegInfo);
+    return true;
+}
+
+/** The function run by the NDWorkerPool threads
+  * \param[in] drvPvt Pointer to the NDFileJPEG object
+  */
+static void encodeJobsC(void *drvPvt)
+{
+    NDFileJPEG *pPlugin = (NDFileJPEG *)drvPvt;
+    pPlugin->encodeJobs();
+}
+
 /** Opens a JPEG file.
   * \param[in] fileName The name of the file to open.
   * \param[in] openMode Mask defining how the file should be opened; bits are 
   *            NDFileModeRead, NDFileModeWrite, NDFileModeAppend, NDFileModeMultiple
   * \param[in] pArray A pointer to an NDArray; this is used to determine the array and attribute properties.
+  * With more than one encoder thread the file is only created by the worker that encodes the image.
   */
 asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
 {
     static const char *functionName = "openFile";
     int colorMode = NDColorModeMono;
     NDAttribute *pAttribute;
-    int quality;
 
     /* We don't support reading yet */
     if (openMode & NDFileModeRead) return(asynError);
@@ -61,28 +238,12 @@ asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode,
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
 
     if (pArray->ndims == 2) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[0].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[1].size;
-        this->jpegInfo.input_components = 1;
-        this->jpegInfo.in_color_space = JCS_GRAYSCALE;
         this->colorMode = NDColorModeMono;
     } else if ((pArray->ndims == 3) && (pArray->dims[0].size == 3) && (colorMode == NDColorModeRGB1)) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[1].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[2].size;
-        this->jpegInfo.input_components = 3;
-        this->jpegInfo.in_color_space = JCS_RGB;
         this->colorMode = NDColorModeRGB1;
     } else if ((pArray->ndims == 3) && (pArray->dims[1].size == 3) && (colorMode == NDColorModeRGB2)) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[0].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[2].size;
-        this->jpegInfo.input_components = 3;
-        this->jpegInfo.in_color_space = JCS_RGB;
         this->colorMode = NDColorModeRGB2;
     } else if ((pArray->ndims == 3) && (pArray->dims[2].size == 3) && (colorMode == NDColorModeRGB3)) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[0].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[1].size;
-        this->jpegInfo.input_components = 3;
-        this->jpegInfo.in_color_space = JCS_RGB;
         this->colorMode = NDColorModeRGB3;
     } else {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -91,6 +252,18 @@ asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode,
         return(asynError);
     }
 
+    /* Get the file quality and the number of encoder threads */
+    /* Must lock when accessing parameter library */
+    this->lock();
+    getIntegerParam(NDFileJPEGQuality, &this->quality);
+    getIntegerParam(NDFileJPEGNumThreads, &this->numThreads);
+    this->unlock();
+    if (this->numThreads < 1) this->numThreads = 1;
+    if (this->numThreads > NDFILE_JPEG_MAX_THREADS) this->numThreads = NDFILE_JPEG_MAX_THREADS;
+    this->fileName = fileName;
+
+    if (this->numThreads > 1) return(asynSuccess);
+
    /* Create the file. */
     if ((this->outFile = fopen(fileName, "wb")) == NULL ) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -98,100 +271,47 @@ asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode,
         driverName, functionName, fileName);
         return(asynError);
     }
-    
-    jpeg_set_defaults(&this->jpegInfo);
-
-    /* Set the file quality */
-    /* Must lock when accessing parameter library */
-    this->lock();
-    getIntegerParam(NDFileJPEGQuality, &quality);
-    this->unlock();
-    jpeg_set_quality(&this->jpegInfo, quality, TRUE);
-    
-    jpeg_start_compress(&this->jpegInfo, TRUE);
     return(asynSuccess);
 }
 
 /** Writes single NDArray to the JPEG file.
+  * With more than one encoder thread the array is queued for the workers; an error
+  * encoding or writing an earlier file is then returned by the next call or by closeFile.
   * \param[in] pArray Pointer to the NDArray to be written
   */
 asynStatus NDFileJPEG::writeFile(NDArray *pArray)
 {
-    JSAMPROW row_pointer[1];
-    int nwrite=0;
-    unsigned char *pRed=NULL, *pGreen=NULL, *pBlue=NULL, *pData=NULL, *pOut, *buffer=NULL;
-    int sizeX = (int)this->jpegInfo.image_width;
-    int sizeY = (int)this->jpegInfo.image_height;
-    int stepSize=0, i;
+    NDFileJPEGJob *pJob;
     static const char *functionName = "writeFile";
 
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
               "%s:%s: %lu, %lu\n", 
               driverName, functionName, (unsigned long)pArray->dims[0].size, (unsigned long)pArray->dims[1].size);
 
-    switch (this->colorMode) {
-        case NDColorModeMono:
-        case NDColorModeRGB1:
-            pData = (unsigned char *)pArray->pData;
-            break;
-        case NDColorModeRGB2:
-            buffer = (unsigned char *)malloc(sizeX * sizeY * 3);
-            stepSize = sizeX * 3;
-            pRed = (unsigned char *)pArray->pData;
-            pGreen = pRed + sizeX;
-            pBlue = pGreen + sizeX;
-            break;
-        case NDColorModeRGB3:
-            buffer = (unsigned char *)malloc(sizeX * sizeY * 3);
-            stepSize = sizeX;
-            pRed = (unsigned char *)pArray->pData;
-            pGreen = pRed + sizeX * sizeY;
-            pBlue = pGreen + sizeX * sizeY;
-            break;
-        default:
-            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-                "%s:%s: unknown color mode %d\n",
-                driverName, functionName, this->colorMode);
-            return(asynError);
-            break;
+    if (this->numThreads > 1) {
+        pJob = new NDFileJPEGJob;
+        pJob->pArray = pArray;
+        pJob->fileName = this->fileName;
+        pJob->colorMode = this->colorMode;
+        pJob->quality = this->quality;
+        pArray->reserve();
+        return this->queueJob(pJob);
     }
-    while ((int)this->jpegInfo.next_scanline < sizeY) {
-        switch (this->colorMode) {
-            case NDColorModeMono:
-            case NDColorModeRGB1:
-                row_pointer[0] = pData;
-                nwrite = jpeg_write_scanlines(&this->jpegInfo, row_pointer, 1);
-                pData += sizeX * this->jpegInfo.input_components;
-                break;
-            case NDColorModeRGB2:
-            case NDColorModeRGB3:
-                row_pointer[0] = buffer;
-                pOut = buffer;
-                for (i=0; i<sizeX; i++) {
-                    *pOut++ = pRed[i];
-                    *pOut++ = pGreen[i];
-                    *pOut++ = pBlue[i];
-                }
-                nwrite = jpeg_write_scanlines(&this->jpegInfo, row_pointer, 1);
-                pRed += stepSize;
-                pBlue += stepSize;
-                pGreen += stepSize;
-                break;
-            default:
-                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-                    "%s:%s: unknown color mode %d\n",
-                    driverName, functionName, this->colorMode);
-                return(asynError);
-                break;
-        }
-        if (nwrite != 1) {
-            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-                "%s:%s: error writing data to file\n",
-                driverName, functionName);
-            return(asynError);
-        }
+
+    if (!this->outFile) return(asynError);
+    if (!this->pEncoder->encode(pArray, this->colorMode, this->quality)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+            "%s:%s: error compressing image\n",
+            driverName, functionName);
+        return(asynError);
+    }
+    if (fwrite(&this->pEncoder->output[0], 1, this->pEncoder->outputSize, this->outFile) !=
+        this->pEncoder->outputSize) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+            "%s:%s: error writing data to file %s\n",
+            driverName, functionName, this->fileName.c_str());
+        return(asynError);
     }
-    if (buffer) free(buffer);
 
     return(asynSuccess);
 }
@@ -207,82 +327,194 @@ asynStatus NDFileJPEG::readFile(NDArray **pArray)
 }
 
 
-/** Closes the JPEG file. */
+/** Closes the JPEG file.
+  * With more than one encoder thread this waits until all the queued files are written and
+  * returns their status. While a stream is running it only returns the status of the files
+  * written so far, so that the next images are encoded in parallel; the last file of the
+  * stream waits for all of them.
+  */
 asynStatus NDFileJPEG::closeFile()
 {
-    //static const char *functionName = "closeFile";
+    static const char *functionName = "closeFile";
+    asynStatus status = asynSuccess;
+    int fileWriteMode, capture, numCapture, numCaptured;
+    char tempSuffix[MAX_FILENAME_LEN];
+
+    if (this->numThreads > 1) {
+        this->lock();
+        getIntegerParam(NDFileWriteMode, &fileWriteMode);
+        getIntegerParam(NDFileCapture, &capture);
+        getIntegerParam(NDFileNumCapture, &numCapture);
+        getIntegerParam(NDFileNumCaptured, &numCaptured);
+        getStringParam(NDFileTempSuffix, sizeof(tempSuffix), tempSuffix);
+        this->unlock();
+        /* NumCaptured is incremented once this file has been written.
+         * A file with a temporary suffix is renamed when closeFile returns, so it must exist. */
+        if ((fileWriteMode == NDFileModeStream) && capture && !tempSuffix[0] &&
+            ((numCapture <= 0) || (numCaptured + 1 < numCapture))) {
+            this->jobLock.lock();
+            status = this->encodeStatus;
+            this->encodeStatus = asynSuccess;
+            this->jobLock.unlock();
+            return status;
+        }
+        return this->waitJobs();
+    }
 
-    jpeg_finish_compress(&this->jpegInfo);
-    fclose(this->outFile);
+    if (!this->outFile) return asynSuccess;
+    if (fclose(this->outFile) != 0) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error closing JPEG file %s\n",
+            driverName, functionName, this->fileName.c_str());
+        status = asynError;
+    }
+    this->outFile = NULL;
 
-    return asynSuccess;
+    return status;
 }
 
-static void init_destination(j_compress_ptr cinfo)
+/** Queue an image for the workers, and submit calls of encodeJobs to the NDWorkerPool
+  * until the configured number of them are running.
+  * Blocks while two images per thread are already queued or being encoded.
+  * \param[in] pJob The image to write; ownership passes to the workers
+  */
+asynStatus NDFileJPEG::queueJob(NDFileJPEGJob *pJob)
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
-    pdest->pNDFileJPEG->initDestination();
+    asynStatus status;
+    bool startWorker = false;
+
+    this->jobLock.lock();
+    while (this->jobsPending >= 2 * this->numThreads) {
+        this->jobLock.unlock();
+        epicsEventMustWait(this->jobDoneEvent);
+        this->jobLock.lock();
+    }
+    this->jobQueue.push_back(pJob);
+    this->jobsPending++;
+    if (this->activeWorkers < this->numThreads) {
+        this->activeWorkers++;
+        startWorker = true;
+    }
+    status = this->encodeStatus;
+    this->encodeStatus = asynSuccess;
+    this->jobLock.unlock();
+    this->setPending();
+    /* If the pool cannot take the call the plugin thread encodes the queued images */
+    if (startWorker && !NDWorkerPool::getInstance()->submit(encodeJobsC, this, this->numThreads)) {
+        this->encodeJobs();
+    }
+    return status;
 }
 
-/** Initializes the destination file; should be private but called from C so must be public */
-void NDFileJPEG::initDestination()
+/** Waits until the workers have written all the queued files.
+  * Returns asynError if any of them could not be written.
+  */
+asynStatus NDFileJPEG::waitJobs()
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) this->jpegInfo.dest;
+    asynStatus status;
 
-    pdest->pub.next_output_byte = this->jpegBuffer;
-    pdest->pub.free_in_buffer = JPEG_BUF_SIZE;
+    this->jobLock.lock();
+    while (this->jobsPending > 0) {
+        this->jobLock.unlock();
+        epicsEventMustWait(this->jobDoneEvent);
+        this->jobLock.lock();
+    }
+    status = this->encodeStatus;
+    this->encodeStatus = asynSuccess;
+    this->jobLock.unlock();
+    this->setPending();
+    return status;
 }
 
-static boolean empty_output_buffer(j_compress_ptr cinfo)
+/** Update the pending files parameter.
+  * The count is read with the plugin lock taken, so updates from several threads cannot leave a stale value.
+  */
+void NDFileJPEG::setPending()
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
-    return pdest->pNDFileJPEG->emptyOutputBuffer();
+    int pending;
+
+    this->lock();
+    this->jobLock.lock();
+    pending = this->jobsPending;
+    this->jobLock.unlock();
+    setIntegerParam(NDFileJPEGPending, pending);
+    callParamCallbacks();
+    this->unlock();
 }
 
-/** Empties the output buffer; should be private but called from C so must be public */
-boolean NDFileJPEG::emptyOutputBuffer()
+/** Encodes the queued images until the queue is empty. Called in an NDWorkerPool thread.
+  * Each call uses an encoder of the plugin that no other call is using, and the images are
+  * taken from the queue in the order they were queued.
+  */
+void NDFileJPEG::encodeJobs()
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) this->jpegInfo.dest;
-    static const char *functionName = "emptyOutputBuffer";
+    NDFileJPEGEncoder *pJobEncoder = NULL;
+    NDFileJPEGJob *pJob;
 
-    if (fwrite(this->jpegBuffer, 1, JPEG_BUF_SIZE, this->outFile) !=
-      (size_t) JPEG_BUF_SIZE) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s:%s error writing JPEG file\n",
-            driverName, functionName);
-        return FALSE;
+    this->jobLock.lock();
+    if (!this->idleEncoders.empty()) {
+        pJobEncoder = this->idleEncoders.back();
+        this->idleEncoders.pop_back();
     }
-    pdest->pub.next_output_byte = this->jpegBuffer;
-    pdest->pub.free_in_buffer = JPEG_BUF_SIZE;
-    return TRUE;
-}
-
-static void term_destination (j_compress_ptr cinfo)
-{
-    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
-    pdest->pNDFileJPEG->termDestination();
+    this->jobLock.unlock();
+    if (!pJobEncoder) pJobEncoder = new NDFileJPEGEncoder;
+
+    this->jobLock.lock();
+    while (!this->jobQueue.empty()) {
+        pJob = this->jobQueue.front();
+        this->jobQueue.pop_front();
+        this->jobLock.unlock();
+
+        this->encodeJob(pJobEncoder, pJob);
+
+        this->jobLock.lock();
+        this->jobsPending--;
+        epicsEventSignal(this->jobDoneEvent);
+        this->jobLock.unlock();
+        this->setPending();
+        this->jobLock.lock();
+    }
+    /* The plugin may be deleted as soon as the lock is released */
+    this->idleEncoders.push_back(pJobEncoder);
+    this->activeWorkers--;
+    epicsEventSignal(this->jobDoneEvent);
+    this->jobLock.unlock();
 }
 
-/** Terminates the destination file; should be private but called from C so must be public */
-void NDFileJPEG::termDestination()
+/** Encodes a queued image and writes it to its file. Called from a worker.
+  * \param[in] pEncoder The encoder of the worker
+  * \param[in] pJob The image to write; it is deleted and its array released
+  */
+void NDFileJPEG::encodeJob(NDFileJPEGEncoder *pEncoder, NDFileJPEGJob *pJob)
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) this->jpegInfo.dest;
-    size_t datacount = JPEG_BUF_SIZE - pdest->pub.free_in_buffer;
-    static const char *functionName = "termDestination";
+    FILE *file;
+    bool ok = false;
+    static const char *functionName = "encodeJob";
 
-    /* Write any data remaining in the buffer */
-    if (datacount > 0) {
-        if (fwrite(this->jpegBuffer, 1, datacount, this->outFile) != datacount)
+    if (!pEncoder->encode(pJob->pArray, pJob->colorMode, pJob->quality)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error compressing image for file %s\n",
+            driverName, functionName, pJob->fileName.c_str());
+    } else if ((file = fopen(pJob->fileName.c_str(), "wb")) == NULL) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error opening file %s\n",
+            driverName, functionName, pJob->fileName.c_str());
+    } else {
+        ok = (fwrite(&pEncoder->output[0], 1, pEncoder->outputSize, file) == pEncoder->outputSize);
+        if (fclose(file) != 0) ok = false;
+        if (!ok) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s error writing JPEG file\n",
-                driverName, functionName);
+                "%s:%s error writing file %s\n",
+                driverName, functionName, pJob->fileName.c_str());
+        }
     }
-    fflush(this->outFile);
-    /* Make sure we wrote the output file OK */
-    if (ferror(this->outFile))
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s:%s error flushing JPEG file\n",
-            driverName, functionName);
+    if (!ok) {
+        this->jobLock.lock();
+        this->encodeStatus = asynError;
+        this->jobLock.unlock();
+    }
+    pJob->pArray->release();
+    delete pJob;
 }
 
 
@@ -309,30 +541,46 @@ NDFileJPEG::NDFileJPEG(const char *portName, int queueSize, int blockingCallback
     : NDPluginFile(portName, queueSize, blockingCallbacks,
                    NDArrayPort, NDArrayAddr, 1,
                    0, 0, asynGenericPointerMask, asynGenericPointerMask, 
-                   ASYN_CANBLOCK, 1, priority, stackSize, 1)
+                   ASYN_CANBLOCK, 1, priority, stackSize, 1),
+      colorMode(NDColorModeMono), quality(50), numThreads(1), outFile(NULL),
+      jobsPending(0), activeWorkers(0), encodeStatus(asynSuccess)
 {
     //static const char *functionName = "NDFileJPEG";
 
-    createParam(NDFileJPEGQualityString, asynParamInt32, &NDFileJPEGQuality);
-    
-    jpeg_create_compress(&this->jpegInfo);
-    this->jpegInfo.err = jpeg_std_error(&this->jpegErr);
+    createParam(NDFileJPEGQualityString,    asynParamInt32, &NDFileJPEGQuality);
+    createParam(NDFileJPEGNumThreadsString, asynParamInt32, &NDFileJPEGNumThreads);
+    createParam(NDFileJPEGPendingString,    asynParamInt32, &NDFileJPEGPending);
 
-    /* Note: we don't use the built-in stdio routines, because this does not work when using
-     * the prebuilt library and either VC++ or g++ on Windows.  The FILE pointers are wrong
-     * when doing that.  Rather we implement our own jpeg_destination_mgr structure and handle
-     * the I/O ourselves.  The code we use is almost a direct copy from jdatadst.c in the standard
-     * package. */
-    this->destMgr.pub.init_destination = init_destination;
-    this->destMgr.pub.empty_output_buffer = empty_output_buffer;
-    this->destMgr.pub.term_destination = term_destination;
-    this->destMgr.pNDFileJPEG = this;
-    this->jpegInfo.dest = (jpeg_destination_mgr *) &this->destMgr;
+    this->pEncoder = new NDFileJPEGEncoder;
+    this->jobDoneEvent = epicsEventMustCreate(epicsEventEmpty);
 
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDFileJPEG");
     this->supportsMultipleArrays = 0;
     setIntegerParam(NDFileJPEGQuality, 50);
+    setIntegerParam(NDFileJPEGNumThreads, 1);
+    setIntegerParam(NDFileJPEGPending, 0);
+}
+
+/** Destructor for NDFileJPEG.
+  * Waits until the workers have written the files that are still queued.
+  */
+NDFileJPEG::~NDFileJPEG()
+{
+    this->jobLock.lock();
+    while (this->activeWorkers > 0) {
+        this->jobLock.unlock();
+        epicsEventMustWait(this->jobDoneEvent);
+        this->jobLock.lock();
+    }
+    this->jobLock.unlock();
+
+    if (this->outFile) fclose(this->outFile);
+    delete this->pEncoder;
+    for (size_t i = 0; i < this->idleEncoders.size(); i++) {
+        delete this->idleEncoders[i];
+    }
+    epicsEventDestroy(this->jobDoneEvent);
 }
 
 /* Configuration routine.  Called directly, or from the iocsh  */
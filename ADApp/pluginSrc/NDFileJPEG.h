@@ -8,6 +8,13 @@
 #ifndef DRV_NDFileJPEG_H
 #define DRV_NDFileJPEG_H
 
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+
 #include "NDPluginFile.h"
 
 #ifdef __cplusplus
@@ -19,46 +26,65 @@ extern "C" {
 }
 #endif
 
-#define JPEG_BUF_SIZE 4096 /* choose an efficiently fwrite'able size */
+#define JPEG_BUF_SIZE 65536 /* initial size of the in-memory output buffer, it grows as needed */
+#define NDFILE_JPEG_MAX_THREADS 64 /* maximum number of encoder threads, the size of the NDWorkerPool */
 
-/** Expanded data destination object for JPEG output */
-typedef struct {
-  struct jpeg_destination_mgr pub; /* public fields */
-  class NDFileJPEG *pNDFileJPEG;   /* Pointer to ourselves */
-} jpegDestMgr;
+struct NDFileJPEGEncoder;
+struct NDFileJPEGJob;
 
-#define NDFileJPEGQualityString  "JPEG_QUALITY"  /* (asynInt32, r/w) File quality */
+#define NDFileJPEGQualityString     "JPEG_QUALITY"      /* (asynInt32, r/w) File quality */
+#define NDFileJPEGNumThreadsString  "JPEG_NUM_THREADS"  /* (asynInt32, r/w) Number of threads encoding files */
+#define NDFileJPEGPendingString     "JPEG_PENDING"      /* (asynInt32, r/o) Number of files queued or being encoded */
 
 /** Writes NDArrays in the JPEG file format, which is a lossy compression format.
   * This plugin was developed using the libjpeg library to write the file.
+  * Each image is compressed in memory in a single pass and written to the file with one write.
+  * With more than one thread the images are handed to the threads of the shared NDWorkerPool,
+  * so several files are encoded in parallel.
   */
 class epicsShareClass NDFileJPEG : public NDPluginFile {
 public:
     NDFileJPEG(const char *portName, int queueSize, int blockingCallbacks,
                const char *NDArrayPort, int NDArrayAddr,
                int priority, int stackSize);
+    virtual ~NDFileJPEG();
 
     /* The methods that this class implements */
     virtual asynStatus openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray);
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
-    /* These should be private, but are called from C, must be public */
-    void initDestination();
-    boolean emptyOutputBuffer();
-    void termDestination();
+    /* This should be private, but is called from C, must be public */
+    void encodeJobs();
 
 protected:
     int NDFileJPEGQuality;
     #define FIRST_NDFILE_JPEG_PARAM NDFileJPEGQuality
+    int NDFileJPEGNumThreads;
+    int NDFileJPEGPending;
 
 private:
-    struct jpeg_compress_struct jpegInfo;
-    struct jpeg_error_mgr jpegErr;
+    asynStatus queueJob(NDFileJPEGJob *pJob);
+    asynStatus waitJobs();
+    void encodeJob(NDFileJPEGEncoder *pEncoder, NDFileJPEGJob *pJob);
+    void setPending();
+
+    NDFileJPEGEncoder *pEncoder; /* Encoder used when the plugin thread writes the file */
     NDColorMode_t colorMode;
+    int quality;
+    int numThreads;              /* Number of encoder threads for the file that is open */
+    std::string fileName;
     FILE *outFile;
-    JOCTET jpegBuffer[JPEG_BUF_SIZE];
-    jpegDestMgr destMgr;
+
+    /* Images encoded by the NDWorkerPool threads. The queue, the counts, the idle encoders and the
+     * status are protected by jobLock. Only the plugin thread waits for jobDoneEvent. */
+    std::deque<NDFileJPEGJob *> jobQueue;
+    std::vector<NDFileJPEGEncoder *> idleEncoders; /* Encoders of the workers, kept for the next images */
+    epicsMutex jobLock;
+    epicsEventId jobDoneEvent;   /* Signalled when an image is written and when a worker returns */
+    int jobsPending;
+    int activeWorkers;           /* Number of calls of encodeJobs submitted to the pool that have not returned */
+    asynStatus encodeStatus;     /* Set when a worker fails, reported by the next writeFile or closeFile */
 };
 
 #endif
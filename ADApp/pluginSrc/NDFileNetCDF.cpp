@@ -36,7 +36,8 @@ static const char *driverName = "NDFileNetCDF";
 
 /** Opens a netCDF file.  
   * In write mode if NDFileModeMultiple is set then the first dimension is set to NC_UNLIMITED to allow 
-  * multiple arrays to be written to the same file.
+  * multiple arrays to be written to the same file, and the arrays are buffered and written
+  * NETCDF_BUFFER_FRAMES at a time.
   * NOTE: Does not currently support NDFileModeRead or NDFileModeAppend.
   * \param[in] fileName  Absolute path name of the file to open.
   * \param[in] openMode Bit mask with one of the access mode bits NDFileModeRead, NDFileModeWrite, NDFileModeAppend.
@@ -55,6 +56,10 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     char dimName[25];
     int dim0;
     int retval;
+    int format, cmode;
+    size_t chunks[ND_ARRAY_MAX_DIMS+1];
+    size_t recordChunk, ioBuffer;
+    NDArrayInfo_t arrayInfo;
     nc_type ncType=NC_NAT;
     int i, j;
     NDAttribute *pAttribute;
@@ -84,11 +89,50 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     
     /* Set the next record in the file to 0 */
     this->nextRecord = 0;
+    this->bufferedFrames = 0;
+
+    /* Must lock when accessing parameter library */
+    this->lock();
+    getIntegerParam(NDFileNetCDFFormat, &format);
+    getIntegerParam(NDFileNetCDFBufferFrames, &this->bufferFrames);
+    getIntegerParam(NDFileNetCDFChunkFrames, &this->chunkFrames);
+    getIntegerParam(NDFileNetCDFDeflateLevel, &this->deflateLevel);
+    getIntegerParam(NDFileNetCDFShuffle, &this->shuffle);
+    this->unlock();
+    if (this->bufferFrames < 1) this->bufferFrames = 1;
+    if (this->chunkFrames < 1) this->chunkFrames = this->bufferFrames;
+    if (this->deflateLevel < 0) this->deflateLevel = 0;
+    if (this->deflateLevel > 9) this->deflateLevel = 9;
+    recordChunk = NETCDF_RECORD_CHUNK;
+    /* A file with a single array has a fixed first dimension of 1 */
+    if (!(openMode & NDFileModeMultiple)) {
+        this->bufferFrames = 1;
+        this->chunkFrames = 1;
+        recordChunk = 1;
+    }
+    pArray->getInfo(&arrayInfo);
+    this->frameBytes = arrayInfo.totalBytes;
+    this->dataType = pArray->dataType;
 
     /* Create the file. The NC_CLOBBER parameter tells netCDF to
      * overwrite this file, if it already exists.*/
-    if ((retval = nc_create(fileName, NC_CLOBBER, &this->ncId)))
-        ERR(retval);
+    this->netCDF4 = 0;
+    cmode = NC_CLOBBER;
+    if (format == NDFileNetCDFFormat64Bit) cmode |= NC_64BIT_OFFSET;
+    if (format == NDFileNetCDFFormatNetCDF4) {
+        cmode |= NC_NETCDF4;
+        this->netCDF4 = 1;
+    }
+    if (this->netCDF4 || (this->bufferFrames == 1)) {
+        if ((retval = nc_create(fileName, cmode, &this->ncId)))
+            ERR(retval);
+    } else {
+        /* Size the I/O buffer of the netCDF library to hold the buffered records */
+        ioBuffer = this->bufferFrames * this->frameBytes;
+        if (ioBuffer > NETCDF_MAX_IO_BUFFER) ioBuffer = NETCDF_MAX_IO_BUFFER;
+        if ((retval = nc__create(fileName, cmode, 0, &ioBuffer, &this->ncId)))
+            ERR(retval);
+    }
 
     /* Create global attribute for the data type because netCDF does not
      * distinguish signed and unsigned.  Readers can use this to know how to treat
@@ -124,11 +168,16 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
         ERR(retval);
 
     /* The next dimensions are the dimensions of the data in reversed order */
+    this->dataCount.resize(pArray->ndims+1);
+    this->dataCount[0] = 1;
+    chunks[0] = this->chunkFrames;
     for (i=0; i<pArray->ndims; i++) {
         j = pArray->ndims - i - 1;
         sprintf(dimName, "dim%d", i);
         if ((retval = nc_def_dim(this->ncId, dimName, pArray->dims[j].size, &dimIds[i+1])))
             ERR(retval);
+        this->dataCount[i+1] = pArray->dims[j].size;
+        chunks[i+1] = pArray->dims[j].size;
         size[i]    = (int)pArray->dims[i].size;
         offset[i]  = (int)pArray->dims[i].offset;
         binning[i] = pArray->dims[i].binning;
@@ -185,31 +234,43 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     if ((retval = nc_def_var(this->ncId, "uniqueId", NC_INT, 1, 
                  &dimIds[0], &this->uniqueIdId)))
         ERR(retval);
+    if (this->defineStorage(this->uniqueIdId, &recordChunk, 0))
+        return asynError;
 
     /* Define the timestamp data variable. */
     if ((retval = nc_def_var(this->ncId, "timeStamp", NC_DOUBLE, 1, 
                  &dimIds[0], &this->timeStampId)))
         ERR(retval);
+    if (this->defineStorage(this->timeStampId, &recordChunk, 0))
+        return asynError;
 
     /* Define the EPICS timestamp data variables. */
     if ((retval = nc_def_var(this->ncId, "epicsTSSec", NC_INT, 1, 
                  &dimIds[0], &this->epicsTSSecId)))
         ERR(retval);
+    if (this->defineStorage(this->epicsTSSecId, &recordChunk, 0))
+        return asynError;
 
     if ((retval = nc_def_var(this->ncId, "epicsTSNsec", NC_INT, 1, 
                  &dimIds[0], &this->epicsTSNsecId)))
         ERR(retval);
+    if (this->defineStorage(this->epicsTSNsecId, &recordChunk, 0))
+        return asynError;
 
     /* Define the array data variable. */
     if ((retval = nc_def_var(this->ncId, "array_data", ncType, pArray->ndims+1,
                  dimIds, &this->arrayDataId)))
         ERR(retval);
+    if (this->defineStorage(this->arrayDataId, chunks, 1))
+        return asynError;
 
     /* Create a variable for each attribute in the array */
     free(this->pAttributeId);
     numAttributes = this->pFileAttributes->count();
     attrCount = 0;
     this->pAttributeId = (int *)calloc(numAttributes, sizeof(int));
+    this->attrSizes.resize(numAttributes);
+    this->attrTypes.resize(numAttributes);
     pAttribute = this->pFileAttributes->next(NULL);
     while (pAttribute) {
         const char *attributeName = pAttribute->getName();
@@ -306,16 +367,43 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
                 return asynError;
                 break;
         }
+        switch (ncType) {
+            case NC_SHORT:
+                this->attrSizes[attrCount] = sizeof(epicsInt16);
+                break;
+            case NC_INT:
+            case NC_FLOAT:
+                this->attrSizes[attrCount] = sizeof(epicsInt32);
+                break;
+            case NC_DOUBLE:
+                this->attrSizes[attrCount] = sizeof(epicsFloat64);
+                break;
+            case NC_CHAR:
+                this->attrSizes[attrCount] = MAX_ATTRIBUTE_STRING_SIZE;
+                break;
+            default:
+                this->attrSizes[attrCount] = sizeof(epicsInt8);
+                break;
+        }
+        /* The values are converted to this type in writeFile, whatever type the attribute has then */
+        this->attrTypes[attrCount] = (attrDataType == NDAttrUndefined) ? NDAttrInt8 : attrDataType;
         epicsSnprintf(tempString, sizeof(tempString), "Attr_%s", pAttribute->getName());
         if (attrDataType == NDAttrString) {
             if ((retval = nc_def_var(this->ncId, tempString, ncType, 2,
-                    stringDimIds, &this->pAttributeId[attrCount++])))
+                    stringDimIds, &this->pAttributeId[attrCount])))
                     ERR(retval);
+            chunks[0] = recordChunk;
+            chunks[1] = MAX_ATTRIBUTE_STRING_SIZE;
+            if (this->defineStorage(this->pAttributeId[attrCount], chunks, 0))
+                return asynError;
         } else {
             if ((retval = nc_def_var(this->ncId, tempString, ncType, 1,
-                    &dimIds[0], &this->pAttributeId[attrCount++])))
+                    &dimIds[0], &this->pAttributeId[attrCount])))
                     ERR(retval);
+            if (this->defineStorage(this->pAttributeId[attrCount], &recordChunk, 0))
+                return asynError;
         }
+        attrCount++;
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
 
@@ -323,30 +411,129 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
      * metadata. */
     if ((retval = nc_enddef(this->ncId)))
         ERR(retval);
+
+    /* Allocate the buffers for the records. The array data are only copied when more than one record is buffered */
+    this->uniqueIds.resize(this->bufferFrames);
+    this->timeStamps.resize(this->bufferFrames);
+    this->epicsTSSecs.resize(this->bufferFrames);
+    this->epicsTSNsecs.resize(this->bufferFrames);
+    this->attrBuffers.resize(numAttributes);
+    for (i=0; i<numAttributes; i++) {
+        this->attrBuffers[i].resize(this->bufferFrames * this->attrSizes[i]);
+    }
+    if (this->bufferFrames > 1) {
+        this->dataBuffer.resize(this->bufferFrames * this->frameBytes);
+    } else {
+        std::vector<char>().swap(this->dataBuffer);
+    }
     return(asynSuccess);
 }
 
 
+/** Sets the chunking and compression of a variable in a netCDF-4 file; does nothing for the classic formats.
+  * \param[in] varId The variable
+  * \param[in] chunks The chunk size of each dimension of the variable
+  * \param[in] compress Apply the deflate and shuffle filters if they are enabled */
+asynStatus NDFileNetCDF::defineStorage(int varId, const size_t *chunks, int compress)
+{
+    int retval;
+    static const char *functionName = "defineStorage";
+
+    if (!this->netCDF4) return asynSuccess;
+    if ((retval = nc_def_var_chunking(this->ncId, varId, NC_CHUNKED, chunks)))
+        ERR(retval);
+    if (compress && ((this->deflateLevel > 0) || this->shuffle)) {
+        if ((retval = nc_def_var_deflate(this->ncId, varId, this->shuffle,
+                                         (this->deflateLevel > 0), this->deflateLevel)))
+            ERR(retval);
+    }
+    return asynSuccess;
+}
+
+/** Writes the buffered records to the file, each variable with a single call to netCDF.
+  * \param[in] pData The array data of the buffered records */
+asynStatus NDFileNetCDF::flushRecords(const void *pData)
+{
+    int retval;
+    size_t start[ND_ARRAY_MAX_DIMS+1], count[ND_ARRAY_MAX_DIMS+1];
+    size_t stringStart[2], stringCount[2];
+    size_t i, numRecords;
+    static const char *functionName = "flushRecords";
+
+    numRecords = this->bufferedFrames;
+    if (numRecords == 0) return asynSuccess;
+    this->bufferedFrames = 0;
+
+    for (i=0; i<this->dataCount.size(); i++) {
+        start[i] = 0;
+        count[i] = this->dataCount[i];
+    }
+    start[0] = this->nextRecord;
+    count[0] = numRecords;
+
+    /* Write the data to the file. */
+    if ((retval = nc_put_vara(this->ncId, this->uniqueIdId, start, count, &this->uniqueIds[0])))
+                ERR(retval);
+    if ((retval = nc_put_vara(this->ncId, this->timeStampId, start, count, &this->timeStamps[0])))
+                ERR(retval);
+    if ((retval = nc_put_vara(this->ncId, this->epicsTSSecId, start, count, &this->epicsTSSecs[0])))
+                ERR(retval);
+    if ((retval = nc_put_vara(this->ncId, this->epicsTSNsecId, start, count, &this->epicsTSNsecs[0])))
+                ERR(retval);
+    /* The file has the same data type as the arrays, so the data are written without conversion */
+    if ((retval = nc_put_vara(this->ncId, this->arrayDataId, start, count, pData)))
+                ERR(retval);
+
+    /* Write the attributes */
+    stringStart[0] = this->nextRecord;
+    stringStart[1] = 0;
+    stringCount[0] = numRecords;
+    stringCount[1] = MAX_ATTRIBUTE_STRING_SIZE;
+    for (i=0; i<this->attrSizes.size(); i++) {
+        if (this->attrSizes[i] == MAX_ATTRIBUTE_STRING_SIZE) {
+            retval = nc_put_vara(this->ncId, this->pAttributeId[i], stringStart, stringCount, &this->attrBuffers[i][0]);
+        } else {
+            retval = nc_put_vara(this->ncId, this->pAttributeId[i], start, count, &this->attrBuffers[i][0]);
+        }
+        if (retval) ERR(retval);
+    }
+    this->nextRecord += (int)numRecords;
+    return asynSuccess;
+}
+
 /** Writes NDArray data to a netCDF file.
+  * The array and its attributes are added to the buffered records, which are written to the file
+  * when NETCDF_BUFFER_FRAMES records have been buffered, and by closeFile.
   * \param[in] pArray Pointer to an NDArray to write to the file. This function can be called multiple
   *           times between the call to openFile and closeFile if
   *           NDFileModeMultiple was set in openMode in the call to NDFileNetCDF::openFile. */ 
 asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
 {       
-    int retval;
-    size_t stringCount[2];
-    size_t start[ND_ARRAY_MAX_DIMS+1], count[ND_ARRAY_MAX_DIMS+1];
-    int attrId;
-    NDAttrValue attrVal;
-    int i, j;
+    int record = this->bufferedFrames;
+    char *pValue;
     NDAttribute *pAttribute;
-    NDAttrDataType_t attrDataType;
-    size_t attrSize;
-    int attrCount;
-    char attrString[MAX_ATTRIBUTE_STRING_SIZE];
+    size_t attrCount;
+    NDArrayInfo_t arrayInfo;
+    int i;
+    bool sameShape;
     static const char *functionName = "writeFile";
 
-    
+    /* The file was defined for the array passed to openFile, and the data are copied
+     * or written with the size of that array */
+    pArray->getInfo(&arrayInfo);
+    sameShape = (arrayInfo.totalBytes == this->frameBytes) &&
+                (pArray->dataType == this->dataType) &&
+                ((size_t)pArray->ndims + 1 == this->dataCount.size());
+    for (i=0; sameShape && i<pArray->ndims; i++) {
+        if (pArray->dims[pArray->ndims - i - 1].size != this->dataCount[i+1]) sameShape = false;
+    }
+    if (!sameShape) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s error, array dimensions or data type differ from the array the file was opened with\n",
+            driverName, functionName);
+        return asynError;
+    }
+
     /* Update attribute list. We use a separate attribute list
      * from the one in pArray to avoid the need to copy the array. */
     /* Get the current values of the attributes for this plugin */
@@ -355,117 +542,31 @@ asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
      * the driver and prior plugins */
     pArray->pAttributeList->copy(this->pFileAttributes);
 
-    count[0] = 1;
-    start[0] = this->nextRecord;
-    for (i=0; i<pArray->ndims; i++) {
-        j = pArray->ndims - i - 1;
-        count[i+1] = pArray->dims[j].size;
-        start[i+1] = 0;
+    this->uniqueIds[record] = pArray->uniqueId;
+    this->timeStamps[record] = pArray->timeStamp;
+    this->epicsTSSecs[record] = pArray->epicsTS.secPastEpoch;
+    this->epicsTSNsecs[record] = pArray->epicsTS.nsec;
+    if (this->bufferFrames > 1) {
+        memcpy(&this->dataBuffer[record * this->frameBytes], pArray->pData, this->frameBytes);
     }
- 
-    /* Write the data to the file. */
-    if ((retval = nc_put_vara_int(this->ncId, this->uniqueIdId, start, count, &pArray->uniqueId)))
-                ERR(retval);
-    if ((retval = nc_put_vara_double(this->ncId, this->timeStampId, start, count, &pArray->timeStamp)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSSecId, start, count, (int *)&pArray->epicsTS.secPastEpoch)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSNsecId, start, count, (int *)&pArray->epicsTS.nsec)))
-                ERR(retval);
 
-    switch (pArray->dataType) {
-        case NDInt8:
-            if ((retval = nc_put_vara_schar(this->ncId, this->arrayDataId, start, count, (signed char*)pArray->pData)))
-                ERR(retval);
-            break;
-        case NDUInt8:
-            if ((retval = nc_put_vara_uchar(this->ncId, this->arrayDataId, start, count, (unsigned char*)pArray->pData)))
-                ERR(retval);
-            break;
-        case NDInt16:
-        case NDUInt16:
-            if ((retval = nc_put_vara_short(this->ncId, this->arrayDataId, start, count, (short *)pArray->pData)))
-                ERR(retval);
-            break;
-        case NDInt32:
-        case NDUInt32:
-            if ((retval = nc_put_vara_int(this->ncId, this->arrayDataId, start, count, (int *)pArray->pData)))
-                ERR(retval);
-            break;
-        case NDFloat32:
-            if ((retval = nc_put_vara_float(this->ncId, this->arrayDataId, start, count, (float *)pArray->pData)))
-                ERR(retval);
-            break;
-        case NDFloat64:
-            if ((retval = nc_put_vara_double(this->ncId, this->arrayDataId, start, count, (double *)pArray->pData)))
-                ERR(retval);
-            break;
-        default:
-            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s error, unknown array data type =%d\n",
-                driverName, functionName, pArray->dataType);
-            return asynError;
-            break;
-    }
-    /* Write the attributes.  Loop through the list of attributes.  These must not have changed since define time! */
+    /* Buffer the attributes.  Loop through the list of attributes.  These must not have changed since define time!
+     * Each value is converted to the type its variable was defined with, so it fits in its slot even if the
+     * type of the attribute has changed, e.g. a PV that was not connected when the file was opened. */
     pAttribute = this->pFileAttributes->next(NULL);
     attrCount = 0;
-    while (pAttribute) {
-        pAttribute->getValueInfo(&attrDataType, &attrSize);
-        attrId = this->pAttributeId[attrCount++];
-        switch (attrDataType) {
-            case NDAttrInt8:
-            case NDAttrUInt8:
-                pAttribute->getValue(attrDataType, &attrVal.i8);
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
-                break;
-            case NDAttrInt16:
-            case NDAttrUInt16:
-                pAttribute->getValue(attrDataType, &attrVal.i16);
-                if ((retval = nc_put_vara_short(this->ncId, attrId, start, count, (short *)&attrVal.i16)))
-                    ERR(retval);
-                break;
-            case NDAttrInt32:
-            case NDAttrUInt32:
-                pAttribute->getValue(attrDataType, &attrVal.i32);
-                if ((retval = nc_put_vara_int(this->ncId, attrId, start, count, (int *)&attrVal.i32)))
-                    ERR(retval);
-                break;
-            case NDAttrFloat32:
-                pAttribute->getValue(attrDataType, &attrVal.f32);
-                if ((retval = nc_put_vara_float(this->ncId, attrId, start, count, (float *)&attrVal.f32)))
-                    ERR(retval);
-                break;
-            case NDAttrFloat64:
-                pAttribute->getValue(attrDataType, &attrVal.f64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.f64)))
-                    ERR(retval);
-                break;
-            case NDAttrString:
-                pAttribute->getValue(attrDataType, attrString, sizeof(attrString));
-                stringCount[0] = 1;
-                stringCount[1] = strlen(attrString);
-                if ((retval = nc_put_vara_text(this->ncId, attrId, start, stringCount, attrString)))
-                    ERR(retval);
-                break;
-            case NDAttrUndefined:
-                /* netCDF does not have a way of storing NaN, etc. We just use 0 byte */
-                attrVal.i8 = 0;
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
-                break;
-            default:
-                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s:%s error, unknown attrDataType=%d\n",
-                    driverName, functionName, attrDataType);
-                return asynError;
-                break;
-        }
+    while (pAttribute && (attrCount < this->attrSizes.size())) {
+        pValue = &this->attrBuffers[attrCount][record * this->attrSizes[attrCount]];
+        /* netCDF does not have a way of storing NaN, etc. Undefined values and values that
+         * cannot be converted are stored as 0 */
+        memset(pValue, 0, this->attrSizes[attrCount]);
+        pAttribute->getValue(this->attrTypes[attrCount], pValue, this->attrSizes[attrCount]);
+        attrCount++;
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
-    this->nextRecord++;
-    return(asynSuccess);
+    this->bufferedFrames++;
+    if (this->bufferedFrames < this->bufferFrames) return(asynSuccess);
+    return this->flushRecords((this->bufferFrames > 1) ? (void *)&this->dataBuffer[0] : pArray->pData);
 }
 
 /** Read NDArray data from a netCDF file; NOTE: not implemented yet.
@@ -482,13 +583,16 @@ asynStatus NDFileNetCDF::readFile(NDArray **pArray)
 asynStatus NDFileNetCDF::closeFile()
 {
     int retval;
+    asynStatus status;
     static const char *functionName = "closeFile";
 
     if (this->ncId == 0) return asynSuccess;
-    if ((retval = nc_close(this->ncId)))
-        ERR(retval);
+    /* Write the records that are still buffered */
+    status = this->flushRecords(this->dataBuffer.empty() ? NULL : &this->dataBuffer[0]);
+    retval = nc_close(this->ncId);
     this->ncId = 0;
-    return asynSuccess;
+    if (retval) ERR(retval);
+    return status;
 }
 
 
@@ -508,9 +612,16 @@ NDFileNetCDF::NDFileNetCDF(const char *portName, int queueSize, int blockingCall
                    2, 0, asynGenericPointerMask, asynGenericPointerMask, 
                    ASYN_CANBLOCK, 1, priority, 
                    /* netCDF needs a relatively large stack, make the default be large */
-                   (stackSize==0) ? epicsThreadGetStackSize(epicsThreadStackBig) : stackSize, 1)
+                   (stackSize==0) ? epicsThreadGetStackSize(epicsThreadStackBig) : stackSize, 1),
+      netCDF4(0), chunkFrames(1), deflateLevel(0), shuffle(0), bufferFrames(1), bufferedFrames(0), frameBytes(0), dataType(NDUInt8)
 {
     //static const char *functionName = "NDFileNetCDF";
+
+    createParam(NDFileNetCDFFormatString,       asynParamInt32, &NDFileNetCDFFormat);
+    createParam(NDFileNetCDFBufferFramesString, asynParamInt32, &NDFileNetCDFBufferFrames);
+    createParam(NDFileNetCDFChunkFramesString,  asynParamInt32, &NDFileNetCDFChunkFrames);
+    createParam(NDFileNetCDFDeflateLevelString, asynParamInt32, &NDFileNetCDFDeflateLevel);
+    createParam(NDFileNetCDFShuffleString,      asynParamInt32, &NDFileNetCDFShuffle);
     
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDFileNetCDF");
@@ -518,6 +629,11 @@ NDFileNetCDF::NDFileNetCDF(const char *portName, int queueSize, int blockingCall
     this->pAttributeId = NULL;
     this->ncId = 0;
     this->pFileAttributes = new NDAttributeList;
+    setIntegerParam(NDFileNetCDFFormat, NDFileNetCDFFormatClassic);
+    setIntegerParam(NDFileNetCDFBufferFrames, 1);
+    setIntegerParam(NDFileNetCDFChunkFrames, 0);
+    setIntegerParam(NDFileNetCDFDeflateLevel, 0);
+    setIntegerParam(NDFileNetCDFShuffle, 0);
 }
 
 /** Configuration routine.  Called directly, or from the iocsh function in NDFileEpics */
@@ -8,18 +8,41 @@
 #ifndef DRV_NDFileNetCDF_H
 #define DRV_NDFileNetCDF_H
 
+#include <vector>
+
 #include "NDPluginFile.h"
 
 /** This version number is an attribute in the netCDF file to allow readers
  * to handle changes in the file contents */
 #define NDNetCDFFileVersion 3.0
 
+#define NDFileNetCDFFormatString        "NETCDF_FORMAT"         /* (asynInt32, r/w) File format, NDFileNetCDFFormat_t */
+#define NDFileNetCDFBufferFramesString  "NETCDF_BUFFER_FRAMES"  /* (asynInt32, r/w) Number of arrays written with each call to netCDF */
+#define NDFileNetCDFChunkFramesString   "NETCDF_CHUNK_FRAMES"   /* (asynInt32, r/w) Number of arrays in each chunk (netCDF-4), 0=BufferFrames */
+#define NDFileNetCDFDeflateLevelString  "NETCDF_DEFLATE_LEVEL"  /* (asynInt32, r/w) Deflate compression level (netCDF-4), 0=none */
+#define NDFileNetCDFShuffleString       "NETCDF_SHUFFLE"        /* (asynInt32, r/w) Shuffle the bytes before compression (netCDF-4) */
+
+/** Format of the netCDF file */
+typedef enum {
+    NDFileNetCDFFormatClassic,  /**< netCDF classic format */
+    NDFileNetCDFFormat64Bit,    /**< netCDF 64-bit offset format, for files larger than 2 GB */
+    NDFileNetCDFFormatNetCDF4   /**< netCDF-4 (HDF5) format, supports chunking and compression */
+} NDFileNetCDFFormat_t;
+
+/** Maximum size of the I/O buffer of the netCDF library for the classic formats */
+#define NETCDF_MAX_IO_BUFFER (16*1024*1024)
+
+/** Number of records in each chunk of the per-array variables (uniqueId, timeStamp, attributes) in netCDF-4 files */
+#define NETCDF_RECORD_CHUNK 1024
+
 /** Writes NDArrays to files in the netCDF file format.
   * netCDF is an open-source, portable, self-describing binary format supported by Unidata at UCAR
   * (http://www.unidata.ucar.edu/software/netcdf).
   * The netCDF format supports arrays of any dimension and all of the data types supported by NDArray.
   * It can store multiple NDArrays in a single file, so it sets NDPluginFile::supportsMultipleArrays to 1.
   * If also can store all of the attributes associated with an NDArray.
+  * The arrays and their attributes can be buffered and written NETCDF_BUFFER_FRAMES records at a time,
+  * and netCDF-4 files can be chunked and compressed.
   * This class implements the 4 pure virtual functions from 
   * NDPluginFile: openFile, readFile, writeFile and closeFile. */
 class epicsShareClass NDFileNetCDF : public NDPluginFile {
@@ -34,7 +57,18 @@ public:
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
 
+protected:
+    int NDFileNetCDFFormat;
+    #define FIRST_NDFILE_NETCDF_PARAM NDFileNetCDFFormat
+    int NDFileNetCDFBufferFrames;
+    int NDFileNetCDFChunkFrames;
+    int NDFileNetCDFDeflateLevel;
+    int NDFileNetCDFShuffle;
+
 private:
+    asynStatus defineStorage(int varId, const size_t *chunks, int compress);
+    asynStatus flushRecords(const void *pData);
+
     int ncId;
     int arrayDataId;
     int uniqueIdId;
@@ -44,6 +78,25 @@ private:
     int nextRecord;
     int *pAttributeId;
     NDAttributeList *pFileAttributes;
+
+    /* Buffered records. With bufferFrames=1 the array data are written directly from the NDArray. */
+    int netCDF4;                           /* File is netCDF-4 */
+    int chunkFrames;                       /* Number of arrays in each chunk of array_data (netCDF-4) */
+    int deflateLevel;                      /* Deflate level (netCDF-4), 0=none */
+    int shuffle;                           /* Shuffle filter (netCDF-4) */
+    int bufferFrames;                      /* Number of records written with each call to netCDF */
+    int bufferedFrames;                    /* Number of records in the buffers */
+    size_t frameBytes;                     /* Size of the data of one array */
+    NDDataType_t dataType;                 /* Data type of the arrays in the file */
+    std::vector<size_t> dataCount;         /* Count of array_data for one record, in netCDF order */
+    std::vector<char> dataBuffer;          /* Array data of the buffered records */
+    std::vector<int> uniqueIds;
+    std::vector<double> timeStamps;
+    std::vector<epicsUInt32> epicsTSSecs;
+    std::vector<epicsUInt32> epicsTSNsecs;
+    std::vector<size_t> attrSizes;         /* Size of one value of each attribute in the file */
+    std::vector<NDAttrDataType_t> attrTypes; /* Type of each attribute in the file */
+    std::vector<std::vector<char> > attrBuffers; /* Values of each attribute of the buffered records */
 };
 
 #endif
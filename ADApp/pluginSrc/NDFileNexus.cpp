@@ -29,6 +29,40 @@
 
 static const char *driverName="NDFileNexus";
 
+/* The NeXus base classes that are written as groups */
+static const char *nexusGroupClasses[] = {
+  "NXentry", "NXinstrument", "NXsample", "NXmonitor", "NXsource", "NXuser", "NXdata",
+  "NXdetector", "NXaperature", "NXattenuator", "NXbeam_stop", "NXbending_magnet",
+  "NXcollimator", "NXcrystal", "NXdisk_chopper", "NXfermi_chopper", "NXfilter",
+  "NXflipper", "NXguide", "NXinsertion_device", "NXmirror", "NXmoderator",
+  "NXmonochromator", "NXpolarizer", "NXpositioner", "NXvelocity_selector",
+  "NXevent_data", "NXprocess", "NXcharacterization", "NXlog", "NXnote", "NXbeam",
+  "NXgeometry", "NXtranslation", "NXshape", "NXorientation", "NXenvironment",
+  "NXsensor", "NXcapillary", "NXcollection", "NXdetector_group", "NXparameters",
+  "NXsubentry", "NXxraylens"
+};
+
+static bool isNexusGroup(const char *nodeValue)
+{
+  size_t i;
+
+  for (i=0; i<sizeof(nexusGroupClasses)/sizeof(nexusGroupClasses[0]); i++) {
+    if (strcmp(nodeValue, nexusGroupClasses[i]) == 0) return true;
+  }
+  return false;
+}
+
+/* Gets an XML property as a string, returns false if the node does not have the property */
+static bool getNodeProp(xmlNode *curNode, const char *propName, std::string &value)
+{
+  xmlChar *prop = xmlGetProp(curNode, (const xmlChar *)propName);
+
+  if (prop == NULL) return false;
+  value = (const char *)prop;
+  xmlFree(prop);
+  return true;
+}
+
 /** Opens NeXus file.
   * \param[in] fileName  Absolute path name of the file to open.
   * \param[in] openMode Bit mask with one of the access mode bits NDFileModeRead, NDFileModeWrite. NDFileModeAppend.
@@ -43,6 +77,7 @@ asynStatus NDFileNexus::openFile( const char *fileName, NDFileOpenMode_t openMod
   char programName[] = "areaDetector NDFileNexus plugin v0.2";
   static const char *functionName = "openFile";
   NXstatus nxstat;
+  int rank, ii;
 
   /* Print trace information if level is set correctly */
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -54,6 +89,18 @@ asynStatus NDFileNexus::openFile( const char *fileName, NDFileOpenMode_t openMod
   /* We don't support opening an existing file for appending yet */
   if (openMode & NDFileModeAppend) return(asynError);
 
+  if (this->writePlan.empty()) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "Error %s:%s no valid template file is loaded\n", driverName, functionName);
+    return (asynError);
+  }
+
+  /* Must lock when accessing parameter library */
+  this->lock();
+  getIntegerParam(NDFileWriteMode, &this->fileWriteMode);
+  getIntegerParam(NDFileNumCapture, &this->numCapture);
+  this->unlock();
+
   /* Construct an attribute list. We use a separate attribute list
    * from the one in pArray to avoid the need to copy the array. */
   /* First clear the list*/
@@ -75,7 +122,26 @@ asynStatus NDFileNexus::openFile( const char *fileName, NDFileOpenMode_t openMod
   }
   nxstat = NXputattr( this->nxFileHandle, "creator", programName, (int)strlen(programName), NX_CHAR);
 
-  processNode(this->rootNode, pArray);
+  this->dataName[0] = '\0';
+  this->executePlan(pArray);
+
+  /* The hyperslab of each array in the data set */
+  rank = pArray->ndims;
+  for (ii=0; ii<rank; ii++) {
+    switch(this->fileWriteMode) {
+    case NDFileModeSingle:
+      this->slabOffset[(rank-1) - ii] = 0;
+      this->slabSize[(rank-1) -ii] = (int)pArray->dims[ii].size;
+      break;
+    case NDFileModeCapture:
+    case NDFileModeStream:
+      this->slabOffset[(rank) - ii] = 0;
+      this->slabSize[(rank) -ii] = (int)pArray->dims[ii].size;
+      break;
+    }
+  }
+  this->slabOffset[0] = 0;
+  this->slabSize[0] = 1;
 
   /*Print trace information if level is set correctly */
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -93,27 +159,25 @@ asynStatus NDFileNexus::openFile( const char *fileName, NDFileOpenMode_t openMod
 asynStatus NDFileNexus::writeFile(NDArray *pArray) {
   static const char *functionName = "writeFile";
 
+  asynStatus status = asynSuccess;
+
   /* Print trace information if level is set correctly */
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
             "Entering %s:%s\n", driverName, functionName );
 
-
-  /* Update attribute list. We use a separate attribute list
-   * from the one in pArray to avoid the need to copy the array. */
-  /* Get the current values of the attributes for this plugin */
-  this->getAttributes(this->pFileAttributes);
-
-  /* Now append the attributes from the array which are already up to date from
-   * the driver and prior plugins */
-  pArray->pAttributeList->copy(this->pFileAttributes);
-
-  processStreamData(pArray);
+  /* The attributes are only written when the file is opened, so they are not read again here */
+  if (processStreamData(pArray)) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s error writing array to data set %s/%s\n",
+              driverName, functionName, this->dataPath, this->dataName);
+    status = asynError;
+  }
 
   /* Print trace information if level is set correctly */
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
             "Leaving %s:%s\n", driverName, functionName );
 
-  return (asynSuccess);
+  return (status);
 }
 
 /** Read NDArray data from a NeXus file; NOT YET IMPLEMENTED.
@@ -162,398 +226,336 @@ asynStatus NDFileNexus::closeFile() {
   return status;
 }
 
-int NDFileNexus::processNode(xmlNode *curNode, NDArray *pArray) {
-  int status = 0;
-  const char *nodeName;
-  const char *nodeValue;
-  const char *nodeOuttype;
-  const char *nodeSource;
-  const char *nodeType;
-  //float data;
-  int rank;
-  NDDataType_t type;
-  int ii;
-  int dims[ND_ARRAY_MAX_DIMS];
-  int numCapture;
-  int fileWriteMode;
-  NDAttrDataType_t attrDataType;
-  NDAttribute *pAttr;
-  size_t attrDataSize;
-  size_t nodeTextLen;
-  int wordSize;
-  int dataOutType=NDInt8;
-  size_t numWords;
-  int numItems = 0;
-  int addr =0;
-  void *pValue;
+/** Compiles the children of an element of the XML template into the write plan.
+  * \param[in] curNode The element */
+void NDFileNexus::compileChildren(xmlNode *curNode) {
+  xmlNode *childNode;
+
+  for(childNode = curNode->children; childNode; childNode = childNode->next) {
+    if (childNode->type <2 ){
+      this->compileNode(childNode);
+    }
+  }
+  return;
+}
+
+/** Converts the text of a CONST element to its outtype.
+  * \param[in] curNode The element
+  * \param[out] pStep The step; its dataType, length and value are set
+  * \return false if the outtype is invalid */
+bool NDFileNexus::compileConst(xmlNode *curNode, NDFileNexusStep_t *pStep) {
+  std::string nodeOuttype = "NX_CHAR";
   char nodeText[256];
-  NXname dataclass;
-  NXname dPath;
-  static const char *functionName = "processNode";
+  static const char *functionName = "compileConst";
 
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-            "Entering %s:%s\n", driverName, functionName );
+  this->findConstText(curNode, nodeText);
+  getNodeProp(curNode, "outtype", nodeOuttype);
+  pStep->dataType = this->typeStringToVal(nodeOuttype.c_str());
+  if (pStep->dataType < 0) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s outtype %s for node %s is invalid\n",
+              driverName, functionName, nodeOuttype.c_str(), pStep->name.c_str());
+    return false;
+  }
+  if (pStep->dataType == NX_CHAR) {
+    pStep->length = (int)strlen(nodeText);
+  }
+  else {
+    pStep->length = 1;
+  }
+  /* Large enough for the string and its terminator, or for one number of any type */
+  pStep->value.assign(strlen(nodeText) + sizeof(epicsFloat64), 0);
+  this->constTextToDataType(nodeText, pStep->dataType, &pStep->value[0]);
+  return true;
+}
 
-  /* Must lock when accessing parameter library */
-  this->lock();
-  getIntegerParam(addr, NDFileWriteMode, &fileWriteMode);
-  getIntegerParam(addr, NDFileNumCapture, &numCapture);
-  this->unlock();
+/** Compiles an element of the XML template and its children into steps of the write plan.
+  * \param[in] curNode The element */
+void NDFileNexus::compileNode(xmlNode *curNode) {
+  const char *nodeValue = (const char *)curNode->name;
+  std::string nodeType;
+  bool hasType;
+  NDFileNexusStep_t step;
+  size_t begin;
+  char nodeText[256];
+  static const char *functionName = "compileNode";
 
-  nodeValue = (const char *)curNode->name;
   asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
             "%s:%s  Value=%s Type=%d\n", driverName, functionName,
             curNode->content, curNode->type);
-  nodeType = (const char *)xmlGetProp(curNode, (const xmlChar *)"type");
-  NXstatus stat;
+  hasType = getNodeProp(curNode, "type", nodeType);
+  step.dataType = NX_CHAR;
+  step.length = 0;
+  step.end = 0;
+
   if (strcmp (nodeValue, "NXroot") == 0) {
-    this->iterateNodes(curNode, pArray);
+    this->compileChildren(curNode);
   }  /*  only include all the NeXus base classes */
-  else if ((strcmp (nodeValue, "NXentry") ==0) ||
-           (strcmp (nodeValue, "NXinstrument") ==0) ||
-           (strcmp (nodeValue, "NXsample") ==0) ||
-           (strcmp (nodeValue, "NXmonitor") ==0) ||
-           (strcmp (nodeValue, "NXsource") ==0) ||
-           (strcmp (nodeValue, "NXuser") ==0) ||
-           (strcmp (nodeValue, "NXdata") ==0) ||
-           (strcmp (nodeValue, "NXdetector") ==0) ||
-           (strcmp (nodeValue, "NXaperature") ==0) ||
-           (strcmp (nodeValue, "NXattenuator") ==0) ||
-           (strcmp (nodeValue, "NXbeam_stop") ==0) ||
-           (strcmp (nodeValue, "NXbending_magnet") ==0) ||
-           (strcmp (nodeValue, "NXcollimator") ==0) ||
-           (strcmp (nodeValue, "NXcrystal") ==0) ||
-           (strcmp (nodeValue, "NXdisk_chopper") ==0) ||
-           (strcmp (nodeValue, "NXfermi_chopper") ==0) ||
-           (strcmp (nodeValue, "NXfilter") ==0) ||
-           (strcmp (nodeValue, "NXflipper") ==0) ||
-           (strcmp (nodeValue, "NXguide") ==0) ||
-           (strcmp (nodeValue, "NXinsertion_device") ==0) ||
-           (strcmp (nodeValue, "NXmirror") ==0) ||
-           (strcmp (nodeValue, "NXmoderator") ==0) ||
-           (strcmp (nodeValue, "NXmonochromator") ==0) ||
-           (strcmp (nodeValue, "NXpolarizer") ==0) ||
-           (strcmp (nodeValue, "NXpositioner") ==0) ||
-           (strcmp (nodeValue, "NXvelocity_selector") ==0) ||
-           (strcmp (nodeValue, "NXevent_data") ==0) ||
-           (strcmp (nodeValue, "NXprocess") ==0) ||
-           (strcmp (nodeValue, "NXcharacterization") ==0) ||
-           (strcmp (nodeValue, "NXlog") ==0) ||
-           (strcmp (nodeValue, "NXnote") ==0) ||
-           (strcmp (nodeValue, "NXbeam") ==0) ||
-           (strcmp (nodeValue, "NXgeometry") ==0) ||
-           (strcmp (nodeValue, "NXtranslation") ==0) ||
-           (strcmp (nodeValue, "NXshape") ==0) ||
-           (strcmp (nodeValue, "NXorientation") ==0) ||
-           (strcmp (nodeValue, "NXenvironment") ==0) ||
-           (strcmp (nodeValue, "NXsensor") ==0) ||
-           (strcmp (nodeValue, "NXcapillary") ==0) ||
-           (strcmp (nodeValue, "NXcollection") ==0) ||
-           (strcmp (nodeValue, "NXdetector_group") ==0) ||
-           (strcmp (nodeValue, "NXparameters") ==0) ||
-           (strcmp (nodeValue, "NXsubentry") ==0) ||
-           (strcmp (nodeValue, "NXxraylens") ==0) ||
-           (nodeType && strcmp (nodeType, "UserGroup") == 0) ) {
-  nodeName = (const char *)xmlGetProp(curNode, (const xmlChar *)"name");
-  if (nodeName == NULL) {
-    nodeName = nodeValue;
-  }
-  stat = NXmakegroup(this->nxFileHandle, (const char *)nodeName, (const char *)nodeValue);
-  stat |= NXopengroup(this->nxFileHandle, (const char *)nodeName, (const char *)nodeValue);
-  if (stat != NX_OK ) {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s Error creating group %s %s\n",
-              driverName, functionName, nodeName, nodeValue);
-  }
-  this->iterateNodes(curNode, pArray);
-  stat = NXclosegroup(this->nxFileHandle);
-  if (stat != NX_OK ) {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s Error closing group %s %s\n",
-              driverName, functionName, nodeName, nodeValue);
+  else if (isNexusGroup(nodeValue) || (hasType && (nodeType == "UserGroup"))) {
+    step.op = NDNexusOpenGroup;
+    if (!getNodeProp(curNode, "name", step.name)) {
+      step.name = nodeValue;
     }
+    step.nxClass = nodeValue;
+    this->writePlan.push_back(step);
+    this->compileChildren(curNode);
+    step.op = NDNexusCloseGroup;
+    this->writePlan.push_back(step);
   }
   else if (strcmp (nodeValue, "Attr") ==0) {
-    nodeName = (const char *)xmlGetProp(curNode, (const xmlChar *)"name");
-    nodeSource = (const char *)xmlGetProp(curNode, (const xmlChar *)"source");
-    if (nodeType && strcmp(nodeType, "ND_ATTR") == 0 ) {
-      pAttr = this->pFileAttributes->find(nodeSource);
-      if (pAttr != NULL ){
-        pAttr->getValueInfo(&attrDataType, &attrDataSize);
-        this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
-
-        if (dataOutType > 0) {
-          pValue = calloc( attrDataSize, wordSize );
-          pAttr->getValue(attrDataType, (char *)pValue, attrDataSize*wordSize);
-
-          NXputattr(this->nxFileHandle, nodeName, pValue, (int)(attrDataSize/wordSize), dataOutType);
-
-          free(pValue);
-        }
-      }
-      else {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                  "%s:%s Could not find attribute named %s\n",
-                  driverName, functionName, nodeSource);
-      }
+    getNodeProp(curNode, "name", step.name);
+    getNodeProp(curNode, "source", step.source);
+    if (hasType && (nodeType == "ND_ATTR")) {
+      step.op = NDNexusNDAttr;
+      this->writePlan.push_back(step);
     }
-    else if (nodeType && strcmp(nodeType, "CONST") == 0 ) {
-      this->findConstText( curNode, nodeText);
-      nodeOuttype = (const char *)xmlGetProp(curNode, (const xmlChar *)"outtype");
-      if (nodeOuttype == NULL){
-        nodeOuttype = "NX_CHAR";
-      }
-      dataOutType = this->typeStringToVal((const char *)nodeOuttype);
-      if ( dataOutType == NX_CHAR ) {
-        nodeTextLen = strlen(nodeText);
+    else if (hasType && (nodeType == "CONST")) {
+      step.op = NDNexusConstAttr;
+      if (this->compileConst(curNode, &step)) {
+        this->writePlan.push_back(step);
       }
-      else {
-        nodeTextLen = 1;
-      }
-      pValue = allocConstValue( dataOutType, nodeTextLen);
-      constTextToDataType(nodeText, dataOutType, pValue);
-      NXputattr(this->nxFileHandle, nodeName, pValue, (int)nodeTextLen, dataOutType);
-      free(pValue);
-
     }
-    else if (nodeType) {
+    else if (hasType) {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s:%s Node type %s for node %s is invalid\n",
-                driverName, functionName, nodeType, nodeValue);
+                driverName, functionName, nodeType.c_str(), nodeValue);
     }
   }
-
   else {
-    nodeSource = (const char *)xmlGetProp(curNode, (const xmlChar *)"source");
-    if (nodeType && strcmp(nodeType, "ND_ATTR") == 0 ) {
-      pAttr = this->pFileAttributes->find(nodeSource);
-      if ( pAttr != NULL) {
-        pAttr->getValueInfo(&attrDataType, &attrDataSize);
-        this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
-
-        if (dataOutType > 0) {
-          pValue = calloc( attrDataSize, wordSize );
-          pAttr->getValue(attrDataType, (char *)pValue, attrDataSize);
-
-          numWords = attrDataSize/wordSize;
-          NXmakedata( this->nxFileHandle, nodeValue, dataOutType, 1, (int *)&(numWords));
-          NXopendata(this->nxFileHandle, nodeValue);
-          NXputdata(this->nxFileHandle, (char *)pValue);
-          free(pValue);
-          this->iterateNodes(curNode, pArray);
-          NXclosedata(this->nxFileHandle);
-        }
+    step.name = nodeValue;
+    getNodeProp(curNode, "source", step.source);
+    if (hasType && (nodeType == "ND_ATTR")) {
+      step.op = NDNexusNDAttrData;
+    }
+    else if (hasType && (nodeType == "pArray")) {
+      step.op = NDNexusArrayData;
+    }
+    else if (hasType && (nodeType == "CONST")) {
+      step.op = NDNexusConstData;
+      if (!this->compileConst(curNode, &step)) return;
+    }
+    else if (hasType) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s Node type %s for node %s is invalid\n",
+                driverName, functionName, nodeType.c_str(), nodeValue);
+      return;
+    }
+    else {
+      this->findConstText( curNode, nodeText);
+      if (strlen(nodeText) == 0) {
+        sprintf(nodeText, "LEFT BLANK");
       }
-      else {
+      step.op = NDNexusConstData;
+      step.dataType = NX_CHAR;
+      step.length = (int)strlen(nodeText);
+      step.value.assign(nodeText, nodeText + strlen(nodeText) + 1);
+    }
+    begin = this->writePlan.size();
+    this->writePlan.push_back(step);
+    this->compileChildren(curNode);
+    step.op = NDNexusCloseData;
+    step.value.clear();
+    this->writePlan.push_back(step);
+    this->writePlan[begin].end = this->writePlan.size();
+  }
+}
+
+/** Executes the write plan, creating the groups and data sets of a new file.
+  * \param[in] pArray The first NDArray of the file */
+void NDFileNexus::executePlan(NDArray *pArray) {
+  NDFileNexusStep_t *pStep;
+  NDAttribute *pAttr;
+  NDAttrDataType_t attrDataType;
+  size_t attrDataSize;
+  int dataOutType=NDInt8;
+  int wordSize;
+  int numWords;
+  int rank;
+  int ii;
+  int dims[ND_ARRAY_MAX_DIMS+1];
+  int numItems = 0;
+  std::vector<char> value;
+  NXname dataclass;
+  NXname dPath;
+  NXstatus stat;
+  size_t step;
+  static const char *functionName = "executePlan";
+
+  for (step=0; step<this->writePlan.size(); step++) {
+    pStep = &this->writePlan[step];
+    switch (pStep->op) {
+    case NDNexusOpenGroup:
+      stat = NXmakegroup(this->nxFileHandle, pStep->name.c_str(), pStep->nxClass.c_str());
+      stat |= NXopengroup(this->nxFileHandle, pStep->name.c_str(), pStep->nxClass.c_str());
+      if (stat != NX_OK ) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s Error creating group %s %s\n",
+                  driverName, functionName, pStep->name.c_str(), pStep->nxClass.c_str());
+      }
+      break;
+
+    case NDNexusCloseGroup:
+      stat = NXclosegroup(this->nxFileHandle);
+      if (stat != NX_OK ) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s Error closing group %s %s\n",
+                  driverName, functionName, pStep->name.c_str(), pStep->nxClass.c_str());
+      }
+      break;
+
+    case NDNexusConstAttr:
+      NXputattr(this->nxFileHandle, pStep->name.c_str(), &pStep->value[0], pStep->length, pStep->dataType);
+      break;
+
+    case NDNexusNDAttr:
+      pAttr = this->pFileAttributes->find(pStep->source.c_str());
+      if (pAttr == NULL) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s Could not find attribute named %s\n",
+                  driverName, functionName, pStep->source.c_str());
+        break;
+      }
+      pAttr->getValueInfo(&attrDataType, &attrDataSize);
+      this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
+      if (dataOutType > 0) {
+        value.assign(attrDataSize * wordSize + 1, 0);
+        pAttr->getValue(attrDataType, &value[0], attrDataSize*wordSize);
+        NXputattr(this->nxFileHandle, pStep->name.c_str(), &value[0], (int)(attrDataSize/wordSize), dataOutType);
+      }
+      break;
+
+    case NDNexusConstData:
+      NXmakedata( this->nxFileHandle, pStep->name.c_str(), pStep->dataType, 1, &pStep->length);
+      NXopendata(this->nxFileHandle, pStep->name.c_str());
+      NXputdata(this->nxFileHandle, &pStep->value[0]);
+      break;
+
+    case NDNexusNDAttrData:
+      pAttr = this->pFileAttributes->find(pStep->source.c_str());
+      if (pAttr == NULL) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                   "%s:%s Could not add node %s could not find an attribute by that name\n",
-                  driverName, functionName, nodeSource);
+                  driverName, functionName, pStep->source.c_str());
+        /* Skip the attributes of the data set */
+        step = pStep->end - 1;
+        break;
       }
-    }
-    else if (nodeType && strcmp(nodeType, "pArray") == 0 ){
+      pAttr->getValueInfo(&attrDataType, &attrDataSize);
+      this->getAttrTypeNSize(pAttr, &dataOutType, &wordSize);
+      if (dataOutType <= 0) {
+        step = pStep->end - 1;
+        break;
+      }
+      value.assign(attrDataSize * wordSize + 1, 0);
+      pAttr->getValue(attrDataType, &value[0], attrDataSize);
+      numWords = (int)(attrDataSize/wordSize);
+      NXmakedata( this->nxFileHandle, pStep->name.c_str(), dataOutType, 1, &numWords);
+      NXopendata(this->nxFileHandle, pStep->name.c_str());
+      NXputdata(this->nxFileHandle, &value[0]);
+      break;
 
+    case NDNexusArrayData:
       rank = pArray->ndims;
-      type = pArray->dataType;
       for (ii=0; ii<rank; ii++) {
         dims[(rank-1) - ii] = (int)pArray->dims[ii].size;
       }
 
-      switch(type) {
+      switch(pArray->dataType) {
         case NDInt8:
           dataOutType = NX_INT8;
-          wordSize = 1;
           break;
         case NDUInt8:
           dataOutType = NX_UINT8;
-          wordSize = 1;
           break;
         case NDInt16:
           dataOutType = NX_INT16;
-          wordSize = 2;
           break;
         case NDUInt16:
           dataOutType = NX_UINT16;
-          wordSize = 2;
           break;
         case NDInt32:
           dataOutType = NX_INT32;
-          wordSize = 4;
           break;
         case NDUInt32:
           dataOutType = NX_UINT32;
-          wordSize = 4;
           break;
         case NDInt64:
           dataOutType = NX_INT64;
-          wordSize = 8;
           break;
         case NDUInt64:
           dataOutType = NX_UINT64;
-          wordSize = 8;
           break;
         case NDFloat32:
           dataOutType = NX_FLOAT32;
-          wordSize = 4;
           break;
         case NDFloat64:
           dataOutType = NX_FLOAT64;
-          wordSize = 8;
           break;
-        }
+      }
 
-        asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
-                  "%s:%s Starting to write data making group\n", driverName, functionName );
+      asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
+                "%s:%s Starting to write data making group\n", driverName, functionName );
 
-      if ( fileWriteMode == NDFileModeSingle ) {
-          NXmakedata( this->nxFileHandle, nodeValue, dataOutType, rank, dims);
+      if ( this->fileWriteMode == NDFileModeSingle ) {
+        NXmakedata( this->nxFileHandle, pStep->name.c_str(), dataOutType, rank, dims);
       }
-      else if ((fileWriteMode == NDFileModeCapture) ||
-               (fileWriteMode == NDFileModeStream)) {
+      else if ((this->fileWriteMode == NDFileModeCapture) ||
+               (this->fileWriteMode == NDFileModeStream)) {
         for (ii = 0; ii < rank; ii++) {
           dims[(rank) - ii] = dims[(rank-1) - ii];
         }
         rank = rank +1;
-        dims[0] = numCapture;
-        NXmakedata( this->nxFileHandle, nodeValue, dataOutType, rank, dims);
+        dims[0] = this->numCapture;
+        NXmakedata( this->nxFileHandle, pStep->name.c_str(), dataOutType, rank, dims);
       }
       dPath[0] = '\0';
       dataclass[0] = '\0';
 
-      NXopendata(this->nxFileHandle, nodeValue);
+      NXopendata(this->nxFileHandle, pStep->name.c_str());
       // If you are having problems with NXgetgroupinfo in Visual Studio,
       // Checkout this link: http://trac.nexusformat.org/code/ticket/217
       // Fixed in Nexus 4.2.1
-      //printf("%s:%s: calling NXgetgroupinfo!\n", driverName, functionName);
       NXgetgroupinfo(this->nxFileHandle, &numItems, dPath, dataclass);
-      //printf("dPath=%s, nodeValue=%s\n", dPath, nodeValue );
-      sprintf(this->dataName, "%s", nodeValue);
-      sprintf(this->dataPath, "%c%s", '/', dPath);
-      this->iterateNodes(curNode, pArray);
-      NXclosedata(this->nxFileHandle);
-    }
-    else if (nodeType && strcmp(nodeType, "CONST") == 0 ){
-      this->findConstText( curNode, nodeText);
-
-      nodeOuttype = (const char *)xmlGetProp(curNode, (const xmlChar *)"outtype");
-      if (nodeOuttype == NULL){
-        nodeOuttype = "NX_CHAR";
-      }
-      dataOutType = this->typeStringToVal(nodeOuttype);
-      if ( dataOutType == NX_CHAR ) {
-        nodeTextLen = strlen(nodeText);
-      }
-      else {
-        nodeTextLen = 1;
-      }
-      pValue = allocConstValue( dataOutType, nodeTextLen);
-      constTextToDataType(nodeText, dataOutType, pValue);
-
-      NXmakedata( this->nxFileHandle, nodeValue, dataOutType, 1, (int *)&nodeTextLen);
-      NXopendata(this->nxFileHandle, nodeValue);
-      NXputdata(this->nxFileHandle, pValue);
-      free(pValue);
-      this->iterateNodes(curNode, pArray);
-      NXclosedata(this->nxFileHandle);
-    }
-    else if (nodeType) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s Node type %s for node %s is invalid\n",
-                driverName, functionName, nodeType, nodeValue);
-    }
-    else {
-      this->findConstText( curNode, nodeText);
-
-      dataOutType = NX_CHAR;
-      nodeTextLen = strlen(nodeText);
-
-      if (nodeTextLen == 0) {
-        sprintf(nodeText, "LEFT BLANK");
-        nodeTextLen = strlen(nodeText);
-      }
-
-      pValue = allocConstValue( dataOutType, nodeTextLen);
-      constTextToDataType(nodeText, dataOutType, pValue);
+      epicsSnprintf(this->dataName, sizeof(this->dataName), "%s", pStep->name.c_str());
+      epicsSnprintf(this->dataPath, sizeof(this->dataPath), "%c%s", '/', dPath);
+      break;
 
-      NXmakedata( this->nxFileHandle, nodeValue, dataOutType, 1, (int *)&nodeTextLen);
-      NXopendata(this->nxFileHandle, nodeValue);
-      NXputdata(this->nxFileHandle, pValue);
-      this->iterateNodes(curNode, pArray);
+    case NDNexusCloseData:
       NXclosedata(this->nxFileHandle);
+      break;
     }
   }
-  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-            "Leaving %s:%s\n", driverName, functionName );
-  return (status);
 }
 
+/** Appends an NDArray to the data set of the NDArrays.
+  * The data set is opened for the first array of the file and stays open until the last one.
+  * \param[in] pArray The NDArray
+  * \return 0 if the array was written */
 int NDFileNexus::processStreamData(NDArray *pArray) {
-  int fileWriteMode;
-  int numCapture;
-  int slabOffset[ND_ARRAY_MAX_DIMS];
-  int slabSize[ND_ARRAY_MAX_DIMS];
-  int rank;
-  int ii;
-  int addr = 0;
-  //static const char *functionName = "processNode";
-
-  /* Must lock when accessing parameter library */
-  this->lock();
-  getIntegerParam(addr, NDFileWriteMode, &fileWriteMode);
-  getIntegerParam(addr, NDFileNumCapture, &numCapture);
-  this->unlock();
-  
-  rank = pArray->ndims;
-  for (ii=0; ii<rank; ii++) {
-    switch(fileWriteMode) {
-    case NDFileModeSingle:
-      slabOffset[(rank-1) - ii] = 0;
-      slabSize[(rank-1) -ii] = (int)pArray->dims[ii].size;
-      break;
-    case NDFileModeCapture:
-    case NDFileModeStream:
-      slabOffset[(rank) - ii] = 0;
-      slabSize[(rank) -ii] = (int)pArray->dims[ii].size;
-      break;
-    }
-  }
+  NXstatus stat = NX_ERROR;
 
-  //printf ("%s: dataPath %s\ndataName %s\nimageNumber %d\n", functionName, this->dataPath, this->dataName, this->imageNumber);
+  if (this->dataName[0] == '\0') return -1;
   if (this->imageNumber == 0) {
     NXopenpath( this->nxFileHandle, this->dataPath);
     NXopendata( this->nxFileHandle, this->dataName);
   }
-  switch (fileWriteMode) {
+  switch (this->fileWriteMode) {
     case NDFileModeSingle:
-      NXputdata(this->nxFileHandle, pArray->pData);
+      stat = NXputdata(this->nxFileHandle, pArray->pData);
       break;
     case NDFileModeCapture:
     case NDFileModeStream:
-      rank = rank+1;
-      slabOffset[0] = this->imageNumber;
-      slabSize[0] = 1;
-
-      NXputslab(this->nxFileHandle, pArray->pData, slabOffset, slabSize);
+      this->slabOffset[0] = this->imageNumber;
+      stat = NXputslab(this->nxFileHandle, pArray->pData, this->slabOffset, this->slabSize);
       break;
   }
-  if (this-> imageNumber == (numCapture-1) ) {
+  if (this-> imageNumber == (this->numCapture-1) ) {
     NXclosedata(this->nxFileHandle);
     NXclosegroup(this->nxFileHandle );
   }
 
   this->imageNumber++;
-  return 0;
-
-}
-
-void NDFileNexus::iterateNodes(xmlNode *curNode, NDArray *pArray) {
-  xmlNode *childNode;
-
-  for(childNode = curNode->children; childNode; childNode = childNode->next) {
-    if (childNode->type <2 ){
-      this->processNode(childNode, pArray);
-    }
-  }
-  return;
+  return (stat == NX_OK) ? 0 : -1;
 }
 
 void NDFileNexus::getAttrTypeNSize(NDAttribute *pAttr, int *retType, int *retSize) {
@@ -639,42 +641,6 @@ void NDFileNexus::findConstText(xmlNode *curNode, char *outtext) {
   return;
 }
 
-void * NDFileNexus::allocConstValue(int dataType, size_t length ) {
-  void *pValue;
-  switch (dataType) {
-    case  NX_INT8:
-    case NX_UINT8:
-      pValue = calloc( length, sizeof(char) );
-      break;
-    case NX_INT16:
-    case NX_UINT16:
-      pValue = calloc( length, sizeof(short) );
-      break;
-    case NX_INT32:
-    case NX_UINT32:
-      pValue = calloc( length, sizeof(int) );
-      break;
-    case NX_INT64:
-    case NX_UINT64:
-      pValue = calloc( length, sizeof(epicsInt64) );
-      break;
-    case NX_FLOAT32:
-      pValue = calloc( length, sizeof(float) );
-      break;
-    case NX_FLOAT64:
-      pValue = calloc( length, sizeof(double) );
-      break;
-    case NX_CHAR:
-      pValue = calloc( length + 1 , sizeof(char) );
-      break;
-    case NDAttrUndefined:
-    default:
-      pValue = NULL;
-      break;
-  }
-  return pValue;
-}
-
 void NDFileNexus::constTextToDataType(char *inText, int dataType, void *pValue) {
   double dval;
   int ival;
@@ -826,6 +792,7 @@ void NDFileNexus::loadTemplateFile() {
   char fullFilename[2*MAX_FILENAME_LEN] = "";
   char template_path[MAX_FILENAME_LEN] = "";
   char template_file[MAX_FILENAME_LEN] = "";
+  xmlDoc *configDoc;
   static const char *functionName = "loadTemplateFile";
 
   /* get the filename to be used for nexus template */
@@ -835,9 +802,9 @@ void NDFileNexus::loadTemplateFile() {
   sprintf(fullFilename, "%s%s", template_path, template_file);
 
   /* Load the Nexus template file */
-  this->configDoc = xmlReadFile(fullFilename, NULL, 0);
+  configDoc = xmlReadFile(fullFilename, NULL, 0);
 
-  if (this->configDoc == NULL){
+  if (configDoc == NULL){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Parameter file %s is invalid\n",
               driverName, functionName, fullFilename);
@@ -845,16 +812,17 @@ void NDFileNexus::loadTemplateFile() {
     callParamCallbacks(addr, addr);
     return;
   }
-  else {
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-              "%s:%s: Parameter file %s was successfully loaded\n",
-              driverName, functionName, fullFilename);
-    setIntegerParam(addr, NDFileNexusTemplateValid, 1);
-    callParamCallbacks(addr, addr);
-  }
 
-  this->rootNode = xmlDocGetRootElement(this->configDoc);
+  /* Compile the template into the write plan; the document is not needed after that */
+  this->writePlan.clear();
+  this->compileNode(xmlDocGetRootElement(configDoc));
+  xmlFreeDoc(configDoc);
 
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: Parameter file %s was successfully loaded, %d steps\n",
+            driverName, functionName, fullFilename, (int)this->writePlan.size());
+  setIntegerParam(addr, NDFileNexusTemplateValid, 1);
+  callParamCallbacks(addr, addr);
 }
 
 /** Constructor for NDFileNexus; all parameters are simply passed to NDPluginFile::NDPluginFile.
@@ -889,6 +857,10 @@ NDFileNexus::NDFileNexus(const char *portName, int queueSize, int blockingCallba
 
   this->pFileAttributes = new NDAttributeList;
   this->imageNumber = 0;
+  this->fileWriteMode = NDFileModeSingle;
+  this->numCapture = 0;
+  this->dataName[0] = '\0';
+  this->dataPath[0] = '\0';
   setIntegerParam(NDFileNexusTemplateValid, 0);
 
   this->supportsMultipleArrays = 1;
@@ -8,6 +8,9 @@
 #ifndef DRV_NDFileNexus_H
 #define DRV_NDFileNexus_H
 
+#include <string>
+#include <vector>
+
 #include "NDPluginFile.h"
 #include <napi.h>
 #include <libxml/parser.h>
@@ -22,11 +25,36 @@
 #define NDFileNexusTemplateValidString "TEMPLATE_FILE_VALID"
 #define NUM_ND_FILE_NEXUS_PARAMS (sizeof(NDFileNexusParamString)/sizeof(NDFileNexusParamString[0]))
 
+/** Operation of a step of the write plan compiled from the XML template */
+typedef enum {
+    NDNexusOpenGroup,   /**< Create and open a group */
+    NDNexusCloseGroup,  /**< Close the group */
+    NDNexusConstAttr,   /**< Write an attribute with a constant value */
+    NDNexusNDAttr,      /**< Write an attribute with the value of an NDAttribute */
+    NDNexusConstData,   /**< Create, open and write a data set with a constant value */
+    NDNexusNDAttrData,  /**< Create, open and write a data set with the value of an NDAttribute */
+    NDNexusArrayData,   /**< Create and open the data set of the NDArrays */
+    NDNexusCloseData    /**< Close the data set */
+} NDFileNexusOp_t;
+
+/** A step of the write plan. The constants of the template are converted to their NeXus type
+  * when the template is loaded, so writing a file does not parse the template again. */
+typedef struct {
+    NDFileNexusOp_t op;
+    std::string name;        /**< Name of the group, data set or attribute */
+    std::string nxClass;     /**< NeXus class of a group */
+    std::string source;      /**< Name of the NDAttribute of NDNexusNDAttr and NDNexusNDAttrData */
+    int dataType;            /**< NeXus data type of a constant */
+    int length;              /**< Number of elements of a constant */
+    std::vector<char> value; /**< Value of a constant */
+    size_t end;              /**< Index of the step after the NDNexusCloseData of a data set */
+} NDFileNexusStep_t;
+
 /** Writes NDArrays in the NeXus file format.
   * Uses an XML template file to configure the contents of the NeXus file.
   *
-  * This version is currently limited to writing a single NDArray to each NeXus file.
-  * Future releases will be capable of storing multiple NDArrays in each NeXus file.
+  * The template is compiled into a write plan when it is loaded. Opening a file executes the plan,
+  * and each NDArray is then appended to the data set of the NDArrays.
   */
 class epicsShareClass NDFileNexus : public NDPluginFile {
 public:
@@ -51,19 +79,23 @@ private:
     NXhandle nxFileHandle;
     int bitsPerSample;
     NDColorMode_t colorMode;
-    xmlDoc *configDoc;
-    xmlNodePtr rootNode;
+    std::vector<NDFileNexusStep_t> writePlan;
     NDAttributeList *pFileAttributes;
     NXname dataPath;
     NXname dataName;
     int imageNumber;
+    int fileWriteMode;
+    int numCapture;
+    int slabOffset[ND_ARRAY_MAX_DIMS+1];
+    int slabSize[ND_ARRAY_MAX_DIMS+1];
 
-    int processNode(xmlNode *curNode, NDArray *);
+    void compileNode(xmlNode *curNode);
+    void compileChildren(xmlNode *curNode);
+    bool compileConst(xmlNode *curNode, NDFileNexusStep_t *pStep);
+    void executePlan(NDArray *pArray);
     int processStreamData(NDArray *);
     void getAttrTypeNSize(NDAttribute *pAttr, int *retType, int *retSize);
-    void iterateNodes(xmlNode *curNode, NDArray *pArray);
     void findConstText(xmlNode *curNode, char *outtext);
-    void * allocConstValue(int dataType, size_t length);
     void constTextToDataType(char *inText, int dataType, void *pValue);
     int typeStringToVal( const char * typeStr );
     void loadTemplateFile();
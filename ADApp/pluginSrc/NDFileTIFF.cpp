@@ -22,12 +22,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
 
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
 #include <epicsEvent.h>
 #include <epicsTime.h>
+#include <epicsAtomic.h>
 #include <iocsh.h>
 
 #include <asynDriver.h>
@@ -36,6 +38,21 @@
 #include "NDPluginFile.h"
 #include "tiffio.h"
 #include "NDFileTIFF.h"
+#include "NDWorkerPool.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#define fileSeek _fseeki64
+#else
+#define fileSeek fseeko
+#endif
 
 #define STRING_BUFFER_SIZE 2048
  
@@ -72,6 +89,295 @@ static void augmentLibTiffWithCustomTags() {
 }
 
 
+/* Write buffer used through TIFFClientOpen when TIFF_WRITE_BUFFER > 0.
+ * The strips, tiles and directories of successive arrays are collected and written
+ * to the file in blocks of up to size bytes. Writes that land inside the pending
+ * block, such as the link from the previous directory to the next one, are made in
+ * the buffer, so a multi-frame file is written with a few large writes. */
+typedef struct {
+    FILE *file;
+    char *data;
+    size_t size;                /* Capacity of data */
+    size_t length;              /* Number of pending bytes in data */
+    toff_t start;               /* File offset of data[0] */
+    toff_t pos;                 /* Current file offset */
+    toff_t end;                 /* Size of the file, including the pending bytes */
+} writeBuffer_t;
+
+static int flushWriteBuffer(writeBuffer_t *pBuf)
+{
+    if (pBuf->length == 0) return 0;
+    if ((fileSeek(pBuf->file, pBuf->start, SEEK_SET) != 0) ||
+        (fwrite(pBuf->data, 1, pBuf->length, pBuf->file) != pBuf->length)) return -1;
+    pBuf->length = 0;
+    return 0;
+}
+
+static tsize_t writeBufferRead(thandle_t handle, tdata_t data, tsize_t size)
+{
+    writeBuffer_t *pBuf = (writeBuffer_t *)handle;
+    size_t count = (size_t)size;
+    size_t nread;
+
+    if ((pBuf->length > 0) && (pBuf->pos < pBuf->start + pBuf->length) && (pBuf->pos + count > pBuf->start)) {
+        if ((pBuf->pos >= pBuf->start) && (pBuf->pos + count <= pBuf->start + pBuf->length)) {
+            memcpy(data, pBuf->data + (pBuf->pos - pBuf->start), count);
+            pBuf->pos += count;
+            return size;
+        }
+        if (flushWriteBuffer(pBuf)) return -1;
+    }
+    if (fileSeek(pBuf->file, pBuf->pos, SEEK_SET) != 0) return -1;
+    nread = fread(data, 1, count, pBuf->file);
+    pBuf->pos += nread;
+    return (tsize_t)nread;
+}
+
+static tsize_t writeBufferWrite(thandle_t handle, tdata_t data, tsize_t size)
+{
+    writeBuffer_t *pBuf = (writeBuffer_t *)handle;
+    size_t count = (size_t)size;
+
+    if ((pBuf->length > 0) && (pBuf->pos >= pBuf->start) && (pBuf->pos <= pBuf->start + pBuf->length) &&
+        (pBuf->pos + count <= pBuf->start + pBuf->size)) {
+        size_t offset = (size_t)(pBuf->pos - pBuf->start);
+        memcpy(pBuf->data + offset, data, count);
+        if (offset + count > pBuf->length) pBuf->length = offset + count;
+    } else {
+        if (flushWriteBuffer(pBuf)) return -1;
+        if (count >= pBuf->size) {
+            if ((fileSeek(pBuf->file, pBuf->pos, SEEK_SET) != 0) ||
+                (fwrite(data, 1, count, pBuf->file) != count)) return -1;
+        } else {
+            memcpy(pBuf->data, data, count);
+            pBuf->start = pBuf->pos;
+            pBuf->length = count;
+        }
+    }
+    pBuf->pos += count;
+    if (pBuf->pos > pBuf->end) pBuf->end = pBuf->pos;
+    return size;
+}
+
+static toff_t writeBufferSeek(thandle_t handle, toff_t offset, int whence)
+{
+    writeBuffer_t *pBuf = (writeBuffer_t *)handle;
+
+    switch (whence) {
+        case SEEK_SET: pBuf->pos = offset; break;
+        case SEEK_CUR: pBuf->pos += offset; break;
+        case SEEK_END: pBuf->pos = pBuf->end + offset; break;
+    }
+    return pBuf->pos;
+}
+
+static int writeBufferClose(thandle_t handle)
+{
+    writeBuffer_t *pBuf = (writeBuffer_t *)handle;
+    int status = flushWriteBuffer(pBuf);
+
+    if (fclose(pBuf->file) != 0) status = -1;
+    free(pBuf->data);
+    free(pBuf);
+    return status;
+}
+
+static toff_t writeBufferSize(thandle_t handle)
+{
+    return ((writeBuffer_t *)handle)->end;
+}
+
+static int writeBufferMap(thandle_t, tdata_t *, toff_t *)
+{
+    return 0;
+}
+
+static void writeBufferUnmap(thandle_t, tdata_t, toff_t)
+{
+}
+
+/* Opens a TIFF file for writing through a write buffer of bufferSize bytes */
+static TIFF *openBufferedTIFF(const char *fileName, const char *mode, size_t bufferSize)
+{
+    writeBuffer_t *pBuf = (writeBuffer_t *)calloc(1, sizeof(writeBuffer_t));
+    TIFF *tiff;
+
+    if (!pBuf) return NULL;
+    pBuf->file = fopen(fileName, "w+b");
+    pBuf->data = (char *)malloc(bufferSize);
+    pBuf->size = bufferSize;
+    if (!pBuf->file || !pBuf->data) {
+        if (pBuf->file) fclose(pBuf->file);
+        free(pBuf->data);
+        free(pBuf);
+        return NULL;
+    }
+    /* The buffering is done here */
+    setvbuf(pBuf->file, NULL, _IONBF, 0);
+    tiff = TIFFClientOpen(fileName, mode, (thandle_t)pBuf,
+                          writeBufferRead, writeBufferWrite, writeBufferSeek, writeBufferClose,
+                          writeBufferSize, writeBufferMap, writeBufferUnmap);
+    if (!tiff) {
+        fclose(pBuf->file);
+        free(pBuf->data);
+        free(pBuf);
+    }
+    return tiff;
+}
+
+
+/* State shared by the threads that prepare the strips or tiles of one NDArray */
+typedef struct {
+    const char *pData;          /* Image data, sizeY rows of rowBytes */
+    char *scratch;              /* Segment i is written to scratch + i*segmentBound */
+    int compression;            /* NDFileTIFFCompression_t */
+    int level;
+    size_t rowBytes;            /* Bytes in one row of the image */
+    size_t sizeY;               /* Rows in the image */
+    size_t segmentRows;         /* Rows in one strip or tile */
+    size_t tileRowBytes;        /* Bytes in one row of a tile, 0 for strips */
+    size_t tilesAcross;         /* Number of tiles across the image */
+    size_t segmentBytes;        /* Uncompressed size of a whole strip or tile */
+    size_t segmentBound;        /* Maximum compressed size of one strip or tile */
+    int numSegments;
+    int nextSegment;            /* Next segment to be prepared, incremented atomically */
+    int error;
+    size_t *segmentSizes;
+} segmentJob_t;
+
+/* Whether strips and tiles can be compressed by this plugin rather than by libtiff */
+static bool haveCompressor(int compression)
+{
+    switch (compression) {
+#ifdef HAVE_ZLIB
+    case NDFileTIFFCompressDeflate:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case NDFileTIFFCompressZstd:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* libtiff compression scheme */
+static int compressionScheme(int compression)
+{
+    switch (compression) {
+    case NDFileTIFFCompressDeflate:
+        return COMPRESSION_ADOBE_DEFLATE;
+#ifdef COMPRESSION_ZSTD
+    case NDFileTIFFCompressZstd:
+        return COMPRESSION_ZSTD;
+#endif
+    default:
+        return COMPRESSION_NONE;
+    }
+}
+
+/* Maximum compressed size of a segment of segmentBytes */
+static size_t segmentBound(int compression, size_t segmentBytes)
+{
+    switch (compression) {
+#ifdef HAVE_ZLIB
+    case NDFileTIFFCompressDeflate:
+        return compressBound((uLong)segmentBytes);
+#endif
+#ifdef HAVE_ZSTD
+    case NDFileTIFFCompressZstd:
+        return ZSTD_compressBound(segmentBytes);
+#endif
+    default:
+        return segmentBytes;
+    }
+}
+
+/* Compress one segment, returns the compressed size or a negative value on error.
+ * Without compression the segment is copied unless it is already in place. */
+static epicsInt64 compressSegment(int compression, const char *src, char *dest,
+                                  size_t srcBytes, size_t destSize, int level)
+{
+    switch (compression) {
+    case NDFileTIFFCompressNone:
+        if (src != dest) memcpy(dest, src, srcBytes);
+        return (epicsInt64)srcBytes;
+#ifdef HAVE_ZLIB
+    case NDFileTIFFCompressDeflate: {
+        uLongf destLen = (uLongf)destSize;
+        if (compress2((Bytef *)dest, &destLen, (const Bytef *)src, (uLong)srcBytes, level) != Z_OK)
+            return -1;
+        return (epicsInt64)destLen;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case NDFileTIFFCompressZstd: {
+        size_t ret = ZSTD_compress(dest, destSize, src, srcBytes, level);
+        return ZSTD_isError(ret) ? -1 : (epicsInt64)ret;
+    }
+#endif
+    default:
+        return -1;
+    }
+}
+
+/* Prepare segments until there are none left.  This runs in the calling thread
+ * and in each of the worker pool threads.
+ */
+static void compressSegmentsWork(void *arg)
+{
+    segmentJob_t *job = (segmentJob_t *)arg;
+    char *tile = NULL;
+    int i;
+
+    if (job->tileRowBytes && (job->compression != NDFileTIFFCompressNone)) {
+        tile = (char *)malloc(job->segmentBytes);
+        if (!tile) {
+            job->error = 1;
+            return;
+        }
+    }
+
+    while ((i = epicsAtomicIncrIntT(&job->nextSegment) - 1) < job->numSegments) {
+        char *dest = job->scratch + i * job->segmentBound;
+        const char *src;
+        size_t srcBytes;
+        epicsInt64 compSize;
+
+        if (job->tileRowBytes == 0) {
+            // Strips are contiguous in the image, the last one may be short
+            size_t firstRow = i * job->segmentRows;
+            size_t rows = job->sizeY - firstRow;
+            if (rows > job->segmentRows) rows = job->segmentRows;
+            src = job->pData + firstRow * job->rowBytes;
+            srcBytes = rows * job->rowBytes;
+        } else {
+            // Tiles are always complete, the parts outside the image are zero
+            char *pTile = tile ? tile : dest;
+            size_t firstRow = (i / job->tilesAcross) * job->segmentRows;
+            size_t offsetX = (i % job->tilesAcross) * job->tileRowBytes;
+            size_t copyBytes = job->rowBytes - offsetX;
+            if (copyBytes > job->tileRowBytes) copyBytes = job->tileRowBytes;
+            memset(pTile, 0, job->segmentBytes);
+            for (size_t row = 0; (row < job->segmentRows) && (firstRow + row < job->sizeY); row++) {
+                memcpy(pTile + row * job->tileRowBytes,
+                       job->pData + (firstRow + row) * job->rowBytes + offsetX, copyBytes);
+            }
+            src = pTile;
+            srcBytes = job->segmentBytes;
+        }
+
+        compSize = compressSegment(job->compression, src, dest, srcBytes, job->segmentBound, job->level);
+        if (compSize < 0)
+            job->error = 1;
+        else
+            job->segmentSizes[i] = (size_t)compSize;
+    }
+    free(tile);
+}
+
+
 /** Opens a TIFF file.
   * \param[in] fileName The name of the file to open.
   * \param[in] openMode Mask defining how the file should be opened; bits are 
@@ -83,14 +389,9 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     /* When we create TIFF variables and dimensions, we get back an
      * ID for each one. */
     static const char *functionName = "openFile";
-    size_t sizeX, sizeY, rowsPerStrip;
-    int bitsPerSample=8, sampleFormat=SAMPLEFORMAT_INT, samplesPerPixel, photoMetric, planarConfig;
-    int colorMode=NDColorModeMono;
-    NDAttribute *pAttribute = NULL;
-    char tagString[STRING_BUFFER_SIZE] = {0};
-    char attrString[STRING_BUFFER_SIZE] = {0};
     char tagName[STRING_BUFFER_SIZE] = {0};
     int i;
+    int bigTIFF, writeBuffer;
     TIFFFieldInfo fieldInfo = {0, 1, 1, TIFF_ASCII, FIELD_CUSTOM, 1, 0, tagName};
 
     for (i=TIFFTAG_FIRST_ATTRIBUTE; i<=TIFFTAG_LAST_ATTRIBUTE; i++) {
@@ -124,7 +425,25 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
     /* Open file for writing */
     else if (openMode & NDFileModeWrite) {
-        if ((this->tiff = TIFFOpen(fileName, "w")) == NULL ) {
+        this->lock();
+        getIntegerParam(NDFileTIFFBigTIFF,       &bigTIFF);
+        getIntegerParam(NDFileTIFFWriteBuffer,   &writeBuffer);
+        getIntegerParam(NDFileTIFFRowsPerStrip,  &this->rowsPerStrip_);
+        getIntegerParam(NDFileTIFFTileWidth,     &this->tileWidth_);
+        getIntegerParam(NDFileTIFFTileLength,    &this->tileLength_);
+        getIntegerParam(NDFileTIFFCompression,   &this->compression_);
+        getIntegerParam(NDFileTIFFCompressLevel, &this->compressLevel_);
+        getIntegerParam(NDFileTIFFNumThreads,    &this->numThreads_);
+        this->unlock();
+
+        /* Files holding many arrays can grow beyond the 4 GB limit of classic TIFF */
+        if (bigTIFF == NDFileTIFFBigTIFFAuto) bigTIFF = this->supportsMultipleArrays ? NDFileTIFFBigTIFFYes : NDFileTIFFBigTIFFNo;
+        const char *mode = (bigTIFF == NDFileTIFFBigTIFFYes) ? "w8" : "w";
+        if (writeBuffer > 0)
+            this->tiff = openBufferedTIFF(fileName, mode, writeBuffer);
+        else
+            this->tiff = TIFFOpen(fileName, mode);
+        if (this->tiff == NULL) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
             "%s:%s error opening file %s\n",
             driverName, functionName, fileName);
@@ -133,11 +452,48 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
             "%s::%s opened file %s\n", 
             driverName, functionName, fileName);
+
+        /* Tiles must be a multiple of 16 pixels in both directions */
+        if ((this->tileWidth_ > 0) && (this->tileLength_ > 0)) {
+            this->tileWidth_  = (this->tileWidth_  + 15) / 16 * 16;
+            this->tileLength_ = (this->tileLength_ + 15) / 16 * 16;
+        } else {
+            this->tileWidth_ = 0;
+            this->tileLength_ = 0;
+        }
+        /* Compress the strips or tiles here if possible, which can use several threads */
+        this->rawSegments_ = haveCompressor(this->compression_);
+        if ((this->compression_ != NDFileTIFFCompressNone) && !this->rawSegments_ &&
+            !TIFFIsCODECConfigured((epicsUInt16)compressionScheme(this->compression_))) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s:%s compression %d is not available, writing uncompressed data\n",
+                driverName, functionName, this->compression_);
+            this->compression_ = NDFileTIFFCompressNone;
+        }
+        this->framesInFile_ = 0;
     }
 
     // If the file is open for reading we are done
     if (openMode & NDFileModeRead) return asynSuccess;
-    
+
+    return this->setTags(pArray);
+}
+
+/** Sets the tags of the current directory of the TIFF file from an NDArray.
+  * This is done for each NDArray written to the file.
+  * \param[in] pArray A pointer to an NDArray; this is used to determine the array and attribute properties.
+  */
+asynStatus NDFileTIFF::setTags(NDArray *pArray)
+{
+    static const char *functionName = "setTags";
+    size_t sizeX, sizeY, rowsPerStrip;
+    int bitsPerSample=8, sampleFormat=SAMPLEFORMAT_INT, samplesPerPixel, photoMetric, planarConfig;
+    int colorMode=NDColorModeMono;
+    NDAttribute *pAttribute = NULL;
+    char tagString[STRING_BUFFER_SIZE] = {0};
+    char attrString[STRING_BUFFER_SIZE] = {0};
+    int scheme = compressionScheme(this->compression_);
+
     /* We do some special treatment based on colorMode */
     pAttribute = pArray->pAttributeList->find("ColorMode");
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
@@ -242,7 +598,29 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     TIFFSetField(this->tiff, TIFFTAG_PLANARCONFIG, planarConfig);
     TIFFSetField(this->tiff, TIFFTAG_IMAGEWIDTH, (epicsUInt32)sizeX);
     TIFFSetField(this->tiff, TIFFTAG_IMAGELENGTH, (epicsUInt32)sizeY);
-    TIFFSetField(this->tiff, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)rowsPerStrip);   
+    if ((this->colorMode == NDColorModeMono) || (this->colorMode == NDColorModeRGB1)) {
+        /* Images with a single plane can be written in strips of any size or in tiles */
+        if (this->tileWidth_ > 0) {
+            TIFFSetField(this->tiff, TIFFTAG_TILEWIDTH, (epicsUInt32)this->tileWidth_);
+            TIFFSetField(this->tiff, TIFFTAG_TILELENGTH, (epicsUInt32)this->tileLength_);
+        } else {
+            if ((this->rowsPerStrip_ > 0) && ((size_t)this->rowsPerStrip_ < sizeY)) rowsPerStrip = this->rowsPerStrip_;
+            TIFFSetField(this->tiff, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)rowsPerStrip);
+        }
+    } else {
+        TIFFSetField(this->tiff, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)rowsPerStrip);
+        /* The planes of RGB2 and RGB3 images are always compressed by libtiff */
+        if (!TIFFIsCODECConfigured((epicsUInt16)scheme)) scheme = COMPRESSION_NONE;
+    }
+    TIFFSetField(this->tiff, TIFFTAG_COMPRESSION, scheme);
+    if ((scheme == COMPRESSION_ADOBE_DEFLATE) && TIFFIsCODECConfigured((epicsUInt16)scheme)) {
+        TIFFSetField(this->tiff, TIFFTAG_ZIPQUALITY, this->compressLevel_);
+    }
+#ifdef COMPRESSION_ZSTD
+    if ((scheme == COMPRESSION_ZSTD) && TIFFIsCODECConfigured((epicsUInt16)scheme)) {
+        TIFFSetField(this->tiff, TIFFTAG_ZSTD_LEVEL, this->compressLevel_);
+    }
+#endif
     
     this->pFileAttributes->clear();
     this->getAttributes(this->pFileAttributes);
@@ -360,7 +738,100 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     return(asynSuccess);
 }
 
+/** Writes the strips or tiles of a single plane NDArray to the TIFF file.
+  * When this plugin can compress them, they are compressed by up to NDFileTIFFNumThreads
+  * threads of the shared NDWorkerPool and written with TIFFWriteRaw*. Otherwise libtiff compresses them if needed.
+  * Returns the number of bytes written, or -1 on error.
+  * \param[in] pArray Pointer to the NDArray to be written
+  */
+tsize_t NDFileTIFF::writeSegments(NDArray *pArray)
+{
+    epicsUInt32 sizeX=0, sizeY=0;
+    epicsUInt16 bitsPerSample=8, samplesPerPixel=1;
+    segmentJob_t job;
+    tsize_t nwrite, total=0;
+    int i, numThreads;
+    static const char *functionName = "writeSegments";
+
+    TIFFGetField(this->tiff, TIFFTAG_IMAGEWIDTH, &sizeX);
+    TIFFGetField(this->tiff, TIFFTAG_IMAGELENGTH, &sizeY);
+    TIFFGetField(this->tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+    TIFFGetField(this->tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+
+    job.pData = (const char *)pArray->pData;
+    job.compression = this->rawSegments_ ? this->compression_ : NDFileTIFFCompressNone;
+    job.level = this->compressLevel_;
+    job.rowBytes = (size_t)sizeX * (bitsPerSample/8) * samplesPerPixel;
+    job.sizeY = sizeY;
+    if (this->tileWidth_ > 0) {
+        job.segmentRows = this->tileLength_;
+        job.tileRowBytes = (size_t)this->tileWidth_ * (bitsPerSample/8) * samplesPerPixel;
+        job.tilesAcross = (sizeX + this->tileWidth_ - 1) / this->tileWidth_;
+        job.numSegments = (int)(job.tilesAcross * ((sizeY + this->tileLength_ - 1) / this->tileLength_));
+        job.segmentBytes = job.tileRowBytes * job.segmentRows;
+    } else {
+        job.segmentRows = sizeY;
+        if ((this->rowsPerStrip_ > 0) && ((epicsUInt32)this->rowsPerStrip_ < sizeY)) job.segmentRows = this->rowsPerStrip_;
+        job.tileRowBytes = 0;
+        job.tilesAcross = 1;
+        job.numSegments = (int)((sizeY + job.segmentRows - 1) / job.segmentRows);
+        job.segmentBytes = job.segmentRows * job.rowBytes;
+    }
+
+    if ((this->tileWidth_ == 0) && !this->rawSegments_) {
+        /* libtiff writes the strips straight from the array */
+        for (i=0; i<job.numSegments; i++) {
+            size_t rows = sizeY - i*job.segmentRows;
+            if (rows > job.segmentRows) rows = job.segmentRows;
+            nwrite = TIFFWriteEncodedStrip(this->tiff, i, (char *)job.pData + i*job.segmentBytes, rows*job.rowBytes);
+            if (nwrite < 0) return -1;
+            total += nwrite;
+        }
+        return total;
+    }
+
+    job.segmentBound = segmentBound(job.compression, job.segmentBytes);
+    if (this->segmentBuffer_.size() < job.numSegments * job.segmentBound)
+        this->segmentBuffer_.resize(job.numSegments * job.segmentBound);
+    job.scratch = &this->segmentBuffer_[0];
+    std::vector<size_t> segmentSizes(job.numSegments);
+    job.segmentSizes = &segmentSizes[0];
+    job.nextSegment = 0;
+    job.error = 0;
+
+    numThreads = this->numThreads_;
+    if (numThreads > job.numSegments)
+        numThreads = job.numSegments;
+    if (numThreads < 1)
+        numThreads = 1;
+
+    NDWorkerPool::getInstance()->run(compressSegmentsWork, &job, numThreads);
+
+    if (job.error) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error compressing strips or tiles\n",
+            driverName, functionName);
+        return -1;
+    }
+
+    /* Strips and tiles must be written in order */
+    for (i=0; i<job.numSegments; i++) {
+        char *pSegment = job.scratch + i*job.segmentBound;
+        if (this->rawSegments_ && this->tileWidth_)
+            nwrite = TIFFWriteRawTile(this->tiff, i, pSegment, segmentSizes[i]);
+        else if (this->rawSegments_)
+            nwrite = TIFFWriteRawStrip(this->tiff, i, pSegment, segmentSizes[i]);
+        else
+            nwrite = TIFFWriteEncodedTile(this->tiff, i, pSegment, segmentSizes[i]);
+        if (nwrite < 0) return -1;
+        total += nwrite;
+    }
+    return total;
+}
+
 /** Writes single NDArray to the TIFF file.
+  * If NDFileTIFFMultiFrame is enabled each NDArray after the first one is written
+  * to a new directory of the file.
   * \param[in] pArray Pointer to the NDArray to be written
   */
 asynStatus NDFileTIFF::writeFile(NDArray *pArray)
@@ -382,13 +853,24 @@ asynStatus NDFileTIFF::writeFile(NDArray *pArray)
         return(asynError);
     }
 
+    if (this->framesInFile_ > 0) {
+        /* Finish the directory of the previous array and start a new one */
+        if (!TIFFWriteDirectory(this->tiff)) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s:%s: error writing TIFF directory\n",
+                driverName, functionName);
+            return(asynError);
+        }
+        if (this->setTags(pArray)) return(asynError);
+    }
+
     stripSize = (unsigned long)TIFFStripSize(this->tiff);
     TIFFGetField(this->tiff, TIFFTAG_IMAGELENGTH, &sizeY);
 
     switch (this->colorMode) {
         case NDColorModeMono:
         case NDColorModeRGB1:
-            nwrite = TIFFWriteEncodedStrip(this->tiff, 0, pArray->pData, stripSize); 
+            nwrite = this->writeSegments(pArray);
             break;
         case NDColorModeRGB2:
             /* TIFF readers don't support row interleave, put all the red strips first, then all the blue, then green. */
@@ -419,6 +901,7 @@ asynStatus NDFileTIFF::writeFile(NDArray *pArray)
             driverName, functionName);
         return(asynError);
     }
+    this->framesInFile_++;
 
     return(asynSuccess);
 }
@@ -592,6 +1075,32 @@ asynStatus NDFileTIFF::closeFile()
 }
 
 
+/** Called when asyn clients call pasynInt32->write().
+  * NDFileTIFFMultiFrame selects whether NDPluginFile writes all the arrays of a capture or
+  * stream to one file; it can not be changed while capturing.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write.
+  */
+asynStatus NDFileTIFF::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int capture;
+    static const char *functionName = "writeInt32";
+
+    if (function == NDFileTIFFMultiFrame) {
+        getIntegerParam(NDFileCapture, &capture);
+        if (capture) {
+            asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: cannot change MultiFrame while capturing\n",
+                driverName, functionName);
+            return asynError;
+        }
+        this->supportsMultipleArrays = value ? 1 : 0;
+    }
+    return NDPluginFile::writeInt32(pasynUser, value);
+}
+
+
 /** Constructor for NDFileTIFF; all parameters are simply passed to NDPluginFile::NDPluginFile.
   * \param[in] portName The name of the asyn port driver to be created.
   * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when 
@@ -616,13 +1125,33 @@ NDFileTIFF::NDFileTIFF(const char *portName, int queueSize, int blockingCallback
                    NDArrayPort, NDArrayAddr, 1,
                    2, 0, asynGenericPointerMask, asynGenericPointerMask, 
                    ASYN_CANBLOCK, 1, priority, stackSize, 1),
-    numAttributes_(0)
+    numAttributes_(0), framesInFile_(0), compression_(NDFileTIFFCompressNone), compressLevel_(6),
+    numThreads_(1), rowsPerStrip_(0), tileWidth_(0), tileLength_(0), rawSegments_(false)
 {
     //static const char *functionName = "NDFileTIFF";
 
+    createParam(NDFileTIFFMultiFrameString,    asynParamInt32, &NDFileTIFFMultiFrame);
+    createParam(NDFileTIFFBigTIFFString,       asynParamInt32, &NDFileTIFFBigTIFF);
+    createParam(NDFileTIFFRowsPerStripString,  asynParamInt32, &NDFileTIFFRowsPerStrip);
+    createParam(NDFileTIFFTileWidthString,     asynParamInt32, &NDFileTIFFTileWidth);
+    createParam(NDFileTIFFTileLengthString,    asynParamInt32, &NDFileTIFFTileLength);
+    createParam(NDFileTIFFCompressionString,   asynParamInt32, &NDFileTIFFCompression);
+    createParam(NDFileTIFFCompressLevelString, asynParamInt32, &NDFileTIFFCompressLevel);
+    createParam(NDFileTIFFNumThreadsString,    asynParamInt32, &NDFileTIFFNumThreads);
+    createParam(NDFileTIFFWriteBufferString,   asynParamInt32, &NDFileTIFFWriteBuffer);
+
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDFileTIFF");
     this->supportsMultipleArrays = 0;
+    setIntegerParam(NDFileTIFFMultiFrame,    0);
+    setIntegerParam(NDFileTIFFBigTIFF,       NDFileTIFFBigTIFFAuto);
+    setIntegerParam(NDFileTIFFRowsPerStrip,  0);
+    setIntegerParam(NDFileTIFFTileWidth,     0);
+    setIntegerParam(NDFileTIFFTileLength,    0);
+    setIntegerParam(NDFileTIFFCompression,   NDFileTIFFCompressNone);
+    setIntegerParam(NDFileTIFFCompressLevel, 6);
+    setIntegerParam(NDFileTIFFNumThreads,    1);
+    setIntegerParam(NDFileTIFFWriteBuffer,   0);
 
     this->pAttributeId = NULL;
     this->pFileAttributes = new NDAttributeList;
@@ -8,6 +8,8 @@
 #ifndef DRV_NDFileTIFF_H
 #define DRV_NDFileTIFF_H
 
+#include <vector>
+
 #include "NDPluginFile.h"
 #include "tiffio.h"
 
@@ -15,10 +17,35 @@
  * to handle changes in the file contents */
 #define NDTIFFFileVersion 1.0
 
+#define NDFileTIFFMultiFrameString     "TIFF_MULTI_FRAME"     /* (asynInt32, r/w) Write all arrays of a capture or stream to one file */
+#define NDFileTIFFBigTIFFString        "TIFF_BIGTIFF"         /* (asynInt32, r/w) Write BigTIFF files, 0=Auto, 1=No, 2=Yes */
+#define NDFileTIFFRowsPerStripString   "TIFF_ROWS_PER_STRIP"  /* (asynInt32, r/w) Rows in each strip, 0=whole image */
+#define NDFileTIFFTileWidthString      "TIFF_TILE_WIDTH"      /* (asynInt32, r/w) Tile width, 0=write strips */
+#define NDFileTIFFTileLengthString     "TIFF_TILE_LENGTH"     /* (asynInt32, r/w) Tile length, 0=write strips */
+#define NDFileTIFFCompressionString    "TIFF_COMPRESSION"     /* (asynInt32, r/w) 0=None, 1=Deflate, 2=zstd */
+#define NDFileTIFFCompressLevelString  "TIFF_COMPRESS_LEVEL"  /* (asynInt32, r/w) Compression level */
+#define NDFileTIFFNumThreadsString     "TIFF_NUM_THREADS"     /* (asynInt32, r/w) Threads compressing strips or tiles */
+#define NDFileTIFFWriteBufferString    "TIFF_WRITE_BUFFER"    /* (asynInt32, r/w) Size of the write buffer in bytes, 0=none */
+
+/** Values of NDFileTIFFBigTIFF */
+typedef enum {
+    NDFileTIFFBigTIFFAuto,  /**< BigTIFF if all arrays are written to one file */
+    NDFileTIFFBigTIFFNo,
+    NDFileTIFFBigTIFFYes
+} NDFileTIFFBigTIFF_t;
+
+/** Values of NDFileTIFFCompression */
+typedef enum {
+    NDFileTIFFCompressNone,
+    NDFileTIFFCompressDeflate,
+    NDFileTIFFCompressZstd
+} NDFileTIFFCompression_t;
+
 /** Writes NDArrays in the TIFF file format.
     Tagged Image File Format is a file format for storing images.  The format was originally created by Aldus corporation and is
     currently developed by Adobe Systems Incorporated.  This plugin was developed using the libtiff library to write the file.
-    The current version is only capable of writing 2-D images with one image per file.
+    It writes 2-D images, either one image per file or, with NDFileTIFFMultiFrame, all the images of a capture or stream
+    as successive directories of one (Big)TIFF file.
     */
 
 class epicsShareClass NDFileTIFF : public NDPluginFile {
@@ -32,13 +59,38 @@ public:
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+protected:
+    int NDFileTIFFMultiFrame;
+    #define FIRST_NDFILE_TIFF_PARAM NDFileTIFFMultiFrame
+    int NDFileTIFFBigTIFF;
+    int NDFileTIFFRowsPerStrip;
+    int NDFileTIFFTileWidth;
+    int NDFileTIFFTileLength;
+    int NDFileTIFFCompression;
+    int NDFileTIFFCompressLevel;
+    int NDFileTIFFNumThreads;
+    int NDFileTIFFWriteBuffer;
 
 private:
+    asynStatus setTags(NDArray *pArray);
+    tsize_t writeSegments(NDArray *pArray);
+
     TIFF *tiff;
     NDColorMode_t colorMode;
     int *pAttributeId;
     NDAttributeList *pFileAttributes;
     int numAttributes_;
+    int framesInFile_;        /* Number of arrays written to the open file */
+    int compression_;         /* NDFileTIFFCompression_t for the open file */
+    int compressLevel_;
+    int numThreads_;
+    int rowsPerStrip_;        /* Requested strip height, 0=whole image */
+    int tileWidth_;           /* Tile size for the open file, 0=strips */
+    int tileLength_;
+    bool rawSegments_;        /* Strips or tiles are compressed here and written with TIFFWriteRaw* */
+    std::vector<char> segmentBuffer_; /* Compressed or padded strips and tiles of one array */
 
 };
 
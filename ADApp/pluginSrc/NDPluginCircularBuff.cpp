@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <ctype.h>
 
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
@@ -18,6 +19,7 @@
 #include <epicsEvent.h>
 #include <epicsTime.h>
 #include <epicsMath.h>
+#include <epicsStdlib.h>
 #include <iocsh.h>
 #include <postfix.h>
 
@@ -31,14 +33,192 @@ static const char *driverName="NDPluginCircularBuff";
 
 #define DEFAULT_TRIGGER_CALC "0"
 
+#define MIN(A,B) ((A)<(B)?(A):(B))
+
+/** Returns an NDArray that the plugin can hold on to after processCallbacks returns.
+  * If zero copy is enabled this is pArray itself with an extra reference, as long as the memory held by reference
+  * stays below CIRC_BUFF_REF_MEMORY_PERCENT of the maximum memory of the source pool and the source pool is not
+  * about to run out of memory.  Otherwise it is a copy from this plugin's NDArrayPool, which lets the driver reuse
+  * its own array.
+  * \param[in] pArray  The NDArray from the callback.
+  * \return The held array, which must be released by the caller, or NULL if the copy failed.
+  */
+NDArray *NDPluginCircularBuff::holdArray(NDArray *pArray)
+{
+    NDArrayPool *pSourcePool = pArray->pNDArrayPool;
+    int zeroCopy, refMemoryPercent;
+    size_t maxMemory;
+    bool reference = false;
+
+    getIntegerParam(NDCircBuffZeroCopy,         &zeroCopy);
+    getIntegerParam(NDCircBuffRefMemoryPercent, &refMemoryPercent);
+
+    if (zeroCopy && pSourcePool && (pSourcePool != this->pNDArrayPool)) {
+        maxMemory = pSourcePool->getMaxMemory();
+        if (maxMemory == 0) {
+            // The source pool has no memory limit
+            reference = true;
+        } else if ((double)(referencedMemory_ + pArray->dataSize) <= (double)maxMemory * refMemoryPercent / 100.) {
+            // The source pool is running low if it cannot allocate another array of this size
+            reference = !((pSourcePool->getMemorySize() + pArray->dataSize > maxMemory) &&
+                          (pSourcePool->getNumFree() == 0));
+        }
+    }
+    if (reference) {
+        pArray->reserve();
+        return pArray;
+    }
+    return this->pNDArrayPool->copy(pArray, NULL, 1);
+}
+
+/** Updates the counts of arrays held in the pre-trigger ring when an array is added (delta=1) or removed (delta=-1).
+  * Arrays that were not allocated from this plugin's NDArrayPool are held by reference.
+  */
+void NDPluginCircularBuff::countHeldArray(NDArray *pArray, int delta)
+{
+    if (pArray->pNDArrayPool != this->pNDArrayPool) {
+        numReferenced_ += delta;
+        if (delta > 0) referencedMemory_ += pArray->dataSize;
+        else           referencedMemory_ -= pArray->dataSize;
+    } else {
+        numCopied_ += delta;
+    }
+    setIntegerParam(NDCircBuffNumReferenced, numReferenced_);
+    setIntegerParam(NDCircBuffNumCopied,     numCopied_);
+}
+
+/** Resets the counts of arrays held in the pre-trigger ring, called when the ring is emptied */
+void NDPluginCircularBuff::resetHeldCounts()
+{
+    referencedMemory_ = 0;
+    numReferenced_ = 0;
+    numCopied_ = 0;
+    setIntegerParam(NDCircBuffNumReferenced, 0);
+    setIntegerParam(NDCircBuffNumCopied,     0);
+}
+
+/** Returns the value of an attribute of the NDArray as a double.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[in] name  The name of the attribute.
+  * \return The value, or NaN if the attribute does not exist or is not numeric.
+  */
+double NDPluginCircularBuff::getTriggerAttribute(NDArray *pArray, const std::string &name)
+{
+    NDAttribute *pAttribute;
+    double value;
+
+    if (name.empty()) return epicsNAN;
+    pAttribute = pArray->pAttributeList->find(name.c_str());
+    if ((pAttribute != NULL) && (pAttribute->getValue(NDAttrFloat64, &value) == asynSuccess)) {
+        return value;
+    }
+    return epicsNAN;
+}
+
+template <typename epicsType>
+double NDPluginCircularBuff::maxPixelT(NDArray *pArray, NDArrayInfo_t *pInfo,
+                                       size_t xMin, size_t xMax, size_t yMin, size_t yMax)
+{
+    epicsType *pData = (epicsType *)pArray->pData;
+    epicsType maxValue = pData[yMin*pInfo->yStride + xMin*pInfo->xStride];
+    epicsType *pRow;
+    size_t color, x, y;
+
+    for (color=0; color<pInfo->colorSize; color++) {
+        for (y=yMin; y<yMax; y++) {
+            pRow = pData + color*pInfo->colorStride + y*pInfo->yStride;
+            if (pInfo->xStride == 1) {
+                // Contiguous rows, this loop can be vectorized by the compiler
+                for (x=xMin; x<xMax; x++) {
+                    maxValue = (pRow[x] > maxValue) ? pRow[x] : maxValue;
+                }
+            } else {
+                for (x=xMin; x<xMax; x++) {
+                    maxValue = (pRow[x*pInfo->xStride] > maxValue) ? pRow[x*pInfo->xStride] : maxValue;
+                }
+            }
+        }
+    }
+    return (double)maxValue;
+}
+
+/** Computes the maximum pixel value in the pixel trigger region of an NDArray.
+  * This is called with the mutex locked, and keeps it locked while the array is scanned:
+  * processCallbacks reads the running state before the trigger is calculated and uses it
+  * afterwards, so the parameters must not change in between.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[out] pMaxValue  The maximum value in the region.
+  * \return asynError if the region is empty or the data type is not supported.
+  */
+int NDPluginCircularBuff::maxPixel(NDArray *pArray, double *pMaxValue)
+{
+    NDArrayInfo_t arrayInfo;
+    int minX, minY, sizeX, sizeY;
+    size_t xMin, xMax, yMin, yMax;
+    int status = asynSuccess;
+    static const char *functionName="maxPixel";
+
+    getIntegerParam(NDCircBuffPixelMinX,  &minX);
+    getIntegerParam(NDCircBuffPixelMinY,  &minY);
+    getIntegerParam(NDCircBuffPixelSizeX, &sizeX);
+    getIntegerParam(NDCircBuffPixelSizeY, &sizeY);
+    pArray->getInfo(&arrayInfo);
+
+    xMin = (minX > 0) ? MIN((size_t)minX, arrayInfo.xSize) : 0;
+    yMin = (minY > 0) ? MIN((size_t)minY, arrayInfo.ySize) : 0;
+    xMax = (sizeX > 0) ? MIN(xMin + sizeX, arrayInfo.xSize) : arrayInfo.xSize;
+    yMax = (sizeY > 0) ? MIN(yMin + sizeY, arrayInfo.ySize) : arrayInfo.ySize;
+    if ((xMin >= xMax) || (yMin >= yMax)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s pixel trigger region is empty\n",
+            driverName, functionName);
+        return asynError;
+    }
+
+    switch(pArray->dataType) {
+        case NDInt8:
+            *pMaxValue = maxPixelT<epicsInt8>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDUInt8:
+            *pMaxValue = maxPixelT<epicsUInt8>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDInt16:
+            *pMaxValue = maxPixelT<epicsInt16>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDUInt16:
+            *pMaxValue = maxPixelT<epicsUInt16>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDInt32:
+            *pMaxValue = maxPixelT<epicsInt32>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDUInt32:
+            *pMaxValue = maxPixelT<epicsUInt32>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDInt64:
+            *pMaxValue = maxPixelT<epicsInt64>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDUInt64:
+            *pMaxValue = maxPixelT<epicsUInt64>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDFloat32:
+            *pMaxValue = maxPixelT<epicsFloat32>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        case NDFloat64:
+            *pMaxValue = maxPixelT<epicsFloat64>(pArray, &arrayInfo, xMin, xMax, yMin, yMax);
+            break;
+        default:
+            status = asynError;
+            break;
+    }
+    return status;
+}
+
 asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 {
-    NDAttribute *trigger;
-    char triggerString[256];
-    double triggerValue;
     double calcResult;
+    double pixelThreshold, pixelMaxValue;
     int status;
-    int preTrigger, postTrigger, currentImage, triggered;
+    int preTrigger, postTrigger, currentImage, triggered, pixelTrigger;
     static const char *functionName="calculateTrigger";
     
     *trig = 0;
@@ -47,39 +227,38 @@ asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
     getIntegerParam(NDCircBuffPostTrigger,  &postTrigger);
     getIntegerParam(NDCircBuffCurrentImage, &currentImage);
     getIntegerParam(NDCircBuffTriggered,    &triggered);   
+    getIntegerParam(NDCircBuffPixelTrigger, &pixelTrigger);
+
+    // The pixel trigger does not need any attributes, it looks at the data in the region directly
+    if (pixelTrigger) {
+        getDoubleParam(NDCircBuffPixelThreshold, &pixelThreshold);
+        if (maxPixel(pArray, &pixelMaxValue) == asynSuccess) {
+            if (pixelMaxValue > pixelThreshold) *trig = 1;
+            setDoubleParam(NDCircBuffPixelMaxVal, pixelMaxValue);
+        }
+    }
 
-    triggerCalcArgs_[0] = epicsNAN;
-    triggerCalcArgs_[1] = epicsNAN;
+    // The attribute names are cached when they are written, so only the attribute lists need to be searched here
+    triggerCalcArgs_[0] = getTriggerAttribute(pArray, triggerAName_);
+    triggerCalcArgs_[1] = getTriggerAttribute(pArray, triggerBName_);
     triggerCalcArgs_[2] = preTrigger;
     triggerCalcArgs_[3] = postTrigger;
     triggerCalcArgs_[4] = currentImage;
     triggerCalcArgs_[5] = triggered;
 
-    getStringParam(NDCircBuffTriggerA, sizeof(triggerString), triggerString);
-    trigger = pArray->pAttributeList->find(triggerString);
-    if (trigger != NULL) {
-        status = trigger->getValue(NDAttrFloat64, &triggerValue);
-        if (status == asynSuccess) {
-            triggerCalcArgs_[0] = triggerValue;
-        }
-    }
-    getStringParam(NDCircBuffTriggerB, sizeof(triggerString), triggerString);
-    trigger = pArray->pAttributeList->find(triggerString);
-    if (trigger != NULL) {
-        status = trigger->getValue(NDAttrFloat64, &triggerValue);
-        if (status == asynSuccess) {
-            triggerCalcArgs_[1] = triggerValue;
-        }
-    }
-    
     setDoubleParam(NDCircBuffTriggerAVal, triggerCalcArgs_[0]);
     setDoubleParam(NDCircBuffTriggerBVal, triggerCalcArgs_[1]);
-    status = calcPerform(triggerCalcArgs_, &calcResult, triggerCalcPostfix_);
-    if (status) {
-        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s::%s error evaluating expression=%s\n",
-            driverName, functionName, calcErrorStr(status));
-        return asynError;
+    if (triggerCalcIsConstant_) {
+        // The expression is a number, e.g. the default of 0, so it does not need to be evaluated
+        calcResult = triggerCalcConstant_;
+    } else {
+        status = calcPerform(triggerCalcArgs_, &calcResult, triggerCalcPostfix_);
+        if (status) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error evaluating expression=%s\n",
+                driverName, functionName, calcErrorStr(status));
+            return asynError;
+        }
     }
     
     if (!isnan(calcResult) && !isinf(calcResult) && (calcResult != 0)) *trig = 1;
@@ -89,6 +268,29 @@ asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 }
     
 
+/** Converts triggerCalcInfix_ to postfix, and finds out if it is a constant that
+  * calculateTrigger does not need to evaluate.
+  */
+asynStatus NDPluginCircularBuff::compileTriggerCalc()
+{
+    asynStatus status;
+    short postfixError;
+    char *pEnd;
+    static const char *functionName = "compileTriggerCalc";
+
+    status = (asynStatus)postfix(triggerCalcInfix_, triggerCalcPostfix_, &postfixError);
+    if (status) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error processing infix expression=%s, error=%s\n",
+            driverName, functionName, triggerCalcInfix_, calcErrorStr(postfixError));
+    }
+    // If the expression is just a number then it never needs to be evaluated
+    triggerCalcConstant_ = epicsStrtod(triggerCalcInfix_, &pEnd);
+    while (isspace((int)*pEnd)) pEnd++;
+    triggerCalcIsConstant_ = (status == asynSuccess) && (pEnd != triggerCalcInfix_) && (*pEnd == 0);
+    return status;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Stores the number of pre-trigger images prior to the trigger in a ring buffer.
   * Once the trigger has been received stores the number of post-trigger buffers
@@ -141,8 +343,8 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
         }
       }
 
-      // First copy the buffer into our buffer pool so we can release the resource on the driver
-      pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      // Hold a reference to the array, or copy it into our buffer pool so we can release the resource on the driver
+      pArrayCpy = holdArray(pArray);
 
       if (pArrayCpy){
 
@@ -150,8 +352,10 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
         if (!triggered){
           // No trigger so add the NDArray to the pre-trigger ring
           pOldArray_ = preBuffer_->addToEnd(pArrayCpy);
+          countHeldArray(pArrayCpy, 1);
           // If we overwrote an existing array in the ring, release it here
           if (pOldArray_){
+            countHeldArray(pOldArray_, -1);
             pOldArray_->release();
             pOldArray_ = NULL;
           }
@@ -221,6 +425,7 @@ void NDPluginCircularBuff::flushPreBuffer()
       }
       preBuffer_->clear();
     }
+    resetHeldCounts();
 }
 
 /** Called when asyn clients call pasynInt32->write().
@@ -243,6 +448,7 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
             delete preBuffer_;
           }
           preBuffer_ = new NDArrayRing(preCount);
+          resetHeldCounts();
           if (pOldArray_){
             pOldArray_->release();
           }
@@ -325,7 +531,6 @@ asynStatus NDPluginCircularBuff::writeOctet(asynUser *pasynUser, const char *val
   int addr=0;
   int function = pasynUser->reason;
   asynStatus status = asynSuccess;
-  short postfixError;
   const char *functionName = "writeOctet";
 
   status = getAddress(pasynUser, &addr); if (status != asynSuccess) return(status);
@@ -333,7 +538,13 @@ asynStatus NDPluginCircularBuff::writeOctet(asynUser *pasynUser, const char *val
   status = (asynStatus)setStringParam(addr, function, (char *)value);
   if (status != asynSuccess) return(status);
 
-  if (function == NDCircBuffTriggerCalc){
+  if (function == NDCircBuffTriggerA){
+    triggerAName_ = value;
+  }
+  else if (function == NDCircBuffTriggerB){
+    triggerBName_ = value;
+  }
+  else if (function == NDCircBuffTriggerCalc){
     if (nChars > sizeof(triggerCalcInfix_)) nChars = sizeof(triggerCalcInfix_);
     // If the input string is empty then use a value of "0", otherwise there is an error
     if ((value == 0) || (strlen(value) == 0)) {
@@ -342,12 +553,7 @@ asynStatus NDPluginCircularBuff::writeOctet(asynUser *pasynUser, const char *val
     } else {
       strncpy(triggerCalcInfix_, value, sizeof(triggerCalcInfix_));
     }
-    status = (asynStatus)postfix(triggerCalcInfix_, triggerCalcPostfix_, &postfixError);
-    if (status) {
-      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-      "%s::%s error processing infix expression=%s, error=%s\n",
-      driverName, functionName, triggerCalcInfix_, calcErrorStr(postfixError));
-    }
+    status = compileTriggerCalc();
   } 
   
   else if (function < FIRST_NDPLUGIN_CIRC_BUFF_PARAM) {
@@ -399,7 +605,9 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
                    NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
-                   0, 1, priority, stackSize, 1), pOldArray_(NULL)
+                   0, 1, priority, stackSize, 1), pOldArray_(NULL),
+      referencedMemory_(0), numReferenced_(0), numCopied_(0),
+      triggerCalcIsConstant_(false), triggerCalcConstant_(0.)
 {
     //const char *functionName = "NDPluginCircularBuff";
     preBuffer_ = NULL;
@@ -424,6 +632,17 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     createParam(NDCircBuffSoftTriggerString,        asynParamInt32,      &NDCircBuffSoftTrigger);
     createParam(NDCircBuffTriggeredString,          asynParamInt32,      &NDCircBuffTriggered);
     createParam(NDCircBuffFlushOnSoftTrigString,    asynParamInt32,      &NDCircBuffFlushOnSoftTrig);
+    createParam(NDCircBuffZeroCopyString,           asynParamInt32,      &NDCircBuffZeroCopy);
+    createParam(NDCircBuffRefMemoryPercentString,   asynParamInt32,      &NDCircBuffRefMemoryPercent);
+    createParam(NDCircBuffNumReferencedString,      asynParamInt32,      &NDCircBuffNumReferenced);
+    createParam(NDCircBuffNumCopiedString,          asynParamInt32,      &NDCircBuffNumCopied);
+    createParam(NDCircBuffPixelTriggerString,       asynParamInt32,      &NDCircBuffPixelTrigger);
+    createParam(NDCircBuffPixelThresholdString,     asynParamFloat64,    &NDCircBuffPixelThreshold);
+    createParam(NDCircBuffPixelMinXString,          asynParamInt32,      &NDCircBuffPixelMinX);
+    createParam(NDCircBuffPixelMinYString,          asynParamInt32,      &NDCircBuffPixelMinY);
+    createParam(NDCircBuffPixelSizeXString,         asynParamInt32,      &NDCircBuffPixelSizeX);
+    createParam(NDCircBuffPixelSizeYString,         asynParamInt32,      &NDCircBuffPixelSizeY);
+    createParam(NDCircBuffPixelMaxValString,        asynParamFloat64,    &NDCircBuffPixelMaxVal);
 
     // Set the plugin type string
     setStringParam(NDPluginDriverPluginType, "NDPluginCircularBuff");
@@ -447,6 +666,25 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     setIntegerParam(NDCircBuffActualTriggerCount, 0);
 
     setIntegerParam(NDCircBuffFlushOnSoftTrig, 0);
+
+    // The default trigger calculation is a constant until TriggerCalc is written
+    strcpy(triggerCalcInfix_, DEFAULT_TRIGGER_CALC);
+    setStringParam(NDCircBuffTriggerCalc, DEFAULT_TRIGGER_CALC);
+    compileTriggerCalc();
+
+    // Hold references to the input arrays, using up to half of the memory of the source pool
+    setIntegerParam(NDCircBuffZeroCopy, 1);
+    setIntegerParam(NDCircBuffRefMemoryPercent, 50);
+    setIntegerParam(NDCircBuffNumReferenced, 0);
+    setIntegerParam(NDCircBuffNumCopied, 0);
+
+    // The pixel trigger is disabled, and uses the whole array
+    setIntegerParam(NDCircBuffPixelTrigger, 0);
+    setDoubleParam(NDCircBuffPixelThreshold, 0.);
+    setIntegerParam(NDCircBuffPixelMinX, 0);
+    setIntegerParam(NDCircBuffPixelMinY, 0);
+    setIntegerParam(NDCircBuffPixelSizeX, 0);
+    setIntegerParam(NDCircBuffPixelSizeY, 0);
     
     // Enable ArrayCallbacks.  
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
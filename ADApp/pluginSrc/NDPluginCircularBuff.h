@@ -1,6 +1,8 @@
 #ifndef NDPluginCircularBuff_H
 #define NDPluginCircularBuff_H
 
+#include <string>
+
 #include <epicsTypes.h>
 #include <postfix.h>
 
@@ -25,6 +27,17 @@
 #define NDCircBuffSoftTriggerString         "CIRC_BUFF_SOFT_TRIGGER"          /* (asynInt32,        r/w) Force a soft trigger */
 #define NDCircBuffTriggeredString           "CIRC_BUFF_TRIGGERED"             /* (asynInt32,        r/o) Have we had a trigger event */
 #define NDCircBuffFlushOnSoftTrigString     "CIRC_BUFF_FLUSH_ON_SOFTTRIGGER"  /* (asynInt32,        r/w) Flush buffer immediatelly when software trigger obtained */
+#define NDCircBuffZeroCopyString            "CIRC_BUFF_ZERO_COPY"             /* (asynInt32,        r/w) Hold references to the input arrays rather than copies */
+#define NDCircBuffRefMemoryPercentString    "CIRC_BUFF_REF_MEMORY_PERCENT"    /* (asynInt32,        r/w) Max. percent of the source pool memory the ring may hold */
+#define NDCircBuffNumReferencedString       "CIRC_BUFF_NUM_REFERENCED"        /* (asynInt32,        r/o) Number of arrays in the ring held by reference */
+#define NDCircBuffNumCopiedString           "CIRC_BUFF_NUM_COPIED"            /* (asynInt32,        r/o) Number of arrays in the ring held as copies */
+#define NDCircBuffPixelTriggerString        "CIRC_BUFF_PIXEL_TRIGGER"         /* (asynInt32,        r/w) Trigger when a pixel in the region exceeds the threshold */
+#define NDCircBuffPixelThresholdString      "CIRC_BUFF_PIXEL_THRESHOLD"       /* (asynFloat64,      r/w) Pixel trigger threshold */
+#define NDCircBuffPixelMinXString           "CIRC_BUFF_PIXEL_MIN_X"           /* (asynInt32,        r/w) Pixel trigger region start in X */
+#define NDCircBuffPixelMinYString           "CIRC_BUFF_PIXEL_MIN_Y"           /* (asynInt32,        r/w) Pixel trigger region start in Y */
+#define NDCircBuffPixelSizeXString          "CIRC_BUFF_PIXEL_SIZE_X"          /* (asynInt32,        r/w) Pixel trigger region size in X, 0=to the end */
+#define NDCircBuffPixelSizeYString          "CIRC_BUFF_PIXEL_SIZE_Y"          /* (asynInt32,        r/w) Pixel trigger region size in Y, 0=to the end */
+#define NDCircBuffPixelMaxValString         "CIRC_BUFF_PIXEL_MAX_VAL"         /* (asynFloat64,      r/o) Maximum pixel value in the region */
 
 
 /** Performs a scope like capture.  Records a quantity
@@ -64,19 +77,45 @@ protected:
     int NDCircBuffSoftTrigger;
     int NDCircBuffTriggered;
     int NDCircBuffFlushOnSoftTrig;
+    int NDCircBuffZeroCopy;
+    int NDCircBuffRefMemoryPercent;
+    int NDCircBuffNumReferenced;
+    int NDCircBuffNumCopied;
+    int NDCircBuffPixelTrigger;
+    int NDCircBuffPixelThreshold;
+    int NDCircBuffPixelMinX;
+    int NDCircBuffPixelMinY;
+    int NDCircBuffPixelSizeX;
+    int NDCircBuffPixelSizeY;
+    int NDCircBuffPixelMaxVal;
 
     void flushPreBuffer();
 
 private:
 
     asynStatus calculateTrigger(NDArray *pArray, int *trig);
+    asynStatus compileTriggerCalc();
+    double getTriggerAttribute(NDArray *pArray, const std::string &name);
+    template <typename epicsType> double maxPixelT(NDArray *pArray, NDArrayInfo_t *pInfo,
+                                                   size_t xMin, size_t xMax, size_t yMin, size_t yMax);
+    int maxPixel(NDArray *pArray, double *pMaxValue);
+    NDArray *holdArray(NDArray *pArray);
+    void countHeldArray(NDArray *pArray, int delta);
+    void resetHeldCounts();
     NDArrayRing *preBuffer_;
     NDArray *pOldArray_;
     int previousTrigger_;
     int maxBuffers_;
+    size_t referencedMemory_;
+    int numReferenced_;
+    int numCopied_;
+    std::string triggerAName_;
+    std::string triggerBName_;
     char triggerCalcInfix_[MAX_INFIX_SIZE];
     char triggerCalcPostfix_[MAX_POSTFIX_SIZE];
     double triggerCalcArgs_[CALCPERFORM_NARGS];
+    bool triggerCalcIsConstant_;
+    double triggerCalcConstant_;
 };
     
 #endif
@@ -23,20 +23,40 @@
  * Compressed NDArrays:
  *
  *  - `codec` holds the name of the codec that was used to compress the data.
- *    This plugin currently supports two codecs: "jpeg" and "blosc".
+ *    This plugin currently supports the codecs "jpeg", "blosc", "lz4", "bslz4",
+ *    "zstd" and "bszstd".
  *
  *  - `compressedSize` holds the length of the compressed data in `pData`, in
- *    bytes.
+ *    bytes, including `codec.headerRoom`.
+ *
+ *  - `codec.headerRoom` bytes at the start of `pData` (and in front of each
+ *    chunk) are not part of the compressed data.  The last
+ *    filterHeaderSize() bytes of them hold the header that the HDF5 lz4 and
+ *    bitshuffle filters expect in front of the data, so NDFileHDF5 can do a
+ *    direct chunk write without copying the data or changing the array.
  *
  *  - `dataSize` holds the length of the allocated `pData` buffer, as usual.
+ *    The data is compressed into a full size scratch array, then copied into
+ *    an array that is only slightly larger than `compressedSize`, so that
+ *    compressed arrays do not hold on to unused NDArrayPool memory.
  *
  *  - `pData` holds the compressed data as `unsigned char`.
  *
  *  - `dataType` holds the data type of the *uncompressed* data. This will be
  *    used for decompression.
+ *
+ *  - LZ4, BSLZ4, zstd and BSZSTD data can be compressed in chunks of `codec.chunkRows`
+ *    elements of the slowest varying dimension.  The chunks are compressed
+ *    independently, in parallel, and follow each other in `pData`; their
+ *    compressed sizes are in `codec.chunkSizes`.  Each chunk holds the
+ *    complete chunk size when decompressed, the last chunk is padded with
+ *    zeros if the number of rows is not a multiple of `codec.chunkRows`.
+ *    This matches the chunks of an HDF5 dataset, so NDFileHDF5 can write
+ *    each of them with a direct chunk write.
  */
 
 #include <string>
+#include <vector>
 
 #include <stdlib.h>
 #include <string.h>
@@ -48,6 +68,8 @@
 #include <epicsThread.h>
 #include <epicsEvent.h>
 #include <epicsTime.h>
+#include <epicsAtomic.h>
+#include <osiSock.h>
 #include <iocsh.h>
 
 #include <asynDriver.h>
@@ -55,6 +77,7 @@
 #include <epicsExport.h>
 #include "Codec.h"
 #include "NDPluginCodec.h"
+#include "NDWorkerPool.h"
 
 #define JPEG_MIN_QUALITY 1
 #define JPEG_MAX_QUALITY 100
@@ -64,8 +87,7 @@ using std::string;
 static const char *driverName="NDPluginCodec";
 
 /* Allocate a new NDArray to hold [un]compressed data.
- * Since there's no way to know the final size of the compressed data, always
- * allocate an array of the same size as the uncompressed one.
+ * By default the array is the same size as the uncompressed one.
  */
 static NDArray *allocArray(NDArray *input, int dataType = -1, size_t dataSize=0, void *pData=NULL)
 {
@@ -90,6 +112,108 @@ static NDArray *allocArray(NDArray *input, int dataType = -1, size_t dataSize=0,
 
 }
 
+/* Allocate a scratch array to compress into.
+ * Since there's no way to know the final size of the compressed data, this must
+ * be large enough for the worst case.  Only the data buffer is used, so no
+ * metadata is copied.  The array comes from the pool of the input array and is
+ * returned to it by allocCompressed, so it is reused for the next frame.
+ */
+static NDArray *allocScratch(NDArray *input, size_t dataSize)
+{
+    return input->pNDArrayPool->alloc(1, &dataSize, NDInt8, dataSize, NULL);
+}
+
+/* Room for the header of the HDF5 lz4 (16 bytes) and bitshuffle (12 bytes) filters */
+#define FILTER_HEADER_ROOM 16
+
+/* Number of bytes to reserve in front of the data (or each chunk) of a codec */
+static size_t headerRoom(NDCodecCompressor_t compressor)
+{
+    switch (compressor) {
+    case NDCODEC_LZ4:
+    case NDCODEC_BSLZ4:
+    case NDCODEC_BSZSTD:
+        return FILTER_HEADER_ROOM;
+    default:
+        return 0;
+    }
+}
+
+#define htonll(x) ( ( (uint64_t)(htonl( (uint32_t)((x << 32) >> 32)))<< 32) | htonl( ((uint32_t)(x >> 32)) ))
+
+/** Returns the size of the header that the HDF5 filter for a codec expects
+  * in front of the compressed data, 0 if the filter has no header.
+  * \param[in] codec The codec name, codec.name of the NDArray. */
+size_t filterHeaderSize(const std::string& codec)
+{
+    if (codec == codecName[NDCODEC_LZ4])
+        return 16;
+    if (codec == codecName[NDCODEC_BSLZ4] || codec == codecName[NDCODEC_BSZSTD])
+        return 12;
+    return 0;
+}
+
+/** Writes the header that the HDF5 filter for a codec expects in front of the
+  * compressed data of a chunk.
+  * \param[in] codec The codec name, codec.name of the NDArray.
+  * \param[out] header Where to write the header, filterHeaderSize(codec) bytes.
+  * \param[in] uncompressedSize The size of the chunk when uncompressed.
+  * \param[in] compressedSize The size of the compressed data, without the header. */
+void writeFilterHeader(const std::string& codec, char *header, size_t uncompressedSize, size_t compressedSize)
+{
+    size_t headerSize = filterHeaderSize(codec);
+    if (headerSize == 0)
+        return;
+    // First 8 bytes is the uncompressed array size
+    uint64_t ui64 = htonll((uint64_t)uncompressedSize);
+    memcpy(header, &ui64, 8);
+    if (headerSize == 16) {
+        // lz4: next 4 bytes is the block size = uncompressed size as long as < 1GB which we assume here
+        epicsUInt32 ui32 = htonl((int)uncompressedSize);
+        memcpy(header+8, &ui32, 4);
+        // Next 4 bytes is the compressed size
+        ui32 = htonl((int)compressedSize);
+        memcpy(header+12, &ui32, 4);
+    } else {
+        // bitshuffle: next 4 bytes is the block size * elem_size;  8192 is the default in bitshuffle
+        epicsUInt32 ui32 = htonl(8192);
+        memcpy(header+8, &ui32, 4);
+    }
+}
+
+/* Allocate the output array for compressed data, copy the compressed data
+ * from the scratch array into it and release the scratch array.
+ * The output array is slightly larger than the compressed data, so that it
+ * can be reused by the pool for later frames whose compressed size is
+ * slightly different.
+ * If the output array cannot be allocated the scratch array is released and
+ * NULL is returned.
+ */
+static NDArray *allocCompressed(NDArray *input, NDArray *scratch, size_t compressedSize,
+                                NDCodecCompressor_t compressor=NDCODEC_NONE)
+{
+    size_t room = headerRoom(compressor);
+    NDArray *output = allocArray(input, -1, room + compressedSize + compressedSize/8 + 1);
+
+    if (output) {
+        memcpy((char *)output->pData + room, scratch->pData, compressedSize);
+        if (room > 0) {
+            // The filter header goes at the end of the room, right in front of the data
+            NDArrayInfo_t info;
+            input->getInfo(&info);
+            size_t headerSize = filterHeaderSize(codecName[compressor]);
+            writeFilterHeader(codecName[compressor], (char *)output->pData + room - headerSize,
+                              info.totalBytes, compressedSize);
+        }
+        output->codec.headerRoom = room;
+        output->compressedSize = room + compressedSize;
+    }
+
+    scratch->release();
+
+    return output;
+}
+
 static int jpeg_clamp_quality(int quality)
 {
     if (quality < JPEG_MIN_QUALITY)
@@ -377,10 +501,10 @@ NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp
     NDArrayInfo_t info;
     input->getInfo(&info);
 
-    NDArray *output = allocArray(input, -1, info.totalBytes + BLOSC_MAX_OVERHEAD);
+    NDArray *scratch = allocScratch(input, info.totalBytes + BLOSC_MAX_OVERHEAD);
 
-    if (!output) {
-        sprintf(errorMessage, "Failed to allocate Blosc output array");
+    if (!scratch) {
+        sprintf(errorMessage, "Failed to allocate Blosc scratch array");
         *status = NDCODEC_ERROR;
         return NULL;
     }
@@ -388,21 +512,28 @@ NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp
     size_t blockSize = 0;
 
     int compSize = blosc_compress_ctx(clevel, shuffle, info.bytesPerElement,
-            info.totalBytes, input->pData, output->pData, output->dataSize,
+            info.totalBytes, input->pData, scratch->pData, scratch->dataSize,
             compname, blockSize, numThreads);
 
     if (compSize < 0) {
-        output->release();
+        scratch->release();
         sprintf(errorMessage, "Internal Blosc error");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
+    NDArray *output = allocCompressed(input, scratch, compSize);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate Blosc output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
     output->codec.name = codecName[NDCODEC_BLOSC];
     output->codec.level = clevel;
     output->codec.shuffle = shuffle;
     output->codec.compressor = compressor;
-    output->compressedSize = compSize;
 
     return output;
 }
@@ -462,8 +593,296 @@ NDArray *decompressBlosc(NDArray *input, int numThreads, NDCodecStatus_t *status
 #ifdef HAVE_BITSHUFFLE
 #include <bitshuffle.h>
 #include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(HAVE_BITSHUFFLE) || defined(HAVE_ZSTD)
+
+/* State shared by the threads that compress the chunks of one NDArray */
+typedef struct {
+    NDArray *input;
+    NDArray *scratch;           /* Chunk i is compressed to scratch->pData + i*chunkBound */
+    NDCodecCompressor_t compressor;
+    int level;                  /* Compression level for zstd and bszstd */
+    size_t elemSize;
+    size_t chunkBytes;          /* Uncompressed size of one chunk */
+    size_t totalBytes;          /* Uncompressed size of the array */
+    size_t chunkBound;          /* Maximum compressed size of one chunk */
+    int numChunks;
+    int nextChunk;              /* Next chunk to be compressed, incremented atomically */
+    int error;
+    size_t *chunkSizes;
+} chunkJob_t;
+
+/* Maximum compressed size of a chunk of chunkBytes */
+static size_t chunkBound(NDCodecCompressor_t compressor, size_t chunkBytes, size_t elemSize)
+{
+    switch (compressor) {
+#ifdef HAVE_BITSHUFFLE
+    case NDCODEC_LZ4:
+        return LZ4_compressBound((int)chunkBytes);
+    case NDCODEC_BSLZ4:
+        return bshuf_compress_lz4_bound(chunkBytes / elemSize, elemSize, 0);
+#endif
+#ifdef HAVE_ZSTD
+    case NDCODEC_ZSTD:
+        return ZSTD_compressBound(chunkBytes);
+#ifdef HAVE_BITSHUFFLE
+    case NDCODEC_BSZSTD:
+        return bshuf_compress_zstd_bound(chunkBytes / elemSize, elemSize, 0);
+#endif
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Compress one chunk, returns the compressed size or a negative value on error */
+static int64_t compressChunk(NDCodecCompressor_t compressor, const char *src, char *dest,
+                             size_t chunkBytes, size_t destSize, size_t elemSize, int level)
+{
+    switch (compressor) {
+#ifdef HAVE_BITSHUFFLE
+    case NDCODEC_LZ4:
+        return LZ4_compress_default(src, dest, (int)chunkBytes, (int)destSize);
+    case NDCODEC_BSLZ4:
+        return bshuf_compress_lz4(src, dest, chunkBytes / elemSize, elemSize, 0);
+#endif
+#ifdef HAVE_ZSTD
+    case NDCODEC_ZSTD: {
+        size_t ret = ZSTD_compress(dest, destSize, src, chunkBytes, level);
+        return ZSTD_isError(ret) ? -1 : (int64_t)ret;
+    }
+#ifdef HAVE_BITSHUFFLE
+    case NDCODEC_BSZSTD:
+        return bshuf_compress_zstd(src, dest, chunkBytes / elemSize, elemSize, 0, level);
+#endif
+#endif
+    default:
+        return -1;
+    }
+}
+
+/* Decompress one chunk, returns a negative value on error */
+static int64_t decompressChunk(NDCodecCompressor_t compressor, const char *src, char *dest,
+                               size_t srcSize, size_t chunkBytes, size_t elemSize)
+{
+    switch (compressor) {
+#ifdef HAVE_BITSHUFFLE
+    case NDCODEC_LZ4:
+        return LZ4_decompress_fast(src, dest, (int)chunkBytes);
+    case NDCODEC_BSLZ4:
+        return bshuf_decompress_lz4(src, dest, chunkBytes / elemSize, elemSize, 0);
+#endif
+#ifdef HAVE_ZSTD
+    case NDCODEC_ZSTD: {
+        size_t ret = ZSTD_decompress(dest, chunkBytes, src, srcSize);
+        return ZSTD_isError(ret) ? -1 : (int64_t)ret;
+    }
+#ifdef HAVE_BITSHUFFLE
+    case NDCODEC_BSZSTD:
+        return bshuf_decompress_zstd(src, dest, chunkBytes / elemSize, elemSize, 0);
+#endif
+#endif
+    default:
+        return -1;
+    }
+}
+
+/* Compress chunks until there are none left.  This runs in the calling thread
+ * and in each of the worker pool threads.
+ */
+static void compressChunksWork(void *arg)
+{
+    chunkJob_t *job = (chunkJob_t *)arg;
+    int i;
+
+    while ((i = epicsAtomicIncrIntT(&job->nextChunk) - 1) < job->numChunks) {
+        size_t offset = i * job->chunkBytes;
+        const char *src = (const char *)job->input->pData + offset;
+        char *dest = (char *)job->scratch->pData + i * job->chunkBound;
+        char *padded = NULL;
+        int64_t compSize;
+
+        if (offset + job->chunkBytes > job->totalBytes) {
+            // The last chunk is only partly filled, pad it to a complete chunk
+            padded = (char *)calloc(job->chunkBytes, 1);
+            if (!padded) {
+                epicsAtomicSetIntT(&job->error, 1);
+                continue;
+            }
+            memcpy(padded, src, job->totalBytes - offset);
+            src = padded;
+        }
+
+        compSize = compressChunk(job->compressor, src, dest, job->chunkBytes, job->chunkBound,
+                                 job->elemSize, job->level);
+
+        if (compSize <= 0)
+            epicsAtomicSetIntT(&job->error, 1);
+        else
+            job->chunkSizes[i] = (size_t)compSize;
+
+        if (padded)
+            free(padded);
+    }
+}
+
+/* Compress an array with LZ4, BSLZ4, zstd or BSZSTD in chunks of chunkRows
+ * elements of the slowest varying dimension, using up to numThreads threads
+ * of the shared NDWorkerPool.
+ */
+static NDArray *compressChunks(NDArray *input, NDCodecCompressor_t compressor, int level,
+                               size_t chunkRows, int numThreads,
+                               NDCodecStatus_t *status, char *errorMessage)
+{
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    size_t rows = input->dims[input->ndims-1].size;
+    chunkJob_t job;
+
+    job.input = input;
+    job.compressor = compressor;
+    job.level = level;
+    job.elemSize = info.bytesPerElement;
+    job.chunkBytes = info.totalBytes / rows * chunkRows;
+    job.totalBytes = info.totalBytes;
+    job.numChunks = (int)((rows + chunkRows - 1) / chunkRows);
+    job.chunkBound = chunkBound(compressor, job.chunkBytes, job.elemSize);
+    job.nextChunk = 0;
+    job.error = 0;
+
+    std::vector<size_t> chunkSizes(job.numChunks);
+    job.chunkSizes = &chunkSizes[0];
 
-NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+    job.scratch = allocScratch(input, job.numChunks * job.chunkBound);
+
+    if (!job.scratch) {
+        sprintf(errorMessage, "Failed to allocate chunk scratch array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    if (numThreads > job.numChunks)
+        numThreads = job.numChunks;
+    if (numThreads < 1)
+        numThreads = 1;
+
+    NDWorkerPool::getInstance()->run(compressChunksWork, &job, numThreads);
+
+    if (epicsAtomicGetIntT(&job.error)) {
+        job.scratch->release();
+        sprintf(errorMessage, "Internal %s error", codecName[compressor].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    // Copy the chunks next to each other in an array of the right size,
+    // leaving header room in front of each of them
+    size_t room = headerRoom(compressor);
+    size_t compSize = 0;
+    for (int i = 0; i < job.numChunks; ++i)
+        compSize += room + chunkSizes[i];
+
+    NDArray *output = allocArray(input, -1, compSize + compSize/8 + 1);
+
+    if (!output) {
+        job.scratch->release();
+        sprintf(errorMessage, "Failed to allocate %s output array", codecName[compressor].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    char *dest = (char *)output->pData;
+    size_t headerSize = filterHeaderSize(codecName[compressor]);
+    for (int i = 0; i < job.numChunks; ++i) {
+        dest += room;
+        writeFilterHeader(codecName[compressor], dest - headerSize, job.chunkBytes, chunkSizes[i]);
+        memcpy(dest, (char *)job.scratch->pData + i * job.chunkBound, chunkSizes[i]);
+        dest += chunkSizes[i];
+    }
+    job.scratch->release();
+
+    output->codec.name = codecName[compressor];
+    if (compressor == NDCODEC_ZSTD || compressor == NDCODEC_BSZSTD)
+        output->codec.level = level;
+    output->codec.chunkRows = chunkRows;
+    output->codec.chunkSizes = chunkSizes;
+    output->codec.headerRoom = room;
+    output->compressedSize = compSize;
+
+    return output;
+}
+
+/* Decompress an array that was compressed by compressChunks */
+static NDArray *decompressChunks(NDArray *input, NDCodecCompressor_t compressor,
+                                 NDCodecStatus_t *status, char *errorMessage)
+{
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    NDArray *output = allocArray(input);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate %s output array", codecName[compressor].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    size_t rows = input->dims[input->ndims-1].size;
+    size_t chunkBytes = info.totalBytes / rows * input->codec.chunkRows;
+    const char *src = (const char *)input->pData;
+    char *padded = NULL;
+
+    for (size_t i = 0; i < input->codec.chunkSizes.size(); ++i) {
+        size_t offset = i * chunkBytes;
+        char *dest = (char *)output->pData + offset;
+        int64_t ret;
+
+        src += input->codec.headerRoom;
+        if (offset + chunkBytes > info.totalBytes) {
+            // The last chunk is padded, decompress it to a temporary buffer
+            padded = (char *)malloc(chunkBytes);
+            dest = padded;
+        }
+
+        if (!dest)
+            ret = -1;
+        else
+            ret = decompressChunk(compressor, src, dest, input->codec.chunkSizes[i],
+                                  chunkBytes, info.bytesPerElement);
+
+        if (ret <= 0) {
+            if (padded)
+                free(padded);
+            output->release();
+            sprintf(errorMessage, "Failed to %s decompress", codecName[compressor].c_str());
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+
+        if (padded) {
+            memcpy((char *)output->pData + offset, padded, info.totalBytes - offset);
+            free(padded);
+            padded = NULL;
+        }
+        src += input->codec.chunkSizes[i];
+    }
+
+    output->codec.clear();
+
+    return output;
+}
+
+#endif // if defined(HAVE_BITSHUFFLE) || defined(HAVE_ZSTD)
+
+#ifdef HAVE_BITSHUFFLE
+NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage,
+                     size_t chunkRows, int numThreads)
 {
     if (!input->codec.empty()) {
         sprintf(errorMessage, "Array is already compressed");
@@ -471,28 +890,38 @@ NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage
         return NULL;
     }
 
+    if (chunkRows > 0 && chunkRows < input->dims[input->ndims-1].size)
+        return compressChunks(input, NDCODEC_LZ4, 0, chunkRows, numThreads, status, errorMessage);
+
     NDArrayInfo_t info;
     input->getInfo(&info);
     int outputSize = LZ4_compressBound(info.totalBytes);
-    NDArray *output = allocArray(input, -1, outputSize);
+    NDArray *scratch = allocScratch(input, outputSize);
 
-    if (!output) {
-        sprintf(errorMessage, "Failed to allocate BZLZ4 output array");
+    if (!scratch) {
+        sprintf(errorMessage, "Failed to allocate LZ4 scratch array");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
-    int compSize = LZ4_compress_default((const char*)input->pData, (char*)output->pData, info.totalBytes, outputSize);
+    int compSize = LZ4_compress_default((const char*)input->pData, (char*)scratch->pData, info.totalBytes, outputSize);
 
     if (compSize <= 0) {
-        output->release();
+        scratch->release();
         sprintf(errorMessage, "Internal Z4 error");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
+    NDArray *output = allocCompressed(input, scratch, compSize, NDCODEC_LZ4);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate LZ4 output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
     output->codec.name = codecName[NDCODEC_LZ4];
-    output->compressedSize = compSize;
 
     return output;
 }
@@ -508,6 +937,9 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
         return NULL;
     }
 
+    if (input->codec.chunkRows > 0)
+        return decompressChunks(input, NDCODEC_LZ4, status, errorMessage);
+
     NDArrayInfo_t info;
     input->getInfo(&info);
 
@@ -519,7 +951,8 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
         return NULL;
     }
 
-    int ret = LZ4_decompress_fast((const char*)input->pData, (char*)output->pData, info.totalBytes);
+    int ret = LZ4_decompress_fast((const char*)input->pData + input->codec.headerRoom,
+                                  (char*)output->pData, info.totalBytes);
 
     if (ret <= 0){
         output->release();
@@ -534,7 +967,8 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
 }
 
 
-NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage,
+                       size_t chunkRows, int numThreads)
 {
     if (!input->codec.empty()) {
         sprintf(errorMessage, "Array is already compressed");
@@ -542,31 +976,42 @@ NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
         return NULL;
     }
 
+    if (chunkRows > 0 && chunkRows < input->dims[input->ndims-1].size)
+        return compressChunks(input, NDCODEC_BSLZ4, 0, chunkRows, numThreads, status, errorMessage);
+
     NDArrayInfo_t info;
     input->getInfo(&info);
 
-    NDArray *output = allocArray(input, -1, info.totalBytes);
+    size_t blockSize = 0;
 
-    if (!output) {
-        sprintf(errorMessage, "Failed to allocate BZLZ4 output array");
+    NDArray *scratch = allocScratch(input, bshuf_compress_lz4_bound(info.nElements,
+                                           info.bytesPerElement, blockSize));
+
+    if (!scratch) {
+        sprintf(errorMessage, "Failed to allocate BSLZ4 scratch array");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
-    size_t blockSize = 0;
-
-    int64_t compSize = bshuf_compress_lz4(input->pData, output->pData, info.nElements, 
+    int64_t compSize = bshuf_compress_lz4(input->pData, scratch->pData, info.nElements, 
                                           info.bytesPerElement, blockSize);
 
     if (compSize < 0) {
-        output->release();
+        scratch->release();
         sprintf(errorMessage, "Internal BSLZ4 error");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
+    NDArray *output = allocCompressed(input, scratch, compSize, NDCODEC_BSLZ4);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate BSLZ4 output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
     output->codec.name = codecName[NDCODEC_BSLZ4];
-    output->compressedSize = compSize;
 
     return output;
 }
@@ -582,6 +1027,9 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
         return NULL;
     }
 
+    if (input->codec.chunkRows > 0)
+        return decompressChunks(input, NDCODEC_BSLZ4, status, errorMessage);
+
     NDArrayInfo_t info;
     input->getInfo(&info);
 
@@ -595,7 +1043,8 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
 
     size_t blockSize = 0;
 
-    int64_t ret = bshuf_decompress_lz4(input->pData, output->pData, info.nElements,
+    int64_t ret = bshuf_decompress_lz4((char *)input->pData + input->codec.headerRoom,
+                                       output->pData, info.nElements,
                                        info.bytesPerElement, blockSize);
 
     if (ret <= 0){
@@ -611,7 +1060,8 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
 }
 #else
 
-NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage,
+                     size_t chunkRows, int numThreads)
 {
     sprintf(errorMessage, "No LZ4 support");
     *status = NDCODEC_ERROR;
@@ -625,7 +1075,8 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
     return NULL;
 }
 
-NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage,
+                       size_t chunkRows, int numThreads)
 {
     sprintf(errorMessage, "No Bitshuffle support");
     *status = NDCODEC_ERROR;
@@ -641,6 +1092,245 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
 
 #endif // ifdef HAVE_BITSHUFFLE
 
+#ifdef HAVE_ZSTD
+
+NDArray *compressZstd(NDArray *input, int clevel, int numThreads, NDCodecStatus_t *status,
+                      char *errorMessage, size_t chunkRows, int chunkThreads)
+{
+    if (!input->codec.empty()) {
+        sprintf(errorMessage, "Array is already compressed");
+        *status = NDCODEC_WARNING;
+        return NULL;
+    }
+
+    if (chunkRows > 0 && chunkRows < input->dims[input->ndims-1].size)
+        return compressChunks(input, NDCODEC_ZSTD, clevel, chunkRows, chunkThreads, status, errorMessage);
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+    size_t outputSize = ZSTD_compressBound(info.totalBytes);
+    NDArray *scratch = allocScratch(input, outputSize);
+
+    if (!scratch) {
+        sprintf(errorMessage, "Failed to allocate zstd scratch array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+    if (!cctx) {
+        scratch->release();
+        sprintf(errorMessage, "Failed to create zstd context");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, clevel);
+    // This fails if libzstd was built without multithreading, zstd then uses the calling thread
+    if (numThreads > 1)
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, numThreads);
+
+    size_t compSize = ZSTD_compress2(cctx, scratch->pData, outputSize, input->pData, info.totalBytes);
+    ZSTD_freeCCtx(cctx);
+
+    if (ZSTD_isError(compSize)) {
+        scratch->release();
+        sprintf(errorMessage, "Internal zstd error: %s", ZSTD_getErrorName(compSize));
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    NDArray *output = allocCompressed(input, scratch, compSize);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate zstd output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.name = codecName[NDCODEC_ZSTD];
+    output->codec.level = clevel;
+
+    return output;
+}
+
+
+NDArray *decompressZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    // Sanity check
+    if (input->codec.name != codecName[NDCODEC_ZSTD]) {
+        sprintf(errorMessage, "Invalid codec '%s', expected '%s'",
+                input->codec.name.c_str(), codecName[NDCODEC_ZSTD].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    if (input->codec.chunkRows > 0)
+        return decompressChunks(input, NDCODEC_ZSTD, status, errorMessage);
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    NDArray *output = allocArray(input);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate zstd output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    size_t ret = ZSTD_decompress(output->pData, info.totalBytes,
+                                 (char *)input->pData + input->codec.headerRoom,
+                                 input->compressedSize - input->codec.headerRoom);
+
+    if (ZSTD_isError(ret)) {
+        output->release();
+        sprintf(errorMessage, "Failed to zstd decompress: %s", ZSTD_getErrorName(ret));
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.clear();
+
+    return output;
+}
+
+#ifdef HAVE_BITSHUFFLE
+
+NDArray *compressBSZstd(NDArray *input, int clevel, NDCodecStatus_t *status, char *errorMessage,
+                        size_t chunkRows, int chunkThreads)
+{
+    if (!input->codec.empty()) {
+        sprintf(errorMessage, "Array is already compressed");
+        *status = NDCODEC_WARNING;
+        return NULL;
+    }
+
+    if (chunkRows > 0 && chunkRows < input->dims[input->ndims-1].size)
+        return compressChunks(input, NDCODEC_BSZSTD, clevel, chunkRows, chunkThreads, status, errorMessage);
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    size_t blockSize = 0;
+
+    NDArray *scratch = allocScratch(input, bshuf_compress_zstd_bound(info.nElements,
+                                           info.bytesPerElement, blockSize));
+
+    if (!scratch) {
+        sprintf(errorMessage, "Failed to allocate BSZSTD scratch array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    int64_t compSize = bshuf_compress_zstd(input->pData, scratch->pData, info.nElements,
+                                           info.bytesPerElement, blockSize, clevel);
+
+    if (compSize < 0) {
+        scratch->release();
+        sprintf(errorMessage, "Internal BSZSTD error");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    NDArray *output = allocCompressed(input, scratch, compSize, NDCODEC_BSZSTD);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate BSZSTD output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.name = codecName[NDCODEC_BSZSTD];
+    output->codec.level = clevel;
+
+    return output;
+}
+
+
+NDArray *decompressBSZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    // Sanity check
+    if (input->codec.name != codecName[NDCODEC_BSZSTD]) {
+        sprintf(errorMessage, "Invalid codec '%s', expected '%s'",
+                input->codec.name.c_str(), codecName[NDCODEC_BSZSTD].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    if (input->codec.chunkRows > 0)
+        return decompressChunks(input, NDCODEC_BSZSTD, status, errorMessage);
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    NDArray *output = allocArray(input);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate BSZSTD output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    size_t blockSize = 0;
+
+    int64_t ret = bshuf_decompress_zstd((char *)input->pData + input->codec.headerRoom,
+                                        output->pData, info.nElements,
+                                        info.bytesPerElement, blockSize);
+
+    if (ret <= 0){
+        output->release();
+        sprintf(errorMessage, "Failed to BSZSTD decompress");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.clear();
+
+    return output;
+}
+
+#endif // ifdef HAVE_BITSHUFFLE
+
+#else
+
+NDArray *compressZstd(NDArray *input, int clevel, int numThreads, NDCodecStatus_t *status,
+                      char *errorMessage, size_t chunkRows, int chunkThreads)
+{
+    sprintf(errorMessage, "No zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+NDArray *decompressZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    sprintf(errorMessage, "No zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+#endif // ifdef HAVE_ZSTD
+
+#if !defined(HAVE_ZSTD) || !defined(HAVE_BITSHUFFLE)
+
+NDArray *compressBSZstd(NDArray *input, int clevel, NDCodecStatus_t *status, char *errorMessage,
+                        size_t chunkRows, int chunkThreads)
+{
+    sprintf(errorMessage, "No Bitshuffle/zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+NDArray *decompressBSZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+{
+    sprintf(errorMessage, "No Bitshuffle/zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+#endif // if !defined(HAVE_ZSTD) || !defined(HAVE_BITSHUFFLE)
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Does JPEG or Blosc compression on the array.
   * If compression is None or fails the input array is passed on without
@@ -710,15 +1400,53 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
         }
 
         case NDCODEC_LZ4: {
+            int chunkRows, chunkThreads;
+
+            getIntegerParam(NDCodecChunkRows, &chunkRows);
+            getIntegerParam(NDCodecChunkThreads, &chunkThreads);
+
             unlock();
-            result = compressLZ4(pArray, &codecStatus, errorMessage);
+            result = compressLZ4(pArray, &codecStatus, errorMessage, chunkRows, chunkThreads);
             lock();
             break;
         }
 
         case NDCODEC_BSLZ4: {
+            int chunkRows, chunkThreads;
+
+            getIntegerParam(NDCodecChunkRows, &chunkRows);
+            getIntegerParam(NDCodecChunkThreads, &chunkThreads);
+
             unlock();
-            result = compressBSLZ4(pArray, &codecStatus, errorMessage);
+            result = compressBSLZ4(pArray, &codecStatus, errorMessage, chunkRows, chunkThreads);
+            lock();
+            break;
+        }
+
+        case NDCODEC_ZSTD: {
+            int clevel, numThreads, chunkRows, chunkThreads;
+
+            getIntegerParam(NDCodecZstdCLevel, &clevel);
+            getIntegerParam(NDCodecZstdNumThreads, &numThreads);
+            getIntegerParam(NDCodecChunkRows, &chunkRows);
+            getIntegerParam(NDCodecChunkThreads, &chunkThreads);
+
+            unlock();
+            result = compressZstd(pArray, clevel, numThreads, &codecStatus, errorMessage,
+                                  chunkRows, chunkThreads);
+            lock();
+            break;
+        }
+
+        case NDCODEC_BSZSTD: {
+            int clevel, chunkRows, chunkThreads;
+
+            getIntegerParam(NDCodecZstdCLevel, &clevel);
+            getIntegerParam(NDCodecChunkRows, &chunkRows);
+            getIntegerParam(NDCodecChunkThreads, &chunkThreads);
+
+            unlock();
+            result = compressBSZstd(pArray, clevel, &codecStatus, errorMessage, chunkRows, chunkThreads);
             lock();
             break;
         }
@@ -757,6 +1485,16 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
             result = decompressBSLZ4(pArray, &codecStatus, errorMessage);
             lock();
             setIntegerParam(NDCodecCompressor, NDCODEC_BSLZ4);
+        } else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+            unlock();
+            result = decompressZstd(pArray, &codecStatus, errorMessage);
+            lock();
+            setIntegerParam(NDCodecCompressor, NDCODEC_ZSTD);
+        } else if (pArray->codec.name == codecName[NDCODEC_BSZSTD]) {
+            unlock();
+            result = decompressBSZstd(pArray, &codecStatus, errorMessage);
+            lock();
+            setIntegerParam(NDCodecCompressor, NDCODEC_BSZSTD);
         } else {
             sprintf(errorMessage, "Unexpected codec: '%s'", pArray->codec.name.c_str());
             codecStatus = NDCODEC_ERROR;
@@ -811,6 +1549,20 @@ asynStatus NDPluginCodec::writeInt32(asynUser *pasynUser, epicsInt32 value)
     } else if (function == NDCodecBloscNumThreads) {
         if (value < 1)
             value = 1;
+    } else if (function == NDCodecZstdCLevel) {
+        if (value < 1)
+            value = 1;
+        else if (value > 22)
+            value = 22;
+    } else if (function == NDCodecZstdNumThreads) {
+        if (value < 1)
+            value = 1;
+    } else if (function == NDCodecChunkRows) {
+        if (value < 0)
+            value = 0;
+    } else if (function == NDCodecChunkThreads) {
+        if (value < 1)
+            value = 1;
     } else if (function < FIRST_NDCODEC_PARAM) {
         status = NDPluginDriver::writeInt32(pasynUser, value);
     }
@@ -883,6 +1635,10 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
     createParam(NDCodecBloscCLevelString,     asynParamInt32,   &NDCodecBloscCLevel);
     createParam(NDCodecBloscShuffleString,    asynParamInt32,   &NDCodecBloscShuffle);
     createParam(NDCodecBloscNumThreadsString, asynParamInt32,   &NDCodecBloscNumThreads);
+    createParam(NDCodecZstdCLevelString,      asynParamInt32,   &NDCodecZstdCLevel);
+    createParam(NDCodecZstdNumThreadsString,  asynParamInt32,   &NDCodecZstdNumThreads);
+    createParam(NDCodecChunkRowsString,       asynParamInt32,   &NDCodecChunkRows);
+    createParam(NDCodecChunkThreadsString,    asynParamInt32,   &NDCodecChunkThreads);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginCodec");
@@ -895,6 +1651,10 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
     setIntegerParam(NDCodecBloscCompressor, NDCODEC_BLOSC_BLOSCLZ);
     setIntegerParam(NDCodecBloscCLevel,     5);
     setIntegerParam(NDCodecBloscNumThreads, 1);
+    setIntegerParam(NDCodecZstdCLevel,      3);
+    setIntegerParam(NDCodecZstdNumThreads,  1);
+    setIntegerParam(NDCodecChunkRows,       0);
+    setIntegerParam(NDCodecChunkThreads,    1);
 
     // Enable ArrayCallbacks.
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
@@ -15,6 +15,10 @@
 #define NDCodecBloscCLevelString      "BLOSC_CLEVEL"     /* (int r/w) Blosc compression level */
 #define NDCodecBloscShuffleString     "BLOSC_SHUFFLE"    /* (bool r/w) Should Blosc apply shuffling? */
 #define NDCodecBloscNumThreadsString  "BLOSC_NUMTHREADS" /* (int r/w) Number of threads to be used by Blosc */
+#define NDCodecZstdCLevelString       "ZSTD_CLEVEL"      /* (int r/w) zstd and BSZSTD compression level */
+#define NDCodecZstdNumThreadsString   "ZSTD_NUMTHREADS"  /* (int r/w) Number of threads to be used by zstd */
+#define NDCodecChunkRowsString        "CHUNK_ROWS"       /* (int r/w) Chunk size in the slowest dimension, 0=whole array */
+#define NDCodecChunkThreadsString     "CHUNK_THREADS"    /* (int r/w) Number of threads used to compress chunks */
 
 /** Compress/decompress NDArrays according to available codecs.
   * This plugin is a source of NDArray callbacks, passing the (possibly
@@ -24,6 +28,10 @@
   * <ul>
   *  <li> JPEG</li>
   *  <li> Blosc</li>
+  *  <li> LZ4</li>
+  *  <li> Bitshuffle/LZ4</li>
+  *  <li> zstd</li>
+  *  <li> Bitshuffle/zstd</li>
   * </ul>
   */
 
@@ -60,10 +68,25 @@ NDArray *decompressJPEG(NDArray *input, NDCodecStatus_t *status, char *errorMess
 NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp_t compressor, 
                        int numThreads, NDCodecStatus_t *status, char *errorMessage);
 NDArray *decompressBlosc(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
-NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage,
+                     size_t chunkRows=0, int numThreads=1);
 NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
-NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage,
+                       size_t chunkRows=0, int numThreads=1);
 NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressZstd(NDArray *input, int clevel, int numThreads, NDCodecStatus_t *status,
+                      char *errorMessage, size_t chunkRows=0, int chunkThreads=1);
+NDArray *decompressZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressBSZstd(NDArray *input, int clevel, NDCodecStatus_t *status, char *errorMessage,
+                        size_t chunkRows=0, int chunkThreads=1);
+NDArray *decompressBSZstd(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+
+/*
+ * The header that the HDF5 lz4 and bitshuffle filters expect in front of the data.
+ * The compress functions write it at the end of codec.headerRoom.
+ */
+size_t filterHeaderSize(const std::string& codec);
+void writeFilterHeader(const std::string& codec, char *header, size_t uncompressedSize, size_t compressedSize);
 
 
 class epicsShareClass NDPluginCodec : public NDPluginDriver {
@@ -89,6 +112,10 @@ protected:
     int NDCodecBloscCLevel;
     int NDCodecBloscShuffle;
     int NDCodecBloscNumThreads;
+    int NDCodecZstdCLevel;
+    int NDCodecZstdNumThreads;
+    int NDCodecChunkRows;
+    int NDCodecChunkThreads;
 
 };
  
@@ -348,10 +348,6 @@ extern "C" {static void driverCallback(void *drvPvt, asynUser *pasynUser, void *
 bool NDPluginDriver::throttled(NDArray *pArray)
 {
     double needed;
-    double maxByteRate;
-    
-    getDoubleParam(NDPluginDriverMaxByteRate, &maxByteRate);
-    if (maxByteRate == 0) return false;
 
     if (pArray->codec.empty()) {
         NDArrayInfo info;
@@ -360,7 +356,19 @@ bool NDPluginDriver::throttled(NDArray *pArray)
     } else {
         needed = pArray->compressedSize;
     }
-    return !throttler_->tryTake(needed);
+    return throttled(needed);
+}
+
+/* Same as throttled(NDArray *) for output that is not an NDArray of the same size.
+ * Lets a plugin check the throttle before it spends time producing the output. */
+bool NDPluginDriver::throttled(double bytes)
+{
+    double maxByteRate;
+    
+    getDoubleParam(NDPluginDriverMaxByteRate, &maxByteRate);
+    if (maxByteRate == 0) return false;
+
+    return !throttler_->tryTake(bytes);
 }
 
 /** Method that is called from the driver with a new NDArray.
@@ -107,6 +107,7 @@ protected:
 
     NDArray *pPrevInputArray_;
     bool throttled(NDArray *pArray);
+    bool throttled(double bytes);
 
 private:
     void processTask();
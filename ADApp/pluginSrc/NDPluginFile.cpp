@@ -29,6 +29,23 @@
 
 static const char *driverName="NDPluginFile";
 
+/** Default number of writes in the sliding window of the write statistics */
+#define NDFILE_STATS_WINDOW_DEFAULT 100
+/** Minimum time between array callbacks of the statistics (s) */
+#define NDFILE_STATS_CALLBACK_PERIOD 0.2
+
+/** Returns the histogram bin of a file operation that took elapsed seconds; see NDFILE_HIST_SIZE */
+static int fileStatsBin(double elapsed)
+{
+    double usec = elapsed * 1.e6;
+    int bin = 0;
+
+    while ((usec >= 2.0) && (bin < NDFILE_HIST_SIZE-1)) {
+        usec /= 2.0;
+        bin++;
+    }
+    return bin;
+}
 
 
 /** Base method for opening a file
@@ -41,6 +58,7 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
     char fullFileName[MAX_FILENAME_LEN];
     char tempSuffix[MAX_FILENAME_LEN];
     char errorMessage[256];
+    epicsTimeStamp tStart, tEnd;
     static const char* functionName = "openFileBase";
 
     if (this->useAttrFilePrefix)
@@ -70,7 +88,9 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
     this->unlock();
     epicsMutexLock(this->fileMutexId);
     this->registerInitFrameInfo(pArray);
+    epicsTimeGetCurrent(&tStart);
     status = this->openFile(fullFileName, openMode, pArray);
+    epicsTimeGetCurrent(&tEnd);
     if (status) {
         epicsSnprintf(errorMessage, sizeof(errorMessage)-1, 
             "Error opening file %s, status=%d", fullFileName, status);
@@ -82,6 +102,8 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
     }
     epicsMutexUnlock(this->fileMutexId);
     this->lock();
+    if (status == asynSuccess)
+        this->updateFileStats(NDFileOpenTime, this->openHist, epicsTimeDiffInSeconds(&tEnd, &tStart));
     
     return(status);
 }
@@ -96,6 +118,7 @@ asynStatus NDPluginFile::closeFileBase()
     char tempSuffix[MAX_FILENAME_LEN];
     char tempFileName[MAX_FILENAME_LEN];
     char errorMessage[256];
+    epicsTimeStamp tStart, tEnd;
     static const char* functionName = "closeFileBase";
 
     setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
@@ -108,7 +131,9 @@ asynStatus NDPluginFile::closeFileBase()
     /* Do this with the main lock released since it is slow */
     this->unlock();
     epicsMutexLock(this->fileMutexId);
+    epicsTimeGetCurrent(&tStart);
     status = this->closeFile();
+    epicsTimeGetCurrent(&tEnd);
     if (status) {
         epicsSnprintf(errorMessage, sizeof(errorMessage)-1, 
             "Error closing file, status=%d", status);
@@ -133,7 +158,10 @@ asynStatus NDPluginFile::closeFileBase()
               driverName, functionName, errorMessage);
         setIntegerParam(NDFileWriteStatus, NDFileWriteError);
         setStringParam(NDFileWriteMessage, errorMessage);
+    } else {
+        this->updateFileStats(NDFileCloseTime, this->closeHist, epicsTimeDiffInSeconds(&tEnd, &tStart));
     }
+    this->doFileStatsCallbacks(true);
 
     return(status);
 }
@@ -253,11 +281,7 @@ asynStatus NDPluginFile::writeFileBase()
             setIntegerParam(NDFileNumCaptured, 1);
             status = this->openFileBase(NDFileModeWrite, pArrayOut);
             if (status == asynSuccess) {
-                this->unlock();
-                epicsMutexLock(this->fileMutexId);
-                status = this->writeFile(pArrayOut);
-                epicsMutexUnlock(this->fileMutexId);
-                this->lock();
+                status = this->writeFileTimed(pArrayOut);
                 NDPluginDriver::endProcessCallbacks(pArrayOut, true, true);
                 if (status) {
                     epicsSnprintf(errorMessage, sizeof(errorMessage)-1, 
@@ -296,11 +320,7 @@ asynStatus NDPluginFile::writeFileBase()
                     else
                         this->attrFileNameCheck();
                     if (status == asynSuccess) {
-                        this->unlock();
-                        epicsMutexLock(this->fileMutexId);
-                        status = this->writeFile(pArray);
-                        epicsMutexUnlock(this->fileMutexId);
-                        this->lock();
+                        status = this->writeFileTimed(pArray);
                         NDPluginDriver::endProcessCallbacks(pArray, true, true);
                         if (status) {
                             epicsSnprintf(errorMessage, sizeof(errorMessage)-1, 
@@ -337,11 +357,7 @@ asynStatus NDPluginFile::writeFileBase()
                 status = asynError;
             }
             if (status == asynSuccess) {
-                this->unlock();
-                epicsMutexLock(this->fileMutexId);
-                status = this->writeFile(pArrayOut);
-                epicsMutexUnlock(this->fileMutexId);
-                this->lock();
+                status = this->writeFileTimed(pArrayOut);
                 NDPluginDriver::endProcessCallbacks(pArrayOut, true, true);
                 if (status) {
                     epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
@@ -409,6 +425,154 @@ void NDPluginFile::freeCaptureBuffer(int numCapture)
     this->pCapture = NULL;
 }
 
+/** Calls writeFile in the derived class with the main lock released, and updates the write statistics.
+  * \param[in] pArray Pointer to the NDArray to write to the file. */
+asynStatus NDPluginFile::writeFileTimed(NDArray *pArray)
+{
+    asynStatus status;
+    epicsTimeStamp tStart, tEnd;
+
+    this->unlock();
+    epicsMutexLock(this->fileMutexId);
+    epicsTimeGetCurrent(&tStart);
+    status = this->writeFile(pArray);
+    epicsTimeGetCurrent(&tEnd);
+    epicsMutexUnlock(this->fileMutexId);
+    this->lock();
+    if (status == asynSuccess)
+        this->updateWriteStats(pArray, &tStart, epicsTimeDiffInSeconds(&tEnd, &tStart));
+    return status;
+}
+
+/** Clears the histograms and the sliding window of the file I/O statistics */
+void NDPluginFile::resetFileStats()
+{
+    memset(this->openHist,  0, sizeof(this->openHist));
+    memset(this->writeHist, 0, sizeof(this->writeHist));
+    memset(this->closeHist, 0, sizeof(this->closeHist));
+    this->writeWindowNext = 0;
+    this->writeWindowCount = 0;
+    this->writeWindowBytes = 0.;
+    this->writeWindowMax = 0.;
+    setIntegerParam(NDFileStatsWrites, 0);
+    setDoubleParam(NDFileOpenTime, 0.);
+    setDoubleParam(NDFileWriteTime, 0.);
+    setDoubleParam(NDFileCloseTime, 0.);
+    setDoubleParam(NDFileWriteRate, 0.);
+    setIntegerParam(NDFileWriteBacklog, 0);
+    setDoubleParam(NDFileMaxStall, 0.);
+}
+
+/** Records the time taken by a file open or close.
+  * \param[in] timeParam Parameter that holds the time of the last operation.
+  * \param[in] histogram Histogram of the operation.
+  * \param[in] elapsed Time the operation took (s). */
+void NDPluginFile::updateFileStats(int timeParam, double *histogram, double elapsed)
+{
+    histogram[fileStatsBin(elapsed)]++;
+    setDoubleParam(timeParam, elapsed * 1000.);
+    this->doFileStatsCallbacks(false);
+}
+
+/** Records a write in the histogram and in the sliding window, and updates the write rate,
+  * the queue backlog and the longest write in the window.
+  * \param[in] pArray The NDArray that was written.
+  * \param[in] pStart Time the write started.
+  * \param[in] elapsed Time the write took (s). */
+void NDPluginFile::updateWriteStats(NDArray *pArray, epicsTimeStamp *pStart, double elapsed)
+{
+    NDArrayInfo_t arrayInfo;
+    NDFileWriteSample_t *pSample;
+    size_t windowSize = this->writeWindow.size();
+    size_t oldest, i;
+    double evicted = 0.;
+    double span;
+    int writes, queueSize, queueFree;
+
+    pArray->getInfo(&arrayInfo);
+    this->writeHist[fileStatsBin(elapsed)]++;
+
+    /* Replace the oldest sample once the window is full */
+    pSample = &this->writeWindow[this->writeWindowNext];
+    if (this->writeWindowCount == windowSize) {
+        this->writeWindowBytes -= pSample->bytes;
+        evicted = pSample->elapsed;
+    } else {
+        this->writeWindowCount++;
+    }
+    pSample->start = *pStart;
+    pSample->elapsed = elapsed;
+    pSample->bytes = (double)(pArray->codec.empty() ? arrayInfo.totalBytes : pArray->compressedSize);
+    this->writeWindowBytes += pSample->bytes;
+    this->writeWindowNext = (this->writeWindowNext + 1) % windowSize;
+
+    /* Only scan the window if the longest write has just left it */
+    if (elapsed >= this->writeWindowMax) {
+        this->writeWindowMax = elapsed;
+    } else if (evicted >= this->writeWindowMax) {
+        this->writeWindowMax = 0.;
+        for (i=0; i<this->writeWindowCount; i++) {
+            if (this->writeWindow[i].elapsed > this->writeWindowMax)
+                this->writeWindowMax = this->writeWindow[i].elapsed;
+        }
+    }
+
+    /* The sustained rate includes the time between writes, from the start of the oldest write
+     * in the window to the end of this one */
+    oldest = (this->writeWindowCount == windowSize) ? this->writeWindowNext : 0;
+    span = epicsTimeDiffInSeconds(pStart, &this->writeWindow[oldest].start) + elapsed;
+    if (span > 0.)
+        setDoubleParam(NDFileWriteRate, this->writeWindowBytes / span / 1.e6);
+
+    getIntegerParam(NDPluginDriverQueueSize, &queueSize);
+    getIntegerParam(NDPluginDriverQueueFree, &queueFree);
+    setIntegerParam(NDFileWriteBacklog, queueSize - queueFree);
+    getIntegerParam(NDFileStatsWrites, &writes);
+    setIntegerParam(NDFileStatsWrites, writes+1);
+    setDoubleParam(NDFileWriteTime, elapsed * 1000.);
+    setDoubleParam(NDFileMaxStall, this->writeWindowMax * 1000.);
+    this->doFileStatsCallbacks(false);
+}
+
+/** Does the array callbacks of the histograms and of the write times in the window.
+  * \param[in] force If false the callbacks are done at most every NDFILE_STATS_CALLBACK_PERIOD seconds. */
+void NDPluginFile::doFileStatsCallbacks(bool force)
+{
+    epicsTimeStamp now;
+    size_t numTimes;
+
+    epicsTimeGetCurrent(&now);
+    if (!force && (epicsTimeDiffInSeconds(&now, &this->statsCallbackTime) < NDFILE_STATS_CALLBACK_PERIOD))
+        return;
+    this->statsCallbackTime = now;
+    doCallbacksFloat64Array(this->openHist,  NDFILE_HIST_SIZE, NDFileOpenHist,  0);
+    doCallbacksFloat64Array(this->writeHist, NDFILE_HIST_SIZE, NDFileWriteHist, 0);
+    doCallbacksFloat64Array(this->closeHist, NDFILE_HIST_SIZE, NDFileCloseHist, 0);
+    doCallbacksFloat64Array(this->histAxis,  NDFILE_HIST_SIZE, NDFileHistAxis,  0);
+    numTimes = this->getWriteTimes(&this->writeTimes[0], this->writeTimes.size());
+    doCallbacksFloat64Array(&this->writeTimes[0], numTimes, NDFileWriteTimes, 0);
+}
+
+/** Copies the times of the writes in the window to an array, oldest first, in ms.
+  * \param[out] pTimes Array to copy the times to.
+  * \param[in] maxTimes Maximum number of times to copy.
+  * \return The number of times copied. */
+size_t NDPluginFile::getWriteTimes(epicsFloat64 *pTimes, size_t maxTimes)
+{
+    size_t windowSize = this->writeWindow.size();
+    size_t numTimes = this->writeWindowCount;
+    size_t first, i;
+
+    if (numTimes > maxTimes) numTimes = maxTimes;
+    /* Skip the oldest writes if they do not all fit */
+    first = (this->writeWindowCount == windowSize) ? this->writeWindowNext : 0;
+    first += this->writeWindowCount - numTimes;
+    for (i=0; i<numTimes; i++) {
+        pTimes[i] = this->writeWindow[(first + i) % windowSize].elapsed * 1000.;
+    }
+    return numTimes;
+}
+
 /** Handles the logic for when NDFileCapture changes state, starting or stopping capturing or streaming NDArrays
   * to a file.
   * \param[in] capture Flag to start or stop capture; 1=start capture, 0=stop capture. */
@@ -859,6 +1023,24 @@ asynStatus NDPluginFile::writeInt32(asynUser *pasynUser, epicsInt32 value)
         } else {
             setIntegerParam(NDFileCapture, 0);
         }
+    } else if (function == NDFileStatsReset) {
+        if (value) {
+            this->resetFileStats();
+            this->doFileStatsCallbacks(true);
+            setIntegerParam(NDFileStatsReset, 0);
+        }
+    } else if (function == NDFileStatsWindow) {
+        if (value < 1) {
+            value = 1;
+            setIntegerParam(NDFileStatsWindow, value);
+        } else if (value > NDFILE_STATS_WINDOW_MAX) {
+            value = NDFILE_STATS_WINDOW_MAX;
+            setIntegerParam(NDFileStatsWindow, value);
+        }
+        this->writeWindow.resize(value);
+        this->writeTimes.resize(value);
+        this->resetFileStats();
+        this->doFileStatsCallbacks(true);
     } else {
         /* This was not a parameter that this driver understands, try the base class */
         status = NDPluginDriver::writeInt32(pasynUser, value);
@@ -879,6 +1061,36 @@ asynStatus NDPluginFile::writeInt32(asynUser *pasynUser, epicsInt32 value)
 }
 
 
+/** Called when asyn clients call pasynFloat64Array->read().
+  * Returns the histograms and the write times of the file I/O statistics.
+  * For other parameters it calls the base class method.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[out] value Array to read.
+  * \param[in] nElements Number of elements to read.
+  * \param[out] nIn Number of elements actually read. */
+asynStatus NDPluginFile::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                          size_t nElements, size_t *nIn)
+{
+    int function = pasynUser->reason;
+    double *histogram = NULL;
+    size_t ncopy = NDFILE_HIST_SIZE;
+
+    if      (function == NDFileOpenHist)  histogram = this->openHist;
+    else if (function == NDFileWriteHist) histogram = this->writeHist;
+    else if (function == NDFileCloseHist) histogram = this->closeHist;
+    else if (function == NDFileHistAxis)  histogram = this->histAxis;
+    else if (function == NDFileWriteTimes) {
+        *nIn = this->getWriteTimes(value, nElements);
+        return asynSuccess;
+    } else {
+        return NDPluginDriver::readFloat64Array(pasynUser, value, nElements, nIn);
+    }
+    if (nElements < ncopy) ncopy = nElements;
+    memcpy(value, histogram, ncopy*sizeof(*value));
+    *nIn = ncopy;
+    return asynSuccess;
+}
+
 asynStatus NDPluginFile::writeNDArray(asynUser *pasynUser, void *genericPointer)
 {
     NDArray *pArray = (NDArray *)genericPointer;
@@ -932,11 +1144,39 @@ NDPluginFile::NDPluginFile(const char *portName, int queueSize, int blockingCall
      * Set autoconnect to 1.  priority and stacksize can be 0, which will use defaults. */
     : NDPluginDriver(portName, queueSize, blockingCallbacks, 
                      NDArrayPort, NDArrayAddr, maxAddr, maxBuffers, maxMemory, 
-                     asynGenericPointerMask, asynGenericPointerMask,
+                     asynGenericPointerMask | asynFloat64ArrayMask, asynGenericPointerMask | asynFloat64ArrayMask,
                      asynFlags, autoConnect, priority, stackSize, maxThreads, compressionAware),
     pCapture(NULL), captureBufferSize(0)
 {
     //static const char *functionName = "NDPluginFile";
+    int i;
+
+    createParam(NDFileStatsResetString,   asynParamInt32,        &NDFileStatsReset);
+    createParam(NDFileStatsWindowString,  asynParamInt32,        &NDFileStatsWindow);
+    createParam(NDFileStatsWritesString,  asynParamInt32,        &NDFileStatsWrites);
+    createParam(NDFileOpenTimeString,     asynParamFloat64,      &NDFileOpenTime);
+    createParam(NDFileWriteTimeString,    asynParamFloat64,      &NDFileWriteTime);
+    createParam(NDFileCloseTimeString,    asynParamFloat64,      &NDFileCloseTime);
+    createParam(NDFileWriteRateString,    asynParamFloat64,      &NDFileWriteRate);
+    createParam(NDFileWriteBacklogString, asynParamInt32,        &NDFileWriteBacklog);
+    createParam(NDFileMaxStallString,     asynParamFloat64,      &NDFileMaxStall);
+    createParam(NDFileWriteTimesString,   asynParamFloat64Array, &NDFileWriteTimes);
+    createParam(NDFileOpenHistString,     asynParamFloat64Array, &NDFileOpenHist);
+    createParam(NDFileWriteHistString,    asynParamFloat64Array, &NDFileWriteHist);
+    createParam(NDFileCloseHistString,    asynParamFloat64Array, &NDFileCloseHist);
+    createParam(NDFileHistAxisString,     asynParamFloat64Array, &NDFileHistAxis);
+
+    /* Lower edge of each histogram bin in ms, see fileStatsBin() */
+    this->histAxis[0] = 0.;
+    for (i=1; i<NDFILE_HIST_SIZE; i++) {
+        this->histAxis[i] = (double)(1 << i) / 1000.;
+    }
+    this->writeWindow.resize(NDFILE_STATS_WINDOW_DEFAULT);
+    this->writeTimes.resize(NDFILE_STATS_WINDOW_DEFAULT);
+    epicsTimeGetCurrent(&this->statsCallbackTime);
+    setIntegerParam(NDFileStatsReset, 0);
+    setIntegerParam(NDFileStatsWindow, NDFILE_STATS_WINDOW_DEFAULT);
+    this->resetFileStats();
 
     this->ndArrayInfoInit = NULL;
     this->lazyOpen = false;
@@ -1,8 +1,11 @@
 #ifndef NDPluginFile_H
 #define NDPluginFile_H
 
+#include <vector>
+
 #include <epicsTypes.h>
 #include <epicsMutex.h>
+#include <epicsTime.h>
 
 #include "NDPluginDriver.h"
 
@@ -21,6 +24,30 @@ typedef int NDFileOpenMode_t;
 #define FILEPLUGIN_DESTINATION "FilePluginDestination"
 #define FILEPLUGIN_CLOSE       "FilePluginClose"
 
+#define NDFileStatsResetString    "FILE_STATS_RESET"    /**< (asynInt32,        r/w) Reset the file I/O statistics */
+#define NDFileStatsWindowString   "FILE_STATS_WINDOW"   /**< (asynInt32,        r/w) Number of writes in the sliding window */
+#define NDFileStatsWritesString   "FILE_STATS_WRITES"   /**< (asynInt32,        r/o) Number of writes since the last reset */
+#define NDFileOpenTimeString      "FILE_OPEN_TIME"      /**< (asynFloat64,      r/o) Time of the last file open (ms) */
+#define NDFileWriteTimeString     "FILE_WRITE_TIME"     /**< (asynFloat64,      r/o) Time of the last write (ms) */
+#define NDFileCloseTimeString     "FILE_CLOSE_TIME"     /**< (asynFloat64,      r/o) Time of the last file close (ms) */
+#define NDFileWriteRateString     "FILE_WRITE_RATE"     /**< (asynFloat64,      r/o) Sustained write rate over the window (MB/s) */
+#define NDFileWriteBacklogString  "FILE_WRITE_BACKLOG"  /**< (asynInt32,        r/o) Arrays waiting in the queue at the last write */
+#define NDFileMaxStallString      "FILE_MAX_STALL"      /**< (asynFloat64,      r/o) Longest write in the window (ms) */
+#define NDFileWriteTimesString    "FILE_WRITE_TIMES"    /**< (asynFloat64Array, r/o) Time of each write in the window, oldest first (ms) */
+#define NDFileOpenHistString      "FILE_OPEN_HIST"      /**< (asynFloat64Array, r/o) Histogram of file open times */
+#define NDFileWriteHistString     "FILE_WRITE_HIST"     /**< (asynFloat64Array, r/o) Histogram of write times */
+#define NDFileCloseHistString     "FILE_CLOSE_HIST"     /**< (asynFloat64Array, r/o) Histogram of file close times */
+#define NDFileHistAxisString      "FILE_HIST_AXIS"      /**< (asynFloat64Array, r/o) Lower edge of each histogram bin (ms) */
+
+/** Number of bins in the open, write and close time histograms.
+  * The bins are logarithmic: bin 0 counts times below 2 us and bin N counts times from 2^N to 2^(N+1) us.
+  * The last bin also counts all longer times. */
+#define NDFILE_HIST_SIZE 24
+
+/** Maximum number of writes in the sliding window of the write statistics.
+  * Larger values of FILE_STATS_WINDOW are clamped to it. */
+#define NDFILE_STATS_WINDOW_MAX 100000
+
 /** Base class for NDArray file writing plugins; actual file writing plugins inherit from this class.
   * This class handles the logic of single file per image, capture into buffer or streaming multiple images
   * to a single file.  
@@ -37,6 +64,8 @@ public:
     virtual void processCallbacks(NDArray *pArray);
     virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     virtual asynStatus writeNDArray(asynUser *pasynUser, void *genericPointer);
+    virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                        size_t nElements, size_t *nIn);
 
     /** Open a file; pure virtual function that must be implemented by derived classes.
       * \param[in] fileName  Absolute path name of the file to open.
@@ -66,6 +95,22 @@ public:
     int supportsMultipleArrays; /**< Derived classes must set this flag to 0/1 if they cannot/can write 
                                   * multiple NDArrays to a single file. Used in capture and stream modes. */
 
+protected:
+    int NDFileStatsReset;
+    int NDFileStatsWindow;
+    int NDFileStatsWrites;
+    int NDFileOpenTime;
+    int NDFileWriteTime;
+    int NDFileCloseTime;
+    int NDFileWriteRate;
+    int NDFileWriteBacklog;
+    int NDFileMaxStall;
+    int NDFileWriteTimes;
+    int NDFileOpenHist;
+    int NDFileWriteHist;
+    int NDFileCloseHist;
+    int NDFileHistAxis;
+
 private:
     asynStatus openFileBase(NDFileOpenMode_t openMode, NDArray *pArray);
     asynStatus readFileBase();
@@ -79,6 +124,12 @@ private:
     bool attrIsProcessingRequired(NDAttributeList* pAttrList);
     void registerInitFrameInfo(NDArray *pArray); /**< Grab a copy of the NDArrayInfo_t structure for future reference */
     bool isFrameValid(NDArray *pArray); /**< Compare pArray dimensions and datatype against latched NDArrayInfo_t structure */
+    asynStatus writeFileTimed(NDArray *pArray);
+    void resetFileStats();
+    void updateFileStats(int timeParam, double *histogram, double elapsed);
+    void updateWriteStats(NDArray *pArray, epicsTimeStamp *pStart, double elapsed);
+    void doFileStatsCallbacks(bool force);
+    size_t getWriteTimes(epicsFloat64 *pTimes, size_t maxTimes);
 
     NDArray **pCapture;
     int captureBufferSize;
@@ -87,6 +138,25 @@ private:
     bool lazyOpen;
     NDArrayInfo_t *ndArrayInfoInit; /**< The NDArray information at file open time.
                                       *  Used to check against changes in incoming frames dimensions or datatype */
+
+    /** One write in the sliding window of the write statistics */
+    typedef struct {
+        epicsTimeStamp start; /**< Time the write started */
+        double elapsed;       /**< Time the write took (s) */
+        double bytes;         /**< Number of bytes written */
+    } NDFileWriteSample_t;
+
+    double openHist[NDFILE_HIST_SIZE];
+    double writeHist[NDFILE_HIST_SIZE];
+    double closeHist[NDFILE_HIST_SIZE];
+    double histAxis[NDFILE_HIST_SIZE];
+    std::vector<NDFileWriteSample_t> writeWindow; /**< Ring buffer of the most recent writes */
+    size_t writeWindowNext;                       /**< Index in writeWindow of the next write */
+    size_t writeWindowCount;                      /**< Number of valid entries in writeWindow */
+    double writeWindowBytes;                      /**< Sum of the bytes of the writes in writeWindow */
+    double writeWindowMax;                        /**< Longest write in writeWindow (s) */
+    std::vector<epicsFloat64> writeTimes;         /**< Times of the writes for the array callbacks, sized like writeWindow */
+    epicsTimeStamp statsCallbackTime;             /**< Time of the last array callbacks of the statistics */
 };
 
 #endif
@@ -37,6 +37,21 @@
 
 static const char *driverName="NDPluginOverlay";
 
+/* The fonts contain the characters 32 through 126 followed by 160 through 255 */
+#define FIRST_FONT_CHAR  32
+#define LAST_ASCII_CHAR  126
+#define FIRST_LATIN_CHAR 160
+#define NUM_FONT_CHARS   191
+
+/* Returns the index of the glyph of a character in the fonts, or -1 if the fonts do not have it */
+static int glyphIndex(unsigned char ch)
+{
+  if (ch < FIRST_FONT_CHAR) return -1;
+  if (ch <= LAST_ASCII_CHAR) return ch - FIRST_FONT_CHAR;
+  if (ch < FIRST_LATIN_CHAR) return -1;
+  return ch - FIRST_LATIN_CHAR + (LAST_ASCII_CHAR - FIRST_FONT_CHAR + 1);
+}
+
 void NDPluginOverlay::addPixel(NDOverlay_t *pOverlay, int ix, int iy, NDArrayInfo_t *pArrayInfo)
 {
   if ((ix >= 0) && (ix < (int)pArrayInfo->xSize) &&
@@ -44,32 +59,48 @@ void NDPluginOverlay::addPixel(NDOverlay_t *pOverlay, int ix, int iy, NDArrayInf
     pOverlay->pvt.addressOffset.push_back((int)(iy*pArrayInfo->yStride) + (int)(ix*pArrayInfo->xStride));
 }
 
+/** Sets all of the pixels in the addressOffset list of an overlay.
+  * The color mode and draw mode are resolved once, so the inner loops are simple scatters
+  * over the address list, one for each color plane.
+  */
 template <typename epicsType>
-void NDPluginOverlay::setPixel(epicsType *pValue, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
+void NDPluginOverlay::setPixels(epicsType *pData, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
 {
+  int numPixels = (int)pOverlay->pvt.addressOffset.size();
+  const int *pOffset;
+  epicsType *pColor;
+  epicsType value;
+  int colors[3];
+  int numColors = 1;
+  int color;
+  int i;
+
+  if (numPixels == 0) return;
+  pOffset = &pOverlay->pvt.addressOffset[0];
   if ((pArrayInfo->colorMode == NDColorModeRGB1) ||
       (pArrayInfo->colorMode == NDColorModeRGB2) ||
       (pArrayInfo->colorMode == NDColorModeRGB3)) {
+    numColors = 3;
+    colors[0] = pOverlay->red;
+    colors[1] = pOverlay->green;
+    colors[2] = pOverlay->blue;
+  } else {
+    colors[0] = pOverlay->green;
+  }
+
+  for (color=0; color<numColors; color++) {
+    pColor = pData + color*pArrayInfo->colorStride;
     if (pOverlay->drawMode == NDOverlaySet) {
-      *pValue = (epicsType)pOverlay->red;
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)pOverlay->green;
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)pOverlay->blue;
+      value = (epicsType)colors[color];
+      for (i=0; i<numPixels; i++) {
+        pColor[pOffset[i]] = value;
+      }
     } else if (pOverlay->drawMode == NDOverlayXOR) {
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->red);
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->green);
-      pValue += pArrayInfo->colorStride;
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->blue);
+      for (i=0; i<numPixels; i++) {
+        pColor[pOffset[i]] = (epicsType)((int)pColor[pOffset[i]] ^ colors[color]);
+      }
     }
   }
-  else {
-    if (pOverlay->drawMode == NDOverlaySet)
-      *pValue = (epicsType)pOverlay->green;
-    else if (pOverlay->drawMode == NDOverlayXOR)
-      *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->green);
-  }
 }
 
 
@@ -77,7 +108,7 @@ void NDPluginOverlay::setPixel(epicsType *pValue, NDOverlay_t *pOverlay, NDArray
 template <typename epicsType>
 void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
 {
-  int xmin, xmax, ymin, ymax, xcent, ycent, xsize, ysize, ix, iy, ii, jj, ib;
+  int xmin, xmax, ymin, ymax, xcent, ycent, xsize, ysize, ix, iy, ii, jj;
   int xwide, ywide, xwidemax_line, xwidemin_line;
   std::vector<int>::iterator it;
   int nSteps;
@@ -85,12 +116,9 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArray
   epicsType *pData=(epicsType *)pArray->pData;
   char textOutStr[512];                    // our string, maybe with a time stamp, to place into the image array
   char *cp;                                // character pointer to current character being rendered
-  int bmc;                                 // current byte in the font bitmap
-  int mask;                                // selects the bit in bmc to look at
   char tstr[64];                           // Used to build the time string
   NDPluginOverlayTextFontBitmapType *bmp;  // pointer to our font information (bitmap pointer, perhaps misnamed)
-  int bpc;                                 // bytes per char, ie, 1 for 6x13 font, 2 for 9x15 font
-  int sbc;                                 // "sub" byte counter to keep track of which byte we are looking at for multi byte fonts
+  NDOverlayGlyph_t *pGlyph;                // pixels of the current character
   //static const char *functionName = "doOverlayT";
 
   asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
@@ -98,6 +126,25 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArray
     pOverlay->shape, (int)pOverlay->PositionX, (int)pOverlay->PositionY, 
     (int)pOverlay->SizeX, (int)pOverlay->SizeY);
 
+  if (pOverlay->shape == NDOverlayText) {
+    if ((pOverlay->Font < 0) || (pOverlay->Font >= NDPluginOverlayTextFontBitmapTypeN)) {
+      // Really, no reason to go on if the font is ill defined
+      return;
+    }
+    if (strlen(pOverlay->TimeStampFormat) > 0) {
+      epicsTimeToStrftime(tstr, sizeof(tstr)-1, pOverlay->TimeStampFormat, &pArray->epicsTS);
+      epicsSnprintf(textOutStr, sizeof(textOutStr)-1, "%s%s", pOverlay->DisplayText, tstr);
+    } else {
+      epicsSnprintf(textOutStr, sizeof(textOutStr)-1, "%s", pOverlay->DisplayText);
+    }
+    textOutStr[sizeof(textOutStr)-1] = 0;
+    // The pixels only need to be computed again if the text has changed, e.g. a time stamp with 1 second resolution
+    if (pOverlay->pvt.text != textOutStr) {
+      pOverlay->pvt.text = textOutStr;
+      pOverlay->pvt.changed = true;
+    }
+  }
+
   if (pOverlay->pvt.changed) {
     pOverlay->pvt.addressOffset.clear();
 
@@ -190,23 +237,7 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArray
         break;
 
       case NDOverlayText:
-        if ((pOverlay->Font >= 0) && (pOverlay->Font < NDPluginOverlayTextFontBitmapTypeN)) {
-          bmp = &NDPluginOverlayTextFontBitmaps[pOverlay->Font];
-        } else {
-          // Really, no reason to go on if the font is ill defined
-          return;
-        }
-
-        bpc = bmp->width / 8 + 1;
-
-        if (strlen(pOverlay->TimeStampFormat) > 0) {
-          epicsTimeToStrftime(tstr, sizeof(tstr)-1, pOverlay->TimeStampFormat, &pArray->epicsTS);
-          epicsSnprintf(textOutStr, sizeof(textOutStr)-1, "%s%s", pOverlay->DisplayText, tstr);
-        } else {
-          epicsSnprintf(textOutStr, sizeof(textOutStr)-1, "%s", pOverlay->DisplayText);
-        }
-        textOutStr[sizeof(textOutStr)-1] = 0;
-
+        bmp  = &NDPluginOverlayTextFontBitmaps[pOverlay->Font];
         cp   = textOutStr;
         xmin = pOverlay->PositionX;
         xmax = pOverlay->PositionX + pOverlay->SizeX;
@@ -214,35 +245,23 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArray
         ymax = pOverlay->PositionY + pOverlay->SizeY;
         ymax = MIN(ymax, pOverlay->PositionY + bmp->height);
 
-        // Loop over vertical lines
-        for (jj=0, iy=ymin; iy<ymax; jj++, iy++) {
-
-          // Loop over characters
-          for (ii=0; cp[ii]!=0; ii++) {
-            if( cp[ii] < 32)
+        // Loop over characters, copying the cached pixels of each one
+        for (ii=0; cp[ii]!=0; ii++) {
+          int glyph = glyphIndex((unsigned char)cp[ii]);
+          if (glyph < 0)
+            continue;
+
+          if (xmin+ii * bmp->width >= xmax)
+            // None of this character can be written
+            break;
+
+          pGlyph = &glyphs_[pOverlay->Font][glyph];
+          for (jj=0; jj<(int)pGlyph->x.size(); jj++) {
+            ix = xmin + ii * bmp->width + pGlyph->x[jj];
+            iy = ymin + pGlyph->y[jj];
+            if ((ix >= xmax) || (iy >= ymax))
               continue;
-
-            if (xmin+ii * bmp->width >= xmax)
-              // None of this character can be written
-              break;
-
-            sbc = 0;
-            bmc = bmp->bitmap[(bmp->height*(cp[ii] - 32) + jj)*bpc];
-            mask = 0x80;
-            for (ib=0; ib<bmp->width; ib++) {
-              ix = xmin + ii * bmp->width + ib;
-              if (ix >= xmax)
-                break;
-              if (mask & bmc) {
-                addPixel(pOverlay, ix, iy, pArrayInfo);
-              }
-              mask >>= 1;
-              if (!mask) {
-                mask = 0x80;
-                sbc++;
-                bmc = bmp->bitmap[(bmp->height*(cp[ii] - 32) + jj)*bpc + sbc];
-              }
-            }
+            addPixel(pOverlay, ix, iy, pArrayInfo);
           }
         }
         break;
@@ -250,9 +269,7 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArray
   } // if (pOverlay->pvt.changed)
 
   // Set the pixels in the image from the addressOffset vector list
-  for (ii=0; ii<(int)pOverlay->pvt.addressOffset.size(); ii++) {
-    setPixel(pData + pOverlay->pvt.addressOffset[ii], pOverlay, pArrayInfo);
-  }
+  setPixels(pData, pOverlay, pArrayInfo);
 }
 
 int NDPluginOverlay::doOverlay(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo)
@@ -309,6 +326,7 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
 
   int overlay;
   int itemp;
+  int inPlace;
   NDArray *pOutput;
   NDArrayInfo arrayInfo;
   std::vector<NDOverlay_t>pOverlays;
@@ -320,8 +338,22 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
   /* Call the base class method */
   NDPluginDriver::beginProcessCallbacks(pArray);
 
-  /* Copy the input array so we can modify it. */
-  pOutput = this->pNDArrayPool->copy(pArray, NULL, 1);
+  getIntegerParam(NDPluginOverlayInPlace, &inPlace);
+  if (inPlace) {
+    /* Draw directly into the input array.  This is only valid if no other plugin uses the output of
+     * the upstream port.  The array is not kept for ProcessPlugin because it no longer contains the original
+     * image, and drawing the overlays on it again would erase XOR overlays. */
+    if (pPrevInputArray_ == pArray) {
+      pPrevInputArray_->release();
+      pPrevInputArray_ = 0;
+    }
+    /* This reference is passed to endProcessCallbacks */
+    pArray->reserve();
+    pOutput = pArray;
+  } else {
+    /* Copy the input array so we can modify it. */
+    pOutput = this->pNDArrayPool->copy(pArray, NULL, 1);
+  }
   
   /* Get information about the array needed later */
   pOutput->getInfo(&arrayInfo);
@@ -357,12 +389,9 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
     pOverlay->DisplayText[sizeof(pOverlay->DisplayText)-1] = 0;
     
     // Compare to see if any fields in the overlay have changed
+    // Text overlays are also updated in doOverlayT() when the text changes, e.g. because of a time stamp
     pOverlay->pvt.changed = (memcmp(&this->prevOverlays_[overlay], pOverlay, overlayUserLen) != 0);
     if (arrayInfoChanged) pOverlay->pvt.changed = true;
-    /* If this is a text overlay with a non-blank time stamp format then it always needs to be updated */
-    if ((pOverlay->shape == NDOverlayText) && (strlen(pOverlay->TimeStampFormat) > 0)) {
-        pOverlay->pvt.changed = true;
-    }
   }
   /* This function is called with the lock taken, and it must be set when we exit.
    * The following code can be exected without the mutex because we are not accessing memory
@@ -384,6 +413,39 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
 
 
 
+/** Computes the pixels that are set in each character of each font.
+  * This is done once so that text overlays copy the pixels of each character rather than
+  * decoding the font bitmaps bit by bit each time the text changes.
+  */
+void NDPluginOverlay::createGlyphs()
+{
+  NDPluginOverlayTextFontBitmapType *bmp;
+  const unsigned char *pRow;
+  NDOverlayGlyph_t *pGlyph;
+  int font, ch, row, col;
+  int bpc;   // bytes per char, ie, 1 for 6x13 font, 2 for 9x15 font
+
+  glyphs_.resize(NDPluginOverlayTextFontBitmapTypeN);
+  for (font=0; font<NDPluginOverlayTextFontBitmapTypeN; font++) {
+    bmp = &NDPluginOverlayTextFontBitmaps[font];
+    bpc = bmp->width / 8 + 1;
+    glyphs_[font].resize(NUM_FONT_CHARS);
+    for (ch=0; ch<NUM_FONT_CHARS; ch++) {
+      pGlyph = &glyphs_[font][ch];
+      for (row=0; row<bmp->height; row++) {
+        pRow = &bmp->bitmap[(bmp->height*ch + row)*bpc];
+        for (col=0; col<bmp->width; col++) {
+          if (pRow[col/8] & (0x80 >> (col%8))) {
+            pGlyph->x.push_back(col);
+            pGlyph->y.push_back(row);
+          }
+        }
+      }
+    }
+  }
+}
+
+
 /** Constructor for NDPluginOverlay; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   * After calling the base class constructor this method sets reasonable default values for all of the
   * ROI parameters.
@@ -421,9 +483,11 @@ NDPluginOverlay::NDPluginOverlay(const char *portName, int queueSize, int blocki
 
   this->maxOverlays_ = maxOverlays;
   this->prevOverlays_.resize(maxOverlays_);
+  createGlyphs();
 
   createParam(NDPluginOverlayMaxSizeXString,        asynParamInt32, &NDPluginOverlayMaxSizeX);
   createParam(NDPluginOverlayMaxSizeYString,        asynParamInt32, &NDPluginOverlayMaxSizeY);
+  createParam(NDPluginOverlayInPlaceString,         asynParamInt32, &NDPluginOverlayInPlace);
   createParam(NDPluginOverlayNameString,            asynParamOctet, &NDPluginOverlayName);
   createParam(NDPluginOverlayUseString,             asynParamInt32, &NDPluginOverlayUse);
   createParam(NDPluginOverlayPositionXString,       asynParamInt32, &NDPluginOverlayPositionX);
@@ -449,6 +513,7 @@ NDPluginOverlay::NDPluginOverlay(const char *portName, int queueSize, int blocki
   // Enable ArrayCallbacks.  
   // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
   setIntegerParam(NDArrayCallbacks, 1);
+  setIntegerParam(NDPluginOverlayInPlace, 0);
 
   /* Try to connect to the array port */
   connectToArrayPort();
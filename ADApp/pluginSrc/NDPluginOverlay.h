@@ -2,6 +2,7 @@
 #define NDPluginOverlay_H
 
 #include <vector>
+#include <string>
 #include <algorithm>
 #include "NDPluginDriver.h"
 
@@ -19,11 +20,18 @@ typedef enum {
 
 typedef struct {
     std::vector<int> addressOffset;
+    std::string text;   /* The text that addressOffset was computed for if this is a text overlay */
     bool changed;
     bool freezePositionX;
     bool freezePositionY;
 } NDOverlayPvt_t;
 
+/** Pixels that are set in one character of a text font, relative to the upper left of the character */
+typedef struct {
+    std::vector<int> x;
+    std::vector<int> y;
+} NDOverlayGlyph_t;
+
 /** Structure defining an overlay */
 typedef struct NDOverlay {
     int use;
@@ -47,6 +55,7 @@ typedef struct NDOverlay {
 
 #define NDPluginOverlayMaxSizeXString           "MAX_SIZE_X"            /* (asynInt32,   r/o) Maximum size of overlay in X dimension */
 #define NDPluginOverlayMaxSizeYString           "MAX_SIZE_Y"            /* (asynInt32,   r/o) Maximum size of overlay in Y dimension */
+#define NDPluginOverlayInPlaceString            "IN_PLACE"              /* (asynInt32,   r/w) Draw into the input array without copying it */
 #define NDPluginOverlayNameString               "NAME"                  /* (asynOctet,   r/w) Name of this overlay */
 #define NDPluginOverlayUseString                "USE"                   /* (asynInt32,   r/w) Use this overlay? */
 #define NDPluginOverlayPositionXString          "OVERLAY_POSITION_X"    /* (asynInt32,   r/w) X position (upper left) of overlay */
@@ -81,6 +90,7 @@ protected:
     int NDPluginOverlayMaxSizeX;
     #define FIRST_NDPLUGIN_OVERLAY_PARAM NDPluginOverlayMaxSizeX
     int NDPluginOverlayMaxSizeY;
+    int NDPluginOverlayInPlace;
     int NDPluginOverlayName;
     int NDPluginOverlayUse;
     int NDPluginOverlayPositionX;
@@ -104,10 +114,12 @@ private:
     int maxOverlays_;
     NDArrayInfo prevArrayInfo_;
     std::vector<NDOverlay_t> prevOverlays_;    /* Vector of NDOverlay structures */
+    std::vector<std::vector<NDOverlayGlyph_t> > glyphs_; /* Glyphs for each character of each font */
+    void createGlyphs();
     inline void addPixel(NDOverlay_t *pOverlay, int ix, int iy, NDArrayInfo_t *pArrayInfo);
     template <typename epicsType> void doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
     int doOverlay(NDArray *pArray, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
-    template <typename epicsType> void setPixel(epicsType *pValue, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
+    template <typename epicsType> void setPixels(epicsType *pData, NDOverlay_t *pOverlay, NDArrayInfo_t *pArrayInfo);
 };
     
 #endif
@@ -3,6 +3,7 @@
 #include <pv/channelProviderLocal.h>
 
 #include <epicsThread.h>
+#include <epicsStdio.h>
 #include <iocsh.h>
 
 #include <ntndArrayConverter.h>
@@ -12,9 +13,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
 
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
+#include "NDPluginCodec.h"
 #include "NDPluginPva.h"
 
 static const char *driverName="NDPluginPva";
@@ -46,6 +49,7 @@ public:
     virtual void destroy ();
     virtual void process () {}
     void update (NDArray *pArray);
+    int getNumberClients () { return getNumberClientChannels(); }
 };
 
 NTNDArrayRecordPtr NTNDArrayRecord::create (string const & name)
@@ -94,6 +98,163 @@ void NTNDArrayRecord::update(NDArray *pArray)
     unlock();
 }
 
+/** Returns a new array with the average over binning x binning pixels of pArray, or NULL on error.
+  * The output is NDFloat64 so that the sums cannot overflow. */
+NDArray *NDPluginPva::binArray(NDArray *pArray, int binning)
+{
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    NDArrayInfo_t arrayInfo;
+    NDArray *pOut;
+    double scale = 1.;
+    size_t i;
+
+    pArray->getInfo(&arrayInfo);
+    for (i=0; i<(size_t)pArray->ndims; i++) {
+        pArray->initDimension(&dims[i], pArray->dims[i].size);
+        if (((int)i == arrayInfo.xDim) || ((int)i == arrayInfo.yDim)) {
+            if ((int)dims[i].size < binning) return NULL;
+            dims[i].binning = binning;
+            dims[i].size -= dims[i].size % binning;
+            scale /= binning;
+        }
+    }
+    if (this->pNDArrayPool->convert(pArray, &pOut, NDFloat64, dims) != ND_SUCCESS) return NULL;
+
+    /* convert() sums the binned pixels */
+    pOut->getInfo(&arrayInfo);
+    epicsFloat64 *pData = (epicsFloat64 *)pOut->pData;
+    for (i=0; i<arrayInfo.nElements; i++) pData[i] *= scale;
+    return pOut;
+}
+
+template <typename epicsType>
+static void scaleArrayT(NDArray *pIn, NDArray *pOut, size_t nElements)
+{
+    epicsType *pData = (epicsType *)pIn->pData;
+    epicsUInt8 *pOutData = (epicsUInt8 *)pOut->pData;
+    epicsType minValue, maxValue;
+    double scale;
+    size_t i;
+
+    if (nElements == 0) return;
+    minValue = maxValue = pData[0];
+    for (i=1; i<nElements; i++) {
+        if (pData[i] < minValue) minValue = pData[i];
+        if (pData[i] > maxValue) maxValue = pData[i];
+    }
+    scale = (maxValue > minValue) ? 255. / ((double)maxValue - (double)minValue) : 0.;
+    for (i=0; i<nElements; i++) {
+        pOutData[i] = (epicsUInt8)(((double)pData[i] - (double)minValue) * scale + 0.5);
+    }
+}
+
+/** Returns a new NDUInt8 array with pArray scaled between its minimum and maximum, or NULL on error */
+NDArray *NDPluginPva::scaleArray(NDArray *pArray)
+{
+    NDArrayInfo_t arrayInfo;
+    size_t dims[ND_ARRAY_MAX_DIMS];
+    NDArray *pOut;
+    int i;
+
+    pArray->getInfo(&arrayInfo);
+    for (i=0; i<pArray->ndims; i++) dims[i] = pArray->dims[i].size;
+    pOut = this->pNDArrayPool->alloc(pArray->ndims, dims, NDUInt8, 0, NULL);
+    if (!pOut) return NULL;
+    memcpy(pOut->dims, pArray->dims, pArray->ndims*sizeof(NDDimension_t));
+    pOut->uniqueId  = pArray->uniqueId;
+    pOut->timeStamp = pArray->timeStamp;
+    pOut->epicsTS   = pArray->epicsTS;
+    pArray->pAttributeList->copy(pOut->pAttributeList);
+
+    switch (pArray->dataType) {
+        case NDInt8:    scaleArrayT<epicsInt8>   (pArray, pOut, arrayInfo.nElements); break;
+        case NDUInt8:   scaleArrayT<epicsUInt8>  (pArray, pOut, arrayInfo.nElements); break;
+        case NDInt16:   scaleArrayT<epicsInt16>  (pArray, pOut, arrayInfo.nElements); break;
+        case NDUInt16:  scaleArrayT<epicsUInt16> (pArray, pOut, arrayInfo.nElements); break;
+        case NDInt32:   scaleArrayT<epicsInt32>  (pArray, pOut, arrayInfo.nElements); break;
+        case NDUInt32:  scaleArrayT<epicsUInt32> (pArray, pOut, arrayInfo.nElements); break;
+        case NDInt64:   scaleArrayT<epicsInt64>  (pArray, pOut, arrayInfo.nElements); break;
+        case NDUInt64:  scaleArrayT<epicsUInt64> (pArray, pOut, arrayInfo.nElements); break;
+        case NDFloat32: scaleArrayT<epicsFloat32>(pArray, pOut, arrayInfo.nElements); break;
+        case NDFloat64: scaleArrayT<epicsFloat64>(pArray, pOut, arrayInfo.nElements); break;
+    }
+    return pOut;
+}
+
+/** Returns the array published by a derived channel, or NULL on error.
+  * Called without the lock; the caller releases the returned array.
+  * \param[in] pArray  The input array.
+  * \param[in] binning Average over binning x binning pixels if > 1.
+  * \param[in] mode    NDPvaChannelMode_t.
+  * \param[in] quality JPEG quality.
+  */
+NDArray *NDPluginPva::deriveArray(NDArray *pArray, int binning, int mode, int quality)
+{
+    static const char *functionName = "deriveArray";
+    NDArray *pBinned = NULL, *pScaled, *pOut = NULL;
+    NDCodecStatus_t codecStatus = NDCODEC_ERROR;
+    char errorMessage[256] = "";
+
+    if (!pArray->codec.empty()) {
+        /* Compressed input can only be passed on as is */
+        if ((binning > 1) || (mode != NDPvaChannelNative)) return NULL;
+        pArray->reserve();
+        return pArray;
+    }
+
+    if (binning > 1) {
+        pBinned = binArray(pArray, binning);
+        if (!pBinned) return NULL;
+    }
+
+    if (mode == NDPvaChannelNative) {
+        if (!pBinned) {
+            pArray->reserve();
+            return pArray;
+        }
+        if (pBinned->dataType != pArray->dataType) {
+            this->pNDArrayPool->convert(pBinned, &pOut, pArray->dataType);
+            pBinned->release();
+            return pOut;
+        }
+        return pBinned;
+    }
+
+    pScaled = scaleArray(pBinned ? pBinned : pArray);
+    if (pBinned) pBinned->release();
+    if (!pScaled || (mode == NDPvaChannel8Bit)) return pScaled;
+
+    pOut = compressJPEG(pScaled, quality, &codecStatus, errorMessage);
+    pScaled->release();
+    if (!pOut) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s JPEG compression failed: %s\n",
+            driverName, functionName, errorMessage);
+    }
+    return pOut;
+}
+
+/** Returns true if a derived channel publishes the current array, and advances its decimation counter.
+  * A channel that is disabled or has no clients starts again with the next array it gets.
+  * \param[in] channel  Index of the channel, the asyn address minus 1.
+  * \param[in] enable   Channel enabled.
+  * \param[in] decimate Publish every Nth array.
+  * \param[in] clients  Number of connected clients.
+  */
+bool NDPluginPva::channelDue(int channel, int enable, int decimate, int clients)
+{
+    bool due;
+
+    if (!enable || (clients == 0)) {
+        m_decimateCount[channel] = 0;
+        return false;
+    }
+    if (decimate < 1) decimate = 1;
+    due = (m_decimateCount[channel] == 0);
+    if (++m_decimateCount[channel] >= decimate) m_decimateCount[channel] = 0;
+    return due;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray
   * data.
   * \param[in] pArray  The NDArray from the callback.
@@ -101,8 +262,20 @@ void NTNDArrayRecord::update(NDArray *pArray)
 void NDPluginPva::processCallbacks(NDArray *pArray)
 {
     static const char *functionName = "processCallbacks";
+    int numChannels = (int)m_channels.size();
+    int enable, decimate, clients, counter;
+    int i;
 
     NDPluginDriver::beginProcessCallbacks(pArray);   // Base class method
+
+    // NTNDArray has no place for the chunk sizes of arrays that NDPluginCodec compressed in chunks
+    if (pArray->codec.chunkRows > 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot publish array uniqueId=%d compressed in chunks, set the codec ChunkRows to 0\n",
+            driverName, functionName, pArray->uniqueId);
+        callParamCallbacks();
+        return;
+    }
     
     // Most plugins can rely on endProcessCallbacks() to check for throttling, but this one cannot
     // because the output is not an NDArray but a pvAccess server.  Need to check here.
@@ -120,9 +293,45 @@ void NDPluginPva::processCallbacks(NDArray *pArray)
         arrayCounter--;
         setIntegerParam(NDArrayCounter, arrayCounter);
     } else {
+        // A derived channel is only computed when it is enabled, has clients and is due
+        for (i=0; i<numChannels; i++) {
+            getIntegerParam(i+1, NDPluginPvaChannelEnable,      &enable);
+            getIntegerParam(i+1, NDPluginPvaChannelDecimate,    &decimate);
+            getIntegerParam(i+1, NDPluginPvaChannelBinning,     &m_binning[i]);
+            getIntegerParam(i+1, NDPluginPvaChannelMode,        &m_mode[i]);
+            getIntegerParam(i+1, NDPluginPvaChannelJPEGQuality, &m_quality[i]);
+            clients = m_channels[i]->getNumberClients();
+            setIntegerParam(i+1, NDPluginPvaChannelClients, clients);
+            m_publish[i] = channelDue(i, enable, decimate, clients);
+        }
+
         this->unlock();             // Function called with the lock taken
         m_record->update(pArray);
+        for (i=0; i<numChannels; i++) {
+            if (!m_publish[i]) continue;
+            NDArray *pOut = deriveArray(pArray, m_binning[i], m_mode[i], m_quality[i]);
+            if (!pOut) {
+                m_publish[i] = 0;
+                continue;
+            }
+            try {
+                m_channels[i]->update(pOut);
+            } catch(...) {
+                pOut->release();
+                this->lock();
+                throw;
+            }
+            pOut->release();
+        }
         this->lock();               // Must return locked
+
+        for (i=0; i<numChannels; i++) {
+            if (m_publish[i]) {
+                getIntegerParam(i+1, NDPluginPvaChannelCounter, &counter);
+                setIntegerParam(i+1, NDPluginPvaChannelCounter, counter+1);
+            }
+            callParamCallbacks(i+1);
+        }
     }  
 
     // Do NDArray callbacks.  We need to copy the array and get the attributes
@@ -156,21 +365,60 @@ void NDPluginPva::processCallbacks(NDArray *pArray)
   *            This value should also be used for any other threads this object creates.
   * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
   *            This value should also be used for any other threads this object creates.
+  * \param[in] maxChannels Number of derived channels. Channel N uses asyn address N and is served
+  *            as the PV pvName:N.
   */
 NDPluginPva::NDPluginPva(const char *portName, int queueSize,
         int blockingCallbacks, const char *NDArrayPort, int NDArrayAddr,
-        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize)
+        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize,
+        int maxChannels)
     /* Invoke the base class constructor */
     : NDPluginDriver(portName, queueSize, blockingCallbacks,
-            NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory, 0, 0,
-            0, 1, priority, stackSize, 1, true),
+            NDArrayPort, NDArrayAddr, std::max<int>(maxChannels,0)+1, maxBuffers, maxMemory, 0, 0,
+            (maxChannels > 0) ? ASYN_MULTIDEVICE : 0, 1, priority, stackSize, 1, true),
             m_record(NTNDArrayRecord::create(pvName))
 {
-    createParam(NDPluginPvaPvNameString, asynParamOctet, &NDPluginPvaPvName);
+    char channelName[256];
+    int i;
+
+    createParam(NDPluginPvaPvNameString,             asynParamOctet, &NDPluginPvaPvName);
+    createParam(NDPluginPvaChannelPvNameString,      asynParamOctet, &NDPluginPvaChannelPvName);
+    createParam(NDPluginPvaChannelEnableString,      asynParamInt32, &NDPluginPvaChannelEnable);
+    createParam(NDPluginPvaChannelDecimateString,    asynParamInt32, &NDPluginPvaChannelDecimate);
+    createParam(NDPluginPvaChannelBinningString,     asynParamInt32, &NDPluginPvaChannelBinning);
+    createParam(NDPluginPvaChannelModeString,        asynParamInt32, &NDPluginPvaChannelMode);
+    createParam(NDPluginPvaChannelJPEGQualityString, asynParamInt32, &NDPluginPvaChannelJPEGQuality);
+    createParam(NDPluginPvaChannelClientsString,     asynParamInt32, &NDPluginPvaChannelClients);
+    createParam(NDPluginPvaChannelCounterString,     asynParamInt32, &NDPluginPvaChannelCounter);
 
     if(!m_record.get())
         throw runtime_error("failed to create NTNDArrayRecord");
 
+    if (maxChannels > 0) {
+        m_decimateCount.resize(maxChannels, 0);
+        m_publish.resize(maxChannels, 0);
+        m_binning.resize(maxChannels, 1);
+        m_mode.resize(maxChannels, NDPvaChannelNative);
+        m_quality.resize(maxChannels, 50);
+    }
+    for (i=0; i<maxChannels; i++) {
+        epicsSnprintf(channelName, sizeof(channelName), "%s:%d", pvName, i+1);
+        NTNDArrayRecordPtr channel(NTNDArrayRecord::create(channelName));
+        if(!channel.get())
+            throw runtime_error("failed to create NTNDArrayRecord");
+        m_channels.push_back(channel);
+
+        setStringParam (i+1, NDPluginPvaChannelPvName,      channelName);
+        setIntegerParam(i+1, NDPluginPvaChannelEnable,      0);
+        setIntegerParam(i+1, NDPluginPvaChannelDecimate,    1);
+        setIntegerParam(i+1, NDPluginPvaChannelBinning,     1);
+        setIntegerParam(i+1, NDPluginPvaChannelMode,        NDPvaChannelNative);
+        setIntegerParam(i+1, NDPluginPvaChannelJPEGQuality, 50);
+        setIntegerParam(i+1, NDPluginPvaChannelClients,     0);
+        setIntegerParam(i+1, NDPluginPvaChannelCounter,     0);
+        callParamCallbacks(i+1);
+    }
+
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginPva");
 
@@ -185,15 +433,21 @@ NDPluginPva::NDPluginPva(const char *portName, int queueSize,
 
     if(!master->addRecord(m_record))
         throw runtime_error("couldn't add record to master database");
+    for (i=0; i<maxChannels; i++) {
+        if(!master->addRecord(m_channels[i]))
+            throw runtime_error("couldn't add record to master database");
+    }
 }
 
 /* Configuration routine.  Called directly, or from the iocsh function */
 extern "C" int NDPvaConfigure(const char *portName, int queueSize,
         int blockingCallbacks, const char *NDArrayPort, int NDArrayAddr,
-        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize)
+        const char *pvName, int maxBuffers, size_t maxMemory, int priority, int stackSize,
+        int maxChannels)
 {
     NDPluginPva *pPlugin = new NDPluginPva(portName, queueSize, blockingCallbacks, NDArrayPort,
-                                           NDArrayAddr, pvName, maxBuffers, maxMemory, priority, stackSize);
+                                           NDArrayAddr, pvName, maxBuffers, maxMemory, priority, stackSize,
+                                           maxChannels);
     return pPlugin->start();
 }
 
@@ -208,6 +462,7 @@ static const iocshArg initArg6 = { "maxBuffers",iocshArgInt};
 static const iocshArg initArg7 = { "maxMemory",iocshArgInt};
 static const iocshArg initArg8 = { "priority",iocshArgInt};
 static const iocshArg initArg9 = { "stack size",iocshArgInt};
+static const iocshArg initArg10 = { "maxChannels",iocshArgInt};
 static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg1,
                                             &initArg2,
@@ -217,14 +472,15 @@ static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg6,
                                             &initArg7,
                                             &initArg8,
-                                            &initArg9,};
-static const iocshFuncDef initFuncDef = {"NDPvaConfigure",10,initArgs};
+                                            &initArg9,
+                                            &initArg10,};
+static const iocshFuncDef initFuncDef = {"NDPvaConfigure",11,initArgs};
 static void initCallFunc(const iocshArgBuf *args)
 {
     NDPvaConfigure(args[0].sval, args[1].ival, args[2].ival, 
                    args[3].sval, args[4].ival, args[5].sval, 
                    args[6].ival, args[7].ival, args[8].ival,
-                   args[9].ival);
+                   args[9].ival, args[10].ival);
 }
 
 extern "C" void NDPvaRegister(void)
@@ -13,6 +13,23 @@
 
 #define NDPluginPvaPvNameString "PV_NAME"
 
+/* Derived channels, one per asyn address starting at 1 */
+#define NDPluginPvaChannelPvNameString      "PVA_CHANNEL_PV_NAME"      /* (asynOctet,   r/o) PV name of the channel */
+#define NDPluginPvaChannelEnableString      "PVA_CHANNEL_ENABLE"       /* (asynInt32,   r/w) Publish the channel */
+#define NDPluginPvaChannelDecimateString    "PVA_CHANNEL_DECIMATE"     /* (asynInt32,   r/w) Publish every Nth array */
+#define NDPluginPvaChannelBinningString     "PVA_CHANNEL_BINNING"      /* (asynInt32,   r/w) Average over NxN pixels */
+#define NDPluginPvaChannelModeString        "PVA_CHANNEL_MODE"         /* (asynInt32,   r/w) NDPvaChannelMode_t */
+#define NDPluginPvaChannelJPEGQualityString "PVA_CHANNEL_JPEG_QUALITY" /* (asynInt32,   r/w) JPEG quality, 1-100 */
+#define NDPluginPvaChannelClientsString     "PVA_CHANNEL_CLIENTS"      /* (asynInt32,   r/o) Number of connected clients */
+#define NDPluginPvaChannelCounterString     "PVA_CHANNEL_COUNTER"      /* (asynInt32,   r/w) Number of arrays published */
+
+/** Data published by a derived channel */
+typedef enum {
+    NDPvaChannelNative,     /**< Same data type as the input */
+    NDPvaChannel8Bit,       /**< Scaled to 8 bits between the minimum and maximum of each array */
+    NDPvaChannelJPEG        /**< Scaled to 8 bits and compressed with JPEG */
+} NDPvaChannelMode_t;
+
 class NTNDArrayRecord;
 typedef std::tr1::shared_ptr<NTNDArrayRecord> NTNDArrayRecordPtr;
 
@@ -25,16 +42,34 @@ public:
     POINTER_DEFINITIONS(NDPluginPva);
     NDPluginPva(const char *portName, int queueSize, int blockingCallbacks,
                  const char *NDArrayPort, int NDArrayAddr, const char *pvName,
-                 int maxBuffers, size_t maxMemory, int priority, int stackSize);
+                 int maxBuffers, size_t maxMemory, int priority, int stackSize,
+                 int maxChannels=0);
 
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
 
 protected:
     int NDPluginPvaPvName;
+    int NDPluginPvaChannelPvName;
+    int NDPluginPvaChannelEnable;
+    int NDPluginPvaChannelDecimate;
+    int NDPluginPvaChannelBinning;
+    int NDPluginPvaChannelMode;
+    int NDPluginPvaChannelJPEGQuality;
+    int NDPluginPvaChannelClients;
+    int NDPluginPvaChannelCounter;
+
+    NDArray *binArray(NDArray *pArray, int binning);
+    NDArray *scaleArray(NDArray *pArray);
+    NDArray *deriveArray(NDArray *pArray, int binning, int mode, int quality);
+    bool channelDue(int channel, int enable, int decimate, int clients);
 
 private:
     NTNDArrayRecordPtr m_record;
+    std::vector<NTNDArrayRecordPtr> m_channels;
+    std::vector<int> m_decimateCount;
+    /* Settings of each channel for the array being processed, sized in the constructor */
+    std::vector<int> m_publish, m_binning, m_mode, m_quality;
 };
 
 #endif
@@ -0,0 +1,438 @@
+/*
+ * NDPluginShm.cpp
+ *
+ * Publishes NDArrays into a POSIX shared memory ring for consumers on the same host.
+ * The layout of the segment is described in NDShmLayout.h.
+ *
+ * The array data and attributes are copied once into the ring. Readers map the segment
+ * and use the slots in place; the sequence lock of each slot tells them if the slot was
+ * overwritten while they were using it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginShm.h"
+
+#ifdef NDSHM_SUPPORTED
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#define NDSHM_DEFAULT_SLOTS     4
+#define NDSHM_DEFAULT_SLOT_SIZE (8*1024*1024)
+
+static const char *driverName="NDPluginShm";
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/** Creates the shared memory segment and initializes the header.
+  * An existing segment with the same name is marked closed so that its readers reopen,
+  * and then replaced. */
+asynStatus NDPluginShm::createSegment()
+{
+    static const char *functionName = "createSegment";
+#ifdef NDSHM_SUPPORTED
+    const char *name = shmName.c_str();
+    size_t slotOffset = alignUp(sizeof(NDShmHeader_t), NDSHM_ALIGN);
+    epicsTimeStamp now;
+    void *pMap;
+    int fd;
+    int flags = MAP_SHARED;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd >= 0) {
+        struct stat st;
+        if ((fstat(fd, &st) == 0) && ((size_t)st.st_size >= sizeof(NDShmHeader_t))) {
+            pMap = mmap(NULL, sizeof(NDShmHeader_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (pMap != MAP_FAILED) {
+                NDShmHeader_t *pOld = (NDShmHeader_t *)pMap;
+                if (pOld->magic == NDSHM_MAGIC) pOld->state = NDSHM_STATE_CLOSED;
+                munmap(pMap, sizeof(NDShmHeader_t));
+            }
+        }
+        close(fd);
+        shm_unlink(name);
+    }
+
+    segmentSize = slotOffset + (size_t)numSlots * slotSize;
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot create shared memory segment %s: %s\n",
+            driverName, functionName, name, strerror(errno));
+        return asynError;
+    }
+    if (ftruncate(fd, (off_t)segmentSize) != 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot set size of shared memory segment %s to %lu bytes: %s\n",
+            driverName, functionName, name, (unsigned long)segmentSize, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return asynError;
+    }
+#ifdef MAP_POPULATE
+    /* Fault the pages in now rather than on the first pass through the ring */
+    flags |= MAP_POPULATE;
+#endif
+    pMap = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot map shared memory segment %s: %s\n",
+            driverName, functionName, name, strerror(errno));
+        shm_unlink(name);
+        return asynError;
+    }
+
+    pHeader = (NDShmHeader_t *)pMap;
+    epicsTimeGetCurrent(&now);
+    pHeader->version = NDSHM_VERSION;
+    pHeader->headerSize = sizeof(NDShmHeader_t);
+    pHeader->numSlots = numSlots;
+    pHeader->slotSize = slotSize;
+    pHeader->slotOffset = slotOffset;
+    pHeader->segmentSize = segmentSize;
+    pHeader->sessionId = (((uint64_t)now.secPastEpoch << 32) | now.nsec) ^ (uint64_t)getpid();
+    pHeader->state = NDSHM_STATE_OPEN;
+    pHeader->writerPid = (uint32_t)getpid();
+    pHeader->writeCount = 0;
+    /* Readers check the magic number last, so it must be written last */
+    ndShmFenceRelease();
+    pHeader->magic = NDSHM_MAGIC;
+    return asynSuccess;
+#else
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s::%s POSIX shared memory is not supported on this platform\n",
+        driverName, functionName);
+    return asynError;
+#endif
+}
+
+/** Marks the segment closed for the readers, unmaps and removes it */
+void NDPluginShm::destroySegment()
+{
+#ifdef NDSHM_SUPPORTED
+    if (!pHeader) return;
+    pHeader->state = NDSHM_STATE_CLOSED;
+    munmap(pHeader, segmentSize);
+    shm_unlink(shmName.c_str());
+    pHeader = NULL;
+#endif
+}
+
+/** Returns the number of bytes that writeAttributes needs for the attribute list */
+size_t NDPluginShm::attributeSize(NDAttributeList *pList)
+{
+    NDAttribute *pAttr;
+    NDAttrDataType_t attrType;
+    size_t valueSize;
+    size_t total = 0;
+
+    for (pAttr = pList->next(NULL); pAttr; pAttr = pList->next(pAttr)) {
+        if (pAttr->getValueInfo(&attrType, &valueSize) != ND_SUCCESS) valueSize = 0;
+        total += alignUp(sizeof(NDShmAttribute_t) +
+                         strlen(pAttr->getName()) + 1 +
+                         strlen(pAttr->getDescription()) + 1 +
+                         strlen(pAttr->getSource()) + 1 +
+                         valueSize, 8);
+    }
+    return total;
+}
+
+/** Serializes the attribute list into the records described by NDShmAttribute_t */
+void NDPluginShm::writeAttributes(NDAttributeList *pList, char *pOut)
+{
+    NDAttribute *pAttr;
+    NDAttrDataType_t attrType;
+    size_t valueSize;
+
+    for (pAttr = pList->next(NULL); pAttr; pAttr = pList->next(pAttr)) {
+        NDShmAttribute_t *pRecord = (NDShmAttribute_t *)pOut;
+        char *pString = pOut + sizeof(NDShmAttribute_t);
+        const char *strings[3] = {pAttr->getName(), pAttr->getDescription(), pAttr->getSource()};
+        uint32_t sizes[3];
+        int i;
+
+        if (pAttr->getValueInfo(&attrType, &valueSize) != ND_SUCCESS) {
+            attrType = NDAttrUndefined;
+            valueSize = 0;
+        }
+        for (i=0; i<3; i++) {
+            sizes[i] = (uint32_t)strlen(strings[i]) + 1;
+            memcpy(pString, strings[i], sizes[i]);
+            pString += sizes[i];
+        }
+        if (valueSize > 0) pAttr->getValue(attrType, pString, valueSize);
+        pRecord->dataType = attrType;
+        pRecord->nameSize = sizes[0];
+        pRecord->descriptionSize = sizes[1];
+        pRecord->sourceSize = sizes[2];
+        pRecord->valueSize = (uint32_t)valueSize;
+        pRecord->recordSize = (uint32_t)alignUp(sizeof(NDShmAttribute_t) +
+                                                sizes[0] + sizes[1] + sizes[2] + valueSize, 8);
+        pOut += pRecord->recordSize;
+    }
+}
+
+/** Writes the array into the next slot of the ring.
+  * Called without the lock; only the plugin thread writes to the segment.
+  * \param[in] pArray  The NDArray to publish.
+  * \return false if the array does not fit in a slot. */
+bool NDPluginShm::publish(NDArray *pArray)
+{
+    NDArrayInfo_t arrayInfo;
+    NDShmSlot_t *pSlot;
+    char *pSlotBase;
+    const char *pData;
+    size_t attrBytes, dataBytes, dataOffset;
+    uint64_t frameNumber, sequence;
+    int i;
+
+    pArray->getInfo(&arrayInfo);
+    if (pArray->codec.empty()) {
+        pData = (const char *)pArray->pData;
+        dataBytes = arrayInfo.totalBytes;
+    } else {
+        /* The room that NDPluginCodec reserves for a file format header is not part of the data */
+        pData = (const char *)pArray->pData + pArray->codec.headerRoom;
+        dataBytes = pArray->compressedSize - pArray->codec.headerRoom;
+    }
+    attrBytes = attributeSize(pArray->pAttributeList);
+    dataOffset = alignUp(sizeof(NDShmSlot_t) + attrBytes, NDSHM_ALIGN);
+    if (dataOffset + dataBytes > slotSize) return false;
+
+    frameNumber = ndShmLoadRelaxed(&pHeader->writeCount);
+    pSlotBase = (char *)pHeader + pHeader->slotOffset + (frameNumber % numSlots) * slotSize;
+    pSlot = (NDShmSlot_t *)pSlotBase;
+
+    /* Make the sequence odd before touching the slot so that readers of the previous frame see the overwrite */
+    sequence = ndShmLoadRelaxed(&pSlot->sequence);
+    ndShmStoreRelaxed(&pSlot->sequence, sequence + 1);
+    ndShmFenceRelease();
+
+    pSlot->frameNumber = frameNumber;
+    pSlot->uniqueId = pArray->uniqueId;
+    pSlot->ndims = pArray->ndims;
+    pSlot->timeStamp = pArray->timeStamp;
+    pSlot->epicsTSSec = pArray->epicsTS.secPastEpoch;
+    pSlot->epicsTSNsec = pArray->epicsTS.nsec;
+    pSlot->dataType = pArray->dataType;
+    pSlot->numAttributes = pArray->pAttributeList->count();
+    for (i=0; i<pArray->ndims; i++) {
+        pSlot->dims[i].size = pArray->dims[i].size;
+        pSlot->dims[i].offset = pArray->dims[i].offset;
+        pSlot->dims[i].binning = pArray->dims[i].binning;
+        pSlot->dims[i].reverse = pArray->dims[i].reverse;
+    }
+    pSlot->attributeOffset = sizeof(NDShmSlot_t);
+    pSlot->attributeSize = attrBytes;
+    pSlot->dataOffset = dataOffset;
+    pSlot->dataSize = dataBytes;
+    memset(pSlot->codec, 0, sizeof(pSlot->codec));
+    strncpy(pSlot->codec, pArray->codec.name.c_str(), sizeof(pSlot->codec)-1);
+    writeAttributes(pArray->pAttributeList, pSlotBase + pSlot->attributeOffset);
+    memcpy(pSlotBase + dataOffset, pData, dataBytes);
+
+    ndShmStoreRelease(&pSlot->sequence, sequence + 2);
+    ndShmStoreRelease(&pHeader->writeCount, frameNumber + 1);
+    return true;
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginShm::processCallbacks(NDArray *pArray)
+{
+    static const char *functionName = "processCallbacks";
+    bool published;
+
+    NDPluginDriver::beginProcessCallbacks(pArray);   // Base class method
+
+    // The slot has no place for the chunk sizes of arrays that NDPluginCodec compressed in chunks
+    if (pArray->codec.chunkRows > 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s cannot publish array uniqueId=%d compressed in chunks, set the codec ChunkRows to 0\n",
+            driverName, functionName, pArray->uniqueId);
+        callParamCallbacks();
+        return;
+    }
+
+    // Like NDPluginPva the output is not an NDArray, so throttling has to be checked here.
+    if (throttled(pArray)) {
+        int droppedOutputArrays;
+        int arrayCounter;
+        getIntegerParam(NDPluginDriverDroppedOutputArrays, &droppedOutputArrays);
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+            "%s::%s maximum byte rate exceeded, dropped array uniqueId=%d\n",
+            driverName, functionName, pArray->uniqueId);
+        droppedOutputArrays++;
+        setIntegerParam(NDPluginDriverDroppedOutputArrays, droppedOutputArrays);
+        // Since this plugin has done no useful work we also decrement ArrayCounter
+        getIntegerParam(NDArrayCounter, &arrayCounter);
+        arrayCounter--;
+        setIntegerParam(NDArrayCounter, arrayCounter);
+    } else if (pHeader) {
+        this->unlock();             // Function called with the lock taken
+        published = publish(pArray);
+        this->lock();               // Must return locked
+        if (published) {
+            setIntegerParam(NDPluginShmWriteCount, (int)pHeader->writeCount);
+        } else {
+            int oversize;
+            getIntegerParam(NDPluginShmOversize, &oversize);
+            setIntegerParam(NDPluginShmOversize, oversize+1);
+            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s array uniqueId=%d does not fit in a %lu byte slot\n",
+                driverName, functionName, pArray->uniqueId, (unsigned long)slotSize);
+        }
+    }
+
+    // Do NDArray callbacks.  We need to copy the array and get the attributes
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+
+    callParamCallbacks();
+}
+
+/** Constructor for NDPluginShm
+  * This plugin cannot block (ASYN_CANBLOCK=0) and is not multi-device (ASYN_MULTIDEVICE=0).
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this
+  *            plugin can hold when NDPluginDriverBlockingCallbacks=0.
+  * \param[in] blockingCallbacks Initial setting for the
+  *            NDPluginDriverBlockingCallbacks flag. 0=callbacks are queued and
+  *            executed by the callback thread; 1 callbacks execute in the
+  *            thread of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of
+  *            NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of
+  *            NDArray callbacks.
+  * \param[in] shmName Name of the POSIX shared memory segment, e.g. "/13SIM1_image".
+  *            A leading "/" is added if it is missing.
+  * \param[in] numSlots Number of frames in the ring. 0 uses 4.
+  * \param[in] slotSize Size in bytes of each slot; it must hold the largest array plus its
+  *            attributes. 0 uses 8 MB.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginShm::NDPluginShm(const char *portName, int queueSize, int blockingCallbacks,
+                         const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                         int numSlots, size_t slotSize,
+                         int maxBuffers, size_t maxMemory, int priority, int stackSize)
+    /* Invoke the base class constructor.
+     * The ring is written in order, so this plugin only uses one thread */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                     NDArrayPort, NDArrayAddr, 1, maxBuffers, maxMemory, 0, 0,
+                     0, 1, priority, stackSize, 1, true),
+      numSlots(numSlots > 0 ? numSlots : NDSHM_DEFAULT_SLOTS),
+      slotSize(alignUp(slotSize > 0 ? slotSize : NDSHM_DEFAULT_SLOT_SIZE, NDSHM_ALIGN)),
+      segmentSize(0),
+      pHeader(NULL)
+{
+    asynStatus status;
+
+    createParam(NDPluginShmNameString,          asynParamOctet,   &NDPluginShmName);
+    createParam(NDPluginShmNumSlotsString,      asynParamInt32,   &NDPluginShmNumSlots);
+    createParam(NDPluginShmSlotSizeString,      asynParamFloat64, &NDPluginShmSlotSize);
+    createParam(NDPluginShmWriteCountString,    asynParamInt32,   &NDPluginShmWriteCount);
+    createParam(NDPluginShmOversizeString,      asynParamInt32,   &NDPluginShmOversize);
+    createParam(NDPluginShmSegmentStatusString, asynParamInt32,   &NDPluginShmSegmentStatus);
+
+    this->shmName = (shmName && shmName[0] == '/') ? "" : "/";
+    if (shmName) this->shmName += shmName;
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginShm");
+
+    setStringParam(NDPluginShmName, this->shmName.c_str());
+    setIntegerParam(NDPluginShmNumSlots, this->numSlots);
+    setDoubleParam(NDPluginShmSlotSize, (double)this->slotSize);
+    setIntegerParam(NDPluginShmWriteCount, 0);
+    setIntegerParam(NDPluginShmOversize, 0);
+
+    status = createSegment();
+    setIntegerParam(NDPluginShmSegmentStatus, status ? 1 : 0);
+
+    /* Try to connect to the NDArray port */
+    connectToArrayPort();
+}
+
+NDPluginShm::~NDPluginShm()
+{
+    destroySegment();
+}
+
+/* Configuration routine.  Called directly, or from the iocsh function */
+extern "C" int NDShmConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                              const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                              int numSlots, size_t slotSize,
+                              int maxBuffers, size_t maxMemory, int priority, int stackSize)
+{
+    NDPluginShm *pPlugin = new NDPluginShm(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+                                           shmName, numSlots, slotSize,
+                                           maxBuffers, maxMemory, priority, stackSize);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "shmName",iocshArgString};
+static const iocshArg initArg6 = { "numSlots",iocshArgInt};
+static const iocshArg initArg7 = { "slotSize",iocshArgInt};
+static const iocshArg initArg8 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg9 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg10 = { "priority",iocshArgInt};
+static const iocshArg initArg11 = { "stack size",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9,
+                                            &initArg10,
+                                            &initArg11,};
+static const iocshFuncDef initFuncDef = {"NDShmConfigure",12,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+    NDShmConfigure(args[0].sval, args[1].ival, args[2].ival,
+                   args[3].sval, args[4].ival, args[5].sval,
+                   args[6].ival, args[7].ival, args[8].ival,
+                   args[9].ival, args[10].ival, args[11].ival);
+}
+
+extern "C" void NDShmRegister(void)
+{
+    iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDShmRegister);
+}
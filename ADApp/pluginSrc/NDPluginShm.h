@@ -0,0 +1,52 @@
+#ifndef NDPluginShm_H
+#define NDPluginShm_H
+
+#include <string>
+
+#include "NDPluginDriver.h"
+#include "NDShmLayout.h"
+
+#define NDPluginShmNameString           "SHM_NAME"            /* (asynOctet,   r/o) Name of the shared memory segment */
+#define NDPluginShmNumSlotsString       "SHM_NUM_SLOTS"       /* (asynInt32,   r/o) Number of slots in the ring */
+#define NDPluginShmSlotSizeString       "SHM_SLOT_SIZE"       /* (asynFloat64, r/o) Size of each slot in bytes */
+#define NDPluginShmWriteCountString     "SHM_WRITE_COUNT"     /* (asynInt32,   r/o) Number of frames published */
+#define NDPluginShmOversizeString       "SHM_OVERSIZE"        /* (asynInt32,   r/w) Number of frames too large for a slot */
+#define NDPluginShmSegmentStatusString  "SHM_SEGMENT_STATUS"  /* (asynInt32,   r/o) 0=OK, 1=Error */
+
+/** Publishes NDArrays into a POSIX shared memory ring so that processes on the same host can
+  * use them without copying. See NDShmLayout.h for the layout and NDShmReader.h for the reader. */
+class epicsShareClass NDPluginShm : public NDPluginDriver {
+public:
+    NDPluginShm(const char *portName, int queueSize, int blockingCallbacks,
+                const char *NDArrayPort, int NDArrayAddr, const char *shmName,
+                int numSlots, size_t slotSize,
+                int maxBuffers, size_t maxMemory, int priority, int stackSize);
+    ~NDPluginShm();
+
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+
+protected:
+    int NDPluginShmName;
+    #define FIRST_NDPLUGIN_SHM_PARAM NDPluginShmName
+    int NDPluginShmNumSlots;
+    int NDPluginShmSlotSize;
+    int NDPluginShmWriteCount;
+    int NDPluginShmOversize;
+    int NDPluginShmSegmentStatus;
+
+private:
+    asynStatus createSegment();
+    void destroySegment();
+    size_t attributeSize(NDAttributeList *pList);
+    void writeAttributes(NDAttributeList *pList, char *pOut);
+    bool publish(NDArray *pArray);
+
+    std::string shmName;
+    int numSlots;
+    size_t slotSize;
+    size_t segmentSize;
+    NDShmHeader_t *pHeader;
+};
+
+#endif
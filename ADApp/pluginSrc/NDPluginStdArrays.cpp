@@ -28,36 +28,67 @@
 
 static const char *driverName="NDPluginStdArrays";
 
+/* The asyn array interfaces are signed. An unsigned integer array has the same
+ * representation as the signed type of the same size, so it can be passed without conversion. */
+static bool sameRepresentation(NDDataType_t dataType, NDDataType_t signedType)
+{
+    switch (dataType) {
+        case NDUInt8:  dataType = NDInt8;  break;
+        case NDUInt16: dataType = NDInt16; break;
+        case NDUInt32: dataType = NDInt32; break;
+        case NDUInt64: dataType = NDInt64; break;
+        default: break;
+    }
+    return dataType == signedType;
+}
+
+/* Simple counted loops with no aliasing between input and output, which the compiler vectorizes */
+template <typename dataTypeIn, typename dataTypeOut>
+static void convertData(const void *pIn, dataTypeOut *pOut, size_t nElements)
+{
+    const dataTypeIn *pDataIn = (const dataTypeIn *)pIn;
+    for (size_t i=0; i<nElements; i++) {
+        pOut[i] = (dataTypeOut)pDataIn[i];
+    }
+}
+
+/* Converts the first nElements of pArray to dataTypeOut */
+template <typename dataTypeOut>
+static void convertData(NDArray *pArray, dataTypeOut *pOut, size_t nElements)
+{
+    switch (pArray->dataType) {
+        case NDInt8:    convertData<epicsInt8,    dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDUInt8:   convertData<epicsUInt8,   dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDInt16:   convertData<epicsInt16,   dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDUInt16:  convertData<epicsUInt16,  dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDInt32:   convertData<epicsInt32,   dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDUInt32:  convertData<epicsUInt32,  dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDInt64:   convertData<epicsInt64,   dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDUInt64:  convertData<epicsUInt64,  dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDFloat32: convertData<epicsFloat32, dataTypeOut>(pArray->pData, pOut, nElements); break;
+        case NDFloat64: convertData<epicsFloat64, dataTypeOut>(pArray->pData, pOut, nElements); break;
+    }
+}
+
 template <typename epicsType, typename interruptType>
 void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pNDArrayPool, 
                             void *interruptPvt, int *initialized, NDDataType_t signedType, bool *wasThrottled)
 {
     ELLLIST *pclientList;
     interruptNode *pnode;
-    int status;
     epicsType *pData=NULL;
     NDArray *pOutput=NULL;
     NDArrayInfo_t arrayInfo;
     static const char* functionName="arrayInterruptCallback";
 
+    pArray->getInfo(&arrayInfo);
     pasynManager->interruptStart(interruptPvt, &pclientList);
     pnode = (interruptNode *)ellFirst(pclientList);
     while (pnode) {
         interruptType *pInterrupt = (interruptType *)pnode->drvPvt;
         if (pInterrupt->pasynUser->reason == NDPluginStdArraysData) {
-            if (!*initialized) {
-                *initialized = 1;
-                pArray->getInfo(&arrayInfo);
-                status = pNDArrayPool->convert(pArray, &pOutput, signedType);
-                if (status) {
-                    asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
-                              "%s::arrayInterruptCallback: error allocating array in convert()\n",
-                               driverName);
-                    break;
-                }
-                pData = (epicsType *)pOutput->pData;
-            }
-            if (throttled(pOutput)) {
+            /* Check the throttle first so that arrays that will be dropped are not converted */
+            if (throttled((double)(arrayInfo.nElements * sizeof(epicsType)))) {
                 int droppedOutputArrays;
                 *wasThrottled = true;
                 getIntegerParam(NDPluginDriverDroppedOutputArrays, &droppedOutputArrays);
@@ -67,6 +98,23 @@ void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pND
                 droppedOutputArrays++;
                 setIntegerParam(NDPluginDriverDroppedOutputArrays, droppedOutputArrays);
             } else {
+                if (!*initialized) {
+                    *initialized = 1;
+                    if (sameRepresentation(pArray->dataType, signedType)) {
+                        /* The clients get the NDArray data without a copy */
+                        pData = (epicsType *)pArray->pData;
+                    } else {
+                        pOutput = pNDArrayPool->alloc(1, &arrayInfo.nElements, signedType, 0, NULL);
+                        if (!pOutput) {
+                            asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
+                                      "%s::arrayInterruptCallback: error allocating array\n",
+                                       driverName);
+                            break;
+                        }
+                        pData = (epicsType *)pOutput->pData;
+                        convertData<epicsType>(pArray, pData, arrayInfo.nElements);
+                    }
+                }
                 pInterrupt->pasynUser->timestamp = pArray->epicsTS;
                 pInterrupt->callback(pInterrupt->userPvt,
                                      pInterrupt->pasynUser,
@@ -84,7 +132,7 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
 {
     int command = pasynUser->reason;
     asynStatus status = asynSuccess;
-    NDArray *pOutput, *myArray;
+    NDArray *myArray;
     NDArrayInfo_t arrayInfo;
 
     myArray = this->pArrays[0];
@@ -95,23 +143,25 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
             status = asynError;
             goto done;
         }
+        if (!myArray->codec.empty()) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s::readArray, can't convert compressed data [%s]",
+                      driverName, myArray->codec.name.c_str());
+            status = asynError;
+            goto done;
+        }
         myArray->getInfo(&arrayInfo);
         if (arrayInfo.nElements > nElements) {
             /* We have been requested fewer pixels than we have.
              * Just pass the first nElements. */
              arrayInfo.nElements = nElements;
         }
-        status = (asynStatus)this->pNDArrayPool->convert(myArray, &pOutput, outputType);
-        if (status) {
-            asynPrint(pasynUser, ASYN_TRACE_ERROR,
-                      "%s::readArray: error allocating array in convert()\n",
-                       driverName);
-           goto done;
-        }
-        /* Copy the data */
+        /* Copy or convert the data straight into the client buffer */
         *nIn = arrayInfo.nElements;
-        memcpy(value, pOutput->pData, *nIn*sizeof(epicsType));
-        pOutput->release();
+        if (sameRepresentation(myArray->dataType, outputType))
+            memcpy(value, myArray->pData, *nIn*sizeof(epicsType));
+        else
+            convertData<epicsType>(myArray, value, *nIn);
         /* Set the timestamp */
         pasynUser->timestamp = myArray->epicsTS;
     } else {
@@ -148,10 +198,19 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
     bool wasThrottled=false;
     NDArrayInfo_t arrayInfo;
     asynStandardInterfaces *pInterfaces = this->getAsynStdInterfaces();
-    /* static const char* functionName = "processCallbacks"; */
+    static const char* functionName = "processCallbacks";
 
     /* Call the base class method */
     NDPluginDriver::beginProcessCallbacks(pArray);
+
+    /* The elements of compressed data are not pixels, and pData is only compressedSize bytes */
+    if (!pArray->codec.empty()) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s can't convert compressed data [%s], array uniqueId=%d\n",
+            driverName, functionName, pArray->codec.name.c_str(), pArray->uniqueId);
+        callParamCallbacks();
+        return;
+    }
     
     pArray->getInfo(&arrayInfo);
  
@@ -29,11 +29,20 @@
 
 #define DEFAULT_NUM_TSPOINTS 2048
 
+/* Number of doubles in the block of averaged points that is transposed into the time series.
+ * 4096 doubles (32 kB) keeps the block resident in the L1 cache of most processors. */
+#define TS_BLOCK_SIZE 4096
+
 enum {
   TSAcquireModeFixed,
   TSAcquireModeCircular
 };
 
+enum {
+  TSPublishModeFull,
+  TSPublishModeIncremental
+};
+
 /** Constructor for NDPluginTimeSeries; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   * \param[in] portName The name of the asyn port driver to be created.
   * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
@@ -64,8 +73,10 @@ NDPluginTimeSeries::NDPluginTimeSeries(const char *portName, int queueSize, int
              asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
              ASYN_MULTIDEVICE, 1, priority, stackSize, 1),
     dataType_(NDFloat64), dataSize_(sizeof(epicsFloat64)), numTimePoints_(DEFAULT_NUM_TSPOINTS), currentTimePoint_(0),
-    uniqueId_(0), numAverage_(1), acquireMode_(TSAcquireModeFixed), averagingTimeRequested_(1), timePerPoint_(0), 
-    signalData_(0), timeAxis_(0), timeStamp_(0), pTimeCircular_(0)
+    uniqueId_(0), numAverage_(1), acquireMode_(TSAcquireModeFixed), publishMode_(TSPublishModeFull),
+    snapshotInterval_(0), numIncremental_(0), numPointsTotal_(0), numPointsPublished_(0),
+    averagingTimeRequested_(1), timePerPoint_(0), 
+    blockStore_(0), blockPoints_(1), signalData_(0), timeAxis_(0), timeStamp_(0), pTimeCircular_(0)
 {
   //const char *functionName = "NDPluginTimeSeries::NDPluginTimeSeries";
 
@@ -75,6 +86,7 @@ NDPluginTimeSeries::NDPluginTimeSeries(const char *portName, int queueSize, int
   maxSignals_ = maxSignals;
   numSignals_ = maxSignals;
   averageStore_ = (double *)calloc(maxSignals_, sizeof(double));
+  pSignalArrays_.resize(maxSignals_, 0);
   
   /* Per-plugin parameters */
   createParam(TSAcquireString,                 asynParamInt32, &P_TSAcquire);
@@ -88,6 +100,8 @@ NDPluginTimeSeries::NDPluginTimeSeries(const char *portName, int queueSize, int
   createParam(TSAcquireModeString,             asynParamInt32, &P_TSAcquireMode);
   createParam(TSTimeAxisString,         asynParamFloat64Array, &P_TSTimeAxis);
   createParam(TSTimestampString,        asynParamFloat64Array, &P_TSTimestamp);
+  createParam(TSPublishModeString,             asynParamInt32, &P_TSPublishMode);
+  createParam(TSSnapshotIntervalString,        asynParamInt32, &P_TSSnapshotInterval);
   
   /* Per-signal parameters */
   createParam(TSTimeSeriesString,       asynParamFloat64Array, &P_TSTimeSeries);
@@ -96,6 +110,8 @@ NDPluginTimeSeries::NDPluginTimeSeries(const char *portName, int queueSize, int
   setStringParam(NDPluginDriverPluginType, "NDPluginTimeSeries");
   
   setIntegerParam(P_TSNumPoints, numTimePoints_);
+  setIntegerParam(P_TSPublishMode, publishMode_);
+  setIntegerParam(P_TSSnapshotInterval, snapshotInterval_);
   allocateArrays();
   
   /* Try to connect to the array port */
@@ -125,6 +141,7 @@ void NDPluginTimeSeries::computeNumAverage()
 
 void NDPluginTimeSeries::allocateArrays()
 {
+  int i;
   int numPoints;
   int nDims=2;
   size_t dims[2];
@@ -133,10 +150,18 @@ void NDPluginTimeSeries::allocateArrays()
   numTimePoints_ = numPoints;
   if (timeStamp_)  free(timeStamp_);
   if (signalData_) free (signalData_);
+  if (blockStore_) free(blockStore_);
   if (pTimeCircular_) pTimeCircular_->release();
+  for (i=0; i<maxSignals_; i++) {
+    if (pSignalArrays_[i]) pSignalArrays_[i]->release();
+    pSignalArrays_[i] = 0;
+  }
 
   timeStamp_  = (double *)calloc(numSignals_*numTimePoints_, sizeof(double));
   signalData_ = (double *)calloc(numSignals_*numTimePoints_, sizeof(double));
+  blockPoints_ = TS_BLOCK_SIZE / numSignals_;
+  if (blockPoints_ < 1) blockPoints_ = 1;
+  blockStore_ = (double *)calloc(blockPoints_*numSignals_, sizeof(double));
   nDims = 2;
   dims[0] = numTimePoints_;
   dims[1] = numSignals_;
@@ -151,6 +176,9 @@ void NDPluginTimeSeries::acquireReset()
   memset(timeStamp_,            0, numTimePoints_ * sizeof(double));
   memset(pTimeCircular_->pData, 0, numTimePoints_ * numSignals_ * dataSize_);
   currentTimePoint_ = 0;
+  numPointsTotal_ = 0;
+  numPointsPublished_ = 0;
+  numIncremental_ = 0;
   setIntegerParam(P_TSCurrentPoint, currentTimePoint_);
   epicsTimeGetCurrent(&startTime_);
 }
@@ -171,40 +199,106 @@ void NDPluginTimeSeries::createAxisArray()
   doCallbacksFloat64Array(timeAxis_, numTimePoints_, P_TSTimeAxis, 0);
 }
 
+/**
+ * Templated function to add consecutive time points of the input array to the running sums in averageStore_.
+ * The signals are the inner loop so both the input and averageStore_ are accessed contiguously,
+ * which allows the compiler to vectorize the loop.
+ * \param[in] pIn Pointer to the first time point to add
+ * \param[in] numTimes The number of time points to add
+ */
+template <typename epicsType>
+void NDPluginTimeSeries::accumulateBlockT(const epicsType *pIn, int numTimes)
+{
+  double *pSum = averageStore_;
+  int numSignals = numSignals_;
+  int signal;
+  int i;
+
+  for (i=0; i<numTimes; i++) {
+    for (signal=0; signal<numSignals; signal++) {
+      pSum[signal] += (epicsFloat64)pIn[signal];
+    }
+    pIn += numSignalsIn_;
+  }
+}
+
+/**
+ * Templated function to write the averaged points in blockStore_ to the time series.
+ * blockStore_ is stored with the signals changing fastest, while the time series is stored with time
+ * changing fastest, so this transposes the block.  Each signal is written as a contiguous run starting at
+ * currentTimePoint_, rather than one element per signal with a stride of numTimePoints_.
+ * \param[in] numBlock The number of averaged points in blockStore_; currentTimePoint_+numBlock must not
+ *            exceed numTimePoints_
+ */
+template <typename epicsType>
+void NDPluginTimeSeries::writeBlockT(int numBlock)
+{
+  epicsType *pTimeCircular = (epicsType *)pTimeCircular_->pData;
+  epicsType *pOut;
+  const double *pIn;
+  int signal;
+  int i;
+
+  for (signal=0; signal<numSignals_; signal++) {
+    pOut = pTimeCircular + signal * numTimePoints_ + currentTimePoint_;
+    pIn = blockStore_ + signal;
+    for (i=0; i<numBlock; i++) {
+      pOut[i] = (epicsType)pIn[i*numSignals_];
+    }
+  }
+}
+
 /**
  * Templated function to append to time series on different NDArray data types.
+ * The input time points are averaged in runs of numAverage_ into blockStore_, and each block is then
+ * written to the time series with writeBlockT().
  * \param[in] pArray The pointer to the NDArray object
  * \return asynStatus
  */
 template <typename epicsType>
 asynStatus NDPluginTimeSeries::doAddToTimeSeriesT(NDArray *pArray)
 {
-  epicsType *pData         = (epicsType *)pArray->pData;
-  epicsType *pIn; 
-  epicsType *pTimeCircular = (epicsType *)pTimeCircular_->pData;
+  epicsType *pData = (epicsType *)pArray->pData;
+  double *pBlock;
+  double scale;
   int signal;
-  int i;
+  int i = 0;
   int numTimes = 1;
+  int numSum;
+  int numBlock;
+  int maxBlock;
   epicsTimeStamp timeNow;
   double elapsedTime;
   
   if (pArray->ndims == 2) numTimes = (int)pArray->dims[1].size;
   
-  for (i=0; i<numTimes; i++) {
-    pIn = pData + i*numSignalsIn_;
-    for (signal=0; signal<numSignals_; signal++) {
-      averageStore_[signal] += (epicsFloat64)*pIn++;
-    }
-    numAveraged_++;
-    if (numAveraged_ < numAverage_) continue;
-    /* We have now collected the desired number of points to average */
-    for (signal=0; signal<numSignals_; signal++) {
-      pTimeCircular[signal * numTimePoints_ + currentTimePoint_] = (epicsType)averageStore_[signal]/numAveraged_;
-      averageStore_[signal] = 0;
+  while (i < numTimes) {
+    // The block must not extend past the end of the time series
+    maxBlock = numTimePoints_ - currentTimePoint_;
+    if (maxBlock > blockPoints_) maxBlock = blockPoints_;
+    numBlock = 0;
+    while ((numBlock < maxBlock) && (i < numTimes)) {
+      numSum = numAverage_ - numAveraged_;
+      if (numSum > numTimes - i) numSum = numTimes - i;
+      accumulateBlockT<epicsType>(pData + i*numSignalsIn_, numSum);
+      i += numSum;
+      numAveraged_ += numSum;
+      if (numAveraged_ < numAverage_) break;
+      /* We have now collected the desired number of points to average */
+      pBlock = blockStore_ + numBlock*numSignals_;
+      scale = 1. / numAveraged_;
+      for (signal=0; signal<numSignals_; signal++) {
+        pBlock[signal] = averageStore_[signal] * scale;
+        averageStore_[signal] = 0;
+      }
+      numAveraged_ = 0;
+      timeStamp_[currentTimePoint_ + numBlock] = pArray->timeStamp;
+      numBlock++;
     }
-    numAveraged_ = 0;
-    timeStamp_[currentTimePoint_] = pArray->timeStamp;
-    currentTimePoint_++;
+    if (numBlock == 0) break;
+    writeBlockT<epicsType>(numBlock);
+    currentTimePoint_ += numBlock;
+    numPointsTotal_ += numBlock;
     if (currentTimePoint_ >= numTimePoints_) {
       if (acquireMode_ == TSAcquireModeFixed) {
         setIntegerParam(P_TSAcquire, 0);
@@ -215,7 +309,7 @@ asynStatus NDPluginTimeSeries::doAddToTimeSeriesT(NDArray *pArray)
           currentTimePoint_ = 0;
       }
     }
-  }  // for (i=0; ...)
+  }  // while (i < numTimes)
   setIntegerParam(P_TSCurrentPoint, currentTimePoint_);     
   epicsTimeGetCurrent(&timeNow);
   elapsedTime = epicsTimeDiffInSeconds(&timeNow, &startTime_);
@@ -300,8 +394,40 @@ void NDPluginTimeSeries::doTimeSeriesCallbacksT()
   }
 }
 
+/**
+ * Returns the 1-D NDArray used to publish the time series of one signal.
+ * The array from the previous publish is reused if no downstream plugin still holds a reference to it,
+ * otherwise it is released and a new one is allocated from the pool.  The arrays are always allocated
+ * large enough for numTimePoints_ so they can be reused when the number of points changes.
+ * \param[in] signal The signal number
+ * \param[in] numPoints The number of time points in the array
+ * \return The NDArray, or NULL if it could not be allocated
+ */
+NDArray *NDPluginTimeSeries::getSignalArray(int signal, size_t numPoints)
+{
+  NDArray *pArray = pSignalArrays_[signal];
+  size_t dims[1];
+
+  if (pArray && ((pArray->getReferenceCount() > 1) || (pArray->dataType != dataType_))) {
+    pArray->release();
+    pArray = 0;
+  }
+  if (!pArray) {
+    dims[0] = numTimePoints_;
+    pArray = pNDArrayPool->alloc(1, dims, dataType_, 0, 0);
+    pSignalArrays_[signal] = pArray;
+    if (!pArray) return 0;
+  }
+  pArray->initDimension(&pArray->dims[0], numPoints);
+  return pArray;
+}
+
 /**
  * Call the templated doTimeSeriesCallbacks so we can cast correctly. 
+ * Then does the NDArray callbacks.  In TSPublishModeFull, or when a full snapshot is due in
+ * TSPublishModeIncremental, the 2-D output contains the entire time series.  Otherwise it contains only
+ * the time points added since the previous publish.  The TSStartIndex attribute is the index of the first
+ * time point in the output since acquisition was started, and TSSnapshot is 1 for a full snapshot.
  * \return asynStatus
  */
 asynStatus NDPluginTimeSeries::doTimeSeriesCallbacks()
@@ -311,8 +437,12 @@ asynStatus NDPluginTimeSeries::doTimeSeriesCallbacks()
   asynStatus status = asynSuccess;
   char *src, *dst;
   int signal;
-  size_t dims[1]; 
+  size_t dims[2]; 
   int numCopy;
+  int numNew;
+  int snapshot = 1;
+  int start;
+  epicsInt64 startIndex;
   
   switch(dataType_) {
   case NDInt8:
@@ -352,26 +482,66 @@ asynStatus NDPluginTimeSeries::doTimeSeriesCallbacks()
 
   getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
   if (arrayCallbacks) {
+    if (publishMode_ == TSPublishModeIncremental) {
+      // Nothing to do if no points were added since the last publish
+      if (numPointsTotal_ == numPointsPublished_) return status;
+      // Publish a full snapshot if points were overwritten before they were published, or if one is due
+      snapshot = (numPointsTotal_ - numPointsPublished_ > numTimePoints_) ||
+                 ((snapshotInterval_ > 0) && (numIncremental_ >= snapshotInterval_));
+    }
     NDArray *pArrayOut = this->pArrays[0];
     if (pArrayOut) pArrayOut->release();
-    if (acquireMode_ == TSAcquireModeFixed) {
-      pArrayOut = pNDArrayPool->copy(pTimeCircular_, NULL, 1);    
+    if (snapshot) {
+      numIncremental_ = 0;
+      if (acquireMode_ == TSAcquireModeFixed) {
+        startIndex = 0;
+        pArrayOut = pNDArrayPool->copy(pTimeCircular_, NULL, 1);    
+      }
+      else {
+        // The oldest point is the first point in the array.  This is negative until the buffer has filled.
+        startIndex = numPointsTotal_ - numTimePoints_;
+        // Shift the data so the oldest time point is the first point in the array
+        pArrayOut = pNDArrayPool->copy(pTimeCircular_, NULL, 0);
+        for (signal=0; signal<numSignals_; signal++) {
+          numCopy = numTimePoints_ - currentTimePoint_;
+          src = (char *)pTimeCircular_->pData + ((signal * numTimePoints_) + currentTimePoint_)*dataSize_;
+          dst = (char *)pArrayOut->pData      +  (signal * numTimePoints_)*dataSize_;
+          memcpy(dst, src, numCopy*dataSize_);
+          numCopy = currentTimePoint_;
+          src = (char *)pTimeCircular_->pData +  (signal * numTimePoints_)*dataSize_;
+          dst = (char *)pArrayOut->pData      + ((signal * numTimePoints_) + numTimePoints_ - currentTimePoint_)*dataSize_;
+          memcpy(dst, src, numCopy*dataSize_);
+        }
+      }
     }
     else {
-      // Shift the data so the oldest time point is the first point in the array
-      pArrayOut = pNDArrayPool->copy(pTimeCircular_, NULL, 0);
+      // Copy only the points added since the last publish, which may wrap around the end of the buffer
+      numIncremental_++;
+      startIndex = numPointsPublished_;
+      numNew = (int)(numPointsTotal_ - numPointsPublished_);
+      start = (int)(numPointsPublished_ % numTimePoints_);
+      dims[0] = numNew;
+      dims[1] = numSignals_;
+      pArrayOut = pNDArrayPool->alloc(2, dims, dataType_, 0, 0);
+      if (!pArrayOut) {
+        this->pArrays[0] = NULL;
+        return asynError;
+      }
       for (signal=0; signal<numSignals_; signal++) {
-        numCopy = numTimePoints_ - currentTimePoint_;
-        src = (char *)pTimeCircular_->pData + ((signal * numTimePoints_) + currentTimePoint_)*dataSize_;
-        dst = (char *)pArrayOut->pData      +  (signal * numTimePoints_)*dataSize_;
+        numCopy = numTimePoints_ - start;
+        if (numCopy > numNew) numCopy = numNew;
+        src = (char *)pTimeCircular_->pData + ((signal * numTimePoints_) + start)*dataSize_;
+        dst = (char *)pArrayOut->pData      +  (signal * numNew)*dataSize_;
         memcpy(dst, src, numCopy*dataSize_);
-        numCopy = currentTimePoint_;
         src = (char *)pTimeCircular_->pData +  (signal * numTimePoints_)*dataSize_;
-        dst = (char *)pArrayOut->pData      + ((signal * numTimePoints_) + numTimePoints_ - currentTimePoint_)*dataSize_;
-        memcpy(dst, src, numCopy*dataSize_);
+        dst += numCopy*dataSize_;
+        memcpy(dst, src, (numNew - numCopy)*dataSize_);
       }
     }
+    numPointsPublished_ = numPointsTotal_;
     this->getAttributes(pArrayOut->pAttributeList);
+    pArrayOut->pAttributeList->add("TSStartIndex", "Index of first time point", NDAttrInt64, &startIndex);
+    pArrayOut->pAttributeList->add("TSSnapshot", "Full time series snapshot", NDAttrInt32, &snapshot);
     getTimeStamp(&pArrayOut->epicsTS);
     epicsTimeGetCurrent(&now);
     pArrayOut->timeStamp = now.secPastEpoch + now.nsec / 1.e9;
@@ -380,18 +550,17 @@ asynStatus NDPluginTimeSeries::doTimeSeriesCallbacks()
     this->pArrays[0] = pArrayOut;
     // Now do NDArray callbacks on 1-D arrays for each signal
     numCopy = (int)pArrayOut->dims[0].size;
-    dims[0] = numCopy;
     for (signal=0; signal<numSignals_; signal++) {
-      NDArray *pArray = pNDArrayPool->alloc(1, dims, pArrayOut->dataType, 0, 0);
-      src = (char *)pArrayOut->pData + (signal * numTimePoints_)*dataSize_;
+      NDArray *pArray = getSignalArray(signal, numCopy);
+      if (!pArray) continue;
+      src = (char *)pArrayOut->pData + (signal * numCopy)*dataSize_;
       dst = (char *)pArray->pData;
       memcpy(dst, src, numCopy*dataSize_); 
-      this->getAttributes(pArray->pAttributeList);
+      pArrayOut->pAttributeList->copy(pArray->pAttributeList);
       pArray->epicsTS   = pArrayOut->epicsTS;
       pArray->timeStamp = pArrayOut->timeStamp;
       pArray->uniqueId  = pArrayOut->uniqueId;
       doCallbacksGenericPointer(pArray, NDArrayData, signal);
-      pArray->release();
     }
   }
   return status;
@@ -480,6 +649,10 @@ asynStatus NDPluginTimeSeries::writeInt32(asynUser *pasynUser, epicsInt32 value)
     }
   } else if (function == P_TSRead) {
     doTimeSeriesCallbacks();
+  } else if (function == P_TSPublishMode) {
+    publishMode_ = value;
+  } else if (function == P_TSSnapshotInterval) {
+    snapshotInterval_ = value;
   } else if (function < FIRST_NDPLUGIN_TIME_SERIES_PARAM) {
     stat = (NDPluginDriver::writeInt32(pasynUser, value) == asynSuccess) && stat;
   }
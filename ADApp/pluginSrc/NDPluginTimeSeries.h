@@ -10,6 +10,8 @@
 #ifndef NDPluginTimeSeries_H
 #define NDPluginTimeSeries_H
 
+#include <vector>
+
 #include <epicsTypes.h>
 #include <epicsTime.h>
 
@@ -28,6 +30,8 @@
 #define TSAcquireModeString     "TS_ACQUIRE_MODE"     /* (asynInt32,        r/w) Acquire mode */
 #define TSTimeAxisString        "TS_TIME_AXIS"        /* (asynFloat64Array, r/o) Time axis array */
 #define TSTimestampString       "TS_TIMESTAMP"        /* (asynFloat64Array, r/o) Series of timestamps */
+#define TSPublishModeString     "TS_PUBLISH_MODE"     /* (asynInt32,        r/w) Publish full time series or new points */
+#define TSSnapshotIntervalString "TS_SNAPSHOT_INTERVAL" /* (asynInt32,      r/w) Incremental publishes between full snapshots */
 
 /* Per-signal parameters */
 #define TSTimeSeriesString      "TS_TIME_SERIES"      /* (asynFloat64Array, r/o) Time series array */
@@ -61,16 +65,21 @@ protected:
   int P_TSAcquireMode;
   int P_TSTimeAxis;
   int P_TSTimestamp;
+  int P_TSPublishMode;
+  int P_TSSnapshotInterval;
 
   // Per-signal parameters
   int P_TSTimeSeries;
                                 
 private:
   template <typename epicsType> asynStatus doAddToTimeSeriesT(NDArray *pArray);
+  template <typename epicsType> void accumulateBlockT(const epicsType *pIn, int numTimes);
+  template <typename epicsType> void writeBlockT(int numBlock);
   asynStatus addToTimeSeries(NDArray *pArray);
   asynStatus clear(epicsUInt32 roi);
   template <typename epicsType> void doTimeSeriesCallbacksT();
   asynStatus doTimeSeriesCallbacks();
+  NDArray *getSignalArray(int signal, size_t numPoints);
   void allocateArrays();
   void acquireReset();
   void createAxisArray();
@@ -87,15 +96,23 @@ private:
   int numAverage_;
   int numAveraged_;
   int acquireMode_;
+  int publishMode_;
+  int snapshotInterval_;
+  int numIncremental_;          /* Incremental publishes since the last full snapshot */
+  epicsInt64 numPointsTotal_;   /* Time points added since acquisition started */
+  epicsInt64 numPointsPublished_; /* Value of numPointsTotal_ at the last NDArray publish */
   double averagingTimeRequested_;
   double averagingTimeActual_;
   double timePerPoint_; /* Actual time between points in input arrays */
   epicsTimeStamp startTime_;
   double *averageStore_;
+  double *blockStore_;  /* Averaged points waiting to be written, [blockPoints_][numSignals_] */
+  int blockPoints_;
   double *signalData_;
   double *timeAxis_;
   double *timeStamp_;
   NDArray *pTimeCircular_;
+  std::vector<NDArray *> pSignalArrays_;
 };
     
 #endif //NDPluginTimeSeries_H
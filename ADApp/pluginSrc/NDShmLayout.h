@@ -0,0 +1,103 @@
+/*
+ * NDShmLayout.h
+ *
+ * Layout of the POSIX shared memory segment written by NDPluginShm and read with NDShmReader.
+ * This file only uses fixed size types so that consumers can include it without the EPICS
+ * or areaDetector headers.
+ *
+ * The segment is a header followed by numSlots slots of slotSize bytes each.
+ * Frame n is written to slot n % numSlots. Each slot starts with an NDShmSlot_t, followed by
+ * the serialized attributes and then the array data, which starts on a NDSHM_ALIGN byte boundary.
+ *
+ * Every slot is protected by a sequence lock. The writer makes slot.sequence odd before it
+ * changes the slot and even again when the slot is complete. A reader that reads the same even
+ * sequence number before and after it used the slot knows that the slot was not overwritten.
+ */
+
+#ifndef NDShmLayout_H
+#define NDShmLayout_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NDSHM_MAGIC    0x4e445348  /* "NDSH" */
+#define NDSHM_VERSION  1
+#define NDSHM_MAX_DIMS 10          /* Same as ND_ARRAY_MAX_DIMS */
+#define NDSHM_ALIGN    64
+#define NDSHM_CODEC_NAME_LEN 16
+
+/** State of the segment */
+typedef enum {
+    NDSHM_STATE_OPEN,       /**< The writer is using the segment */
+    NDSHM_STATE_CLOSED      /**< The writer has replaced or abandoned the segment; readers should reopen it */
+} NDShmState_t;
+
+/** Segment header, at offset 0 */
+typedef struct {
+    uint32_t magic;              /**< NDSHM_MAGIC */
+    uint32_t version;            /**< NDSHM_VERSION */
+    uint32_t headerSize;         /**< sizeof(NDShmHeader_t) */
+    uint32_t numSlots;           /**< Number of slots in the ring */
+    uint64_t slotSize;           /**< Size of each slot in bytes, including the NDShmSlot_t */
+    uint64_t slotOffset;         /**< Offset of the first slot from the start of the segment */
+    uint64_t segmentSize;        /**< Total size of the segment in bytes */
+    uint64_t sessionId;          /**< Changes every time the segment is created */
+    volatile uint32_t state;     /**< NDShmState_t */
+    uint32_t writerPid;          /**< Process ID of the writer */
+    volatile uint64_t writeCount;/**< Number of frames published; the newest frame is writeCount-1 */
+} NDShmHeader_t;
+
+/** Mirrors NDDimension_t */
+typedef struct {
+    uint64_t size;
+    uint64_t offset;
+    int32_t  binning;
+    int32_t  reverse;
+} NDShmDimension_t;
+
+/** Slot header; mirrors the NDArray fields */
+typedef struct {
+    volatile uint64_t sequence;  /**< Sequence lock; odd while the writer is changing the slot */
+    uint64_t frameNumber;        /**< Number of this frame in the ring, 0 for the first frame written */
+    int32_t  uniqueId;
+    int32_t  ndims;
+    double   timeStamp;
+    uint32_t epicsTSSec;
+    uint32_t epicsTSNsec;
+    int32_t  dataType;           /**< NDDataType_t */
+    int32_t  numAttributes;
+    NDShmDimension_t dims[NDSHM_MAX_DIMS];
+    uint64_t attributeOffset;    /**< Offset of the attributes from the start of the slot */
+    uint64_t attributeSize;      /**< Size of the attributes in bytes */
+    uint64_t dataOffset;         /**< Offset of the data from the start of the slot */
+    uint64_t dataSize;           /**< Size of the data in bytes; if codec is not empty the compressed size without the codec header room */
+    char     codec[NDSHM_CODEC_NAME_LEN]; /**< Codec name, empty if the data are not compressed */
+} NDShmSlot_t;
+
+/** Serialized attribute. It is followed by the name, description and source strings, each nil terminated,
+  * and then the value. The next attribute starts recordSize bytes after this one. */
+typedef struct {
+    uint32_t recordSize;         /**< Size of this record in bytes, a multiple of 8 */
+    int32_t  dataType;           /**< NDAttrDataType_t */
+    uint32_t nameSize;           /**< Sizes of the strings including the nil */
+    uint32_t descriptionSize;
+    uint32_t sourceSize;
+    uint32_t valueSize;          /**< Size of the value; for NDAttrString including the nil */
+} NDShmAttribute_t;
+
+/* The sequence lock needs ordered loads and stores on memory that other processes share */
+#if defined(__GNUC__) || defined(__clang__)
+static inline uint64_t ndShmLoadAcquire(const volatile uint64_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline uint64_t ndShmLoadRelaxed(const volatile uint64_t *p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+static inline void ndShmStoreRelease(volatile uint64_t *p, uint64_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline void ndShmStoreRelaxed(volatile uint64_t *p, uint64_t v) { __atomic_store_n(p, v, __ATOMIC_RELAXED); }
+static inline void ndShmFenceAcquire(void) { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+static inline void ndShmFenceRelease(void) { __atomic_thread_fence(__ATOMIC_RELEASE); }
+#define NDSHM_SUPPORTED
+#endif
+
+#if defined(_WIN32) || defined(vxWorks) || defined(__rtems__)
+#undef NDSHM_SUPPORTED
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * NDShmReader.cpp
+ *
+ * Reader for the shared memory ring written by NDPluginShm.
+ * This file does not use EPICS so that it can be built into programs outside the IOC.
+ */
+
+#include <errno.h>
+
+#include "NDShmReader.h"
+
+#ifdef NDSHM_SUPPORTED
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+NDShmReader::NDShmReader()
+    : pHeader(NULL), mapSize(0), nextFrame(0), missed_(0)
+{
+}
+
+NDShmReader::~NDShmReader()
+{
+    close();
+}
+
+/** Maps the segment read-only. Only frames written after open() are returned.
+  * \param[in] name  Name of the segment, as shown by the SHM_NAME parameter of the plugin.
+  * \return 0 on success, -1 with errno set on failure. errno is EAGAIN if the writer
+  *         has not finished creating the segment, and EPROTO if the layout is not recognized. */
+int NDShmReader::open(const char *name)
+{
+#ifdef NDSHM_SUPPORTED
+    struct stat st;
+    void *pMap;
+    int fd;
+
+    close();
+    this->name = (name[0] == '/') ? "" : "/";
+    this->name += name;
+    fd = shm_open(this->name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(NDShmHeader_t)) {
+        ::close(fd);
+        errno = EAGAIN;
+        return -1;
+    }
+    pMap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (pMap == MAP_FAILED) return -1;
+
+    NDShmHeader_t *pMapped = (NDShmHeader_t *)pMap;
+    if (pMapped->magic != NDSHM_MAGIC) {
+        munmap(pMap, st.st_size);
+        errno = EAGAIN;
+        return -1;
+    }
+    ndShmFenceAcquire();
+    if ((pMapped->version != NDSHM_VERSION) ||
+        (pMapped->headerSize != sizeof(NDShmHeader_t)) ||
+        (pMapped->segmentSize > (uint64_t)st.st_size) ||
+        (pMapped->slotSize < sizeof(NDShmSlot_t)) ||
+        (pMapped->slotOffset + pMapped->numSlots * pMapped->slotSize > pMapped->segmentSize)) {
+        munmap(pMap, st.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+    pHeader = pMapped;
+    mapSize = st.st_size;
+    nextFrame = ndShmLoadAcquire(&pHeader->writeCount);
+    missed_ = 0;
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/** Unmaps the segment */
+void NDShmReader::close()
+{
+#ifdef NDSHM_SUPPORTED
+    if (pHeader) munmap(pHeader, mapSize);
+#endif
+    pHeader = NULL;
+    mapSize = 0;
+}
+
+/** Returns the next frame after the one returned last.
+  * If the reader fell behind and frames were overwritten they are skipped and counted in missed().
+  * \param[out] pFrame  The frame.
+  */
+NDShmReadStatus_t NDShmReader::next(NDShmFrame *pFrame)
+{
+    if (!pHeader) return NDSHM_READ_ERROR;
+
+    for (;;) {
+        if (pHeader->state == NDSHM_STATE_CLOSED) return NDSHM_READ_CLOSED;
+        uint64_t writeCount = ndShmLoadAcquire(&pHeader->writeCount);
+        if (nextFrame >= writeCount) return NDSHM_READ_NONE;
+        if (writeCount - nextFrame > pHeader->numSlots) {
+            missed_ += writeCount - pHeader->numSlots - nextFrame;
+            nextFrame = writeCount - pHeader->numSlots;
+        }
+
+        const char *pSlotBase = (const char *)pHeader + pHeader->slotOffset +
+                                (nextFrame % pHeader->numSlots) * pHeader->slotSize;
+        const NDShmSlot_t *pSlot = (const NDShmSlot_t *)pSlotBase;
+        uint64_t sequence = ndShmLoadAcquire(&pSlot->sequence);
+        if (sequence & 1) {
+            /* The writer is already replacing this frame */
+            missed_++;
+            nextFrame++;
+            continue;
+        }
+        memcpy(&pFrame->slot, (const void *)pSlot, sizeof(NDShmSlot_t));
+        ndShmFenceAcquire();
+        if (ndShmLoadRelaxed(&pSlot->sequence) != sequence) continue;
+        if (pFrame->slot.frameNumber != nextFrame) {
+            missed_++;
+            nextFrame++;
+            continue;
+        }
+        if ((pFrame->slot.dataOffset + pFrame->slot.dataSize > pHeader->slotSize) ||
+            (pFrame->slot.attributeOffset + pFrame->slot.attributeSize > pFrame->slot.dataOffset) ||
+            (pFrame->slot.ndims < 0) || (pFrame->slot.ndims > NDSHM_MAX_DIMS)) {
+            /* Not a consistent slot; cannot happen unless the segment was corrupted */
+            missed_++;
+            nextFrame++;
+            continue;
+        }
+        pFrame->pSlotBase = pSlotBase;
+        pFrame->pData = pSlotBase + pFrame->slot.dataOffset;
+        pFrame->sequence = sequence;
+        nextFrame++;
+        return NDSHM_READ_OK;
+    }
+}
+
+/** Returns the newest frame, skipping any older frames that were not read.
+  * The skipped frames are not counted in missed().
+  * \param[out] pFrame  The frame.
+  */
+NDShmReadStatus_t NDShmReader::latest(NDShmFrame *pFrame)
+{
+    if (!pHeader) return NDSHM_READ_ERROR;
+    uint64_t writeCount = ndShmLoadAcquire(&pHeader->writeCount);
+    if (writeCount > nextFrame + 1) nextFrame = writeCount - 1;
+    return next(pFrame);
+}
+
+/** Waits for the next frame.
+  * The segment has no wakeup mechanism, so this polls with a short sleep.
+  * \param[out] pFrame  The frame.
+  * \param[in] timeout  Maximum time to wait in seconds.
+  */
+NDShmReadStatus_t NDShmReader::wait(NDShmFrame *pFrame, double timeout)
+{
+    NDShmReadStatus_t status;
+#ifdef NDSHM_SUPPORTED
+    struct timespec pollTime = {0, 100000};
+    double waited = 0.;
+
+    while (((status = next(pFrame)) == NDSHM_READ_NONE) && (waited < timeout)) {
+        nanosleep(&pollTime, NULL);
+        waited += 1.e-4;
+    }
+#else
+    status = next(pFrame);
+#endif
+    return status;
+}
+
+/** Checks that the frame was not overwritten since it was returned.
+  * Call this after the data and attributes were used; if it returns false they may be inconsistent.
+  * \param[in] pFrame  The frame returned by next(), latest() or wait().
+  */
+bool NDShmReader::valid(const NDShmFrame *pFrame) const
+{
+    if (!pHeader) return false;
+    const NDShmSlot_t *pSlot = (const NDShmSlot_t *)pFrame->pSlotBase;
+    ndShmFenceAcquire();
+    return ndShmLoadRelaxed(&pSlot->sequence) == pFrame->sequence;
+}
@@ -0,0 +1,100 @@
+/*
+ * NDShmReader.h
+ *
+ * Reader for the shared memory ring written by NDPluginShm.
+ * It only depends on NDShmLayout.h and the POSIX shared memory functions, so consumers can
+ * build NDShmReader.cpp into their own programs without EPICS.
+ *
+ * Typical use:
+ *
+ *   NDShmReader reader;
+ *   NDShmFrame frame;
+ *   if (reader.open("/13SIM1_image")) error...
+ *   while (...) {
+ *       if (reader.wait(&frame, 1.0) != NDSHM_READ_OK) continue;
+ *       process(frame.pData, frame.slot.dims, ...);   // no copy
+ *       if (!reader.valid(&frame)) the writer overwrote the slot while it was processed
+ *   }
+ */
+
+#ifndef NDShmReader_H
+#define NDShmReader_H
+
+#include <string.h>
+#include <string>
+
+#include "NDShmLayout.h"
+
+typedef enum {
+    NDSHM_READ_OK,          /**< A frame was returned */
+    NDSHM_READ_NONE,        /**< No new frame */
+    NDSHM_READ_CLOSED,      /**< The writer closed or replaced the segment; reopen it */
+    NDSHM_READ_ERROR        /**< The reader is not open */
+} NDShmReadStatus_t;
+
+/** A frame in the ring. The slot header is copied; the attributes and data are used in place
+  * and are only guaranteed to be consistent if NDShmReader::valid() returns true after they were used. */
+struct NDShmFrame {
+    NDShmSlot_t slot;               /**< Copy of the slot header */
+    const char *pSlotBase;          /**< Start of the slot in the segment */
+    const void *pData;              /**< The array data, slot.dataSize bytes */
+    uint64_t sequence;              /**< Sequence number of the slot when the frame was read */
+
+    const NDShmAttribute_t *firstAttribute() const {
+        return slot.numAttributes > 0 ? (const NDShmAttribute_t *)(pSlotBase + slot.attributeOffset) : NULL;
+    }
+    const NDShmAttribute_t *nextAttribute(const NDShmAttribute_t *pAttr) const {
+        const char *pNext = (const char *)pAttr + pAttr->recordSize;
+        return pNext < pSlotBase + slot.attributeOffset + slot.attributeSize ? (const NDShmAttribute_t *)pNext : NULL;
+    }
+    const NDShmAttribute_t *findAttribute(const char *name) const {
+        const NDShmAttribute_t *pAttr;
+        for (pAttr = firstAttribute(); pAttr; pAttr = nextAttribute(pAttr)) {
+            if (strcmp(attributeName(pAttr), name) == 0) return pAttr;
+        }
+        return NULL;
+    }
+    static const char *attributeName(const NDShmAttribute_t *pAttr) {
+        return (const char *)(pAttr + 1);
+    }
+    static const char *attributeDescription(const NDShmAttribute_t *pAttr) {
+        return attributeName(pAttr) + pAttr->nameSize;
+    }
+    static const char *attributeSource(const NDShmAttribute_t *pAttr) {
+        return attributeDescription(pAttr) + pAttr->descriptionSize;
+    }
+    static const void *attributeValue(const NDShmAttribute_t *pAttr) {
+        return attributeSource(pAttr) + pAttr->sourceSize;
+    }
+};
+
+class NDShmReader {
+public:
+    NDShmReader();
+    ~NDShmReader();
+
+    int open(const char *name);
+    void close();
+    bool isOpen() const { return pHeader != NULL; }
+    const NDShmHeader_t *header() const { return pHeader; }
+
+    NDShmReadStatus_t next(NDShmFrame *pFrame);
+    NDShmReadStatus_t latest(NDShmFrame *pFrame);
+    NDShmReadStatus_t wait(NDShmFrame *pFrame, double timeout);
+    bool valid(const NDShmFrame *pFrame) const;
+
+    /** Number of frames that were overwritten before next() could return them */
+    uint64_t missed() const { return missed_; }
+
+private:
+    NDShmReader(const NDShmReader&);
+    NDShmReader& operator=(const NDShmReader&);
+
+    NDShmHeader_t *pHeader;
+    size_t mapSize;
+    uint64_t nextFrame;
+    uint64_t missed_;
+    std::string name;
+};
+
+#endif
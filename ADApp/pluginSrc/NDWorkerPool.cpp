@@ -0,0 +1,147 @@
+/*
+ * NDWorkerPool.cpp
+ *
+ * Pool of persistent worker threads shared by the plugins
+ */
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include "NDWorkerPool.h"
+
+/* One call of NDWorkerPool::run, shared by the threads working on it,
+ * or one call of NDWorkerPool::submit, which is deleted by the thread that ran it */
+typedef struct {
+    NDWorkerPool::NDWorkerFunc func;
+    void *arg;
+    int numRunning;             /* Number of workers that have not returned yet */
+    epicsEventId doneEvent;     /* NULL for a call of submit */
+} workerJob_t;
+
+static NDWorkerPool *pInstance = NULL;
+static epicsThreadOnceId instanceOnce = EPICS_THREAD_ONCE_INIT;
+
+void NDWorkerPool::createInstance(void *)
+{
+    pInstance = new NDWorkerPool();
+}
+
+/** Returns the pool shared by all plugins */
+NDWorkerPool *NDWorkerPool::getInstance()
+{
+    epicsThreadOnce(&instanceOnce, createInstance, NULL);
+    return pInstance;
+}
+
+NDWorkerPool::NDWorkerPool()
+  : queue_(ND_WORKER_POOL_MAX_THREADS, sizeof(workerJob_t *)), numWorkers_(0)
+{
+}
+
+/* Starts threads until the pool has numThreads of them */
+void NDWorkerPool::addThreads(int numThreads)
+{
+    epicsGuard<epicsMutex> guard(lock_);
+
+    if (numThreads > ND_WORKER_POOL_MAX_THREADS)
+        numThreads = ND_WORKER_POOL_MAX_THREADS;
+    while (numWorkers_ < numThreads) {
+        epicsThreadId tid = epicsThreadCreate("NDWorkerPool", epicsThreadPriorityMedium,
+                epicsThreadGetStackSize(epicsThreadStackMedium), workerThread, this);
+        if (!tid) break;
+        epicsAtomicIncrIntT(&numWorkers_);
+    }
+}
+
+void NDWorkerPool::workerThread(void *arg)
+{
+    NDWorkerPool *pPool = (NDWorkerPool *)arg;
+    workerJob_t *job;
+
+    while (1) {
+        if (pPool->queue_.receive(&job, sizeof(job)) != sizeof(job))
+            continue;
+        job->func(job->arg);
+        if (!job->doneEvent)
+            delete job;
+        else if (epicsAtomicDecrIntT(&job->numRunning) == 0)
+            epicsEventSignal(job->doneEvent);
+    }
+}
+
+/** Calls func(arg) in numThreads threads at once and returns when all the calls have returned.
+  * The calling thread makes one of the calls, the others are made by the pool threads.
+  * func must share the work out itself, typically by atomically incrementing an index into
+  * the pieces of work, so that the calls which start late find less or nothing left to do.
+  * If the pool is busy or has fewer threads than requested the calls that were already
+  * started do the remaining work.
+  * \param[in] func Function to call
+  * \param[in] arg Argument passed to func
+  * \param[in] numThreads Number of threads to use, including the calling thread
+  */
+void NDWorkerPool::run(NDWorkerFunc func, void *arg, int numThreads)
+{
+    workerJob_t job;
+    workerJob_t *pJob = &job;
+    int i;
+
+    if (numThreads > ND_WORKER_POOL_MAX_THREADS + 1)
+        numThreads = ND_WORKER_POOL_MAX_THREADS + 1;
+    if (numThreads <= 1) {
+        func(arg);
+        return;
+    }
+
+    if (epicsAtomicGetIntT(&numWorkers_) < numThreads - 1)
+        addThreads(numThreads - 1);
+
+    job.func = func;
+    job.arg = arg;
+    job.numRunning = 1;
+    job.doneEvent = epicsEventMustCreate(epicsEventEmpty);
+
+    for (i=1; i<numThreads; i++) {
+        epicsAtomicIncrIntT(&job.numRunning);
+        // If the queue is full the other threads do this call's work
+        if (queue_.trySend(&pJob, sizeof(pJob)) != 0)
+            epicsAtomicDecrIntT(&job.numRunning);
+    }
+
+    func(arg);
+
+    if (epicsAtomicDecrIntT(&job.numRunning) != 0)
+        epicsEventMustWait(job.doneEvent);
+    epicsEventDestroy(job.doneEvent);
+}
+
+/** Calls func(arg) once in a pool thread and returns without waiting for it.
+  * func must report its completion itself.
+  * \param[in] func Function to call
+  * \param[in] arg Argument passed to func
+  * \param[in] numThreads Number of pool threads the caller keeps busy with such calls;
+  *            the pool is grown to this size
+  * \return false if the call could not be queued; the caller must then call func itself
+  */
+bool NDWorkerPool::submit(NDWorkerFunc func, void *arg, int numThreads)
+{
+    workerJob_t *pJob;
+
+    if (epicsAtomicGetIntT(&numWorkers_) < numThreads)
+        addThreads(numThreads);
+    if (epicsAtomicGetIntT(&numWorkers_) == 0)
+        return false;
+
+    pJob = new workerJob_t;
+    pJob->func = func;
+    pJob->arg = arg;
+    pJob->numRunning = 1;
+    pJob->doneEvent = NULL;
+    if (queue_.trySend(&pJob, sizeof(pJob)) != 0) {
+        delete pJob;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef NDWorkerPool_H
+#define NDWorkerPool_H
+
+#include <epicsMutex.h>
+#include <epicsMessageQueue.h>
+#include <shareLib.h>
+
+/** Maximum number of threads in the pool */
+#define ND_WORKER_POOL_MAX_THREADS 64
+
+/** Pool of worker threads shared by the plugins that split an NDArray into independent
+  * pieces of work, e.g. the chunks compressed by NDPluginCodec or the strips and tiles
+  * compressed by NDFileTIFF, or that hand whole arrays to other threads, e.g. the files
+  * encoded by NDFileJPEG.  The threads are created the first time they are needed
+  * and are kept for the life of the IOC, so no thread is created or destroyed per array.
+  */
+class epicsShareClass NDWorkerPool {
+public:
+    /** Function run by the workers.  Each call takes pieces of work until none are left. */
+    typedef void (*NDWorkerFunc)(void *arg);
+
+    static NDWorkerPool *getInstance();
+    void run(NDWorkerFunc func, void *arg, int numThreads);
+    bool submit(NDWorkerFunc func, void *arg, int numThreads);
+
+private:
+    NDWorkerPool();
+    static void createInstance(void *);
+    void addThreads(int numThreads);
+    static void workerThread(void *arg);
+
+    epicsMutex lock_;
+    epicsMessageQueue queue_;
+    int numWorkers_;
+};
+
+#endif
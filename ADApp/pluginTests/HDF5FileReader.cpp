@@ -195,6 +195,59 @@ TestFileDataType_t HDF5FileReader::getDatasetType(const std::string& name)
   return type;
 }
 
+bool HDF5FileReader::readDataset(const std::string& name, hid_t memType, void *buffer)
+{
+  hid_t       dataset_id;
+  herr_t      status = -1;
+  // Check the name given is present in the file
+  if (objects.count(name) == 1){
+    // Check the name given is a dataset
+    if (objects[name]->getTypeString() == "dataset"){
+
+      // Open the dataset.
+      dataset_id = H5Dopen(file, name.c_str(), H5P_DEFAULT);
+
+      // Read the whole dataset, through the filters it was written with
+      status = H5Dread(dataset_id, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, buffer);
+
+      // Close the dataset
+      H5Dclose(dataset_id);
+    }
+  }
+  return (status >= 0);
+}
+
+std::vector<unsigned int> HDF5FileReader::getDatasetFilterValues(const std::string& name, H5Z_filter_t filter)
+{
+  hid_t        dataset_id;
+  hid_t        dcpl_id;
+  unsigned int flags = 0;
+  size_t       nValues = 16;
+  unsigned int values[16];
+  std::vector<unsigned int> vvalues;
+  // Check the name given is present in the file
+  if (objects.count(name) == 1){
+    // Check the name given is a dataset
+    if (objects[name]->getTypeString() == "dataset"){
+
+      // Open the dataset.
+      dataset_id = H5Dopen(file, name.c_str(), H5P_DEFAULT);
+
+      // Get the filter from the creation properties
+      dcpl_id = H5Dget_create_plist(dataset_id);
+      if (H5Pget_filter_by_id(dcpl_id, filter, &flags, &nValues, values, 0, NULL, NULL) >= 0){
+        if (nValues > 16) nValues = 16;
+        vvalues.assign(values, values + nValues);
+      }
+      H5Pclose(dcpl_id);
+
+      // Close the dataset
+      H5Dclose(dataset_id);
+    }
+  }
+  return vvalues;
+}
+
 HDF5FileReader::~HDF5FileReader ()
 {
   // Close the file
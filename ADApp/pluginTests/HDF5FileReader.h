@@ -40,6 +40,8 @@ public:
   std::vector<hsize_t> getDatasetDimensions(const std::string& name);
   int getDatasetAttributeCount(const std::string& name);
   TestFileDataType_t getDatasetType(const std::string& name);
+  bool readDataset(const std::string& name, hid_t memType, void *buffer);
+  std::vector<unsigned int> getDatasetFilterValues(const std::string& name, H5Z_filter_t filter);
   virtual ~HDF5FileReader();
 private:
   hid_t file;
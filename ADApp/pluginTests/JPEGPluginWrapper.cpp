@@ -0,0 +1,17 @@
+/*
+ * JPEGPluginWrapper.cpp
+ *
+ */
+
+#include "JPEGPluginWrapper.h"
+
+JPEGPluginWrapper::JPEGPluginWrapper(const std::string& port, const std::string& detectorPort)
+  :  NDFileJPEG(port.c_str(), 50, 1, detectorPort.c_str(), 0, 0, 0),
+     AsynPortClientContainer(port)
+{
+}
+
+JPEGPluginWrapper::~JPEGPluginWrapper()
+{
+  cleanup();
+}
@@ -0,0 +1,19 @@
+/*
+ * JPEGPluginWrapper.h
+ *
+ */
+
+#ifndef ADAPP_PLUGINTESTS_JPEGPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_JPEGPLUGINWRAPPER_H_
+
+#include <NDFileJPEG.h>
+#include "AsynPortClientContainer.h"
+
+class JPEGPluginWrapper : public NDFileJPEG, public AsynPortClientContainer
+{
+public:
+  JPEGPluginWrapper(const std::string& port, const std::string& detectorPort);
+  virtual ~JPEGPluginWrapper();
+};
+
+#endif /* ADAPP_PLUGINTESTS_JPEGPLUGINWRAPPER_H_ */
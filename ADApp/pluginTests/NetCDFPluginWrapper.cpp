@@ -0,0 +1,17 @@
+/*
+ * NetCDFPluginWrapper.cpp
+ *
+ */
+
+#include "NetCDFPluginWrapper.h"
+
+NetCDFPluginWrapper::NetCDFPluginWrapper(const std::string& port, const std::string& detectorPort)
+  :  NDFileNetCDF(port.c_str(), 50, 1, detectorPort.c_str(), 0, 0, 0),
+     AsynPortClientContainer(port)
+{
+}
+
+NetCDFPluginWrapper::~NetCDFPluginWrapper()
+{
+  cleanup();
+}
@@ -0,0 +1,19 @@
+/*
+ * NetCDFPluginWrapper.h
+ *
+ */
+
+#ifndef ADAPP_PLUGINTESTS_NETCDFPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_NETCDFPLUGINWRAPPER_H_
+
+#include <NDFileNetCDF.h>
+#include "AsynPortClientContainer.h"
+
+class NetCDFPluginWrapper : public NDFileNetCDF, public AsynPortClientContainer
+{
+public:
+  NetCDFPluginWrapper(const std::string& port, const std::string& detectorPort);
+  virtual ~NetCDFPluginWrapper();
+};
+
+#endif /* ADAPP_PLUGINTESTS_NETCDFPLUGINWRAPPER_H_ */
@@ -0,0 +1,18 @@
+/*
+ * PvaPluginWrapper.cpp
+ *
+ */
+
+#include "PvaPluginWrapper.h"
+
+// The port name is also used as the PV name, so that each test serves its own PVs
+PvaPluginWrapper::PvaPluginWrapper(const std::string& port, const std::string& detectorPort, int maxChannels)
+  :  NDPluginPva(port.c_str(), 50, 1, detectorPort.c_str(), 0, port.c_str(), 0, 0, 0, 0, maxChannels),
+     AsynPortClientContainer(port)
+{
+}
+
+PvaPluginWrapper::~PvaPluginWrapper()
+{
+  cleanup();
+}
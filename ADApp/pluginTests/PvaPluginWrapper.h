@@ -0,0 +1,25 @@
+/*
+ * PvaPluginWrapper.h
+ *
+ */
+
+#ifndef ADAPP_PLUGINTESTS_PVAPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_PVAPLUGINWRAPPER_H_
+
+#include <NDPluginPva.h>
+#include "AsynPortClientContainer.h"
+
+/** Gives the tests access to the derived channel functions, which need no pvAccess client */
+class PvaPluginWrapper : public NDPluginPva, public AsynPortClientContainer
+{
+public:
+  PvaPluginWrapper(const std::string& port, const std::string& detectorPort, int maxChannels);
+  virtual ~PvaPluginWrapper();
+
+  using NDPluginPva::binArray;
+  using NDPluginPva::scaleArray;
+  using NDPluginPva::deriveArray;
+  using NDPluginPva::channelDue;
+};
+
+#endif /* ADAPP_PLUGINTESTS_PVAPLUGINWRAPPER_H_ */
@@ -0,0 +1,17 @@
+/*
+ * TIFFPluginWrapper.cpp
+ *
+ */
+
+#include "TIFFPluginWrapper.h"
+
+TIFFPluginWrapper::TIFFPluginWrapper(const std::string& port, const std::string& detectorPort)
+  :  NDFileTIFF(port.c_str(), 50, 1, detectorPort.c_str(), 0, 0, 0),
+     AsynPortClientContainer(port)
+{
+}
+
+TIFFPluginWrapper::~TIFFPluginWrapper()
+{
+  cleanup();
+}
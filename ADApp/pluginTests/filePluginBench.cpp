@@ -0,0 +1,328 @@
+/** filePluginBench.cpp
+ *
+ *  Benchmark for the file writing plugins. Each plugin is connected to a dummy
+ *  driver that sends synthetic NDArrays as fast as the plugin accepts them in
+ *  Stream mode. The file I/O statistics of NDPluginFile are then read back and
+ *  printed: open, write and close times, sustained write rate, the longest
+ *  write and the backlog of the plugin queue.
+ *
+ *  Run file-plugin-bench -h for the options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsGetopt.h>
+#include <asynPortClient.h>
+
+#include <asynNDArrayDriver.h>
+#include <NDPluginFile.h>
+
+typedef int (*configurePlugin_t)(const char *portName, int queueSize, int blockingCallbacks,
+                                 const char *NDArrayPort, int NDArrayAddr,
+                                 int priority, int stackSize);
+
+extern "C" int NDFileNullConfigure(const char *, int, int, const char *, int, int, int);
+#ifdef HAVE_TIFF
+extern "C" int NDFileTIFFConfigure(const char *, int, int, const char *, int, int, int);
+#endif
+#ifdef HAVE_JPEG
+extern "C" int NDFileJPEGConfigure(const char *, int, int, const char *, int, int, int);
+#endif
+#ifdef HAVE_NETCDF
+extern "C" int NDFileNetCDFConfigure(const char *, int, int, const char *, int, int, int);
+#endif
+#ifdef HAVE_NEXUS
+extern "C" int NDFileNexusConfigure(const char *, int, int, const char *, int, int, int);
+#endif
+#ifdef HAVE_HDF5
+extern "C" int NDFileHDF5Configure(const char *, int, int, const char *, int, int, int);
+#endif
+#ifdef HAVE_GRAPHICSMAGICK
+extern "C" int NDFileMagickConfigure(const char *, int, int, const char *, int, int, int);
+#endif
+
+typedef struct {
+    const char *name;
+    const char *extension;
+    configurePlugin_t configure;
+} benchPlugin_t;
+
+static benchPlugin_t benchPlugins[] = {
+    {"null",   "",    NDFileNullConfigure},
+#ifdef HAVE_TIFF
+    {"tiff",   "tif", NDFileTIFFConfigure},
+#endif
+#ifdef HAVE_JPEG
+    {"jpeg",   "jpg", NDFileJPEGConfigure},
+#endif
+#ifdef HAVE_NETCDF
+    {"netcdf", "nc",  NDFileNetCDFConfigure},
+#endif
+#ifdef HAVE_NEXUS
+    {"nexus",  "nxs", NDFileNexusConfigure},
+#endif
+#ifdef HAVE_HDF5
+    {"hdf5",   "h5",  NDFileHDF5Configure},
+#endif
+#ifdef HAVE_GRAPHICSMAGICK
+    {"magick", "png", NDFileMagickConfigure},
+#endif
+};
+static const int numBenchPlugins = sizeof(benchPlugins)/sizeof(benchPlugins[0]);
+
+/** Dummy driver that sends arrays to the plugins */
+class BenchSource : public asynNDArrayDriver {
+public:
+    BenchSource(const char *portName)
+        : asynNDArrayDriver(portName, 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0) {}
+
+    void sendArray(NDArray *pArray)
+    {
+        this->lock();
+        doCallbacksGenericPointer(pArray, NDArrayData, 0);
+        this->unlock();
+    }
+};
+
+typedef struct {
+    int numFrames;
+    size_t sizeX;
+    size_t sizeY;
+    NDDataType_t dataType;
+    int queueSize;
+    int blocking;
+    const char *filePath;
+    const char *nexusTemplate;
+} benchOptions_t;
+
+static void setInt(const char *portName, const char *param, int value)
+{
+    asynInt32Client client(portName, 0, param);
+    client.write(value);
+}
+
+static int getInt(const char *portName, const char *param)
+{
+    epicsInt32 value = 0;
+    asynInt32Client client(portName, 0, param);
+    client.read(&value);
+    return value;
+}
+
+static double getDouble(const char *portName, const char *param)
+{
+    epicsFloat64 value = 0.;
+    asynFloat64Client client(portName, 0, param);
+    client.read(&value);
+    return value;
+}
+
+static void setString(const char *portName, const char *param, const std::string& value)
+{
+    size_t nActual;
+    asynOctetClient client(portName, 0, param);
+    client.write(value.c_str(), value.size()+1, &nActual);
+}
+
+/** Returns the value below which fraction p of the sorted times lie */
+static double percentile(const std::vector<epicsFloat64>& sorted, double p)
+{
+    if (sorted.empty()) return 0.;
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void runBench(BenchSource *pSource, const char *sourcePort, benchPlugin_t *pPlugin,
+                     std::vector<NDArray *>& arrays, const benchOptions_t *pOptions)
+{
+    std::string portName = std::string("BENCH_") + pPlugin->name;
+    const char *port = portName.c_str();
+    std::string fileTemplate;
+    std::vector<epicsFloat64> writeTimes(pOptions->numFrames);
+    size_t numTimes = 0;
+    NDArrayInfo_t arrayInfo;
+    epicsTimeStamp tStart, tEnd;
+    double elapsed;
+    int i, backlog, maxBacklog = 0;
+
+    if (pPlugin->configure(port, pOptions->queueSize, pOptions->blocking, sourcePort, 0, 0, 0)) {
+        printf("%-8s failed to create the plugin\n", pPlugin->name);
+        return;
+    }
+    setInt(port, NDPluginDriverEnableCallbacksString, 1);
+    setInt(port, NDFileStatsWindowString, pOptions->numFrames);
+    setString(port, NDFilePathString, pOptions->filePath);
+    setString(port, NDFileNameString, std::string("bench_") + pPlugin->name);
+    fileTemplate = std::string("%s%s_%6.6d.") + pPlugin->extension;
+    setString(port, NDFileTemplateString, fileTemplate);
+    setInt(port, NDFileNumberString, 1);
+    setInt(port, NDAutoIncrementString, 1);
+    setInt(port, NDFileWriteModeString, NDFileModeStream);
+    setInt(port, NDFileNumCaptureString, pOptions->numFrames);
+    if (strcmp(pPlugin->name, "nexus") == 0) {
+        /* NDFileNexusTemplatePathString and NDFileNexusTemplateFileString; NDFileNexus.h needs napi.h */
+        std::string nexusTemplate(pOptions->nexusTemplate);
+        size_t slash = nexusTemplate.find_last_of('/');
+        if (slash == std::string::npos) {
+            setString(port, "TEMPLATE_FILE_PATH", "./");
+            setString(port, "TEMPLATE_FILE_NAME", nexusTemplate);
+        } else {
+            setString(port, "TEMPLATE_FILE_PATH", nexusTemplate.substr(0, slash+1));
+            setString(port, "TEMPLATE_FILE_NAME", nexusTemplate.substr(slash+1));
+        }
+    }
+
+    /* The first array gives the plugin the dimensions and data type before capture starts */
+    pSource->sendArray(arrays[0]);
+    epicsThreadSleep(0.1);
+    setInt(port, NDFileCaptureString, 1);
+
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<pOptions->numFrames; i++) {
+        pSource->sendArray(arrays[i % arrays.size()]);
+        backlog = getInt(port, NDFileWriteBacklogString);
+        if (backlog > maxBacklog) maxBacklog = backlog;
+    }
+    /* Wait for the queue to drain. If arrays were dropped the plugin does not stop by itself */
+    while (getInt(port, NDPluginDriverQueueFreeString) < getInt(port, NDPluginDriverQueueSizeString))
+        epicsThreadSleep(0.01);
+    if (getInt(port, NDFileCaptureString))
+        setInt(port, NDFileCaptureString, 0);
+    epicsTimeGetCurrent(&tEnd);
+    elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+
+    asynFloat64ArrayClient timesClient(port, 0, NDFileWriteTimesString);
+    timesClient.read(&writeTimes[0], writeTimes.size(), &numTimes);
+    writeTimes.resize(numTimes);
+    std::sort(writeTimes.begin(), writeTimes.end());
+
+    int written = getInt(port, NDFileStatsWritesString);
+    arrays[0]->getInfo(&arrayInfo);
+    printf("%-8s %7d %7d %9.1f %9.1f %8.3f %8.3f %8.3f %8.3f %8.3f %7d\n",
+           pPlugin->name, written,
+           getInt(port, NDPluginDriverDroppedArraysString),
+           elapsed > 0. ? written * arrayInfo.totalBytes / elapsed / 1.e6 : 0.,
+           getDouble(port, NDFileWriteRateString),
+           getDouble(port, NDFileOpenTimeString),
+           percentile(writeTimes, 0.5),
+           percentile(writeTimes, 0.99),
+           getDouble(port, NDFileMaxStallString),
+           getDouble(port, NDFileCloseTimeString),
+           maxBacklog);
+}
+
+static void usage(const char *program)
+{
+    int i;
+
+    printf("Usage: %s [options] [plugin ...]\n"
+           "Writes synthetic frames with each file plugin in Stream mode and prints the file I/O statistics.\n"
+           "  -n frames     Number of frames to write (default 1000)\n"
+           "  -x size       Frame size in X (default 1024)\n"
+           "  -y size       Frame size in Y (default 1024)\n"
+           "  -t type       Data type: uint8, uint16, uint32, float32 (default uint8)\n"
+           "  -q size       Plugin queue size (default 20)\n"
+           "  -b            Use blocking callbacks\n"
+           "  -d path       Directory to write the files to (default ./)\n"
+           "  -T file       Nexus XML template file; the nexus plugin is only run if this is given\n"
+           "Plugins:", program);
+    for (i=0; i<numBenchPlugins; i++) printf(" %s", benchPlugins[i].name);
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    benchOptions_t options;
+    std::vector<NDArray *> arrays(4);
+    size_t dims[2];
+    size_t j;
+    int opt, i, k;
+
+    options.numFrames = 1000;
+    options.sizeX = 1024;
+    options.sizeY = 1024;
+    options.dataType = NDUInt8;
+    options.queueSize = 20;
+    options.blocking = 0;
+    options.filePath = "./";
+    options.nexusTemplate = NULL;
+
+    while ((opt = getopt(argc, argv, "n:x:y:t:q:bd:T:h")) != -1) {
+        switch (opt) {
+            case 'n': options.numFrames = atoi(optarg); break;
+            case 'x': options.sizeX = atoi(optarg); break;
+            case 'y': options.sizeY = atoi(optarg); break;
+            case 't':
+                if      (strcmp(optarg, "uint8")   == 0) options.dataType = NDUInt8;
+                else if (strcmp(optarg, "uint16")  == 0) options.dataType = NDUInt16;
+                else if (strcmp(optarg, "uint32")  == 0) options.dataType = NDUInt32;
+                else if (strcmp(optarg, "float32") == 0) options.dataType = NDFloat32;
+                else { usage(argv[0]); return 1; }
+                break;
+            case 'q': options.queueSize = atoi(optarg); break;
+            case 'b': options.blocking = 1; break;
+            case 'd': options.filePath = optarg; break;
+            case 'T': options.nexusTemplate = optarg; break;
+            default:  usage(argv[0]); return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if ((options.numFrames < 1) || (options.sizeX < 1) || (options.sizeY < 1) || (options.queueSize < 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        BenchSource *pSource = new BenchSource("BENCH_SOURCE");
+
+        /* A few different frames so that compressing plugins do not see the same data every time */
+        dims[0] = options.sizeX;
+        dims[1] = options.sizeY;
+        for (j=0; j<arrays.size(); j++) {
+            NDArrayInfo_t arrayInfo;
+            arrays[j] = pSource->pNDArrayPool->alloc(2, dims, options.dataType, 0, NULL);
+            if (!arrays[j]) {
+                printf("Cannot allocate %lu x %lu array\n", (unsigned long)dims[0], (unsigned long)dims[1]);
+                return 1;
+            }
+            arrays[j]->getInfo(&arrayInfo);
+            for (k=0; k<(int)arrayInfo.totalBytes; k++) {
+                ((epicsUInt8 *)arrays[j]->pData)[k] = (epicsUInt8)((k + j*7) ^ (k >> 8));
+            }
+        }
+
+        printf("%lu x %lu frames, %d frames per plugin, queue size %d, %s callbacks\n",
+               (unsigned long)options.sizeX, (unsigned long)options.sizeY, options.numFrames,
+               options.queueSize, options.blocking ? "blocking" : "non-blocking");
+        printf("%-8s %7s %7s %9s %9s %8s %8s %8s %8s %8s %7s\n",
+               "plugin", "written", "dropped", "MB/s", "plug MB/s",
+               "open ms", "p50 ms", "p99 ms", "max ms", "close ms", "backlog");
+        for (i=0; i<numBenchPlugins; i++) {
+            benchPlugin_t *pPlugin = &benchPlugins[i];
+            bool selected = (optind == argc);
+            for (k=optind; k<argc; k++) {
+                if (strcmp(argv[k], pPlugin->name) == 0) selected = true;
+            }
+            if (!selected) continue;
+            if ((strcmp(pPlugin->name, "nexus") == 0) && !options.nexusTemplate) {
+                printf("%-8s skipped, no template file (-T)\n", pPlugin->name);
+                continue;
+            }
+            runBench(pSource, "BENCH_SOURCE", pPlugin, arrays, &options);
+        }
+
+        for (j=0; j<arrays.size(); j++) arrays[j]->release();
+    }
+    catch (std::exception& e) {
+        printf("Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
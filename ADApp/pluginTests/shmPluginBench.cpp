@@ -0,0 +1,370 @@
+/** shmPluginBench.cpp
+ *
+ *  Throughput benchmark for handing NDArrays to a consumer on the same host.
+ *  A dummy driver sends synthetic NDArrays to NDPluginShm and, if built with pvAccess,
+ *  to NDPluginPva. A consumer thread in the same process reads the frames back, with
+ *  NDShmReader for the shared memory ring and with a pvAccess monitor over loopback for
+ *  the Pva plugin. For each transport the number of frames received and lost, the
+ *  delivered rate and the latency from the driver callback to the consumer are printed.
+ *
+ *  Run shm-plugin-bench -h for the options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsGetopt.h>
+#include <asynPortClient.h>
+
+#include <asynNDArrayDriver.h>
+#include <NDPluginDriver.h>
+#include <NDShmReader.h>
+
+#ifdef HAVE_PVA
+#include <pv/pvData.h>
+#include <pv/serverContext.h>
+#include <pv/channelProviderLocal.h>
+#include <pva/client.h>
+extern "C" int NDPvaConfigure(const char *, int, int, const char *, int, const char *, int, size_t, int, int, int);
+#endif
+
+extern "C" int NDShmConfigure(const char *, int, int, const char *, int, const char *, int, size_t,
+                              int, size_t, int, int);
+
+/** Dummy driver that sends arrays to the plugins */
+class BenchSource : public asynNDArrayDriver {
+public:
+    BenchSource(const char *portName)
+        : asynNDArrayDriver(portName, 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0) {}
+
+    void sendArray(NDArray *pArray)
+    {
+        this->lock();
+        doCallbacksGenericPointer(pArray, NDArrayData, 0);
+        this->unlock();
+    }
+};
+
+typedef struct {
+    int numFrames;
+    size_t sizeX;
+    size_t sizeY;
+    NDDataType_t dataType;
+    int queueSize;
+    int numSlots;
+    double frameRate;
+} benchOptions_t;
+
+/** State shared by the sending thread and the consumer thread */
+typedef struct {
+    const benchOptions_t *pOptions;
+    const char *name;                 /* Shared memory segment or PV name */
+    std::vector<double> sendTimes;    /* Indexed by uniqueId */
+    std::vector<double> latencies;
+    int received;
+    int lastUniqueId;
+    double lastReceiveTime;
+    epicsEventId readyEvent;
+    epicsEventId doneEvent;
+    volatile bool sending;
+} benchConsumer_t;
+
+static double now()
+{
+    epicsTimeStamp t;
+    epicsTimeGetCurrent(&t);
+    return t.secPastEpoch + t.nsec / 1.e9;
+}
+
+static void setInt(const char *portName, const char *param, int value)
+{
+    asynInt32Client client(portName, 0, param);
+    client.write(value);
+}
+
+static int getInt(const char *portName, const char *param)
+{
+    epicsInt32 value = 0;
+    asynInt32Client client(portName, 0, param);
+    client.read(&value);
+    return value;
+}
+
+/** Records the latency of a received frame */
+static void frameReceived(benchConsumer_t *pConsumer, int uniqueId)
+{
+    pConsumer->received++;
+    pConsumer->lastUniqueId = uniqueId;
+    pConsumer->lastReceiveTime = now();
+    if ((uniqueId >= 0) && (uniqueId < (int)pConsumer->sendTimes.size()))
+        pConsumer->latencies.push_back(pConsumer->lastReceiveTime - pConsumer->sendTimes[uniqueId]);
+}
+
+static void shmConsumerTask(void *drvPvt)
+{
+    benchConsumer_t *pConsumer = (benchConsumer_t *)drvPvt;
+    NDShmReader reader;
+    NDShmFrame frame;
+    NDShmReadStatus_t status;
+
+    if (reader.open(pConsumer->name)) {
+        perror("NDShmReader::open");
+        epicsEventSignal(pConsumer->readyEvent);
+        epicsEventSignal(pConsumer->doneEvent);
+        return;
+    }
+    epicsEventSignal(pConsumer->readyEvent);
+    for (;;) {
+        status = reader.wait(&frame, 0.5);
+        if (status == NDSHM_READ_OK) {
+            /* The data are used in place; valid() tells if the writer overwrote them meanwhile */
+            if (reader.valid(&frame)) frameReceived(pConsumer, frame.slot.uniqueId);
+            if (frame.slot.uniqueId == pConsumer->pOptions->numFrames - 1) break;
+        } else if ((status != NDSHM_READ_NONE) || !pConsumer->sending) {
+            break;
+        }
+    }
+    epicsEventSignal(pConsumer->doneEvent);
+}
+
+#ifdef HAVE_PVA
+static void pvaConsumerTask(void *drvPvt)
+{
+    benchConsumer_t *pConsumer = (benchConsumer_t *)drvPvt;
+
+    try {
+        pvac::ClientProvider provider("pva");
+        pvac::ClientChannel channel(provider.connect(pConsumer->name));
+        pvac::MonitorSync monitor(channel.monitor());
+        bool done = false;
+
+        epicsEventSignal(pConsumer->readyEvent);
+        while (!done) {
+            if (!monitor.wait(0.5)) {
+                if (!pConsumer->sending) break;
+                continue;
+            }
+            if (monitor.event.event != pvac::MonitorEvent::Data) continue;
+            while (monitor.poll()) {
+                int uniqueId = monitor.root->getSubFieldT<epics::pvData::PVInt>("uniqueId")->get();
+                frameReceived(pConsumer, uniqueId);
+                if (uniqueId == pConsumer->pOptions->numFrames - 1) done = true;
+            }
+        }
+    }
+    catch (std::exception& e) {
+        printf("pvAccess client error: %s\n", e.what());
+        epicsEventSignal(pConsumer->readyEvent);
+    }
+    epicsEventSignal(pConsumer->doneEvent);
+}
+#endif
+
+/** Returns the value below which fraction p of the sorted times lie */
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0.;
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void runBench(BenchSource *pSource, const char *transport,
+                     const char *port, const char *name, EPICSTHREADFUNC consumerTask,
+                     std::vector<NDArray *>& arrays, const benchOptions_t *pOptions)
+{
+    benchConsumer_t consumer;
+    NDArrayInfo_t arrayInfo;
+    double start, elapsed;
+    int i;
+
+    setInt(port, NDPluginDriverEnableCallbacksString, 1);
+    arrays[0]->getInfo(&arrayInfo);
+
+    consumer.pOptions = pOptions;
+    consumer.name = name;
+    consumer.sendTimes.resize(pOptions->numFrames);
+    consumer.latencies.reserve(pOptions->numFrames);
+    consumer.received = 0;
+    consumer.lastUniqueId = -1;
+    consumer.lastReceiveTime = 0.;
+    consumer.readyEvent = epicsEventMustCreate(epicsEventEmpty);
+    consumer.doneEvent = epicsEventMustCreate(epicsEventEmpty);
+    consumer.sending = true;
+    epicsThreadCreate(transport, epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium), consumerTask, &consumer);
+    epicsEventWait(consumer.readyEvent);
+    /* Give the pvAccess monitor time to connect */
+    epicsThreadSleep(0.5);
+
+    start = now();
+    for (i=0; i<pOptions->numFrames; i++) {
+        /* A new array for every frame, as a driver would, so queued arrays keep their uniqueId */
+        NDArray *pArray = pSource->pNDArrayPool->copy(arrays[i % arrays.size()], NULL, 1);
+        if (!pArray) {
+            printf("%-8s cannot allocate array\n", transport);
+            break;
+        }
+        pArray->uniqueId = i;
+        consumer.sendTimes[i] = now();
+        pSource->sendArray(pArray);
+        pArray->release();
+        if (pOptions->frameRate > 0.) {
+            double wait = start + (i+1) / pOptions->frameRate - now();
+            if (wait > 0.) epicsThreadSleep(wait);
+        }
+    }
+    /* Wait for the plugin queue to drain and the consumer to get the last frame */
+    while (getInt(port, NDPluginDriverQueueFreeString) < getInt(port, NDPluginDriverQueueSizeString))
+        epicsThreadSleep(0.01);
+    consumer.sending = false;
+    epicsEventWait(consumer.doneEvent);
+    /* The consumer may have timed out waiting for lost frames, so use the time of the last frame received */
+    elapsed = consumer.lastReceiveTime - start;
+    setInt(port, NDPluginDriverEnableCallbacksString, 0);
+
+    std::sort(consumer.latencies.begin(), consumer.latencies.end());
+    printf("%-8s %7d %7d %8d %8d %9.1f %9.1f %8.3f %8.3f %8.3f\n",
+           transport, pOptions->numFrames,
+           getInt(port, NDPluginDriverDroppedArraysString),
+           consumer.received,
+           pOptions->numFrames - getInt(port, NDPluginDriverDroppedArraysString) - consumer.received,
+           elapsed > 0. ? consumer.received / elapsed : 0.,
+           elapsed > 0. ? consumer.received * arrayInfo.totalBytes / elapsed / 1.e6 : 0.,
+           percentile(consumer.latencies, 0.5) * 1000.,
+           percentile(consumer.latencies, 0.99) * 1000.,
+           consumer.latencies.empty() ? 0. : consumer.latencies.back() * 1000.);
+    epicsEventDestroy(consumer.readyEvent);
+    epicsEventDestroy(consumer.doneEvent);
+}
+
+static void usage(const char *program)
+{
+    printf("Usage: %s [options] [shm] [pva]\n"
+           "Sends synthetic frames to NDPluginShm and NDPluginPva and reads them back in a consumer thread.\n"
+           "  -n frames     Number of frames to send (default 1000)\n"
+           "  -x size       Frame size in X (default 1024)\n"
+           "  -y size       Frame size in Y (default 1024)\n"
+           "  -t type       Data type: uint8, uint16, uint32, float32 (default uint8)\n"
+           "  -q size       Plugin queue size (default 20)\n"
+           "  -s slots      Number of slots in the shared memory ring (default 8)\n"
+           "  -r rate       Frames per second to send, 0 for as fast as possible (default 0)\n"
+#ifndef HAVE_PVA
+           "This program was built without pvAccess, so only shm is available.\n"
+#endif
+           , program);
+}
+
+int main(int argc, char **argv)
+{
+    benchOptions_t options;
+    std::vector<NDArray *> arrays(4);
+    size_t dims[2];
+    size_t j;
+    int opt, k;
+    bool runShm, runPva = false;
+
+    options.numFrames = 1000;
+    options.sizeX = 1024;
+    options.sizeY = 1024;
+    options.dataType = NDUInt8;
+    options.queueSize = 20;
+    options.numSlots = 8;
+    options.frameRate = 0.;
+
+    while ((opt = getopt(argc, argv, "n:x:y:t:q:s:r:h")) != -1) {
+        switch (opt) {
+            case 'n': options.numFrames = atoi(optarg); break;
+            case 'x': options.sizeX = atoi(optarg); break;
+            case 'y': options.sizeY = atoi(optarg); break;
+            case 't':
+                if      (strcmp(optarg, "uint8")   == 0) options.dataType = NDUInt8;
+                else if (strcmp(optarg, "uint16")  == 0) options.dataType = NDUInt16;
+                else if (strcmp(optarg, "uint32")  == 0) options.dataType = NDUInt32;
+                else if (strcmp(optarg, "float32") == 0) options.dataType = NDFloat32;
+                else { usage(argv[0]); return 1; }
+                break;
+            case 'q': options.queueSize = atoi(optarg); break;
+            case 's': options.numSlots = atoi(optarg); break;
+            case 'r': options.frameRate = atof(optarg); break;
+            default:  usage(argv[0]); return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if ((options.numFrames < 1) || (options.sizeX < 1) || (options.sizeY < 1) ||
+        (options.queueSize < 1) || (options.numSlots < 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+    runShm = (optind == argc);
+#ifdef HAVE_PVA
+    runPva = (optind == argc);
+#endif
+    for (k=optind; k<argc; k++) {
+        if (strcmp(argv[k], "shm") == 0) runShm = true;
+#ifdef HAVE_PVA
+        else if (strcmp(argv[k], "pva") == 0) runPva = true;
+#endif
+        else { usage(argv[0]); return 1; }
+    }
+
+    try {
+        BenchSource *pSource = new BenchSource("BENCH_SOURCE");
+        NDArrayInfo_t arrayInfo;
+
+        dims[0] = options.sizeX;
+        dims[1] = options.sizeY;
+        for (j=0; j<arrays.size(); j++) {
+            arrays[j] = pSource->pNDArrayPool->alloc(2, dims, options.dataType, 0, NULL);
+            if (!arrays[j]) {
+                printf("Cannot allocate %lu x %lu array\n", (unsigned long)dims[0], (unsigned long)dims[1]);
+                return 1;
+            }
+            arrays[j]->getInfo(&arrayInfo);
+            for (k=0; k<(int)arrayInfo.totalBytes; k++) {
+                ((epicsUInt8 *)arrays[j]->pData)[k] = (epicsUInt8)((k + j*7) ^ (k >> 8));
+            }
+        }
+
+        printf("%lu x %lu frames, %d frames, queue size %d, %d shared memory slots, %s\n",
+               (unsigned long)options.sizeX, (unsigned long)options.sizeY, options.numFrames,
+               options.queueSize, options.numSlots,
+               options.frameRate > 0. ? "rate limited" : "as fast as possible");
+        printf("%-8s %7s %7s %8s %8s %9s %9s %8s %8s %8s\n",
+               "plugin", "sent", "dropped", "received", "lost", "frames/s", "MB/s",
+               "p50 ms", "p99 ms", "max ms");
+
+        if (runShm) {
+            /* Room for the slot header and attributes in front of the data */
+            size_t slotSize = arrayInfo.totalBytes + 65536;
+            NDShmConfigure("BENCH_SHM", options.queueSize, 0, "BENCH_SOURCE", 0, "/shm_plugin_bench",
+                           options.numSlots, slotSize, 0, 0, 0, 0);
+            runBench(pSource, "shm", "BENCH_SHM", "/shm_plugin_bench",
+                     shmConsumerTask, arrays, &options);
+        }
+#ifdef HAVE_PVA
+        if (runPva) {
+            epics::pvAccess::ServerContext::shared_pointer server =
+                epics::pvAccess::ServerContext::create(
+                    epics::pvAccess::ServerContext::Config()
+                        .provider(epics::pvDatabase::getChannelProviderLocal()));
+            NDPvaConfigure("BENCH_PVA", options.queueSize, 0, "BENCH_SOURCE", 0, "BENCH:Pva:Image", 0, 0, 0, 0, 0);
+            runBench(pSource, "pva", "BENCH_PVA", "BENCH:Pva:Image",
+                     pvaConsumerTask, arrays, &options);
+        }
+#endif
+
+        for (j=0; j<arrays.size(); j++) arrays[j]->release();
+    }
+    catch (std::exception& e) {
+        printf("Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -15,6 +15,8 @@
 
 using namespace std;
 
+// Defined in NDArrayPool.cpp, set with "var alignNDArrayData" in an IOC
+extern volatile int alignNDArrayData;
 
 struct NDArrayPoolFixture
 {
@@ -129,4 +131,97 @@ BOOST_AUTO_TEST_CASE(test_Pool)
     
 }
 
+class TestBufferOwner : public NDArrayBufferOwner
+{
+public:
+  TestBufferOwner() : released(0) {}
+  void release() { released++; }
+  int released;
+};
+
+BOOST_AUTO_TEST_CASE(test_BufferOwner)
+{
+  char buffer[1000];
+  size_t dims = sizeof(buffer);
+  TestBufferOwner owner;
+  NDArray *pArray;
+
+  pArray = pPool->alloc(1, &dims, NDUInt8, sizeof(buffer), buffer, &owner);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(pArray->pData, (void *)buffer);
+  BOOST_CHECK_EQUAL(pArray->pBufferOwner, &owner);
+  // A buffer the pool does not own is not counted against maxMemory
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), 0);
+
+  pArray->reserve();
+  pArray->release();
+  BOOST_CHECK_EQUAL(owner.released, 0);
+
+  // The last release gives the buffer back to its owner and keeps the NDArray without a buffer
+  pArray->release();
+  BOOST_CHECK_EQUAL(owner.released, 1);
+  BOOST_CHECK(pArray->pData == 0);
+  BOOST_CHECK(pArray->pBufferOwner == 0);
+  BOOST_CHECK_EQUAL(pPool->getNumFree(), 1);
+
+  // The empty NDArray is picked first for the next external buffer
+  NDArray *pArrayTest = pPool->alloc(1, &dims, NDUInt8, sizeof(buffer), buffer, &owner);
+  BOOST_CHECK_EQUAL(pArrayTest, pArray);
+  BOOST_CHECK_EQUAL(pPool->getNumFree(), 0);
+  pArrayTest->release();
+  BOOST_CHECK_EQUAL(owner.released, 2);
+
+  // Arrays allocated by the pool are not affected
+  pArray = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK(pArray->pData != (void *)buffer);
+  BOOST_CHECK(pArray->pBufferOwner == 0);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), sizeof(buffer));
+  pArray->release();
+  BOOST_CHECK_EQUAL(owner.released, 2);
+}
+
+// With alignNDArrayData set, the buffers of new arrays and of arrays reused from the free list are aligned,
+// also when the buffer of a reused array is reallocated
+BOOST_AUTO_TEST_CASE(test_AlignedData)
+{
+  static const int align = 4096;
+  static const int numArrays = 3;
+  size_t bufferSizes[numArrays] = {100, 1000, 5000};
+  NDArray *pArrays[numArrays];
+  void *pData[numArrays];
+  NDArray *pArrayTest;
+  size_t dims;
+  int i;
+
+  alignNDArrayData = align;
+  for (i=0; i<numArrays; i++) {
+    dims = bufferSizes[i];
+    pArrays[i] = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArrays[i] != 0);
+    BOOST_CHECK_EQUAL((uintptr_t)pArrays[i]->pData % align, 0u);
+    pData[i] = pArrays[i]->pData;
+  }
+  for (i=0; i<numArrays; i++) {
+    pArrays[i]->release();
+  }
+
+  // Same size: the array is reused with its buffer
+  dims = bufferSizes[1];
+  pArrayTest = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE_EQUAL(pArrayTest, pArrays[1]);
+  BOOST_CHECK_EQUAL(pArrayTest->pData, pData[1]);
+  BOOST_CHECK_EQUAL((uintptr_t)pArrayTest->pData % align, 0u);
+  pArrayTest->release();
+
+  // More than 1.5 times smaller: the array is reused and its buffer is reallocated
+  dims = 600;
+  pArrayTest = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE_EQUAL(pArrayTest, pArrays[1]);
+  BOOST_CHECK_EQUAL(pArrayTest->dataSize, dims);
+  BOOST_CHECK_EQUAL((uintptr_t)pArrayTest->pData % align, 0u);
+  pArrayTest->release();
+  alignNDArrayData = 0;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <NDArray.h>
 #include <NDAttribute.h>
 #include <asynDriver.h>
+#include <epicsStdio.h>
 
 #include <string.h>
 #include <stdint.h>
@@ -21,9 +22,17 @@ using namespace std;
 #include "asynPortDriver.h"
 #include "HDF5PluginWrapper.h"
 #include "HDF5FileReader.h"
+#include "NDPluginCodec.h"
 
 static  NDArrayPool *arrayPool;
 
+// Values of HDF5_compressionType and the filter IDs used with them
+static const int hdf5CompressZstd = 8;
+static const int hdf5CompressBshufZstd = 9;
+static const H5Z_filter_t filterZstd = 32015;
+static const H5Z_filter_t filterBshuf = 32008;
+static const H5Z_filter_t filterLZ4 = 32004;
+
 struct NDFileHDF5TestFixture
 {
   asynNDArrayDriver* dummy_driver;
@@ -107,6 +116,49 @@ struct NDFileHDF5TestFixture
     NDAttribute *pA8 = new NDAttribute("Manufacturer", "Camera manufacturer", NDAttrSourceParam, "MANUFACTURER", NDAttrString, val8);
     pAttributeList->add(pA8);
   }
+
+  // Fills UInt16 arrays with a pattern that differs in each array
+  void fillPattern(std::vector<NDArray*>& arrays)
+  {
+    for (size_t i = 0; i < arrays.size(); i++)
+    {
+      NDArrayInfo_t info;
+      arrays[i]->getInfo(&info);
+      epicsUInt16 *pData = (epicsUInt16 *)arrays[i]->pData;
+      for (size_t j = 0; j < info.nElements; j++)
+      {
+        pData[j] = (epicsUInt16)((i * 7 + j) % 60);
+      }
+    }
+  }
+
+  // Writes the arrays to one file
+  void capture(std::vector<NDArray*>& arrays)
+  {
+    hdf5->processCallbacks(arrays[0]);
+    hdf5->write(NDFileNumCaptureString, (int)arrays.size());
+    hdf5->write(NDFileCaptureString, 1);
+    for (size_t i = 0; i < arrays.size(); i++)
+    {
+      hdf5->lock();
+      BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+      hdf5->unlock();
+    }
+    BOOST_REQUIRE_EQUAL(hdf5->readInt(NDFileNumCapturedString), (int)arrays.size());
+  }
+
+  // Checks that the data read back from the file is the data of the arrays
+  void checkData(HDF5FileReader& fr, std::vector<NDArray*>& arrays)
+  {
+    NDArrayInfo_t info;
+    arrays[0]->getInfo(&info);
+    std::vector<epicsUInt16> data(arrays.size() * info.nElements);
+    BOOST_REQUIRE(fr.readDataset("/entry/data/data", H5T_NATIVE_UINT16, &data[0]));
+    for (size_t i = 0; i < arrays.size(); i++)
+    {
+      BOOST_CHECK_EQUAL(memcmp(&data[i * info.nElements], arrays[i]->pData, info.totalBytes), 0);
+    }
+  }
 };
 
 BOOST_FIXTURE_TEST_SUITE(NDFileHDF5Tests, NDFileHDF5TestFixture)
@@ -292,4 +344,396 @@ BOOST_AUTO_TEST_CASE(test_DatasetLayout1)
 
 }
 
+BOOST_AUTO_TEST_CASE(test_AsyncCapture)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  // Create some test arrays
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  // Configure the HDF5 plugin to write from its writer thread
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 36);
+  hdf5->write(str_NDFileHDF5_asyncWrite, 1);
+  hdf5->write(str_NDFileHDF5_asyncQueueSize, 2);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+    BOOST_CHECK_LE(hdf5->readInt(str_NDFileHDF5_asyncQueueDepth), 2);
+  }
+
+  // The file is closed after the last frame, once all queued frames are written
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_asyncQueueDepth), 0);
+  HDF5FileReader fr("testing_36.5");
+  std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/data/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+  BOOST_CHECK_EQUAL(odims[1], 6);
+  BOOST_CHECK_EQUAL(odims[2], 4);
+
+  // The performance dataset has the queue depth and write latency columns
+  odims = fr.getDatasetDimensions("/entry/instrument/performance/timestamp");
+  BOOST_REQUIRE_EQUAL(odims.size(), 2);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+  BOOST_CHECK_EQUAL(odims[1], HDF5_PERF_COLUMNS_ASYNC);
+  BOOST_CHECK_EQUAL(fr.getDatasetAttributeCount("/entry/instrument/performance/timestamp"), 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_RoundRobinCapture)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  // Create some test arrays
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  // Spread the frames over three writers
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 38);
+  hdf5->write(str_NDFileHDF5_numWriters, 3);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+  hdf5->write(NDFileNumCaptureString, 10);
+
+  const char *writerFiles[] = {"testing_38_w0.5", "testing_38_w1.5", "testing_38_w2.5"};
+  hbool_t threadSafe = 0;
+  if (H5is_library_threadsafe(&threadSafe) < 0 || !threadSafe)
+  {
+    // The writers would call HDF5 concurrently, so capture is refused and no files are created
+    BOOST_CHECK_THROW(hdf5->write(NDFileCaptureString, 1), AsynException);
+    BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 0);
+    BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), (int)NDFileWriteError);
+    for (int i = 0; i < 3; i++)
+    {
+      FILE *file = fopen(writerFiles[i], "r");
+      BOOST_CHECK_MESSAGE(file == NULL, writerFiles[i] << " was created");
+      if (file) fclose(file);
+    }
+    return;
+  }
+
+  // Start capture to disk
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+
+  // Each writer file has its share of the frames
+  hsize_t writerFrames[] = {4, 3, 3};
+  for (int i = 0; i < 3; i++)
+  {
+    HDF5FileReader fr(writerFiles[i]);
+    std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/instrument/detector/data");
+    BOOST_REQUIRE_EQUAL(odims.size(), 3);
+    BOOST_CHECK_EQUAL(odims[0], writerFrames[i]);
+  }
+
+  // The master file presents all of the frames, including through the hard link
+  HDF5FileReader fr("testing_38.5");
+  std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/instrument/detector/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+  BOOST_CHECK_EQUAL(odims[1], 6);
+  BOOST_CHECK_EQUAL(odims[2], 4);
+  BOOST_CHECK(fr.checkDatasetExists("/entry/data/data"));
+  BOOST_CHECK_GT(fr.getDatasetAttributeCount("/entry/instrument/detector/data"), 0);
+  odims = fr.getDatasetDimensions("/entry/instrument/NDAttributes/NDArrayUniqueId");
+  BOOST_REQUIRE_EQUAL(odims.size(), 1);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+
+  // The next file uses the same writers
+  hdf5->write(NDFileNumberString, 45);
+  hdf5->write(NDFileNumCaptureString, 4);
+  hdf5->write(NDFileCaptureString, 1);
+  for (int i = 0; i < 4; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), (int)NDFileWriteOK);
+  HDF5FileReader fr2("testing_45.5");
+  odims = fr2.getDatasetDimensions("/entry/instrument/detector/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_EQUAL(odims[0], 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_ChunkAutoTune)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  // Create some test arrays
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  // Aim for chunks of 10 frames of 96 bytes
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 39);
+  hdf5->write(str_NDFileHDF5_chunkAutoTune, 1);
+  hdf5->write(str_NDFileHDF5_chunkTargetBytes, 960);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+
+  // Frames are grouped, and the cache holds the open chunk and one more
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_nFramesChunks), 10);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_chunkCacheBytes), 1920);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_chunkRewrites), 0);
+  HDF5FileReader fr("testing_39.5");
+  std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/data/data");
+  BOOST_REQUIRE_EQUAL(odims.size(), 3);
+  BOOST_CHECK_EQUAL(odims[0], 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_FileStats)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  // Create some test arrays
+  std::vector<NDArray*>arrays(10);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+
+  // Keep a window of 4 writes
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 37);
+  hdf5->write(NDFileStatsWindowString, 4);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileStatsWritesString), 0);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk
+  hdf5->write(NDFileNumCaptureString, 10);
+  hdf5->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+
+  // Every write is counted, the file was opened and closed, and the window holds the last 4 writes
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileStatsWritesString), 10);
+  BOOST_CHECK_GT(hdf5->readDouble(NDFileOpenTimeString), 0.0);
+  BOOST_CHECK_GT(hdf5->readDouble(NDFileCloseTimeString), 0.0);
+  BOOST_CHECK_GT(hdf5->readDouble(NDFileWriteRateString), 0.0);
+  BOOST_CHECK_GE(hdf5->readDouble(NDFileMaxStallString), hdf5->readDouble(NDFileWriteTimeString));
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteBacklogString), 0);
+
+  asynFloat64ArrayClient times(hdf5->asynPortDriver::portName, 0, NDFileWriteTimesString);
+  epicsFloat64 values[10];
+  size_t nIn = 0;
+  times.read(values, 10, &nIn);
+  BOOST_CHECK_EQUAL(nIn, 4);
+
+  asynFloat64ArrayClient hist(hdf5->asynPortDriver::portName, 0, NDFileWriteHistString);
+  epicsFloat64 counts[NDFILE_HIST_SIZE];
+  double total = 0.0;
+  hist.read(counts, NDFILE_HIST_SIZE, &nIn);
+  BOOST_REQUIRE_EQUAL(nIn, NDFILE_HIST_SIZE);
+  for (int i = 0; i < NDFILE_HIST_SIZE; i++) total += counts[i];
+  BOOST_CHECK_EQUAL(total, 10.0);
+
+  // Reset clears the statistics
+  hdf5->write(NDFileStatsResetString, 1);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileStatsWritesString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readDouble(NDFileMaxStallString), 0.0);
+
+  // The window is clamped to its maximum size
+  hdf5->write(NDFileStatsWindowString, NDFILE_STATS_WINDOW_MAX + 1);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileStatsWindowString), NDFILE_STATS_WINDOW_MAX);
+}
+
+BOOST_AUTO_TEST_CASE(test_ZstdRoundTrip)
+{
+  if (H5Zfilter_avail(filterZstd) <= 0)
+  {
+    BOOST_TEST_MESSAGE("The HDF5 zstd filter is not available");
+    return;
+  }
+  size_t tmpdims[] = {40,30};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*>arrays(4);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillPattern(arrays);
+
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 40);
+  hdf5->write(str_NDFileHDF5_compressionType, hdf5CompressZstd);
+  hdf5->write(str_NDFileHDF5_zstdCompressLevel, 5);
+  capture(arrays);
+
+  HDF5FileReader fr("testing_40.5");
+  std::vector<unsigned int> values = fr.getDatasetFilterValues("/entry/data/data", filterZstd);
+  BOOST_REQUIRE_GE(values.size(), 1);
+  BOOST_CHECK_EQUAL(values[0], 5);
+  checkData(fr, arrays);
+}
+
+BOOST_AUTO_TEST_CASE(test_BshufZstdRoundTrip)
+{
+  if (H5Zfilter_avail(filterBshuf) <= 0)
+  {
+    BOOST_TEST_MESSAGE("The HDF5 bitshuffle filter is not available");
+    return;
+  }
+  size_t tmpdims[] = {40,30};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*>arrays(4);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillPattern(arrays);
+
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 41);
+  hdf5->write(str_NDFileHDF5_compressionType, hdf5CompressBshufZstd);
+  hdf5->write(str_NDFileHDF5_zstdCompressLevel, 22);
+  capture(arrays);
+
+  // The filter selects zstd and the level after the reserved values
+  HDF5FileReader fr("testing_41.5");
+  std::vector<unsigned int> values = fr.getDatasetFilterValues("/entry/data/data", filterBshuf);
+  BOOST_REQUIRE_GE(values.size(), 6);
+  BOOST_CHECK_EQUAL(values[4], 3);
+  BOOST_CHECK_EQUAL(values[5], 22);
+  checkData(fr, arrays);
+}
+
+#if defined(HAVE_ZSTD) && defined(HAVE_BITSHUFFLE)
+// The level of a pre-compressed array is not checked by writeInt32
+BOOST_AUTO_TEST_CASE(test_PrecompressedBshufZstdLevel)
+{
+  if (H5Zfilter_avail(filterBshuf) <= 0)
+  {
+    BOOST_TEST_MESSAGE("The HDF5 bitshuffle filter is not available");
+    return;
+  }
+  size_t tmpdims[] = {40,30};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*>arrays(4);
+  std::vector<NDArray*>compressed(4);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillPattern(arrays);
+
+  // zstd compresses at its default level when the level is 0
+  char errorMessage[256] = "";
+  for (size_t i = 0; i < arrays.size(); i++)
+  {
+    NDCodecStatus_t status = NDCODEC_SUCCESS;
+    compressed[i] = compressBSZstd(arrays[i], 0, &status, errorMessage);
+    BOOST_REQUIRE_MESSAGE(compressed[i] != NULL, errorMessage);
+  }
+
+  setup_hdf_stream();
+  hdf5->write(NDFileNumberString, 42);
+  capture(compressed);
+
+  HDF5FileReader fr("testing_42.5");
+  std::vector<unsigned int> values = fr.getDatasetFilterValues("/entry/data/data", filterBshuf);
+  BOOST_REQUIRE_GE(values.size(), 6);
+  BOOST_CHECK_EQUAL(values[4], 3);
+  BOOST_CHECK_EQUAL(values[5], 1);
+  checkData(fr, arrays);
+
+  for (size_t i = 0; i < compressed.size(); i++)
+  {
+    compressed[i]->release();
+  }
+}
+#endif
+
+#ifdef HAVE_BITSHUFFLE
+// Writes arrays compressed by NDPluginCodec, which have room for the filter header in front
+// of the data, while another plugin holds them. The arrays must not be changed.
+static void checkPrecompressedHeaderRoom(NDFileHDF5TestFixture& fixture, NDCodecCompressor_t compressor,
+                                         H5Z_filter_t filter, int fileNumber)
+{
+  if (H5Zfilter_avail(filter) <= 0)
+  {
+    BOOST_TEST_MESSAGE("The HDF5 filter for " << codecName[compressor] << " is not available");
+    return;
+  }
+  size_t tmpdims[] = {40,30};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*>arrays(4);
+  std::vector<NDArray*>compressed(4);
+  std::vector<std::vector<char> >before(4);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fixture.fillPattern(arrays);
+
+  char errorMessage[256] = "";
+  for (size_t i = 0; i < arrays.size(); i++)
+  {
+    NDCodecStatus_t status = NDCODEC_SUCCESS;
+    if (compressor == NDCODEC_LZ4)
+      compressed[i] = compressLZ4(arrays[i], &status, errorMessage);
+    else
+      compressed[i] = compressBSLZ4(arrays[i], &status, errorMessage);
+    BOOST_REQUIRE_MESSAGE(compressed[i] != NULL, errorMessage);
+    BOOST_REQUIRE_GE(compressed[i]->codec.headerRoom, filterHeaderSize(codecName[compressor]));
+    // Like another plugin that is still using the array
+    compressed[i]->reserve();
+    char *pData = (char *)compressed[i]->pData;
+    before[i].assign(pData, pData + compressed[i]->compressedSize);
+  }
+
+  fixture.setup_hdf_stream();
+  fixture.hdf5->write(NDFileNumberString, fileNumber);
+  fixture.capture(compressed);
+
+  char fileName[64];
+  epicsSnprintf(fileName, sizeof(fileName), "testing_%d.5", fileNumber);
+  HDF5FileReader fr(fileName);
+  fixture.checkData(fr, arrays);
+
+  for (size_t i = 0; i < compressed.size(); i++)
+  {
+    BOOST_CHECK_EQUAL(memcmp(&before[i][0], compressed[i]->pData, before[i].size()), 0);
+    compressed[i]->release();
+    compressed[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_PrecompressedLZ4HeaderRoom)
+{
+  checkPrecompressedHeaderRoom(*this, NDCODEC_LZ4, filterLZ4, 43);
+}
+
+BOOST_AUTO_TEST_CASE(test_PrecompressedBSLZ4HeaderRoom)
+{
+  checkPrecompressedHeaderRoom(*this, NDCODEC_BSLZ4, filterBshuf, 44);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -739,3 +739,47 @@ BOOST_AUTO_TEST_CASE(test_AttributeDimensionalDataset)
 
 }
 
+
+BOOST_AUTO_TEST_CASE(test_AttributeBufferedDataset)
+{
+  // Open an HDF5 file for testing
+  std::string filename = "test_att_buffered.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  boost::shared_ptr<NDFileHDF5AttributeDataset> adPtr;
+
+  // Create an attribute dataset of type NDAttrInt32 with chunks of 16 values,
+  // which are written a chunk at a time
+  adPtr = boost::shared_ptr<NDFileHDF5AttributeDataset>(new NDFileHDF5AttributeDataset(file, "att1", NDAttrInt32));
+  adPtr->setDsetName("dset1");
+  adPtr->createDataset(16);
+  // Write two and a half chunks of values
+  epicsInt32 val1 = 0;
+  for (epicsInt32 index = 0; index < 40; index++){
+    val1 = index * 3;
+    NDAttribute ndAttr("att1", "Test attribute 1", NDAttrSourceFunct, "test", NDAttrInt32, &val1);
+    adPtr->writeAttributeDataset(hdf5::OnFrame, &ndAttr, 0);
+  }
+  // Closing the dataset writes the values of the partial chunk
+  adPtr->closeAttributeDataset();
+  H5Fclose(file);
+
+  HDF5FileReader fr(filename);
+  std::vector<hsize_t> dims = fr.getDatasetDimensions("/dset1");
+  BOOST_REQUIRE_EQUAL(dims.size(), 1);
+  BOOST_CHECK_EQUAL(dims[0], 40);
+
+  // Check that every value landed in the right place
+  file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(file, -1);
+  hid_t dataset = H5Dopen(file, "/dset1", H5P_DEFAULT);
+  BOOST_REQUIRE_GT(dataset, -1);
+  std::vector<epicsInt32> values(40);
+  BOOST_REQUIRE_GE(H5Dread(dataset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &values[0]), 0);
+  for (epicsInt32 index = 0; index < 40; index++){
+    BOOST_CHECK_EQUAL(values[index], index * 3);
+  }
+  H5Dclose(dataset);
+  H5Fclose(file);
+}
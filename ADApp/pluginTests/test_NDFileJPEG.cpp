@@ -0,0 +1,179 @@
+/*
+ * test_NDFileJPEG.cpp
+ *
+ * Tests of NDFileJPEG encoding files on more than one thread of NDWorkerPool
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <NDAttribute.h>
+#include <asynDriver.h>
+#include <epicsStdio.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include <deque>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "asynPortDriver.h"
+#include "JPEGPluginWrapper.h"
+
+static NDArrayPool *arrayPool;
+
+// Returns true if fileName is a complete JPEG file, starting with SOI and ending with EOI
+static bool isJPEGFile(const std::string& fileName)
+{
+  unsigned char head[2], tail[2];
+  FILE *file = fopen(fileName.c_str(), "rb");
+  if (!file) return false;
+  bool ok = (fread(head, 1, 2, file) == 2) &&
+            (fseek(file, -2, SEEK_END) == 0) &&
+            (fread(tail, 1, 2, file) == 2);
+  fclose(file);
+  return ok && (head[0] == 0xFF) && (head[1] == 0xD8) && (tail[0] == 0xFF) && (tail[1] == 0xD9);
+}
+
+struct NDFileJPEGTestFixture
+{
+  asynNDArrayDriver* dummy_driver;
+  boost::shared_ptr<JPEGPluginWrapper> jpeg;
+  std::string fileName;
+  std::vector<NDArray*> arrays;
+
+  NDFileJPEGTestFixture()
+  {
+    std::string dummy_port("simJPEGtest"), testport("JPEG");
+    uniqueAsynPortName(dummy_port);
+    uniqueAsynPortName(testport);
+
+    dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+    arrayPool = dummy_driver->pNDArrayPool;
+
+    jpeg = boost::shared_ptr<JPEGPluginWrapper>(new JPEGPluginWrapper(testport, dummy_port));
+    jpeg->start();
+    jpeg->write(NDPluginDriverEnableCallbacksString, 1);
+    jpeg->write(NDPluginDriverBlockingCallbacksString, 1);
+
+    fileName = testport;
+    jpeg->write(NDFilePathString, "");
+    jpeg->write(NDFileNameString, fileName);
+    jpeg->write(NDFileTemplateString, "%s%s_%d.jpg");
+    jpeg->write(NDFileNumberString, 0);
+    jpeg->write(NDAutoIncrementString, 1);
+    jpeg->write(NDFileJPEGNumThreadsString, 4);
+
+    size_t tmpdims[] = {640, 480};
+    std::vector<size_t> dims(tmpdims, tmpdims + 2);
+    arrays.resize(12);
+    fillNDArraysFromPool(dims, NDUInt8, arrays, arrayPool);
+  }
+
+  ~NDFileJPEGTestFixture()
+  {
+    jpeg.reset();
+    for (size_t i = 0; i < arrays.size(); i++) {
+      arrays[i]->release();
+      remove(numberedFile((int)i).c_str());
+    }
+    delete dummy_driver;
+  }
+
+  std::string numberedFile(int number)
+  {
+    char name[256];
+    epicsSnprintf(name, sizeof(name), "%s_%d.jpg", fileName.c_str(), number);
+    return name;
+  }
+
+  void process(NDArray *pArray)
+  {
+    jpeg->lock();
+    jpeg->processCallbacks(pArray);
+    jpeg->unlock();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileJPEGTests, NDFileJPEGTestFixture)
+
+// In single mode each write must have created its file when it completes
+BOOST_AUTO_TEST_CASE(test_ThreadedSingleWaits)
+{
+  jpeg->write(NDFileWriteModeString, NDFileModeSingle);
+  jpeg->write(NDAutoSaveString, 1);
+
+  for (int i = 0; i < 4; i++) {
+    process(arrays[i]);
+    BOOST_CHECK(isJPEGFile(numberedFile(i)));
+    BOOST_CHECK_EQUAL(jpeg->readInt(NDFileJPEGPendingString), 0);
+    BOOST_CHECK_EQUAL(jpeg->readInt(NDFileWriteStatusString), NDFileWriteOK);
+  }
+}
+
+// The files of a stream are written in parallel, the last one waits for all of them
+BOOST_AUTO_TEST_CASE(test_ThreadedStream)
+{
+  int numCapture = (int)arrays.size();
+  jpeg->write(NDFileWriteModeString, NDFileModeStream);
+  jpeg->write(NDFileNumCaptureString, numCapture);
+  jpeg->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < numCapture; i++) {
+    process(arrays[i]);
+  }
+
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileNumCapturedString), numCapture);
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileJPEGPendingString), 0);
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileWriteStatusString), NDFileWriteOK);
+  for (int i = 0; i < numCapture; i++) {
+    BOOST_CHECK(isJPEGFile(numberedFile(i)));
+    // The workers have released the arrays; the plugin keeps the last one
+    BOOST_CHECK_EQUAL(arrays[i]->getReferenceCount(), (i == numCapture-1) ? 2 : 1);
+  }
+}
+
+// A file that cannot be written is reported when the file is closed
+BOOST_AUTO_TEST_CASE(test_ThreadedError)
+{
+  jpeg->write(NDFilePathString, "/nonexistent_NDFileJPEG_test_dir/");
+  jpeg->write(NDFileWriteModeString, NDFileModeSingle);
+  jpeg->write(NDAutoSaveString, 1);
+
+  process(arrays[0]);
+
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileWriteStatusString), NDFileWriteError);
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileJPEGPendingString), 0);
+  BOOST_CHECK_EQUAL(arrays[0]->getReferenceCount(), 2);
+}
+
+// The destructor waits until the workers have written the queued files
+BOOST_AUTO_TEST_CASE(test_ThreadedDestructor)
+{
+  int numArrays = (int)arrays.size();
+  jpeg->write(NDFileWriteModeString, NDFileModeStream);
+  jpeg->write(NDFileNumCaptureString, 0);
+  jpeg->write(NDFileCaptureString, 1);
+
+  for (int i = 0; i < numArrays; i++) {
+    process(arrays[i]);
+  }
+  jpeg.reset();
+
+  for (int i = 0; i < numArrays; i++) {
+    BOOST_CHECK(isJPEGFile(numberedFile(i)));
+  }
+  for (int i = 0; i < numArrays-1; i++) {
+    BOOST_CHECK_EQUAL(arrays[i]->getReferenceCount(), 1);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
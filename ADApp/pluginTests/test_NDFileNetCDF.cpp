@@ -0,0 +1,180 @@
+/*
+ * test_NDFileNetCDF.cpp
+ *
+ * Tests of NDFileNetCDF streams written with more than one buffered record
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <NDAttribute.h>
+#include <asynDriver.h>
+#include <epicsStdio.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include <deque>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include <netcdf.h>
+
+#include "testingutilities.h"
+#include "asynPortDriver.h"
+#include "NetCDFPluginWrapper.h"
+
+static NDArrayPool *arrayPool;
+
+static const int sizeX = 6;
+static const int sizeY = 4;
+static const int numFrames = 7;
+// Length of the string attribute variables, MAX_ATTRIBUTE_STRING_SIZE in NDFileNetCDF.cpp
+static const int attrStringSize = 256;
+
+static epicsInt16 pixelValue(int frame, int i)
+{
+  return (epicsInt16)(frame * 100 - i);
+}
+
+struct NDFileNetCDFTestFixture
+{
+  asynNDArrayDriver* dummy_driver;
+  boost::shared_ptr<NetCDFPluginWrapper> netCDF;
+  std::string fileName;
+  std::vector<NDArray*> arrays;
+
+  NDFileNetCDFTestFixture()
+  {
+    std::string dummy_port("simNetCDFtest"), testport("NetCDF");
+    uniqueAsynPortName(dummy_port);
+    uniqueAsynPortName(testport);
+
+    dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+    arrayPool = dummy_driver->pNDArrayPool;
+
+    netCDF = boost::shared_ptr<NetCDFPluginWrapper>(new NetCDFPluginWrapper(testport, dummy_port));
+    netCDF->start();
+    netCDF->write(NDPluginDriverEnableCallbacksString, 1);
+    netCDF->write(NDPluginDriverBlockingCallbacksString, 1);
+
+    fileName = testport + "_0.nc";
+    netCDF->write(NDFilePathString, "");
+    netCDF->write(NDFileNameString, testport);
+    netCDF->write(NDFileTemplateString, "%s%s_%d.nc");
+    netCDF->write(NDFileNumberString, 0);
+    netCDF->write(NDAutoIncrementString, 0);
+    netCDF->write(NDFileWriteModeString, NDFileModeStream);
+
+    size_t tmpdims[] = {sizeX, sizeY};
+    std::vector<size_t> dims(tmpdims, tmpdims + 2);
+    arrays.resize(numFrames);
+    fillNDArraysFromPool(dims, NDInt16, arrays, arrayPool);
+    for (int i = 0; i < numFrames; i++) {
+      epicsInt16 *pData = (epicsInt16 *)arrays[i]->pData;
+      for (int j = 0; j < sizeX * sizeY; j++) {
+        pData[j] = pixelValue(i, j);
+      }
+      arrays[i]->uniqueId = i + 1;
+      epicsInt32 counter = i * 10;
+      epicsFloat64 temperature = 1.5 * i;
+      char label[attrStringSize];
+      epicsSnprintf(label, sizeof(label), "frame %d", i);
+      arrays[i]->pAttributeList->add("Counter", "", NDAttrInt32, &counter);
+      arrays[i]->pAttributeList->add("Temperature", "", NDAttrFloat64, &temperature);
+      arrays[i]->pAttributeList->add("Label", "", NDAttrString, label);
+      // Like a PV that is not connected, the attribute has no value
+      arrays[i]->pAttributeList->add("Disconnected", "", NDAttrUndefined, NULL);
+    }
+  }
+
+  ~NDFileNetCDFTestFixture()
+  {
+    netCDF.reset();
+    for (size_t i = 0; i < arrays.size(); i++) {
+      arrays[i]->release();
+    }
+    remove(fileName.c_str());
+    delete dummy_driver;
+  }
+
+  void process(NDArray *pArray)
+  {
+    netCDF->lock();
+    netCDF->processCallbacks(pArray);
+    netCDF->unlock();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileNetCDFTests, NDFileNetCDFTestFixture)
+
+// 7 frames with 3 buffered records: two full buffers, and one record that is written by closeFile
+BOOST_AUTO_TEST_CASE(test_BufferedRecords)
+{
+  netCDF->write(NDFileNetCDFBufferFramesString, 3);
+
+  // The file is opened with the last array the plugin received
+  process(arrays[0]);
+  netCDF->write(NDFileNumCaptureString, numFrames);
+  netCDF->write(NDFileCaptureString, 1);
+  for (int i = 0; i < numFrames; i++) {
+    process(arrays[i]);
+  }
+  BOOST_REQUIRE_EQUAL(netCDF->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_REQUIRE_EQUAL(netCDF->readInt(NDFileCaptureString), 0);
+  BOOST_REQUIRE_EQUAL(netCDF->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  int ncId, dimId, varId;
+  size_t numRecords = 0;
+  BOOST_REQUIRE_EQUAL(nc_open(fileName.c_str(), NC_NOWRITE, &ncId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_inq_unlimdim(ncId, &dimId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_inq_dimlen(ncId, dimId, &numRecords), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(numRecords, (size_t)numFrames);
+
+  std::vector<int> uniqueIds(numFrames);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "uniqueId", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_int(ncId, varId, &uniqueIds[0]), NC_NOERR);
+
+  std::vector<short> data(numFrames * sizeX * sizeY);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "array_data", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_short(ncId, varId, &data[0]), NC_NOERR);
+
+  std::vector<int> counters(numFrames);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Counter", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_int(ncId, varId, &counters[0]), NC_NOERR);
+
+  std::vector<double> temperatures(numFrames);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Temperature", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_double(ncId, varId, &temperatures[0]), NC_NOERR);
+
+  std::vector<char> labels(numFrames * attrStringSize);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Label", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_text(ncId, varId, &labels[0]), NC_NOERR);
+
+  std::vector<signed char> disconnected(numFrames, -1);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Disconnected", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_schar(ncId, varId, &disconnected[0]), NC_NOERR);
+  nc_close(ncId);
+
+  for (int i = 0; i < numFrames; i++) {
+    BOOST_CHECK_EQUAL(uniqueIds[i], i + 1);
+    int errors = 0;
+    for (int j = 0; j < sizeX * sizeY; j++) {
+      if (data[i * sizeX * sizeY + j] != pixelValue(i, j)) errors++;
+    }
+    BOOST_CHECK_EQUAL(errors, 0);
+    BOOST_CHECK_EQUAL(counters[i], i * 10);
+    BOOST_CHECK_EQUAL(temperatures[i], 1.5 * i);
+    char label[attrStringSize];
+    epicsSnprintf(label, sizeof(label), "frame %d", i);
+    BOOST_CHECK_EQUAL(std::string(&labels[i * attrStringSize]), std::string(label));
+    BOOST_CHECK_EQUAL(disconnected[i], 0);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,207 @@
+/*
+ * test_NDFileTIFF.cpp
+ *
+ * Tests of NDFileTIFF multi-frame files, written as BigTIFF or classic TIFF,
+ * with strips or tiles compressed by the plugin
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <NDAttribute.h>
+#include <asynDriver.h>
+#include <epicsStdio.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include <deque>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "asynPortDriver.h"
+#include "TIFFPluginWrapper.h"
+
+static NDArrayPool *arrayPool;
+
+static const int sizeX = 100;
+static const int sizeY = 70;
+static const int numFrames = 5;
+
+static epicsUInt16 pixelValue(int frame, int x, int y)
+{
+  return (epicsUInt16)(frame * 1000 + y * sizeX + x);
+}
+
+// Reads the image of the current directory, from strips or from tiles
+static bool readFrame(TIFF *tiff, std::vector<epicsUInt16>& image)
+{
+  epicsUInt32 width = 0, length = 0;
+
+  image.assign(sizeX * sizeY, 0);
+  if (TIFFIsTiled(tiff)) {
+    TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &width);
+    TIFFGetField(tiff, TIFFTAG_TILELENGTH, &length);
+    std::vector<epicsUInt16> tile(TIFFTileSize(tiff) / sizeof(epicsUInt16));
+    for (epicsUInt32 y0 = 0; y0 < (epicsUInt32)sizeY; y0 += length) {
+      for (epicsUInt32 x0 = 0; x0 < (epicsUInt32)sizeX; x0 += width) {
+        if (TIFFReadTile(tiff, &tile[0], x0, y0, 0, 0) < 0) return false;
+        for (epicsUInt32 y = y0; (y < y0 + length) && (y < (epicsUInt32)sizeY); y++) {
+          for (epicsUInt32 x = x0; (x < x0 + width) && (x < (epicsUInt32)sizeX); x++) {
+            image[y * sizeX + x] = tile[(y - y0) * width + (x - x0)];
+          }
+        }
+      }
+    }
+  } else {
+    for (int y = 0; y < sizeY; y++) {
+      if (TIFFReadScanline(tiff, &image[y * sizeX], y, 0) < 0) return false;
+    }
+  }
+  return true;
+}
+
+struct NDFileTIFFTestFixture
+{
+  asynNDArrayDriver* dummy_driver;
+  boost::shared_ptr<TIFFPluginWrapper> tiff;
+  std::string fileName;
+  std::vector<NDArray*> arrays;
+
+  NDFileTIFFTestFixture()
+  {
+    std::string dummy_port("simTIFFtest"), testport("TIFF");
+    uniqueAsynPortName(dummy_port);
+    uniqueAsynPortName(testport);
+
+    dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+    arrayPool = dummy_driver->pNDArrayPool;
+
+    tiff = boost::shared_ptr<TIFFPluginWrapper>(new TIFFPluginWrapper(testport, dummy_port));
+    tiff->start();
+    tiff->write(NDPluginDriverEnableCallbacksString, 1);
+    tiff->write(NDPluginDriverBlockingCallbacksString, 1);
+
+    fileName = testport + "_0.tif";
+    tiff->write(NDFilePathString, "");
+    tiff->write(NDFileNameString, testport);
+    tiff->write(NDFileTemplateString, "%s%s_%d.tif");
+    tiff->write(NDFileNumberString, 0);
+    tiff->write(NDAutoIncrementString, 0);
+    tiff->write(NDFileWriteModeString, NDFileModeStream);
+    tiff->write(NDFileTIFFMultiFrameString, 1);
+
+    size_t tmpdims[] = {sizeX, sizeY};
+    std::vector<size_t> dims(tmpdims, tmpdims + 2);
+    arrays.resize(numFrames);
+    fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+    for (int i = 0; i < numFrames; i++) {
+      epicsUInt16 *pData = (epicsUInt16 *)arrays[i]->pData;
+      for (int y = 0; y < sizeY; y++) {
+        for (int x = 0; x < sizeX; x++) {
+          pData[y * sizeX + x] = pixelValue(i, x, y);
+        }
+      }
+    }
+  }
+
+  ~NDFileTIFFTestFixture()
+  {
+    tiff.reset();
+    for (size_t i = 0; i < arrays.size(); i++) {
+      arrays[i]->release();
+    }
+    remove(fileName.c_str());
+    delete dummy_driver;
+  }
+
+  void process(NDArray *pArray)
+  {
+    tiff->lock();
+    tiff->processCallbacks(pArray);
+    tiff->unlock();
+  }
+
+  // Streams all the arrays to one file
+  void stream()
+  {
+    // The file is opened with the last array the plugin received
+    process(arrays[0]);
+    tiff->write(NDFileNumCaptureString, numFrames);
+    tiff->write(NDFileCaptureString, 1);
+    for (int i = 0; i < numFrames; i++) {
+      process(arrays[i]);
+    }
+    BOOST_REQUIRE_EQUAL(tiff->readInt(NDFileNumCapturedString), numFrames);
+    BOOST_REQUIRE_EQUAL(tiff->readInt(NDFileCaptureString), 0);
+    BOOST_REQUIRE_EQUAL(tiff->readInt(NDFileWriteStatusString), NDFileWriteOK);
+  }
+
+  // Checks that the file has one directory per array holding the data of that array
+  void checkFile(bool bigTIFF)
+  {
+    std::vector<epicsUInt16> image;
+    TIFF *pTiff = TIFFOpen(fileName.c_str(), "r");
+    BOOST_REQUIRE(pTiff != NULL);
+    BOOST_CHECK_EQUAL(TIFFIsBigTIFF(pTiff) != 0, bigTIFF);
+    BOOST_CHECK_EQUAL((int)TIFFNumberOfDirectories(pTiff), numFrames);
+    for (int i = 0; i < numFrames; i++) {
+      BOOST_REQUIRE(TIFFSetDirectory(pTiff, (tdir_t)i));
+      BOOST_REQUIRE(readFrame(pTiff, image));
+      int errors = 0;
+      for (int y = 0; y < sizeY; y++) {
+        for (int x = 0; x < sizeX; x++) {
+          if (image[y * sizeX + x] != pixelValue(i, x, y)) errors++;
+        }
+      }
+      BOOST_CHECK_EQUAL(errors, 0);
+    }
+    TIFFClose(pTiff);
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileTIFFTests, NDFileTIFFTestFixture)
+
+// Multi-frame files are BigTIFF by default
+BOOST_AUTO_TEST_CASE(test_MultiFrameBigTIFF)
+{
+  stream();
+  checkFile(true);
+}
+
+BOOST_AUTO_TEST_CASE(test_MultiFrameClassic)
+{
+  tiff->write(NDFileTIFFBigTIFFString, NDFileTIFFBigTIFFNo);
+  stream();
+  checkFile(false);
+}
+
+// Tiles at the edges of the image are only partly filled
+BOOST_AUTO_TEST_CASE(test_MultiFrameTilesDeflate)
+{
+  tiff->write(NDFileTIFFTileWidthString, 32);
+  tiff->write(NDFileTIFFTileLengthString, 32);
+  tiff->write(NDFileTIFFCompressionString, NDFileTIFFCompressDeflate);
+  tiff->write(NDFileTIFFNumThreadsString, 4);
+  stream();
+  checkFile(true);
+}
+
+// The last strip is short
+BOOST_AUTO_TEST_CASE(test_MultiFrameStripsDeflateBuffered)
+{
+  tiff->write(NDFileTIFFRowsPerStripString, 16);
+  tiff->write(NDFileTIFFCompressionString, NDFileTIFFCompressDeflate);
+  tiff->write(NDFileTIFFNumThreadsString, 3);
+  tiff->write(NDFileTIFFWriteBufferString, 65536);
+  stream();
+  checkFile(true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
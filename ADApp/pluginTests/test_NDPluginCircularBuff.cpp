@@ -183,4 +183,129 @@ BOOST_AUTO_TEST_CASE(test_PreBufferOrder)
     BOOST_CHECK_EQUAL(3, ((uint8_t *)ds->arrays[3]->pData)[0]);
 }
 
+BOOST_AUTO_TEST_CASE(test_ZeroCopyPreBuffer)
+{
+    size_t gotbytes;
+    int numReferenced, numCopied;
+    cbCalc->write("0", 2, &gotbytes);
+
+    asynInt32Client zeroCopy(cb->portName, 0, NDCircBuffZeroCopyString);
+    asynInt32Client cbNumReferenced(cb->portName, 0, NDCircBuffNumReferencedString);
+    asynInt32Client cbNumCopied(cb->portName, 0, NDCircBuffNumCopiedString);
+
+    size_t dims = 3;
+    NDArray *testArrays[4];
+    for (int i = 0; i < 4; i++) {
+        testArrays[i] = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+        memset(testArrays[i]->pData, i, 3);
+    }
+
+    // The source pool has no memory limit, so the ring holds references to the input arrays
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+    for (int i = 0; i < 4; i++) {
+        cbProcess(testArrays[i]);
+    }
+    cbNumReferenced.read(&numReferenced);
+    cbNumCopied.read(&numCopied);
+    BOOST_CHECK_EQUAL(numReferenced, 3);
+    BOOST_CHECK_EQUAL(numCopied, 0);
+
+    // Trigger the buffer flush, the downstream plugin gets the input arrays themselves
+    cbSoftTrigger->write(1);
+    cbProcess(testArrays[0]);
+    BOOST_REQUIRE_EQUAL((size_t)4, ds->arrays.size());
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(testArrays[i+1]->pData, ds->arrays[i]->pData);
+    }
+    cbNumReferenced.read(&numReferenced);
+    BOOST_CHECK_EQUAL(numReferenced, 0);
+
+    // With zero copy disabled the ring holds copies
+    zeroCopy.write(0);
+    cbControl->write(1);
+    for (int i = 0; i < 2; i++) {
+        cbProcess(testArrays[i]);
+    }
+    cbNumReferenced.read(&numReferenced);
+    cbNumCopied.read(&numCopied);
+    BOOST_CHECK_EQUAL(numReferenced, 0);
+    BOOST_CHECK_EQUAL(numCopied, 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_PixelTrigger)
+{
+    size_t gotbytes;
+    int triggered;
+    cbCalc->write("0", 2, &gotbytes);
+
+    asynInt32Client pixelTrigger(cb->portName, 0, NDCircBuffPixelTriggerString);
+    asynFloat64Client pixelThreshold(cb->portName, 0, NDCircBuffPixelThresholdString);
+    asynInt32Client pixelMinX(cb->portName, 0, NDCircBuffPixelMinXString);
+    asynInt32Client pixelSizeX(cb->portName, 0, NDCircBuffPixelSizeXString);
+    asynInt32Client cbTriggered(cb->portName, 0, NDCircBuffTriggeredString);
+
+    size_t dims[2] = {8,4};
+    NDArray *quietArray = arrayPool->alloc(2,dims,NDUInt16,0,NULL);
+    NDArray *brightArray = arrayPool->alloc(2,dims,NDUInt16,0,NULL);
+    memset(quietArray->pData, 0, quietArray->dataSize);
+    memset(brightArray->pData, 0, brightArray->dataSize);
+    // Pixel x=6, y=2 is above the threshold
+    ((epicsUInt16 *)brightArray->pData)[2*8 + 6] = 100;
+
+    pixelTrigger.write(1);
+    pixelThreshold.write(50.);
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    // The bright pixel is outside the region
+    pixelMinX.write(0);
+    pixelSizeX.write(4);
+    cbProcess(quietArray);
+    cbProcess(brightArray);
+    cbTriggered.read(&triggered);
+    BOOST_CHECK_EQUAL(triggered, 0);
+    BOOST_CHECK_EQUAL((size_t)0, ds->arrays.size());
+
+    // The bright pixel is inside the region
+    pixelMinX.write(4);
+    cbProcess(quietArray);
+    cbTriggered.read(&triggered);
+    BOOST_CHECK_EQUAL(triggered, 0);
+    cbProcess(brightArray);
+    cbTriggered.read(&triggered);
+    BOOST_CHECK_EQUAL(triggered, 1);
+    BOOST_CHECK_EQUAL((size_t)4, ds->arrays.size());
+}
+
+// The default trigger calculation is usable without TriggerCalc being written
+BOOST_AUTO_TEST_CASE(test_DefaultTriggerCalc)
+{
+    size_t gotbytes;
+    int eom;
+    int triggered;
+    char calc[50] = {0};
+
+    asynInt32Client cbTriggered(cb->portName, 0, NDCircBuffTriggeredString);
+    asynFloat64Client cbCalcVal(cb->portName, 0, NDCircBuffTriggerCalcValString);
+
+    cbCalc->read(calc, 50, &gotbytes, &eom);
+    BOOST_CHECK_EQUAL(calc, "0");
+
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    size_t dims[2] = {2,5};
+    NDArray *testArray = arrayPool->alloc(2,dims,NDFloat64,0,NULL);
+    for (int i = 0; i < 5; i++)
+        cbProcess(testArray);
+
+    double calcVal = -1.;
+    cbCalcVal.read(&calcVal);
+    cbTriggered.read(&triggered);
+    BOOST_CHECK_EQUAL(calcVal, 0.);
+    BOOST_CHECK_EQUAL(triggered, 0);
+    BOOST_CHECK_EQUAL((size_t)0, ds->arrays.size());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
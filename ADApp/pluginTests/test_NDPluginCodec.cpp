@@ -0,0 +1,284 @@
+/*
+ * test_NDPluginCodec.cpp
+ *
+ * Round trip tests of the zstd, LZ4 and Bitshuffle codecs, on whole arrays and in chunks,
+ * and of the direct chunk writes of chunked arrays by NDFileHDF5
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+#include <NDPluginCodec.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include "testingutilities.h"
+#ifdef HAVE_HDF5
+#include "HDF5PluginWrapper.h"
+#include "HDF5FileReader.h"
+#endif
+
+using namespace std;
+
+static const int sizeX = 64;
+static const int sizeY = 48;
+
+struct NDPluginCodecFixture
+{
+  asynNDArrayDriver *dummy_driver;
+  std::string dummy_port;
+  NDArray *pInput;
+  char errorMessage[256];
+
+  NDPluginCodecFixture()
+  {
+    dummy_port = "simCodecTest";
+    uniqueAsynPortName(dummy_port);
+    dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+
+    size_t dims[] = {sizeX, sizeY};
+    pInput = dummy_driver->pNDArrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pInput->pData;
+    for (int y = 0; y < sizeY; y++) {
+      for (int x = 0; x < sizeX; x++) {
+        pData[y * sizeX + x] = (epicsUInt16)((x + y) % 50);
+      }
+    }
+    errorMessage[0] = '\0';
+  }
+
+  ~NDPluginCodecFixture()
+  {
+    pInput->release();
+    delete dummy_driver;
+  }
+
+  // Checks that the compressed array is smaller and records its codec
+  void checkCompressed(NDArray *pCompressed, NDCodecStatus_t status, NDCodecCompressor_t codec,
+                       int level, size_t chunkRows)
+  {
+    NDArrayInfo_t info;
+
+    BOOST_REQUIRE_MESSAGE(pCompressed != NULL, errorMessage);
+    BOOST_CHECK_EQUAL(status, NDCODEC_SUCCESS);
+    pInput->getInfo(&info);
+    BOOST_CHECK_EQUAL(pCompressed->codec.name, codecName[codec]);
+    BOOST_CHECK_EQUAL(pCompressed->codec.level, level);
+    BOOST_CHECK_EQUAL(pCompressed->codec.chunkRows, chunkRows);
+    BOOST_CHECK_LT(pCompressed->compressedSize, info.totalBytes);
+  }
+
+  // Checks that the decompressed array is the input array
+  void checkDecompressed(NDArray *pOutput, NDCodecStatus_t status)
+  {
+    NDArrayInfo_t info;
+
+    BOOST_REQUIRE_MESSAGE(pOutput != NULL, errorMessage);
+    BOOST_CHECK_EQUAL(status, NDCODEC_SUCCESS);
+    BOOST_CHECK(pOutput->codec.empty());
+    BOOST_REQUIRE_EQUAL(pOutput->ndims, 2);
+    BOOST_CHECK_EQUAL(pOutput->dims[0].size, (size_t)sizeX);
+    BOOST_CHECK_EQUAL(pOutput->dims[1].size, (size_t)sizeY);
+    BOOST_CHECK_EQUAL(pOutput->dataType, NDUInt16);
+    pInput->getInfo(&info);
+    BOOST_CHECK_EQUAL(memcmp(pOutput->pData, pInput->pData, info.totalBytes), 0);
+  }
+
+  // Checks the number of chunks, and the uncompressed size in the HDF5 filter header
+  // that the codec writes at the end of the header room in front of each chunk
+  void checkChunks(NDArray *pCompressed, size_t chunkRows)
+  {
+    size_t numChunks = (sizeY + chunkRows - 1) / chunkRows;
+    size_t chunkBytes = sizeX * sizeof(epicsUInt16) * chunkRows;
+    size_t headerSize = filterHeaderSize(pCompressed->codec.name);
+    const unsigned char *pChunk = (const unsigned char *)pCompressed->pData;
+    size_t compressedSize = 0;
+
+    BOOST_REQUIRE_EQUAL(pCompressed->codec.chunkSizes.size(), numChunks);
+    BOOST_REQUIRE_GE(pCompressed->codec.headerRoom, headerSize);
+    for (size_t i = 0; i < numChunks; i++) {
+      pChunk += pCompressed->codec.headerRoom;
+      epicsUInt64 uncompressedSize = 0;
+      for (size_t j = 0; j < headerSize && j < 8; j++) {
+        uncompressedSize = (uncompressedSize << 8) | (pChunk - headerSize)[j];
+      }
+      if (headerSize > 0) BOOST_CHECK_EQUAL(uncompressedSize, chunkBytes);
+      pChunk += pCompressed->codec.chunkSizes[i];
+      compressedSize += pCompressed->codec.headerRoom + pCompressed->codec.chunkSizes[i];
+    }
+    BOOST_CHECK_EQUAL(pCompressed->compressedSize, compressedSize);
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginCodecTests, NDPluginCodecFixture)
+
+BOOST_AUTO_TEST_CASE(test_ZstdRoundTrip)
+{
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pCompressed = compressZstd(pInput, 3, 1, &status, errorMessage);
+  checkCompressed(pCompressed, status, NDCODEC_ZSTD, 3, 0);
+
+  NDArray *pOutput = decompressZstd(pCompressed, &status, errorMessage);
+  checkDecompressed(pOutput, status);
+
+  pOutput->release();
+  pCompressed->release();
+}
+
+// The last chunk is short
+BOOST_AUTO_TEST_CASE(test_ZstdChunkedRoundTrip)
+{
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pCompressed = compressZstd(pInput, 22, 1, &status, errorMessage, 10, 4);
+  checkCompressed(pCompressed, status, NDCODEC_ZSTD, 22, 10);
+
+  NDArray *pOutput = decompressZstd(pCompressed, &status, errorMessage);
+  checkDecompressed(pOutput, status);
+
+  pOutput->release();
+  pCompressed->release();
+}
+
+// Fewer chunks than threads: the extra threads must not take a chunk
+BOOST_AUTO_TEST_CASE(test_ZstdMoreThreadsThanChunks)
+{
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pCompressed = compressZstd(pInput, 3, 1, &status, errorMessage, 30, 16);
+  checkCompressed(pCompressed, status, NDCODEC_ZSTD, 3, 30);
+  checkChunks(pCompressed, 30);
+
+  NDArray *pOutput = decompressZstd(pCompressed, &status, errorMessage);
+  checkDecompressed(pOutput, status);
+
+  pOutput->release();
+  pCompressed->release();
+}
+
+#ifdef HAVE_BITSHUFFLE
+
+// 7 rows do not divide the 48 rows, the last chunk has 6 rows and is padded
+BOOST_AUTO_TEST_CASE(test_LZ4ChunkRowsNotDividing)
+{
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pCompressed = compressLZ4(pInput, &status, errorMessage, 7, 3);
+  checkCompressed(pCompressed, status, NDCODEC_LZ4, -1, 7);
+  checkChunks(pCompressed, 7);
+
+  NDArray *pOutput = decompressLZ4(pCompressed, &status, errorMessage);
+  checkDecompressed(pOutput, status);
+
+  pOutput->release();
+  pCompressed->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_BSLZ4MoreThreadsThanChunks)
+{
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pCompressed = compressBSLZ4(pInput, &status, errorMessage, 24, 8);
+  checkCompressed(pCompressed, status, NDCODEC_BSLZ4, -1, 24);
+  checkChunks(pCompressed, 24);
+
+  NDArray *pOutput = decompressBSLZ4(pCompressed, &status, errorMessage);
+  checkDecompressed(pOutput, status);
+
+  pOutput->release();
+  pCompressed->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_BSZstdRoundTrip)
+{
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pCompressed = compressBSZstd(pInput, 3, &status, errorMessage);
+  checkCompressed(pCompressed, status, NDCODEC_BSZSTD, 3, 0);
+
+  NDArray *pOutput = decompressBSZstd(pCompressed, &status, errorMessage);
+  checkDecompressed(pOutput, status);
+
+  pOutput->release();
+  pCompressed->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_BSZstdChunkedRoundTrip)
+{
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pCompressed = compressBSZstd(pInput, 1, &status, errorMessage, 10, 4);
+  checkCompressed(pCompressed, status, NDCODEC_BSZSTD, 1, 10);
+
+  NDArray *pOutput = decompressBSZstd(pCompressed, &status, errorMessage);
+  checkDecompressed(pOutput, status);
+
+  pOutput->release();
+  pCompressed->release();
+}
+
+#endif
+
+#ifdef HAVE_HDF5
+
+// NDFileHDF5 writes each chunk of a chunked array with a direct chunk write;
+// the dataset is read back through the HDF5 zstd filter
+BOOST_AUTO_TEST_CASE(test_ZstdChunkedHDF5)
+{
+  const H5Z_filter_t filterZstd = 32015;
+  if (H5Zfilter_avail(filterZstd) <= 0)
+  {
+    BOOST_TEST_MESSAGE("The HDF5 zstd filter is not available");
+    return;
+  }
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  NDArray *pCompressed = compressZstd(pInput, 3, 1, &status, errorMessage, 10, 4);
+  checkCompressed(pCompressed, status, NDCODEC_ZSTD, 3, 10);
+  checkChunks(pCompressed, 10);
+
+  std::string testport("HDF5Codec");
+  uniqueAsynPortName(testport);
+  {
+    HDF5PluginWrapper hdf5(testport, 50, 1, dummy_port, 0, 0, 2000000);
+    hdf5.start();
+    hdf5.write(NDPluginDriverEnableCallbacksString, 1);
+    hdf5.write(NDPluginDriverBlockingCallbacksString, 1);
+    hdf5.write(NDFileWriteModeString, NDFileModeStream);
+    hdf5.write(NDFilePathString, "");
+    hdf5.write(NDFileNameString, "codec_chunked");
+    hdf5.write(NDFileTemplateString, "%s%s_%d.h5");
+    hdf5.write(NDFileNumberString, 0);
+    hdf5.write(NDAutoIncrementString, 0);
+
+    hdf5.lock();
+    hdf5.processCallbacks(pCompressed);
+    hdf5.unlock();
+    hdf5.write(NDFileNumCaptureString, 1);
+    hdf5.write(NDFileCaptureString, 1);
+    hdf5.lock();
+    hdf5.processCallbacks(pCompressed);
+    hdf5.unlock();
+    BOOST_REQUIRE_EQUAL(hdf5.readInt(NDFileNumCapturedString), 1);
+    BOOST_REQUIRE_EQUAL(hdf5.readInt(NDFileWriteStatusString), (int)NDFileWriteOK);
+  }
+
+  std::vector<epicsUInt16> data(sizeX * sizeY);
+  {
+    HDF5FileReader fr("codec_chunked_0.h5");
+    BOOST_REQUIRE(fr.readDataset("/entry/data/data", H5T_NATIVE_UINT16, &data[0]));
+  }
+  BOOST_CHECK_EQUAL(memcmp(&data[0], pInput->pData, data.size() * sizeof(epicsUInt16)), 0);
+  remove("codec_chunked_0.h5");
+  pCompressed->release();
+}
+
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -256,4 +256,96 @@ BOOST_AUTO_TEST_CASE(basic_overlay_operation)
 }
 
 
+BOOST_AUTO_TEST_CASE(in_place_operation)
+{
+  // Use the "normal" cross, centered on pixel (525, 525)
+  overlayTestCaseStr *pStr = &overlayTestCaseStrs[0];
+  NDArray *pArray = pStr->pArrays[0];
+  size_t center = 525*pStr->arrayDims[0] + 525;
+
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayUseString,       1,               pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayPositionXString, pStr->positionX, pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayPositionYString, pStr->positionY, pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlaySizeXString,     pStr->sizeX,     pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlaySizeYString,     pStr->sizeY,     pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayWidthXString,    pStr->widthX,    pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayWidthYString,    pStr->widthY,    pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayShapeString,     pStr->shape,     pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayDrawModeString,  pStr->drawMode,  pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayGreenString,     pStr->green,     pStr->overlayNum));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDArrayCallbacksString, 1));
+
+  // In Copy mode the input array is not modified
+  Overlay->lock();
+  BOOST_CHECK_NO_THROW(Overlay->processCallbacks(pArray));
+  Overlay->unlock();
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), 1);
+  BOOST_CHECK(downstream_plugin->arrays[0] != pArray);
+  BOOST_CHECK_EQUAL(((epicsFloat32 *)downstream_plugin->arrays[0]->pData)[center], pStr->green);
+  BOOST_CHECK_EQUAL(((epicsFloat32 *)pArray->pData)[center], 0);
+
+  // In In place mode the overlay is drawn into the input array, which is passed downstream
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayInPlaceString, 1));
+  Overlay->lock();
+  BOOST_CHECK_NO_THROW(Overlay->processCallbacks(pArray));
+  Overlay->unlock();
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), 2);
+  BOOST_CHECK(downstream_plugin->arrays[1] == pArray);
+  BOOST_CHECK_EQUAL(((epicsFloat32 *)pArray->pData)[center], pStr->green);
+}
+
+
+// Counts the pixels that are set in a rectangle of a mono NDFloat32 array
+static int countPixels(NDArray *pArray, int xmin, int ymin, int sizeX, int sizeY)
+{
+  epicsFloat32 *pData = (epicsFloat32 *)pArray->pData;
+  size_t nx = pArray->dims[0].size;
+  int count = 0;
+  for (int iy=ymin; iy<ymin+sizeY; iy++) {
+    for (int ix=xmin; ix<xmin+sizeX; ix++) {
+      if (pData[iy*nx + ix] != 0) count++;
+    }
+  }
+  return count;
+}
+
+BOOST_AUTO_TEST_CASE(text_fonts)
+{
+  // The fonts have the characters 32-126 and 160-255; 127-159 are skipped but take up a cell
+  const int fontWidth[]  = {6, 6, 9, 9};
+  const int fontHeight[] = {13, 13, 15, 15};
+  const int xpos = 100, ypos = 100;
+  overlayTestCaseStr *pStr = &overlayTestCaseStrs[0];
+  size_t numArrays = 0;
+
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayUseString,       1));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayPositionXString, xpos));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayPositionYString, ypos));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlaySizeXString,     400));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlaySizeYString,     40));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayShapeString,     NDOverlayText));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayDrawModeString,  NDOverlaySet));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayGreenString,     255));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayDisplayTextString, std::string("A\x7f\xe9\xff")));
+  BOOST_CHECK_NO_THROW(Overlay->write(NDArrayCallbacksString, 1));
+
+  for (int font=0; font<4; font++) {
+    BOOST_MESSAGE("Font " << font);
+    BOOST_CHECK_NO_THROW(Overlay->write(NDPluginOverlayFontString, font));
+    Overlay->lock();
+    BOOST_CHECK_NO_THROW(Overlay->processCallbacks(pStr->pArrays[0]));
+    Overlay->unlock();
+    numArrays++;
+    BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), numArrays);
+    NDArray *pOut = downstream_plugin->arrays.back();
+    int w = fontWidth[font], h = fontHeight[font];
+    BOOST_CHECK(countPixels(pOut, xpos,     ypos, w, h) > 0);    // 'A'
+    BOOST_CHECK_EQUAL(countPixels(pOut, xpos+w, ypos, w, h), 0); // 127 is not in the font
+    BOOST_CHECK(countPixels(pOut, xpos+2*w, ypos, w, h) > 0);    // e acute
+    BOOST_CHECK(countPixels(pOut, xpos+3*w, ypos, w, h) > 0);    // y diaeresis, the last glyph
+    // Nothing is drawn after the text
+    BOOST_CHECK_EQUAL(countPixels(pOut, xpos+4*w, ypos, 400-4*w, 40), 0);
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END() // Done!
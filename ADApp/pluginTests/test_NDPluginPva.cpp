@@ -0,0 +1,196 @@
+/*
+ * test_NDPluginPva.cpp
+ *
+ * Tests of the arrays that the derived channels of NDPluginPva publish,
+ * and of their decimation. These need no pvAccess client.
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include "testingutilities.h"
+#include "PvaPluginWrapper.h"
+
+using namespace std;
+
+// An odd width, so that binning drops the last column
+static const size_t sizeX = 5;
+static const size_t sizeY = 4;
+static const size_t nPixels = sizeX * sizeY;
+
+struct NDPluginPvaFixture
+{
+    asynNDArrayDriver *dummy_driver;
+    NDArrayPool *arrayPool;
+    boost::shared_ptr<PvaPluginWrapper> pva;
+
+    NDPluginPvaFixture()
+    {
+        std::string dummy_port("simPva"), testport("Pva");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        arrayPool = dummy_driver->pNDArrayPool;
+
+        pva = boost::shared_ptr<PvaPluginWrapper>(new PvaPluginWrapper(testport, dummy_port, 2));
+    }
+
+    ~NDPluginPvaFixture()
+    {
+        pva.reset();
+        delete dummy_driver;
+    }
+
+    // Pixel (x, y) is 4*x + 40*y, so the average of each 2x2 block is an integer
+    NDArray *allocArray()
+    {
+        size_t dims[2] = {sizeX, sizeY};
+        NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+
+        for (size_t y = 0; y < sizeY; y++) {
+            for (size_t x = 0; x < sizeX; x++) {
+                pData[y * sizeX + x] = (epicsUInt16)(4 * x + 40 * y);
+            }
+        }
+        pArray->uniqueId = 7;
+        return pArray;
+    }
+
+    static double binnedValue(size_t x, size_t y)
+    {
+        return 4. * (2 * x + 0.5) + 40. * (2 * y + 0.5);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginPvaTests, NDPluginPvaFixture)
+
+// Binning averages the pixels of each block in Float64; a native channel converts back to the input type
+BOOST_AUTO_TEST_CASE(test_BinningAverage)
+{
+    NDArray *pArray = allocArray();
+    NDArray *pBinned = pva->binArray(pArray, 2);
+
+    BOOST_REQUIRE(pBinned != NULL);
+    BOOST_CHECK_EQUAL(pBinned->dataType, NDFloat64);
+    BOOST_REQUIRE_EQUAL(pBinned->ndims, 2);
+    BOOST_REQUIRE_EQUAL(pBinned->dims[0].size, sizeX / 2);
+    BOOST_REQUIRE_EQUAL(pBinned->dims[1].size, sizeY / 2);
+    epicsFloat64 *pBinnedData = (epicsFloat64 *)pBinned->pData;
+    for (size_t y = 0; y < sizeY / 2; y++) {
+        for (size_t x = 0; x < sizeX / 2; x++) {
+            BOOST_CHECK_CLOSE(pBinnedData[y * (sizeX / 2) + x], binnedValue(x, y), 1e-9);
+        }
+    }
+    pBinned->release();
+
+    NDArray *pOut = pva->deriveArray(pArray, 2, NDPvaChannelNative, 50);
+    BOOST_REQUIRE(pOut != NULL);
+    BOOST_CHECK_EQUAL(pOut->dataType, NDUInt16);
+    BOOST_REQUIRE_EQUAL(pOut->dims[0].size, sizeX / 2);
+    BOOST_REQUIRE_EQUAL(pOut->dims[1].size, sizeY / 2);
+    epicsUInt16 *pOutData = (epicsUInt16 *)pOut->pData;
+    for (size_t y = 0; y < sizeY / 2; y++) {
+        for (size_t x = 0; x < sizeX / 2; x++) {
+            BOOST_CHECK_EQUAL(pOutData[y * (sizeX / 2) + x], (epicsUInt16)binnedValue(x, y));
+        }
+    }
+    pOut->release();
+
+    // A binning larger than the array is refused
+    BOOST_CHECK(pva->binArray(pArray, sizeX + 1) == NULL);
+    pArray->release();
+}
+
+// 8-bit mode scales each array between its own minimum and maximum
+BOOST_AUTO_TEST_CASE(test_Scale8Bit)
+{
+    size_t dims[2] = {sizeX, sizeY};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDInt16, 0, NULL);
+    epicsInt16 *pData = (epicsInt16 *)pArray->pData;
+
+    for (size_t i = 0; i < nPixels; i++) pData[i] = 27;
+    pData[3] = -100;
+    pData[11] = 155;
+
+    NDArray *pOut = pva->deriveArray(pArray, 1, NDPvaChannel8Bit, 50);
+    BOOST_REQUIRE(pOut != NULL);
+    BOOST_CHECK_EQUAL(pOut->dataType, NDUInt8);
+    BOOST_REQUIRE_EQUAL(pOut->dims[0].size, sizeX);
+    BOOST_REQUIRE_EQUAL(pOut->dims[1].size, sizeY);
+    epicsUInt8 *pOutData = (epicsUInt8 *)pOut->pData;
+    BOOST_CHECK_EQUAL(pOutData[3], 0);
+    BOOST_CHECK_EQUAL(pOutData[11], 255);
+    BOOST_CHECK_EQUAL(pOutData[0], 127);
+    pOut->release();
+
+    // A constant array is all 0
+    for (size_t i = 0; i < nPixels; i++) pData[i] = 1000;
+    pOut = pva->scaleArray(pArray);
+    BOOST_REQUIRE(pOut != NULL);
+    pOutData = (epicsUInt8 *)pOut->pData;
+    int errors = 0;
+    for (size_t i = 0; i < nPixels; i++) {
+        if (pOutData[i] != 0) errors++;
+    }
+    BOOST_CHECK_EQUAL(errors, 0);
+    pOut->release();
+    pArray->release();
+}
+
+// A channel publishes every Nth array, and starts again when it is disabled or loses its clients
+BOOST_AUTO_TEST_CASE(test_Decimation)
+{
+    for (int i = 0; i < 7; i++) {
+        BOOST_CHECK_EQUAL(pva->channelDue(0, 1, 3, 1), (i % 3) == 0);
+    }
+    // The other channel counts on its own
+    BOOST_CHECK(pva->channelDue(1, 1, 3, 1));
+    BOOST_CHECK(!pva->channelDue(1, 1, 3, 1));
+
+    // Channel 0 is at the second array of its cycle; without clients it starts again
+    BOOST_CHECK(!pva->channelDue(0, 1, 3, 0));
+    BOOST_CHECK(pva->channelDue(0, 1, 3, 1));
+    BOOST_CHECK(!pva->channelDue(0, 1, 3, 1));
+    BOOST_CHECK(!pva->channelDue(0, 0, 3, 1));
+    BOOST_CHECK(pva->channelDue(0, 1, 3, 1));
+
+    // A decimation below 1 publishes every array
+    BOOST_CHECK(!pva->channelDue(1, 0, 0, 1));
+    BOOST_CHECK(pva->channelDue(1, 1, 0, 1));
+    BOOST_CHECK(pva->channelDue(1, 1, 0, 1));
+}
+
+// Compressed arrays are only passed on unchanged by a native channel without binning
+BOOST_AUTO_TEST_CASE(test_CompressedPassThrough)
+{
+    NDArray *pArray = allocArray();
+    pArray->codec.name = codecName[NDCODEC_LZ4];
+    pArray->compressedSize = 10;
+
+    NDArray *pOut = pva->deriveArray(pArray, 1, NDPvaChannelNative, 50);
+    BOOST_CHECK(pOut == pArray);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 2);
+    if (pOut) pOut->release();
+
+    BOOST_CHECK(pva->deriveArray(pArray, 2, NDPvaChannelNative, 50) == NULL);
+    BOOST_CHECK(pva->deriveArray(pArray, 1, NDPvaChannel8Bit, 50) == NULL);
+    BOOST_CHECK(pva->deriveArray(pArray, 1, NDPvaChannelJPEG, 50) == NULL);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 1);
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,221 @@
+/*
+ * test_NDPluginShm.cpp
+ *
+ * Tests of the frames that NDPluginShm publishes, read back with NDShmReader
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginShm.h>
+#include <NDShmReader.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <epicsStdio.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+static const size_t sizeX = 16;
+static const size_t sizeY = 8;
+static const size_t nPixels = sizeX * sizeY;
+static const int numSlots = 4;
+static const size_t slotSize = 64*1024;
+
+struct NDPluginShmFixture
+{
+    asynNDArrayDriver *dummy_driver;
+    NDArrayPool *arrayPool;
+    NDPluginShm *shm;
+    std::string shmName;
+    NDShmReader reader;
+
+    NDPluginShmFixture()
+    {
+        std::string dummy_port("simShm"), testport("Shm");
+        char name[256];
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        arrayPool = dummy_driver->pNDArrayPool;
+
+        // Test runs in other processes must not share the segment
+        epicsSnprintf(name, sizeof(name), "/%s_%d", testport.c_str(), (int)getpid());
+        shmName = name;
+        shm = new NDPluginShm(testport.c_str(), 50, 1, dummy_port.c_str(), 0, shmName.c_str(),
+                              numSlots, slotSize, 0, 0, 0, 0);
+        BOOST_REQUIRE_EQUAL(reader.open(shmName.c_str()), 0);
+    }
+
+    ~NDPluginShmFixture()
+    {
+        reader.close();
+        delete shm;
+        delete dummy_driver;
+    }
+
+    void process(NDArray *pArray)
+    {
+        shm->lock();
+        shm->processCallbacks(pArray);
+        shm->unlock();
+    }
+
+    NDArray *allocArray(int frame)
+    {
+        size_t dims[2] = {sizeX, sizeY};
+        NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+        epicsInt32 counter = frame * 10;
+        char label[64];
+
+        for (size_t i = 0; i < nPixels; i++) pData[i] = (epicsUInt16)(frame * 1000 + i);
+        pArray->uniqueId = frame;
+        epicsSnprintf(label, sizeof(label), "frame %d", frame);
+        pArray->pAttributeList->add("Counter", "Frame counter", NDAttrInt32, &counter);
+        pArray->pAttributeList->add("Label", "", NDAttrString, label);
+        return pArray;
+    }
+
+    // Publishes frames first..last-1
+    void publish(int first, int last)
+    {
+        for (int i = first; i < last; i++) {
+            NDArray *pArray = allocArray(i);
+            process(pArray);
+            pArray->release();
+        }
+    }
+
+    void checkFrame(const NDShmFrame &frame, int number)
+    {
+        const NDShmAttribute_t *pAttr;
+        char label[64];
+        int errors = 0;
+
+        BOOST_CHECK_EQUAL(frame.slot.uniqueId, number);
+        BOOST_CHECK_EQUAL(frame.slot.dataType, NDUInt16);
+        BOOST_REQUIRE_EQUAL(frame.slot.ndims, 2);
+        BOOST_CHECK_EQUAL(frame.slot.dims[0].size, sizeX);
+        BOOST_CHECK_EQUAL(frame.slot.dims[1].size, sizeY);
+        BOOST_CHECK_EQUAL(frame.slot.codec[0], 0);
+        BOOST_REQUIRE_EQUAL(frame.slot.dataSize, nPixels * sizeof(epicsUInt16));
+        const epicsUInt16 *pData = (const epicsUInt16 *)frame.pData;
+        for (size_t i = 0; i < nPixels; i++) {
+            if (pData[i] != (epicsUInt16)(number * 1000 + i)) errors++;
+        }
+        BOOST_CHECK_EQUAL(errors, 0);
+
+        BOOST_CHECK_EQUAL(frame.slot.numAttributes, 2);
+        pAttr = frame.findAttribute("Counter");
+        BOOST_REQUIRE(pAttr != NULL);
+        BOOST_CHECK_EQUAL(pAttr->dataType, NDAttrInt32);
+        BOOST_CHECK_EQUAL(std::string(NDShmFrame::attributeDescription(pAttr)), "Frame counter");
+        BOOST_REQUIRE_EQUAL(pAttr->valueSize, sizeof(epicsInt32));
+        BOOST_CHECK_EQUAL(*(const epicsInt32 *)NDShmFrame::attributeValue(pAttr), number * 10);
+        pAttr = frame.findAttribute("Label");
+        BOOST_REQUIRE(pAttr != NULL);
+        BOOST_CHECK_EQUAL(pAttr->dataType, NDAttrString);
+        epicsSnprintf(label, sizeof(label), "frame %d", number);
+        BOOST_CHECK_EQUAL(std::string((const char *)NDShmFrame::attributeValue(pAttr)), std::string(label));
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginShmTests, NDPluginShmFixture)
+
+// The reader gets every frame, with the data, dimensions and attributes of the array
+BOOST_AUTO_TEST_CASE(test_Frames)
+{
+    NDShmFrame frame;
+
+    BOOST_CHECK_EQUAL(reader.next(&frame), NDSHM_READ_NONE);
+    publish(0, numSlots - 1);
+    for (int i = 0; i < numSlots - 1; i++) {
+        BOOST_REQUIRE_EQUAL(reader.next(&frame), NDSHM_READ_OK);
+        checkFrame(frame, i);
+        BOOST_CHECK(reader.valid(&frame));
+    }
+    BOOST_CHECK_EQUAL(reader.next(&frame), NDSHM_READ_NONE);
+    BOOST_CHECK_EQUAL(reader.missed(), 0u);
+    BOOST_CHECK_EQUAL(reader.header()->writeCount, (uint64_t)(numSlots - 1));
+}
+
+// When the writer overruns the ring the reader skips to the oldest frame left and counts the others
+BOOST_AUTO_TEST_CASE(test_Overrun)
+{
+    NDShmFrame frame;
+    int numFrames = 3 * numSlots + 1;
+
+    publish(0, numFrames);
+    for (int i = numFrames - numSlots; i < numFrames; i++) {
+        BOOST_REQUIRE_EQUAL(reader.next(&frame), NDSHM_READ_OK);
+        checkFrame(frame, i);
+    }
+    BOOST_CHECK_EQUAL(reader.next(&frame), NDSHM_READ_NONE);
+    BOOST_CHECK_EQUAL(reader.missed(), (uint64_t)(numFrames - numSlots));
+}
+
+// A frame that is still used when the writer comes round the ring again is no longer valid
+BOOST_AUTO_TEST_CASE(test_Overwritten)
+{
+    NDShmFrame frame;
+
+    publish(0, 1);
+    BOOST_REQUIRE_EQUAL(reader.next(&frame), NDSHM_READ_OK);
+    checkFrame(frame, 0);
+    publish(1, numSlots);
+    BOOST_CHECK(reader.valid(&frame));
+    publish(numSlots, numSlots + 1);
+    BOOST_CHECK(!reader.valid(&frame));
+}
+
+// Compressed arrays are published without the header room that NDPluginCodec reserves
+BOOST_AUTO_TEST_CASE(test_CompressedHeaderRoom)
+{
+    static const size_t headerRoom = 16;
+    static const size_t compressedBytes = 100;
+    NDShmFrame frame;
+    NDArray *pArray = allocArray(0);
+    unsigned char *pData = (unsigned char *)pArray->pData;
+
+    memset(pData, 0xff, headerRoom);
+    for (size_t i = 0; i < compressedBytes; i++) pData[headerRoom + i] = (unsigned char)i;
+    pArray->codec.name = codecName[NDCODEC_LZ4];
+    pArray->codec.headerRoom = headerRoom;
+    pArray->compressedSize = headerRoom + compressedBytes;
+    process(pArray);
+    pArray->release();
+
+    BOOST_REQUIRE_EQUAL(reader.next(&frame), NDSHM_READ_OK);
+    BOOST_CHECK_EQUAL(std::string(frame.slot.codec), std::string(codecName[NDCODEC_LZ4]));
+    BOOST_REQUIRE_EQUAL(frame.slot.dataSize, compressedBytes);
+    BOOST_CHECK_EQUAL(memcmp(frame.pData, pData + headerRoom, compressedBytes), 0);
+}
+
+// Arrays compressed in chunks are refused
+BOOST_AUTO_TEST_CASE(test_ChunkedRefused)
+{
+    NDShmFrame frame;
+    NDArray *pArray = allocArray(0);
+
+    pArray->codec.name = codecName[NDCODEC_LZ4];
+    pArray->codec.chunkRows = 2;
+    pArray->codec.headerRoom = 16;
+    pArray->compressedSize = 200;
+    process(pArray);
+    pArray->release();
+
+    BOOST_CHECK_EQUAL(reader.header()->writeCount, 0u);
+    BOOST_CHECK_EQUAL(reader.next(&frame), NDSHM_READ_NONE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
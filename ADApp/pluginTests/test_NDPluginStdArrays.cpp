@@ -0,0 +1,189 @@
+/*
+ * test_NDPluginStdArrays.cpp
+ *
+ * Tests of the data that NDPluginStdArrays passes to its waveform clients,
+ * through the interrupt callbacks and through read()
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginStdArrays.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+static const size_t sizeX = 8;
+static const size_t sizeY = 4;
+static const size_t nPixels = sizeX * sizeY;
+
+// The last data each client received from the interrupt callbacks
+static std::vector<epicsInt16> int16Data;
+static std::vector<epicsFloat64> float64Data;
+static int int16Callbacks;
+
+static void int16Interrupt(void *userPvt, asynUser *pasynUser, epicsInt16 *data, size_t nelms)
+{
+    int16Data.assign(data, data + nelms);
+    int16Callbacks++;
+}
+
+static void float64Interrupt(void *userPvt, asynUser *pasynUser, epicsFloat64 *data, size_t nelms)
+{
+    float64Data.assign(data, data + nelms);
+}
+
+struct NDPluginStdArraysFixture
+{
+    asynNDArrayDriver *dummy_driver;
+    NDArrayPool *arrayPool;
+    NDPluginStdArrays *stdArrays;
+    asynInt16ArrayClient *int16Client;
+    asynFloat64ArrayClient *float64Client;
+
+    NDPluginStdArraysFixture()
+    {
+        std::string dummy_port("simStdArrays"), testport("StdArrays");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        arrayPool = dummy_driver->pNDArrayPool;
+
+        stdArrays = new NDPluginStdArrays(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 0, 0, 0);
+
+        int16Data.clear();
+        float64Data.clear();
+        int16Callbacks = 0;
+        int16Client = new asynInt16ArrayClient(testport.c_str(), 0, NDPluginStdArraysDataString);
+        int16Client->registerInterruptUser(int16Interrupt);
+        float64Client = new asynFloat64ArrayClient(testport.c_str(), 0, NDPluginStdArraysDataString);
+        float64Client->registerInterruptUser(float64Interrupt);
+    }
+
+    ~NDPluginStdArraysFixture()
+    {
+        delete float64Client;
+        delete int16Client;
+        delete stdArrays;
+        delete dummy_driver;
+    }
+
+    void process(NDArray *pArray)
+    {
+        stdArrays->lock();
+        stdArrays->processCallbacks(pArray);
+        stdArrays->unlock();
+    }
+
+    NDArray *allocArray(NDDataType_t dataType)
+    {
+        size_t dims[2] = {sizeX, sizeY};
+        return arrayPool->alloc(2, dims, dataType, 0, NULL);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginStdArraysTests, NDPluginStdArraysFixture)
+
+// An array of the type of the interface is passed unchanged
+BOOST_AUTO_TEST_CASE(test_MatchingType)
+{
+    NDArray *pArray = allocArray(NDInt16);
+    epicsInt16 *pData = (epicsInt16 *)pArray->pData;
+    for (size_t i = 0; i < nPixels; i++) pData[i] = (epicsInt16)(i * 100 - 1000);
+
+    process(pArray);
+
+    BOOST_REQUIRE_EQUAL(int16Data.size(), nPixels);
+    BOOST_CHECK_EQUAL(memcmp(&int16Data[0], pData, nPixels * sizeof(epicsInt16)), 0);
+
+    std::vector<epicsInt16> value(nPixels);
+    size_t nIn = 0;
+    BOOST_CHECK_EQUAL(int16Client->read(&value[0], nPixels, &nIn), asynSuccess);
+    BOOST_REQUIRE_EQUAL(nIn, nPixels);
+    BOOST_CHECK_EQUAL(memcmp(&value[0], pData, nPixels * sizeof(epicsInt16)), 0);
+    pArray->release();
+}
+
+// An unsigned array is passed to the signed interface of the same size without conversion
+BOOST_AUTO_TEST_CASE(test_UnsignedOnSignedInterface)
+{
+    NDArray *pArray = allocArray(NDUInt16);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    for (size_t i = 0; i < nPixels; i++) pData[i] = (epicsUInt16)(40000 + i);
+
+    process(pArray);
+
+    BOOST_REQUIRE_EQUAL(int16Data.size(), nPixels);
+    for (size_t i = 0; i < nPixels; i++) {
+        BOOST_CHECK_EQUAL((epicsUInt16)int16Data[i], pData[i]);
+    }
+
+    std::vector<epicsInt16> value(nPixels);
+    size_t nIn = 0;
+    BOOST_CHECK_EQUAL(int16Client->read(&value[0], nPixels, &nIn), asynSuccess);
+    BOOST_REQUIRE_EQUAL(nIn, nPixels);
+    BOOST_CHECK_EQUAL(memcmp(&value[0], pData, nPixels * sizeof(epicsInt16)), 0);
+    pArray->release();
+}
+
+// Other types are converted, here UInt8 to Float64
+BOOST_AUTO_TEST_CASE(test_ConvertedType)
+{
+    NDArray *pArray = allocArray(NDUInt8);
+    epicsUInt8 *pData = (epicsUInt8 *)pArray->pData;
+    for (size_t i = 0; i < nPixels; i++) pData[i] = (epicsUInt8)(200 + i);
+
+    process(pArray);
+
+    BOOST_REQUIRE_EQUAL(float64Data.size(), nPixels);
+    for (size_t i = 0; i < nPixels; i++) {
+        BOOST_CHECK_EQUAL(float64Data[i], (double)pData[i]);
+    }
+
+    std::vector<epicsFloat64> value(nPixels);
+    size_t nIn = 0;
+    BOOST_CHECK_EQUAL(float64Client->read(&value[0], nPixels, &nIn), asynSuccess);
+    BOOST_REQUIRE_EQUAL(nIn, nPixels);
+    for (size_t i = 0; i < nPixels; i++) {
+        BOOST_CHECK_EQUAL(value[i], (double)pData[i]);
+    }
+    pArray->release();
+}
+
+// Compressed arrays are refused, the clients keep the last uncompressed array
+BOOST_AUTO_TEST_CASE(test_CompressedRejected)
+{
+    NDArray *pArray = allocArray(NDInt16);
+    epicsInt16 *pData = (epicsInt16 *)pArray->pData;
+    for (size_t i = 0; i < nPixels; i++) pData[i] = (epicsInt16)i;
+    process(pArray);
+    BOOST_REQUIRE_EQUAL(int16Callbacks, 1);
+
+    NDArray *pCompressed = allocArray(NDInt16);
+    pCompressed->codec.name = codecName[NDCODEC_LZ4];
+    pCompressed->compressedSize = 10;
+    process(pCompressed);
+    BOOST_CHECK_EQUAL(int16Callbacks, 1);
+
+    std::vector<epicsInt16> value(nPixels);
+    size_t nIn = 0;
+    BOOST_CHECK_EQUAL(int16Client->read(&value[0], nPixels, &nIn), asynSuccess);
+    BOOST_REQUIRE_EQUAL(nIn, nPixels);
+    BOOST_CHECK_EQUAL(memcmp(&value[0], pData, nPixels * sizeof(epicsInt16)), 0);
+    pCompressed->release();
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
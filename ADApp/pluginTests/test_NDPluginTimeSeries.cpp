@@ -307,6 +307,48 @@ BOOST_AUTO_TEST_CASE(output_NDArray_fixed_mode)
 }
 
 
+BOOST_AUTO_TEST_CASE(averaged_values_fixed_mode)
+{
+  BOOST_MESSAGE("Checking averaged values in Fixed Mode, 2D input: " << arrays_2d[0]->dims[0].size
+                << " channels with " << arrays_2d[0]->dims[1].size
+                << " elements. Averaging=" << 10 << " Time series length=" << 20);
+
+  // Fill the input with the same ramp in time for each channel
+  size_t numChannels = arrays_2d[0]->dims[0].size;
+  size_t numTimes = arrays_2d[0]->dims[1].size;
+  for (size_t i = 0; i < 10; i++)
+  {
+    epicsFloat32 *pData = (epicsFloat32 *)arrays_2d[i]->pData;
+    for (size_t t = 0; t < numTimes; t++)
+    {
+      for (size_t c = 0; c < numChannels; c++)
+      {
+        pData[t*numChannels + c] = (epicsFloat32)(i*numTimes + t);
+      }
+    }
+  }
+
+  BOOST_CHECK_NO_THROW(ts->write(NDArrayCallbacksString, 1));
+  BOOST_CHECK_NO_THROW(ts->write(TSAcquireString, 1));
+  for (int i = 0; i < 10; i++)
+  {
+    ts->lock();
+    BOOST_CHECK_NO_THROW(ts->processCallbacks(arrays_2d[i]));
+    ts->unlock();
+  }
+  BOOST_CHECK_EQUAL(ts->readInt(TSAcquireString), 0);
+
+  // The downstream plugin receives the 1-D time series. Each point is the average of 10 consecutive input points.
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), 1);
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays[0]->dims[0].size, 20);
+  epicsFloat32 *pOut = (epicsFloat32 *)downstream_plugin->arrays[0]->pData;
+  for (int p = 0; p < 20; p++)
+  {
+    BOOST_CHECK_CLOSE(pOut[p], p*10 + 4.5, 1e-4);
+  }
+}
+
+
 BOOST_AUTO_TEST_CASE(trigger_output_NDArray_circular_mode)
 {
   BOOST_MESSAGE("Checking that NDArrays are output when triggered in Circular Mode, 2D input: " << arrays_2d[0]->dims[0].size
@@ -339,4 +381,49 @@ BOOST_AUTO_TEST_CASE(trigger_output_NDArray_circular_mode)
 }
 
 
+BOOST_AUTO_TEST_CASE(incremental_output_NDArray_circular_mode)
+{
+  BOOST_MESSAGE("Checking incremental NDArray output in Circular Mode, 2D input: " << arrays_2d[0]->dims[0].size
+                << " channels with " << arrays_2d[0]->dims[1].size
+                << " elements. Averaging=" << 10 << " Time series length=" << 20);
+
+  BOOST_CHECK_NO_THROW(ts->write(NDArrayCallbacksString, 1));
+  BOOST_CHECK_NO_THROW(ts->write(TSPublishModeString, 1)); // TSPublishModeIncremental=1
+  BOOST_CHECK_NO_THROW(ts->write(TSAcquireModeString, 1)); // TSAcquireModeCircular=1
+  BOOST_CHECK_NO_THROW(ts->write(TSAcquireString, 1));
+
+  // 3 arrays add 6 time points
+  for (int i = 0; i < 3; i++)
+  {
+    ts->lock();
+    BOOST_CHECK_NO_THROW(ts->processCallbacks(arrays_2d[i]));
+    ts->unlock();
+  }
+  BOOST_CHECK_NO_THROW(ts->write(TSReadString, 1));
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), 1);
+  BOOST_CHECK_EQUAL(downstream_plugin->arrays[0]->dims[0].size, 6);
+
+  // 2 more arrays add 4 time points, only those are published
+  for (int i = 3; i < 5; i++)
+  {
+    ts->lock();
+    BOOST_CHECK_NO_THROW(ts->processCallbacks(arrays_2d[i]));
+    ts->unlock();
+  }
+  BOOST_CHECK_NO_THROW(ts->write(TSReadString, 1));
+  BOOST_REQUIRE_EQUAL(downstream_plugin->arrays.size(), 2);
+  NDArray *pDelta = downstream_plugin->arrays[1];
+  BOOST_CHECK_EQUAL(pDelta->dims[0].size, 4);
+  epicsInt64 startIndex = -1;
+  NDAttribute *pAttr = pDelta->pAttributeList->find("TSStartIndex");
+  BOOST_REQUIRE(pAttr != NULL);
+  pAttr->getValue(NDAttrInt64, &startIndex);
+  BOOST_CHECK_EQUAL(startIndex, 6);
+
+  // No new points, so nothing is published
+  BOOST_CHECK_NO_THROW(ts->write(TSReadString, 1));
+  BOOST_CHECK_EQUAL(downstream_plugin->arrays.size(), 2);
+}
+
+
 BOOST_AUTO_TEST_SUITE_END() // Done!
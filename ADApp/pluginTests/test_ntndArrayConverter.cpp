@@ -0,0 +1,203 @@
+/*
+ * test_ntndArrayConverter.cpp
+ *
+ * Tests of the attribute structures that NTNDArrayConverter::fromArray publishes,
+ * which are reused from one array to the next while pvAccess does not reference them
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDArray.h>
+#include <NDAttribute.h>
+#include <asynNDArrayDriver.h>
+#include <ntndArrayConverter.h>
+#include <epicsStdio.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+using namespace epics::pvData;
+using namespace epics::nt;
+
+static const size_t sizeX = 4;
+static const size_t sizeY = 2;
+
+struct NTNDArrayConverterFixture
+{
+    asynNDArrayDriver *dummy_driver;
+    NDArray *pArray;
+    NTNDArrayPtr ntndArray;
+    NTNDArrayConverterPtr converter;
+
+    NTNDArrayConverterFixture()
+    {
+        std::string dummy_port("simConverter");
+        size_t dims[2] = {sizeX, sizeY};
+        uniqueAsynPortName(dummy_port);
+
+        dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+        pArray = dummy_driver->pNDArrayPool->alloc(2, dims, NDUInt8, 0, NULL);
+        memset(pArray->pData, 0, sizeX * sizeY);
+
+        NTNDArrayBuilderPtr builder = NTNDArray::createBuilder();
+        builder->addDescriptor()->addTimeStamp()->addAlarm()->addDisplay();
+        ntndArray = builder->create();
+        converter.reset(new NTNDArrayConverter(ntndArray));
+    }
+
+    ~NTNDArrayConverterFixture()
+    {
+        converter.reset();
+        ntndArray.reset();
+        pArray->release();
+        delete dummy_driver;
+    }
+
+    // Sets the attributes Counter (Int32), Label (String) and Undefined, and publishes the array
+    void publish(epicsInt32 counter)
+    {
+        char label[64];
+
+        epicsSnprintf(label, sizeof(label), "frame %d", counter);
+        pArray->pAttributeList->add("Counter", "Frame counter", NDAttrInt32, &counter);
+        pArray->pAttributeList->add("Label", "", NDAttrString, label);
+        pArray->pAttributeList->add("Undefined", "", NDAttrUndefined, NULL);
+        converter->fromArray(pArray);
+    }
+
+    // The structures of the published attributes. Only the pointers are returned, so that the
+    // test does not hold references that prevent the converter from reusing them.
+    std::vector<PVStructure *> published()
+    {
+        PVStructureArray::const_svector attrs(ntndArray->getAttribute()->view());
+        std::vector<PVStructure *> structures;
+
+        for (size_t i = 0; i < attrs.size(); i++) structures.push_back(attrs[i].get());
+        return structures;
+    }
+
+    static std::string name(const PVStructurePtr& attr)
+    {
+        return attr->getSubField<PVString>("name")->get();
+    }
+
+    static PVFieldPtr value(const PVStructurePtr& attr)
+    {
+        return attr->getSubField<PVUnion>("value")->get();
+    }
+
+    // Checks the values that publish(counter) sets
+    static void checkValues(const PVStructureArray::const_svector& attrs, epicsInt32 counter)
+    {
+        char label[64];
+        PVIntPtr pvCounter;
+        PVStringPtr pvLabel;
+
+        epicsSnprintf(label, sizeof(label), "frame %d", counter);
+        BOOST_REQUIRE_EQUAL(attrs.size(), 3u);
+        BOOST_CHECK_EQUAL(name(attrs[0]), "Counter");
+        BOOST_CHECK_EQUAL(attrs[0]->getSubField<PVString>("descriptor")->get(), "Frame counter");
+        pvCounter = std::tr1::dynamic_pointer_cast<PVInt>(value(attrs[0]));
+        BOOST_REQUIRE(pvCounter);
+        BOOST_CHECK_EQUAL(pvCounter->get(), counter);
+        BOOST_CHECK_EQUAL(name(attrs[1]), "Label");
+        pvLabel = std::tr1::dynamic_pointer_cast<PVString>(value(attrs[1]));
+        BOOST_REQUIRE(pvLabel);
+        BOOST_CHECK_EQUAL(pvLabel->get(), std::string(label));
+        BOOST_CHECK_EQUAL(name(attrs[2]), "Undefined");
+        BOOST_CHECK(!value(attrs[2]));
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NTNDArrayConverterTests, NTNDArrayConverterFixture)
+
+// With the same names and types the structures are reused. The published array holds the last set,
+// so the converter alternates between two sets.
+BOOST_AUTO_TEST_CASE(test_UnchangedLayoutReused)
+{
+    publish(0);
+    std::vector<PVStructure *> first(published());
+    publish(1);
+    std::vector<PVStructure *> second(published());
+    BOOST_REQUIRE_EQUAL(second.size(), first.size());
+    BOOST_CHECK(second[0] != first[0]);
+
+    publish(2);
+    BOOST_CHECK(published() == first);
+    checkValues(ntndArray->getAttribute()->view(), 2);
+    publish(3);
+    BOOST_CHECK(published() == second);
+    checkValues(ntndArray->getAttribute()->view(), 3);
+}
+
+// A set that a client still holds, like a monitor queue, is not changed by the next arrays
+BOOST_AUTO_TEST_CASE(test_HeldSetNotModified)
+{
+    publish(0);
+    PVStructureArray::const_svector held(ntndArray->getAttribute()->view());
+    std::vector<PVStructure *> first(published());
+
+    for (int i = 1; i <= NTNDARRAY_ATTRIBUTE_SETS + 1; i++) {
+        publish(i);
+        BOOST_CHECK(published() != first);
+        checkValues(ntndArray->getAttribute()->view(), i);
+    }
+    checkValues(held, 0);
+
+    // Once the client lets go the set can be reused again
+    held.clear();
+    publish(10);
+    checkValues(ntndArray->getAttribute()->view(), 10);
+}
+
+// A change of the name or type of an attribute rebuilds the sets
+BOOST_AUTO_TEST_CASE(test_LayoutChangeRebuilds)
+{
+    epicsFloat64 counter = 2.5;
+    epicsInt32 index = 7;
+    PVStructureArray::const_svector attrs;
+    PVDoublePtr pvCounter;
+    PVIntPtr pvIndex;
+
+    publish(0);
+    publish(1);
+
+    // Counter becomes Float64: the value is a new double field, not the int field of the cached sets
+    pArray->pAttributeList->clear();
+    pArray->pAttributeList->add("Counter", "Frame counter", NDAttrFloat64, &counter);
+    converter->fromArray(pArray);
+    attrs = ntndArray->getAttribute()->view();
+    BOOST_REQUIRE_EQUAL(attrs.size(), 1u);
+    BOOST_CHECK_EQUAL(name(attrs[0]), "Counter");
+    pvCounter = std::tr1::dynamic_pointer_cast<PVDouble>(value(attrs[0]));
+    BOOST_REQUIRE(pvCounter);
+    BOOST_CHECK_EQUAL(pvCounter->get(), counter);
+    attrs.clear();
+
+    // Counter is renamed to Index, with the type of the first arrays
+    pArray->pAttributeList->clear();
+    pArray->pAttributeList->add("Index", "Frame index", NDAttrInt32, &index);
+    converter->fromArray(pArray);
+    attrs = ntndArray->getAttribute()->view();
+    BOOST_REQUIRE_EQUAL(attrs.size(), 1u);
+    BOOST_CHECK_EQUAL(name(attrs[0]), "Index");
+    BOOST_CHECK_EQUAL(attrs[0]->getSubField<PVString>("descriptor")->get(), "Frame index");
+    pvIndex = std::tr1::dynamic_pointer_cast<PVInt>(value(attrs[0]));
+    BOOST_REQUIRE(pvIndex);
+    BOOST_CHECK_EQUAL(pvIndex->get(), index);
+    attrs.clear();
+
+    // And back to the first layout
+    pArray->pAttributeList->clear();
+    publish(5);
+    checkValues(ntndArray->getAttribute()->view(), 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
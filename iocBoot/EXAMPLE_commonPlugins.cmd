@@ -170,9 +170,16 @@ dbLoadRecords("$(AUTOSAVE)/asApp/Db/save_restoreStatus.db", "P=$(PREFIX)")
 # Optional: load NDPluginPva plugin
 #NDPvaConfigure("PVA1", $(QSIZE), 0, "$(PORT)", 0, $(PREFIX)Pva1:Image, 0, 0, 0)
 #dbLoadRecords("NDPva.template",  "P=$(PREFIX),R=Pva1:, PORT=PVA1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+# Optional: derived channels $(PREFIX)Pva1:Image:1 and :2, set the last argument of NDPvaConfigure to 2
+#dbLoadRecords("NDPvaN.template", "P=$(PREFIX),R=Pva1:1:, PORT=PVA1,ADDR=1,TIMEOUT=1")
+#dbLoadRecords("NDPvaN.template", "P=$(PREFIX),R=Pva1:2:, PORT=PVA1,ADDR=2,TIMEOUT=1")
 # Must start PVA server if this is enabled
 #startPVAServer
 
+# Optional: load NDPluginShm plugin for consumers on the same host
+#NDShmConfigure("SHM1", $(QSIZE), 0, "$(PORT)", 0, "$(PREFIX)Image", 8, 0, 0, 0, 0, 0)
+#dbLoadRecords("NDShm.template",  "P=$(PREFIX),R=Shm1:, PORT=SHM1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+
 # Optional: load ffmpegServer plugin
 #ffmpegServerConfigure(8081)
 #ffmpegStreamConfigure("FfmStream1", 2, 0, "$(PORT)", 0, -1, 0)